@@ -0,0 +1,1611 @@
+/*
+Copyright (C) 2012 Brady Catherman
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+/*
+  irk-bench: Microbenchmarks for irk's internal data structures.
+
+  Each benchmark prints one JSON object per line on stdout so results can be
+  collected and compared between builds:
+
+    {"name":"strhash_get","keys":"paths","size":10000,"ops":2000000,
+     "ns_per_op":31.20,"allocs_per_op":0.000,"bytes_per_op":0.0}
+
+  Inputs are generated from a fixed seed and every benchmark runs a fixed
+  number of operations, so two runs on the same machine do the same work.
+  Allocations are counted through the irk_malloc() family, so they cover
+  everything irk itself allocates but not allocations made inside libc.
+
+  Usage: irk-bench [-d directory] [-v] [name_filter]
+
+    -d directory: Where to build the directory tree for the security
+                  benchmarks. It must be secure (owned by root and not group
+                  or world writable all the way up), otherwise those
+                  benchmarks are skipped. Defaults to the current directory.
+    -v: Also run the stress tests that check results rather than time
+        them, currently the cstrhash one. irk-bench exits with 1 if any of
+        them finds an error.
+    name_filter: Only run the benchmark groups (strhash, cstrhash, security,
+                 module_data, snapshot, encode, compress, distribution,
+                 scheduler and workers) whose name contains this string.
+*/
+
+#include <errno.h>
+#include <event.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <collector/scheduler.h>
+#include <collector/workers.h>
+#include <common/compress.h>
+#include <common/config.h>
+#include <common/cstrhash.h>
+#include <common/epoch.h>
+#include <common/fragment.h>
+#include <common/logging.h>
+#include <common/memory.h>
+#include <common/strhash.h>
+#include <master/encoder.h>
+#include <master/module_data.h>
+#include <master/schema.h>
+#include <security/security.h>
+
+
+// Stops the compiler from optimizing away the work being measured.
+static volatile uintptr_t bench_sink;
+
+// Set from the command line.
+static const char *bench_filter = NULL;
+static const char *bench_directory = ".";
+static bool bench_verify = false;
+
+// Set when a stress test finds an error.
+static bool bench_failed = false;
+
+
+/** Captures the clock and allocation counters at the start of a run. */
+struct bench_timer {
+  clockid_t clock;
+  uint64_t start_ns;
+  struct memory_stats start_memory;
+};
+
+
+static uint64_t
+bench_now_ns(
+    clockid_t clock)
+{
+  struct timespec ts;
+  clock_gettime(clock, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+
+static void
+bench_start(
+    struct bench_timer *t)
+{
+  memory_stats_get(&(t->start_memory));
+  t->clock = CLOCK_MONOTONIC;
+  t->start_ns = bench_now_ns(t->clock);
+}
+
+
+/**
+  Like bench_start() but measures CPU time rather than wall time, for runs
+  that spend most of their time waiting on timers.
+ */
+static void
+bench_start_cpu(
+    struct bench_timer *t)
+{
+  memory_stats_get(&(t->start_memory));
+  t->clock = CLOCK_PROCESS_CPUTIME_ID;
+  t->start_ns = bench_now_ns(t->clock);
+}
+
+
+/**
+  Stops the timer and prints the result line.
+
+  Arguments:
+    t: The timer passed to bench_start().
+    name: The benchmark name.
+    params: Extra JSON members describing this run, without braces.
+    ops: The number of operations performed since bench_start().
+ */
+static void
+bench_stop(
+    struct bench_timer *t,
+    const char *name,
+    const char *params,
+    uint64_t ops)
+{
+  uint64_t elapsed = bench_now_ns(t->clock) - t->start_ns;
+  struct memory_stats end_memory;
+  memory_stats_get(&end_memory);
+
+  printf(
+      "{\"name\":\"%s\",%s,\"ops\":%" PRIu64 ",\"ns_per_op\":%.2f,"
+      "\"allocs_per_op\":%.3f,\"bytes_per_op\":%.1f}\n",
+      name,
+      params,
+      ops,
+      (double) elapsed / ops,
+      (double) (end_memory.allocations - t->start_memory.allocations) / ops,
+      (double) (end_memory.bytes - t->start_memory.bytes) / ops);
+  fflush(stdout);
+}
+
+
+// xorshift64*, good enough for generating benchmark input.
+static uint64_t
+bench_random(
+    uint64_t *state)
+{
+  *state ^= *state >> 12;
+  *state ^= *state << 25;
+  *state ^= *state >> 27;
+  return *state * 0x2545f4914f6cdd1dull;
+}
+
+
+// The shapes of key used by the hash table benchmarks.
+enum bench_key_type {
+  // Metric paths with long shared prefixes.
+  BENCH_KEYS_PATHS,
+  // Short keys, a few characters each.
+  BENCH_KEYS_SHORT,
+  // 32 random characters.
+  BENCH_KEYS_RANDOM
+};
+
+static const char *bench_key_type_names[] = {"paths", "short", "random"};
+
+static const char *bench_stat_names[] = {
+  "rx_bytes", "rx_packets", "rx_errs", "rx_drop",
+  "tx_bytes", "tx_packets", "tx_errs", "tx_drop"
+};
+
+
+/**
+  Generates 'count' distinct keys of the given type.
+
+  Returns:
+    An array of keys that must be freed with bench_free_keys().
+ */
+static char **
+bench_make_keys(
+    enum bench_key_type type,
+    size_t count,
+    uint64_t seed)
+{
+  char **keys = (char **) malloc(count * sizeof(char *));
+  if (keys == NULL) {
+    perror("malloc");
+    exit(1);
+  }
+
+  uint64_t state = seed;
+  for (size_t i = 0; i < count; i++) {
+    char buffer[64];
+    switch (type) {
+      case BENCH_KEYS_PATHS:
+        snprintf(
+            buffer,
+            sizeof(buffer),
+            "/proc/net/dev/eth%zu/%s",
+            i / 8,
+            bench_stat_names[i % 8]);
+        break;
+      case BENCH_KEYS_SHORT:
+        snprintf(buffer, sizeof(buffer), "k%zx", i);
+        break;
+      case BENCH_KEYS_RANDOM:
+        for (int j = 0; j < 32; j++) {
+          buffer[j] = 'a' + bench_random(&state) % 26;
+        }
+        // The index keeps random keys distinct.
+        snprintf(buffer + 32, sizeof(buffer) - 32, "%zx", i);
+        break;
+    }
+    keys[i] = strdup(buffer);
+    if (keys[i] == NULL) {
+      perror("strdup");
+      exit(1);
+    }
+  }
+
+  return keys;
+}
+
+
+static void
+bench_free_keys(
+    char **keys,
+    size_t count)
+{
+  for (size_t i = 0; i < count; i++) {
+    free(keys[i]);
+  }
+  free(keys);
+}
+
+
+// Returns an order to visit 'count' items in that defeats the prefetcher.
+static size_t *
+bench_make_order(
+    size_t count,
+    uint64_t seed)
+{
+  size_t *order = (size_t *) malloc(count * sizeof(size_t));
+  if (order == NULL) {
+    perror("malloc");
+    exit(1);
+  }
+
+  uint64_t state = seed;
+  for (size_t i = 0; i < count; i++) {
+    order[i] = i;
+  }
+  for (size_t i = count - 1; i > 0; i--) {
+    size_t j = bench_random(&state) % (i + 1);
+    size_t tmp = order[i];
+    order[i] = order[j];
+    order[j] = tmp;
+  }
+  return order;
+}
+
+
+// Number of repetitions needed to do at least 'min_ops' operations when
+// each repetition does 'per_rep'.
+static size_t
+bench_reps(
+    size_t per_rep,
+    size_t min_ops)
+{
+  return (min_ops + per_rep - 1) / per_rep;
+}
+
+
+static const size_t bench_sizes[] = {100, 10000, 100000};
+
+#define BENCH_SIZES (sizeof(bench_sizes) / sizeof(bench_sizes[0]))
+#define BENCH_KEY_TYPES 3
+
+
+static void
+bench_strhash(void)
+{
+  for (size_t si = 0; si < BENCH_SIZES; si++) {
+    for (int kt = 0; kt < BENCH_KEY_TYPES; kt++) {
+      size_t size = bench_sizes[si];
+      char **keys = bench_make_keys(kt, size, 1);
+      char **missing = bench_make_keys(kt, size, 2);
+      size_t *order = bench_make_order(size, 3);
+      char params[128];
+      snprintf(
+          params,
+          sizeof(params),
+          "\"keys\":\"%s\",\"size\":%zu",
+          bench_key_type_names[kt],
+          size);
+
+      // The key sets for "paths" and "short" are deterministic so use
+      // keys from past the end of the table as the missing ones.
+      if (kt != BENCH_KEYS_RANDOM) {
+        bench_free_keys(missing, size);
+        char **all = bench_make_keys(kt, size * 2, 2);
+        missing = (char **) malloc(size * sizeof(char *));
+        for (size_t i = 0; i < size; i++) {
+          missing[i] = all[size + i];
+          free(all[i]);
+        }
+        free(all);
+      }
+
+      struct bench_timer t;
+      size_t reps = bench_reps(size, 1000000);
+
+      // Inserting into a new table, including every resize on the way.
+      bench_start(&t);
+      for (size_t r = 0; r < reps; r++) {
+        strhash *s = strhash_init(0);
+        for (size_t i = 0; i < size; i++) {
+          strhash_add(s, keys[i], keys[i]);
+        }
+        strhash_destroy(s, NULL);
+      }
+      bench_stop(&t, "strhash_add", params, reps * size);
+
+      strhash *s = strhash_init(0);
+      for (size_t i = 0; i < size; i++) {
+        strhash_add(s, keys[i], keys[i]);
+      }
+
+      bench_start(&t);
+      for (size_t r = 0; r < reps; r++) {
+        for (size_t i = 0; i < size; i++) {
+          bench_sink += (uintptr_t) strhash_get(s, keys[order[i]]);
+        }
+      }
+      bench_stop(&t, "strhash_get_hit", params, reps * size);
+
+      bench_start(&t);
+      for (size_t r = 0; r < reps; r++) {
+        for (size_t i = 0; i < size; i++) {
+          bench_sink += (uintptr_t) strhash_get(s, missing[order[i]]);
+        }
+      }
+      bench_stop(&t, "strhash_get_miss", params, reps * size);
+
+      // The steady state of a cache: every key gets a new value.
+      bench_start(&t);
+      for (size_t r = 0; r < reps; r++) {
+        for (size_t i = 0; i < size; i++) {
+          strhash_replace(s, keys[order[i]], keys[i], NULL);
+        }
+      }
+      bench_stop(&t, "strhash_replace", params, reps * size);
+
+      // Keys coming and going every cycle.
+      bench_start(&t);
+      for (size_t r = 0; r < reps; r++) {
+        for (size_t i = 0; i < size; i++) {
+          strhash_remove(s, keys[order[i]]);
+          strhash_replace(s, keys[order[i]], keys[i], NULL);
+        }
+      }
+      bench_stop(&t, "strhash_remove_add", params, reps * size);
+
+      strhash_destroy(s, NULL);
+      free(order);
+      bench_free_keys(keys, size);
+      bench_free_keys(missing, size);
+    }
+  }
+}
+
+
+/** Shared between the cstrhash reader threads. */
+struct bench_cstrhash_state {
+  cstrhash *table;
+  epoch *e;
+  char **keys;
+  size_t *order;
+  size_t size;
+  size_t reps;
+  volatile bool stop_writer;
+};
+
+
+static void *
+bench_cstrhash_reader(
+    void *arg)
+{
+  struct bench_cstrhash_state *state = (struct bench_cstrhash_state *) arg;
+  epoch_reader *r = epoch_reader_register(state->e);
+  uintptr_t sink = 0;
+
+  for (size_t rep = 0; rep < state->reps; rep++) {
+    epoch_enter(r);
+    for (size_t i = 0; i < state->size; i++) {
+      const char *key = state->keys[state->order[i]];
+      sink += (uintptr_t) cstrhash_get(state->table, key);
+    }
+    epoch_exit(r);
+  }
+
+  bench_sink += sink;
+  epoch_reader_unregister(r);
+  return NULL;
+}
+
+
+static void *
+bench_cstrhash_writer(
+    void *arg)
+{
+  struct bench_cstrhash_state *state = (struct bench_cstrhash_state *) arg;
+  while (!state->stop_writer) {
+    for (size_t i = 0; i < state->size && !state->stop_writer; i++) {
+      cstrhash_put(state->table, state->keys[i], state->keys[i]);
+    }
+  }
+  return NULL;
+}
+
+
+// A value in the cstrhash stress test, which readers check is the one
+// they asked for and not one that has been freed.
+struct bench_verify_value {
+  uint64_t magic;
+  size_t index;
+  uint64_t version;
+};
+
+#define BENCH_VERIFY_MAGIC 0x69726b7665726679ull
+#define BENCH_VERIFY_KEYS 4096
+#define BENCH_VERIFY_READERS 4
+#define BENCH_VERIFY_WRITERS 2
+#define BENCH_VERIFY_ROUNDS 100
+
+
+/** Shared between the threads of the cstrhash stress test. */
+struct bench_verify_state {
+  cstrhash *table;
+  epoch *e;
+  char **keys;
+  size_t writer;
+  volatile bool stop;
+  uint64_t lookups;
+  uint64_t errors;
+};
+
+
+/** Reports an error found by the stress test, printing the first few. */
+static void
+bench_verify_error(
+    struct bench_verify_state *state,
+    const char *what,
+    size_t index)
+{
+  if (__atomic_fetch_add(&(state->errors), 1, __ATOMIC_RELAXED) < 10) {
+    fprintf(stderr, "cstrhash_verify: %s: %s\n", state->keys[index], what);
+  }
+}
+
+
+/** Poisons a value before freeing it, so a reader that still has it sees. */
+static void
+bench_verify_free(
+    void *ptr)
+{
+  struct bench_verify_value *value = (struct bench_verify_value *) ptr;
+  value->magic = 0;
+  free(value);
+}
+
+
+static struct bench_verify_value *
+bench_verify_new(
+    size_t index,
+    uint64_t version)
+{
+  struct bench_verify_value *value = (struct bench_verify_value *) malloc(
+      sizeof(struct bench_verify_value));
+  if (value == NULL) {
+    perror("malloc");
+    exit(1);
+  }
+  value->magic = BENCH_VERIFY_MAGIC;
+  value->index = index;
+  value->version = version;
+  return value;
+}
+
+
+/**
+  Looks every key up until the writers are done. Even keys are never
+  removed so must always be found, and no key may go back to an older
+  version than this reader has already seen.
+ */
+static void *
+bench_verify_reader(
+    void *arg)
+{
+  struct bench_verify_state *state = (struct bench_verify_state *) arg;
+  epoch_reader *r = epoch_reader_register(state->e);
+  uint64_t *seen = (uint64_t *) calloc(BENCH_VERIFY_KEYS, sizeof(uint64_t));
+  if (r == NULL || seen == NULL) {
+    fprintf(stderr, "cstrhash_verify: out of memory\n");
+    exit(1);
+  }
+
+  uint64_t lookups = 0;
+  while (!state->stop) {
+    epoch_enter(r);
+    for (size_t i = 0; i < BENCH_VERIFY_KEYS; i++) {
+      const struct bench_verify_value *value =
+          (const struct bench_verify_value *) cstrhash_get(
+              state->table, state->keys[i]);
+      lookups++;
+      if (value == NULL) {
+        if (i % 2 == 0) {
+          bench_verify_error(state, "missing", i);
+        }
+        continue;
+      }
+      if (value->magic != BENCH_VERIFY_MAGIC) {
+        bench_verify_error(state, "value was freed", i);
+      } else if (value->index != i) {
+        bench_verify_error(state, "value of another key", i);
+      } else if (value->version < seen[i]) {
+        bench_verify_error(state, "older version", i);
+      } else {
+        seen[i] = value->version;
+      }
+    }
+    epoch_exit(r);
+  }
+
+  __atomic_fetch_add(&(state->lookups), lookups, __ATOMIC_RELAXED);
+  free(seen);
+  epoch_reader_unregister(r);
+  return NULL;
+}
+
+
+/**
+  Replaces the value of every key this writer owns with a newer one,
+  removing and adding back the odd ones, for BENCH_VERIFY_ROUNDS rounds.
+ */
+static void *
+bench_verify_writer(
+    void *arg)
+{
+  struct bench_verify_state *state = (struct bench_verify_state *) arg;
+  size_t self = __atomic_fetch_add(&(state->writer), 1, __ATOMIC_RELAXED);
+
+  for (uint64_t round = 1; round <= BENCH_VERIFY_ROUNDS; round++) {
+    for (size_t i = self; i < BENCH_VERIFY_KEYS; i += BENCH_VERIFY_WRITERS) {
+      if (i % 2 == 1 && round % 2 == 0) {
+        cstrhash_remove(state->table, state->keys[i]);
+        continue;
+      }
+      if (cstrhash_put(
+              state->table, state->keys[i], bench_verify_new(i, round))) {
+        bench_verify_error(state, "put failed", i);
+      }
+    }
+  }
+  return NULL;
+}
+
+
+/**
+  Checks cstrhash under concurrent readers and writers. The table starts
+  small and the odd keys are only added once readers are running, so it
+  grows under them too.
+ */
+static void
+bench_cstrhash_verify(void)
+{
+  struct bench_verify_state state;
+  memset(&state, 0, sizeof(state));
+  state.e = epoch_init();
+  state.table = cstrhash_init(16, state.e, bench_verify_free);
+  state.keys = bench_make_keys(BENCH_KEYS_PATHS, BENCH_VERIFY_KEYS, 1);
+  if (state.e == NULL || state.table == NULL) {
+    fprintf(stderr, "cstrhash_verify: out of memory\n");
+    exit(1);
+  }
+  for (size_t i = 0; i < BENCH_VERIFY_KEYS; i += 2) {
+    cstrhash_put(state.table, state.keys[i], bench_verify_new(i, 0));
+  }
+
+  pthread_t readers[BENCH_VERIFY_READERS];
+  pthread_t writers[BENCH_VERIFY_WRITERS];
+  struct bench_timer t;
+  bench_start(&t);
+  for (int i = 0; i < BENCH_VERIFY_READERS; i++) {
+    pthread_create(&readers[i], NULL, bench_verify_reader, &state);
+  }
+  for (int i = 0; i < BENCH_VERIFY_WRITERS; i++) {
+    pthread_create(&writers[i], NULL, bench_verify_writer, &state);
+  }
+  for (int i = 0; i < BENCH_VERIFY_WRITERS; i++) {
+    pthread_join(writers[i], NULL);
+  }
+  state.stop = true;
+  for (int i = 0; i < BENCH_VERIFY_READERS; i++) {
+    pthread_join(readers[i], NULL);
+  }
+
+  char params[160];
+  snprintf(
+      params,
+      sizeof(params),
+      "\"keys\":\"paths\",\"size\":%d,\"readers\":%d,\"writers\":%d,"
+      "\"errors\":%" PRIu64,
+      BENCH_VERIFY_KEYS,
+      BENCH_VERIFY_READERS,
+      BENCH_VERIFY_WRITERS,
+      state.errors);
+  bench_stop(&t, "cstrhash_verify", params, state.lookups);
+  if (state.errors != 0) {
+    bench_failed = true;
+  }
+
+  cstrhash_destroy(state.table);
+  epoch_destroy(state.e);
+  bench_free_keys(state.keys, BENCH_VERIFY_KEYS);
+}
+
+
+static void
+bench_cstrhash(void)
+{
+  static const int thread_counts[] = {1, 2, 4, 8};
+  size_t size = 10000;
+
+  struct bench_cstrhash_state state;
+  state.e = epoch_init();
+  state.table = cstrhash_init(size, state.e, NULL);
+  state.keys = bench_make_keys(BENCH_KEYS_PATHS, size, 1);
+  state.order = bench_make_order(size, 3);
+  state.size = size;
+  state.reps = bench_reps(size, 2000000);
+  for (size_t i = 0; i < size; i++) {
+    cstrhash_put(state.table, state.keys[i], state.keys[i]);
+  }
+
+  for (int with_writer = 0; with_writer < 2; with_writer++) {
+    for (int ti = 0; ti < 4; ti++) {
+      int threads = thread_counts[ti];
+      pthread_t readers[8];
+      pthread_t writer;
+      char params[128];
+      snprintf(
+          params,
+          sizeof(params),
+          "\"keys\":\"paths\",\"size\":%zu,\"threads\":%d,\"writer\":%s",
+          size,
+          threads,
+          with_writer ? "true" : "false");
+
+      state.stop_writer = false;
+      if (with_writer) {
+        pthread_create(&writer, NULL, bench_cstrhash_writer, &state);
+      }
+
+      // ns_per_op is wall time over the total lookups of every thread, so
+      // it drops as readers are added if reads scale.
+      struct bench_timer t;
+      bench_start(&t);
+      for (int i = 0; i < threads; i++) {
+        pthread_create(&readers[i], NULL, bench_cstrhash_reader, &state);
+      }
+      for (int i = 0; i < threads; i++) {
+        pthread_join(readers[i], NULL);
+      }
+      bench_stop(&t, "cstrhash_get", params, state.reps * size * threads);
+
+      if (with_writer) {
+        state.stop_writer = true;
+        pthread_join(writer, NULL);
+      }
+    }
+  }
+
+  cstrhash_destroy(state.table);
+  epoch_destroy(state.e);
+  free(state.order);
+  bench_free_keys(state.keys, size);
+
+  if (bench_verify) {
+    bench_cstrhash_verify();
+  }
+}
+
+
+/**
+  Builds a chain of 'depth' directories below the bench directory.
+
+  Returns:
+    The path of the deepest directory, or NULL if it could not be created.
+    The top of the tree is written to 'top' so it can be removed.
+ */
+static char *
+bench_make_tree(
+    int depth,
+    char *top,
+    size_t top_size)
+{
+  // security_check_path() changes directory as it goes, so the tree must
+  // be named by an absolute path.
+  char cwd[PATH_MAX];
+  int len;
+  if (bench_directory[0] != '/') {
+    if (getcwd(cwd, sizeof(cwd)) == NULL) {
+      return NULL;
+    }
+    len = snprintf(
+        top, top_size, "%s/%s/irk-bench.XXXXXX", cwd, bench_directory);
+  } else {
+    len = snprintf(top, top_size, "%s/irk-bench.XXXXXX", bench_directory);
+  }
+  if (len < 0 || (size_t) len >= top_size) {
+    errno = ENAMETOOLONG;
+    return NULL;
+  }
+  if (mkdtemp(top) == NULL) {
+    return NULL;
+  }
+  chmod(top, 0755);
+
+  size_t size = strlen(top) + depth * 8 + 1;
+  char *path = (char *) malloc(size);
+  strcpy(path, top);
+  for (int i = 0; i < depth; i++) {
+    char component[16];
+    snprintf(component, sizeof(component), "/d%d", i);
+    strcat(path, component);
+    if (mkdir(path, 0755) != 0) {
+      free(path);
+      return NULL;
+    }
+  }
+  return path;
+}
+
+
+static void
+bench_remove_tree(
+    const char *top,
+    char *deepest)
+{
+  // Remove the directories deepest first by chopping components off the
+  // end of the path.
+  while (strcmp(deepest, top) != 0) {
+    rmdir(deepest);
+    *strrchr(deepest, '/') = '\0';
+  }
+  rmdir(top);
+}
+
+
+static void
+bench_security(void)
+{
+  static const int depths[] = {4, 16, 64};
+
+  for (int di = 0; di < 3; di++) {
+    char top[PATH_MAX];
+    char *deepest = bench_make_tree(depths[di], top, sizeof(top));
+    if (deepest == NULL) {
+      fprintf(
+          stderr, "irk-bench: unable to create tree: %s\n", strerror(errno));
+      return;
+    }
+
+    if (security_check_path(deepest, NULL) != S_OK) {
+      fprintf(
+          stderr,
+          "irk-bench: %s is not secure, skipping security benchmarks.\n",
+          top);
+      bench_remove_tree(top, deepest);
+      free(deepest);
+      return;
+    }
+
+    char params[64];
+    snprintf(params, sizeof(params), "\"depth\":%d", depths[di]);
+    size_t reps = 20000;
+    struct bench_timer t;
+
+    bench_start(&t);
+    for (size_t r = 0; r < reps; r++) {
+      bench_sink += security_check_path(deepest, NULL);
+    }
+    bench_stop(&t, "security_check_path_uncached", params, reps);
+
+    // This is how modules_load_walkfiles uses it, one cache for the whole
+    // walk so each directory is only checked once.
+    strhash *cache = strhash_init(0);
+    security_check_path(deepest, cache);
+    bench_start(&t);
+    for (size_t r = 0; r < reps; r++) {
+      bench_sink += security_check_path(deepest, cache);
+    }
+    bench_stop(&t, "security_check_path_cached", params, reps);
+    strhash_destroy(cache, NULL);
+
+    bench_remove_tree(top, deepest);
+    free(deepest);
+  }
+}
+
+
+static void
+bench_module_data(void)
+{
+  static const size_t metric_counts[] = {16, 256};
+
+  for (int mi = 0; mi < 2; mi++) {
+    size_t metrics = metric_counts[mi];
+    char **keys = bench_make_keys(BENCH_KEYS_PATHS, metrics, 1);
+    size_t *order = bench_make_order(metrics, 3);
+    char params[64];
+    snprintf(params, sizeof(params), "\"metrics\":%zu", metrics);
+    size_t reps = bench_reps(metrics, 1000000);
+    struct bench_timer t;
+
+    // One cycle of a module reporting its data: every fourth value is a
+    // short string, the rest are integers.
+    bench_start(&t);
+    for (size_t r = 0; r < reps; r++) {
+      module_data *md = new_module_data(metrics);
+      for (size_t i = 0; i < metrics; i++) {
+        if (i % 4 == 3) {
+          add_string_value(md, keys[i], "up");
+        } else {
+          add_int_value(md, keys[i], (int64_t) (r + i));
+        }
+      }
+      bench_sink += md->items;
+      free_module_data(md);
+    }
+    bench_stop(&t, "module_data_build", params, reps);
+
+    // The same but with keys interned up front, as a module does when it
+    // registers its keys at load time.
+    static module bench_module;
+    uint32_t *ids = (uint32_t *) malloc(metrics * sizeof(uint32_t));
+    for (size_t i = 0; i < metrics; i++) {
+      ids[i] = intern_key(&bench_module, keys[i], strlen(keys[i]));
+    }
+    bench_start(&t);
+    for (size_t r = 0; r < reps; r++) {
+      module_data *md = new_module_data(metrics);
+      for (size_t i = 0; i < metrics; i++) {
+        if (i % 4 == 3) {
+          add_string_value_by_id(md, ids[i], "up");
+        } else {
+          add_int_value_by_id(md, ids[i], (int64_t) (r + i));
+        }
+      }
+      bench_sink += md->items;
+      free_module_data(md);
+    }
+    bench_stop(&t, "module_data_build_by_id", params, reps);
+
+    // The same again with the keys declared as metrics, so each cycle
+    // copies a template into a recycled block and sets values by slot.
+    static module schema_modules[2];
+    module *schema_module = &schema_modules[mi];
+    for (size_t i = 0; i < metrics; i++) {
+      schema_declare(
+          schema_module, keys[i], i % 4 == 3 ? IRK_STRING : IRK_INT, &ids[i]);
+    }
+    bench_start(&t);
+    for (size_t r = 0; r < reps; r++) {
+      module_data *md = new_schema_data(schema_module);
+      for (size_t i = 0; i < metrics; i++) {
+        if (i % 4 == 3) {
+          set_string_slot(md, ids[i], "up");
+        } else {
+          set_int_slot(md, ids[i], (int64_t) (r + i));
+        }
+      }
+      bench_sink += md->items;
+      free_module_data(md);
+    }
+    bench_stop(&t, "module_data_build_schema", params, reps);
+    free(ids);
+
+    module_data *md = new_module_data(metrics);
+    for (size_t i = 0; i < metrics; i++) {
+      if (i % 4 == 3) {
+        add_string_value(md, keys[i], "up");
+      } else {
+        add_int_value(md, keys[i], (int64_t) i);
+      }
+    }
+
+    // Visiting every key and value in order, as serialization does.
+    bench_start(&t);
+    for (size_t r = 0; r < reps; r++) {
+      const module_data_slot *slots = module_data_slots(md);
+      uintptr_t sink = 0;
+      for (uint32_t i = 0; i < md->items; i++) {
+        sink += (uintptr_t) module_data_key(md, &slots[i]);
+        if (slots[i].type == IRK_STRING) {
+          sink += (uintptr_t) module_data_string(md, &slots[i]);
+        } else {
+          sink += slots[i].value.i;
+        }
+      }
+      bench_sink += sink;
+    }
+    bench_stop(&t, "module_data_walk", params, reps);
+
+    bench_start(&t);
+    for (size_t r = 0; r < reps; r++) {
+      const char *key = keys[order[r % metrics]];
+      bench_sink += (uintptr_t) module_data_find(md, key, strlen(key));
+    }
+    bench_stop(&t, "module_data_find", params, reps);
+
+    free_module_data(md);
+    free(order);
+    bench_free_keys(keys, metrics);
+  }
+}
+
+
+static void
+bench_encode(void)
+{
+  static const size_t metric_counts[] = {16, 256};
+  static const struct encoder *encoders[] = {
+    &encoder_json, &encoder_prometheus, &encoder_binary
+  };
+  static module bench_module = {.registered_path = "/bench"};
+
+  for (int mi = 0; mi < 2; mi++) {
+    size_t metrics = metric_counts[mi];
+    char **keys = bench_make_keys(BENCH_KEYS_PATHS, metrics, 1);
+    size_t reps = bench_reps(metrics, 200000);
+    struct bench_timer t;
+
+    module_data *md = new_module_data(metrics);
+    for (size_t i = 0; i < metrics; i++) {
+      if (i % 4 == 3) {
+        add_string_value(md, keys[i], "up");
+      } else if (i % 4 == 2) {
+        add_double_value(md, keys[i], i / 3.0);
+      } else {
+        add_int_value(md, keys[i], (int64_t) i * 1000);
+      }
+    }
+
+    for (int ei = 0; ei < ENCODER_COUNT; ei++) {
+      const struct encoder *e = encoders[ei];
+      char params[96];
+      snprintf(
+          params,
+          sizeof(params),
+          "\"format\":\"%s\",\"metrics\":%zu",
+          e->name,
+          metrics);
+
+      // Paid once per snapshot and format, after which whole module
+      // requests send the cached bytes.
+      bench_start(&t);
+      for (size_t r = 0; r < reps; r++) {
+        fragment *f = fragment_new(0);
+        size_t values = 0;
+        e->write(&f, &bench_module, md, "", 0, 0, &values);
+        bench_sink += fragment_length(f);
+        fragment_release(f);
+      }
+      bench_stop(&t, "encode_module", params, reps);
+
+      // What a request for part of a module pays.
+      bench_start(&t);
+      for (size_t r = 0; r < reps; r++) {
+        fragment *f = fragment_new(0);
+        size_t values = 0;
+        e->write(
+            &f, &bench_module, md, "/proc/net/dev/eth0", 18, 0, &values);
+        bench_sink += values;
+        fragment_release(f);
+      }
+      bench_stop(&t, "encode_module_prefix", params, reps);
+    }
+
+    free_module_data(md);
+    bench_free_keys(keys, metrics);
+  }
+}
+
+
+// The shape of the response measured by bench_compress().
+#define BENCH_COMPRESS_MODULES 16
+#define BENCH_COMPRESS_METRICS 256
+
+
+/**
+  Builds the JSON response for "/" over 'mds' the way the HTTP server
+  does, from the snapshot caches, into one fragment.
+
+  The server references the cached bytes rather than copying them, so this
+  overstates the per request cost of every coding by the same copy.
+ */
+static fragment *
+bench_compress_response(
+    enum compress_encoding encoding,
+    module *mods,
+    module_data **mds)
+{
+  const struct encoder *e = &encoder_json;
+  fragment *out = fragment_new(0);
+  struct compress_stream s;
+  compress_stream_begin(&s, encoding, &out);
+  compress_stream_raw(&s, e->prologue, strlen(e->prologue), &out);
+  for (int i = 0; i < BENCH_COMPRESS_MODULES; i++) {
+    if (i > 0) {
+      compress_stream_raw(&s, e->separator, strlen(e->separator), &out);
+    }
+    if (encoding == COMPRESS_IDENTITY) {
+      fragment *f = encoder_module_fragment(e, &mods[i], mds[i]);
+      fragment_append(&out, fragment_data(f), fragment_length(f));
+    } else {
+      const compress_segment *segment =
+          encoder_module_compressed(e, encoding, &mods[i], mds[i]);
+      fragment_append(
+          &out, fragment_data(segment->data), fragment_length(segment->data));
+      compress_stream_segment(&s, segment);
+    }
+  }
+  compress_stream_raw(&s, e->epilogue, strlen(e->epilogue), &out);
+  compress_stream_end(&s, &out);
+  return out;
+}
+
+
+/**
+  What compression costs and saves for a "/" request on a host with 16
+  modules of 256 values each, in JSON.
+
+  compress_module is the cost of compressing one module, paid once per
+  snapshot. compress_response is the cost of each request built from the
+  compressed caches and compress_per_request that of compressing the whole
+  response for every request instead. wire_bytes is the size of the body.
+ */
+static void
+bench_compress(void)
+{
+  static const enum compress_encoding encodings[] = {
+    COMPRESS_IDENTITY,
+    COMPRESS_GZIP,
+#ifdef HAVE_ZSTD
+    COMPRESS_ZSTD,
+#endif
+  };
+  static module mods[BENCH_COMPRESS_MODULES];
+  static char paths[BENCH_COMPRESS_MODULES][16];
+  module_data *mds[BENCH_COMPRESS_MODULES];
+
+  char **keys = bench_make_keys(
+      BENCH_KEYS_PATHS, BENCH_COMPRESS_METRICS, 1);
+  uint64_t state = 5;
+  for (int m = 0; m < BENCH_COMPRESS_MODULES; m++) {
+    snprintf(paths[m], sizeof(paths[m]), "/bench%d", m);
+    mods[m].registered_path = paths[m];
+    mds[m] = new_module_data(BENCH_COMPRESS_METRICS);
+    for (size_t i = 0; i < BENCH_COMPRESS_METRICS; i++) {
+      if (i % 4 == 3) {
+        add_string_value(mds[m], keys[i], "up");
+      } else {
+        // Counters of realistic magnitudes, which compress less well
+        // than small numbers.
+        add_int_value(
+            mds[m], keys[i], (int64_t) (bench_random(&state) >> 24));
+      }
+    }
+  }
+
+  fragment *identity =
+      bench_compress_response(COMPRESS_IDENTITY, mods, mds);
+  fragment *module_json = encoder_module_fragment(&encoder_json, mods, mds[0]);
+  size_t reps = 200;
+  struct bench_timer t;
+
+  for (size_t ei = 0; ei < sizeof(encodings) / sizeof(encodings[0]); ei++) {
+    enum compress_encoding encoding = encodings[ei];
+    const char *name = compress_encoding_name(encoding);
+    char params[160];
+
+    if (encoding != COMPRESS_IDENTITY) {
+      snprintf(
+          params,
+          sizeof(params),
+          "\"encoding\":\"%s\",\"metrics\":%d",
+          name,
+          BENCH_COMPRESS_METRICS);
+      bench_start(&t);
+      for (size_t r = 0; r < reps; r++) {
+        compress_segment *segment = compress_segment_new(
+            encoding, fragment_data(module_json), fragment_length(module_json));
+        bench_sink += fragment_length(segment->data);
+        compress_segment_free(segment);
+      }
+      bench_stop(&t, "compress_module", params, reps);
+    }
+
+    fragment *response = bench_compress_response(encoding, mods, mds);
+    snprintf(
+        params,
+        sizeof(params),
+        "\"encoding\":\"%s\",\"modules\":%d,\"metrics\":%d,"
+        "\"wire_bytes\":%zu",
+        name != NULL ? name : "identity",
+        BENCH_COMPRESS_MODULES,
+        BENCH_COMPRESS_METRICS,
+        fragment_length(response));
+    fragment_release(response);
+
+    bench_start(&t);
+    for (size_t r = 0; r < reps * 10; r++) {
+      response = bench_compress_response(encoding, mods, mds);
+      bench_sink += fragment_length(response);
+      fragment_release(response);
+    }
+    bench_stop(&t, "compress_response", params, reps * 10);
+
+    if (encoding != COMPRESS_IDENTITY) {
+      // One stream over the whole response can find more repetition than
+      // separately compressed modules.
+      compress_segment *whole = compress_segment_new(
+          encoding, fragment_data(identity), fragment_length(identity));
+      snprintf(
+          params,
+          sizeof(params),
+          "\"encoding\":\"%s\",\"modules\":%d,\"metrics\":%d,"
+          "\"wire_bytes\":%zu",
+          name,
+          BENCH_COMPRESS_MODULES,
+          BENCH_COMPRESS_METRICS,
+          fragment_length(whole->data));
+      compress_segment_free(whole);
+
+      bench_start(&t);
+      for (size_t r = 0; r < reps; r++) {
+        compress_segment *segment = compress_segment_new(
+            encoding, fragment_data(identity), fragment_length(identity));
+        bench_sink += fragment_length(segment->data);
+        compress_segment_free(segment);
+      }
+      bench_stop(&t, "compress_per_request", params, reps);
+    }
+  }
+
+  fragment_release(identity);
+  for (int m = 0; m < BENCH_COMPRESS_MODULES; m++) {
+    free_module_data(mds[m]);
+  }
+  bench_free_keys(keys, BENCH_COMPRESS_METRICS);
+}
+
+
+/** Shared between the snapshot reader and publisher threads. */
+struct bench_snapshot_state {
+  module mod;
+  char **keys;
+  size_t metrics;
+  volatile bool stop_publisher;
+};
+
+
+static module_data *
+bench_snapshot_build(
+    struct bench_snapshot_state *state,
+    uint64_t seed)
+{
+  module_data *md = new_module_data(state->metrics);
+  for (size_t i = 0; i < state->metrics; i++) {
+    add_int_value(md, state->keys[i], (int64_t) (seed + i));
+  }
+  return md;
+}
+
+
+static void *
+bench_snapshot_publisher(
+    void *arg)
+{
+  struct bench_snapshot_state *state = (struct bench_snapshot_state *) arg;
+  while (!state->stop_publisher) {
+    module_publish(&(state->mod), bench_snapshot_build(state, 0));
+  }
+  return NULL;
+}
+
+
+static void
+bench_snapshot(void)
+{
+  struct bench_snapshot_state state;
+  memset(&state, 0, sizeof(state));
+  state.metrics = 256;
+  state.keys = bench_make_keys(BENCH_KEYS_PATHS, state.metrics, 1);
+  module_publish(&(state.mod), bench_snapshot_build(&state, 0));
+
+  for (int with_publisher = 0; with_publisher < 2; with_publisher++) {
+    pthread_t publisher;
+    char params[128];
+    snprintf(
+        params,
+        sizeof(params),
+        "\"metrics\":%zu,\"publisher\":%s",
+        state.metrics,
+        with_publisher ? "true" : "false");
+
+    state.stop_publisher = false;
+    if (with_publisher) {
+      pthread_create(&publisher, NULL, bench_snapshot_publisher, &state);
+    }
+
+    // A request: pin the current snapshot and read every value from it.
+    size_t reps = 200000;
+    struct bench_timer t;
+    bench_start(&t);
+    for (size_t r = 0; r < reps; r++) {
+      module_snapshot_enter();
+      const module_data *md = module_snapshot(&(state.mod));
+      const module_data_slot *slots = module_data_slots(md);
+      int64_t sum = 0;
+      for (uint32_t i = 0; i < md->items; i++) {
+        sum += slots[i].value.i;
+      }
+      bench_sink += sum;
+      module_snapshot_exit();
+    }
+    bench_stop(&t, "snapshot_read", params, reps);
+
+    if (with_publisher) {
+      state.stop_publisher = true;
+      pthread_join(publisher, NULL);
+    }
+  }
+
+  bench_free_keys(state.keys, state.metrics);
+}
+
+
+/** Shared between the threads recording into one histogram and sketch. */
+struct bench_distribution_state {
+  irk_histogram *histogram;
+  irk_sketch *sketch;
+  size_t reps;
+};
+
+
+static void *
+bench_distribution_histogram(
+    void *arg)
+{
+  struct bench_distribution_state *state =
+      (struct bench_distribution_state *) arg;
+  uint64_t seed = (uintptr_t) &seed;
+  for (size_t i = 0; i < state->reps; i++) {
+    // Latencies from about a microsecond to a second.
+    histogram_record(
+        state->histogram, (double) (bench_random(&seed) >> 44) / 1000000);
+  }
+  return NULL;
+}
+
+
+static void *
+bench_distribution_sketch(
+    void *arg)
+{
+  struct bench_distribution_state *state =
+      (struct bench_distribution_state *) arg;
+  uint64_t seed = (uintptr_t) &seed;
+  for (size_t i = 0; i < state->reps; i++) {
+    sketch_record(
+        state->sketch, (double) (bench_random(&seed) >> 44) / 1000000);
+  }
+  return NULL;
+}
+
+
+static void
+bench_distribution(void)
+{
+  static const int thread_counts[] = {1, 2, 4, 8};
+  struct bench_distribution_state state;
+  state.histogram = new_histogram();
+  state.sketch = new_sketch(0.01, 1e-6, 10);
+  state.reps = 4000000;
+
+  for (int kind = 0; kind < 2; kind++) {
+    for (int ti = 0; ti < 4; ti++) {
+      int threads = thread_counts[ti];
+      pthread_t recorders[8];
+      char params[64];
+      snprintf(params, sizeof(params), "\"threads\":%d", threads);
+
+      // Every thread records into the same one, so this is the worst
+      // case for contention on the counts.
+      struct bench_timer t;
+      bench_start(&t);
+      for (int i = 0; i < threads; i++) {
+        pthread_create(
+            &recorders[i],
+            NULL,
+            kind == 0 ? bench_distribution_histogram :
+                bench_distribution_sketch,
+            &state);
+      }
+      for (int i = 0; i < threads; i++) {
+        pthread_join(recorders[i], NULL);
+      }
+      bench_stop(
+          &t,
+          kind == 0 ? "histogram_record" : "sketch_record",
+          params,
+          state.reps * threads);
+    }
+  }
+
+  // Copying them into a module_data, as a module does every cycle.
+  size_t reps = 20000;
+  for (int kind = 0; kind < 2; kind++) {
+    struct bench_timer t;
+    bench_start(&t);
+    for (size_t r = 0; r < reps; r++) {
+      module_data *md = new_module_data(1);
+      if (kind == 0) {
+        add_histogram_value(md, "latency", state.histogram);
+      } else {
+        add_sketch_value(md, "latency", state.sketch);
+      }
+      bench_sink += md->strings_used;
+      free_module_data(md);
+    }
+    bench_stop(
+        &t,
+        kind == 0 ? "histogram_add" : "sketch_add",
+        "\"threads\":1",
+        reps);
+  }
+
+  free_histogram(state.histogram);
+  free_sketch(state.sketch);
+}
+
+
+// Timers in the scheduler benchmarks, spread over this many cycle times
+// from 1ms up.
+#define BENCH_SCHEDULER_TIMERS 10000
+#define BENCH_SCHEDULER_CYCLE_TIMES 10
+
+
+/** A module timer that does no work, counting its calls in 'user_data'. */
+static module_data *
+bench_scheduler_timer(
+    void *user_data)
+{
+  (*(size_t *) user_data)++;
+  return NULL;
+}
+
+
+/** The same as a plain libevent callback. */
+static void
+bench_scheduler_event(
+    evutil_socket_t fd,
+    short flags,
+    void *user_data)
+{
+  (*(size_t *) user_data)++;
+}
+
+
+/**
+  scheduler_run is the CPU time taken per module collected when every
+  timer is driven by the scheduler, and event_per_timer_run the same with
+  a libevent timer for each module, which is what the scheduler replaces.
+  Both run for the same 200ms, and the callbacks do nothing so this is
+  purely the cost of deciding what to run, with config_accounting off so
+  that measuring them is not counted either. The modules are spread over
+  every phase, as they would be in practice.
+ */
+static void
+bench_scheduler(void)
+{
+  static module mods[BENCH_SCHEDULER_TIMERS];
+  static char paths[BENCH_SCHEDULER_TIMERS][16];
+  char params[64];
+  snprintf(
+      params, sizeof(params), "\"timers\":%d,\"cycle_times\":%d",
+      BENCH_SCHEDULER_TIMERS, BENCH_SCHEDULER_CYCLE_TIMES);
+  struct timeval run_time = {0, 200000};
+  struct bench_timer t;
+  size_t calls = 0;
+  bool accounting_default = config_accounting;
+  config_accounting = false;
+
+  // The scheduler keeps its timers on this base, so it is never freed.
+  struct event_base *eb = event_base_new();
+  scheduler_init(eb);
+
+  bench_start(&t);
+  for (int i = 0; i < BENCH_SCHEDULER_TIMERS; i++) {
+    // Paths pick the phase, so these spread over every phase.
+    snprintf(paths[i], sizeof(paths[i]), "/bench/%d", i);
+    mods[i].registered_path = paths[i];
+    mods[i].timer = bench_scheduler_timer;
+    mods[i].timer_data = &calls;
+    mods[i].timer_delay.tv_sec = 0;
+    mods[i].timer_delay.tv_usec =
+        (i % BENCH_SCHEDULER_CYCLE_TIMES + 1) * 1000;
+    scheduler_add(&mods[i]);
+  }
+  bench_stop(&t, "scheduler_add", params, BENCH_SCHEDULER_TIMERS);
+
+  event_base_loopexit(eb, &run_time);
+  bench_start_cpu(&t);
+  event_base_dispatch(eb);
+  bench_stop(&t, "scheduler_run", params, calls);
+  config_accounting = accounting_default;
+
+  for (int i = 0; i < BENCH_SCHEDULER_TIMERS; i++) {
+    scheduler_remove(&mods[i]);
+  }
+
+  struct event **events = (struct event **) malloc(
+      BENCH_SCHEDULER_TIMERS * sizeof(struct event *));
+  calls = 0;
+  for (int i = 0; i < BENCH_SCHEDULER_TIMERS; i++) {
+    events[i] = event_new(eb, -1, EV_PERSIST, bench_scheduler_event, &calls);
+    event_add(events[i], &(mods[i].timer_delay));
+  }
+  event_base_loopexit(eb, &run_time);
+  bench_start_cpu(&t);
+  event_base_dispatch(eb);
+  bench_stop(&t, "event_per_timer_run", params, calls);
+
+  for (int i = 0; i < BENCH_SCHEDULER_TIMERS; i++) {
+    event_free(events[i]);
+  }
+  free(events);
+}
+
+
+/** Counts the jobs handed back in bench_workers(). */
+struct bench_workers_state {
+  struct event_base *eb;
+  size_t done;
+  size_t jobs;
+};
+
+
+static module_data *
+bench_workers_job(
+    void *user_data)
+{
+  return NULL;
+}
+
+
+static void
+bench_workers_done(
+    module *mod,
+    module_data *md,
+    void *done_data)
+{
+  struct bench_workers_state *state = (struct bench_workers_state *) done_data;
+  if (++(state->done) == state->jobs) {
+    event_base_loopbreak(state->eb);
+  }
+}
+
+
+/**
+  worker_job is the cost of one job that does nothing making the round
+  trip from the loop to a worker and back, which is the overhead added to
+  every module callback. It is run again with config_accounting and
+  config_accounting_allocations set, to show what measuring each callback
+  adds, see collector/accounting.h.
+ */
+static void
+bench_workers(void)
+{
+  static const size_t thread_counts[] = {1, 2, 4};
+  static module mod;
+  bool accounting_default = config_accounting;
+  bool allocations_default = config_accounting_allocations;
+
+  for (int accounting = 0; accounting < 2; accounting++) {
+    config_accounting = accounting;
+    config_accounting_allocations = accounting;
+    for (int ti = 0; ti < 3; ti++) {
+      struct bench_workers_state state = {
+        .eb = event_base_new(),
+        .done = 0,
+        .jobs = 200000,
+      };
+      if (workers_init(state.eb, thread_counts[ti]) != 0) {
+        fprintf(stderr, "Unable to start the workers.\n");
+        event_base_free(state.eb);
+        return;
+      }
+      char params[64];
+      snprintf(
+          params, sizeof(params), "\"threads\":%zu,\"accounting\":%s",
+          thread_counts[ti], accounting ? "true" : "false");
+
+      struct bench_timer t;
+      bench_start(&t);
+      for (size_t i = 0; i < state.jobs; i++) {
+        workers_submit(
+            &mod, bench_workers_job, NULL, bench_workers_done, &state);
+      }
+      event_base_dispatch(state.eb);
+      bench_stop(&t, "worker_job", params, state.jobs);
+
+      workers_shutdown();
+      event_base_free(state.eb);
+    }
+  }
+  config_accounting = accounting_default;
+  config_accounting_allocations = allocations_default;
+}
+
+
+/** Every benchmark group, in the order they run. */
+static const struct {
+  const char *name;
+  void (*run)(void);
+} bench_groups[] = {
+  {"strhash", bench_strhash},
+  {"cstrhash", bench_cstrhash},
+  {"security", bench_security},
+  {"module_data", bench_module_data},
+  {"snapshot", bench_snapshot},
+  {"encode", bench_encode},
+  {"compress", bench_compress},
+  {"distribution", bench_distribution},
+  {"scheduler", bench_scheduler},
+  {"workers", bench_workers},
+};
+
+
+int
+main(
+    int argc,
+    char **argv)
+{
+  int opt;
+  while ((opt = getopt(argc, argv, "d:v")) != -1) {
+    switch (opt) {
+      case 'd':
+        bench_directory = optarg;
+        break;
+      case 'v':
+        bench_verify = true;
+        break;
+      default:
+        fprintf(
+            stderr, "Usage: %s [-d directory] [-v] [name_filter]\n", argv[0]);
+        return 1;
+    }
+  }
+  if (optind < argc) {
+    bench_filter = argv[optind];
+  }
+
+  // Debug logging on every cache hit would swamp the measurements.
+  log_set_level(LOG_LEVEL_ERROR);
+
+  for (size_t i = 0; i < sizeof(bench_groups) / sizeof(bench_groups[0]); i++) {
+    if (bench_filter == NULL || strstr(bench_groups[i].name, bench_filter)) {
+      bench_groups[i].run();
+    }
+  }
+  return bench_failed ? 1 : 0;
+}
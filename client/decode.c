@@ -0,0 +1,658 @@
+/*
+Copyright (C) 2012 Brady Catherman
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <client/decode.h>
+
+#define IRK_DECODE_FRAME_MODULE 0x01
+#define IRK_DECODE_FRAME_KEYS 0x02
+#define IRK_DECODE_FRAME_VALUES 0x03
+#define IRK_DECODE_FRAME_HISTORY 0x04
+
+// The type in the low bits of a value header for a histogram or sketch,
+// which is followed by a byte saying which.
+#define IRK_DECODE_VALUE_DISTRIBUTION 3
+#define IRK_DECODE_DISTRIBUTION_HISTOGRAM 0
+#define IRK_DECODE_DISTRIBUTION_SKETCH 1
+
+// The layout of histogram bins, see decode.h.
+#define IRK_DECODE_HISTOGRAM_MIN_EXPONENT (-20)
+#define IRK_DECODE_HISTOGRAM_SUB_BUCKETS 8
+#define IRK_DECODE_HISTOGRAM_OVERFLOW 513
+
+// The longest a varint can be.
+#define IRK_DECODE_VARINT_MAX 10
+
+static const uint8_t irk_decode_header[] = {
+  'I', 'R', 'K', IRK_DECODE_VERSION
+};
+
+
+/**
+  Reads a varint from data[*position] up to 'end'.
+
+  Returns:
+    true if a varint was read, with *position moved past it.
+ */
+static bool
+irk_decode_varint(
+    const uint8_t *data,
+    size_t *position,
+    size_t end,
+    uint64_t *value)
+{
+  uint64_t result = 0;
+  for (int shift = 0; shift < 64 && *position < end; shift += 7) {
+    uint8_t byte = data[(*position)++];
+    result |= (uint64_t) (byte & 0x7f) << shift;
+    if (!(byte & 0x80)) {
+      *value = result;
+      return true;
+    }
+  }
+  return false;
+}
+
+
+/** Undoes zigzag encoding. */
+static int64_t
+irk_decode_unzigzag(
+    uint64_t value)
+{
+  return (int64_t) (value >> 1) ^ -(int64_t) (value & 1);
+}
+
+
+/** Reads an 8 byte double from data[*position] up to 'end'. */
+static bool
+irk_decode_double(
+    const uint8_t *data,
+    size_t *position,
+    size_t end,
+    double *value)
+{
+  if (end - *position < 8) {
+    return false;
+  }
+  uint64_t bits = 0;
+  for (int i = 0; i < 8; i++) {
+    bits |= (uint64_t) data[*position + i] << (8 * i);
+  }
+  memcpy(value, &bits, sizeof(bits));
+  *position += 8;
+  return true;
+}
+
+
+/**
+  Makes room for 'len' more bytes of names.
+
+  The module path lives at the start of the names, so it is pointed at
+  again in case they moved.
+ */
+static bool
+irk_decode_names_reserve(
+    struct irk_decoder *d,
+    size_t len)
+{
+  if (d->names == NULL || d->names_used + len > d->names_capacity) {
+    size_t capacity = d->names_capacity ? d->names_capacity : 256;
+    while (capacity < d->names_used + len) {
+      capacity *= 2;
+    }
+    char *names = realloc(d->names, capacity);
+    if (names == NULL) {
+      return false;
+    }
+    d->names = names;
+    d->names_capacity = capacity;
+    if (d->root != NULL) {
+      d->root = names;
+    }
+  }
+  return true;
+}
+
+
+/** Reads a module frame held in data[position, end). */
+static bool
+irk_decode_module(
+    struct irk_decoder *d,
+    size_t position,
+    size_t end)
+{
+  uint64_t generation;
+  uint64_t len;
+  if (!irk_decode_varint(d->data, &position, end, &generation) ||
+      !irk_decode_varint(d->data, &position, end, &len) ||
+      len > end - position) {
+    return false;
+  }
+
+  // The keys of the previous module no longer apply.
+  d->keys_used = 0;
+  d->names_used = 0;
+  if (!irk_decode_names_reserve(d, len)) {
+    return false;
+  }
+  memcpy(d->names, d->data + position, len);
+  d->names_used = len;
+  d->root = d->names;
+  d->root_length = len;
+  d->generation = generation;
+  return true;
+}
+
+
+/** Reads a keys frame held in data[position, end). */
+static bool
+irk_decode_keys(
+    struct irk_decoder *d,
+    size_t position,
+    size_t end)
+{
+  uint64_t count;
+  if (!irk_decode_varint(d->data, &position, end, &count) ||
+      count > end - position) {
+    return false;
+  }
+
+  if (count > d->keys_capacity) {
+    struct irk_decode_key *keys = realloc(d->keys, count * sizeof(*keys));
+    if (keys == NULL) {
+      return false;
+    }
+    d->keys = keys;
+    d->keys_capacity = count;
+  }
+
+  d->keys_used = 0;
+  d->names_used = d->root_length;
+  uint32_t id = 0;
+  for (uint64_t i = 0; i < count; i++) {
+    uint64_t delta;
+    uint64_t len;
+    if (!irk_decode_varint(d->data, &position, end, &delta) ||
+        !irk_decode_varint(d->data, &position, end, &len) ||
+        len > end - position ||
+        !irk_decode_names_reserve(d, len)) {
+      return false;
+    }
+    id += (uint32_t) irk_decode_unzigzag(delta);
+
+    struct irk_decode_key *key = &d->keys[d->keys_used++];
+    key->id = id;
+    key->offset = d->names_used;
+    key->length = len;
+    memcpy(d->names + d->names_used, d->data + position, len);
+    d->names_used += len;
+    position += len;
+  }
+  return true;
+}
+
+
+/**
+  Finds the name of key 'id'.
+
+  Values come in the same order as the keys frame, so the key after the
+  last one found is nearly always the right one.
+ */
+static const struct irk_decode_key *
+irk_decode_key_find(
+    struct irk_decoder *d,
+    uint32_t id)
+{
+  if (d->keys_cursor < d->keys_used && d->keys[d->keys_cursor].id == id) {
+    return &d->keys[d->keys_cursor++];
+  }
+  for (size_t i = 0; i < d->keys_used; i++) {
+    if (d->keys[i].id == id) {
+      d->keys_cursor = i + 1;
+      return &d->keys[i];
+    }
+  }
+  return NULL;
+}
+
+
+/**
+  Reads a histogram or sketch from data[*position] up to 'end'.
+
+  The bins are checked here so that irk_decode_bins_next() can trust them.
+ */
+static bool
+irk_decode_distribution(
+    const uint8_t *data,
+    size_t *position,
+    size_t end,
+    struct irk_decode_value *value)
+{
+  struct irk_decode_distribution *dist = &(value->value.distribution);
+  if (*position == end) {
+    return false;
+  }
+  uint8_t kind = data[(*position)++];
+  if (kind == IRK_DECODE_DISTRIBUTION_HISTOGRAM) {
+    value->type = IRK_DECODE_HISTOGRAM;
+    dist->gamma = 0;
+  } else if (kind == IRK_DECODE_DISTRIBUTION_SKETCH) {
+    value->type = IRK_DECODE_SKETCH;
+  } else {
+    return false;
+  }
+
+  if (!irk_decode_varint(data, position, end, &(dist->count)) ||
+      !irk_decode_double(data, position, end, &(dist->sum)) ||
+      (kind == IRK_DECODE_DISTRIBUTION_SKETCH &&
+       (!irk_decode_double(data, position, end, &(dist->gamma)) ||
+        !(dist->gamma > 1))) ||
+      !irk_decode_varint(data, position, end, &(dist->bins))) {
+    return false;
+  }
+
+  dist->data = data + *position;
+  for (uint64_t i = 0; i < dist->bins; i++) {
+    uint64_t delta;
+    uint64_t count;
+    if (!irk_decode_varint(data, position, end, &delta) ||
+        !irk_decode_varint(data, position, end, &count)) {
+      return false;
+    }
+  }
+  dist->length = data + *position - dist->data;
+  return true;
+}
+
+
+/**
+  Reads a history frame held in data[position, end) into 'value'.
+
+  The samples are checked here so that irk_decode_points_next() can trust
+  them.
+ */
+static bool
+irk_decode_history(
+    struct irk_decoder *d,
+    size_t position,
+    size_t end,
+    struct irk_decode_value *value)
+{
+  struct irk_decode_history *history = &(value->value.history);
+  uint64_t len;
+  if (d->root == NULL ||
+      !irk_decode_varint(d->data, &position, end, &(history->count)) ||
+      position == end) {
+    return false;
+  }
+  uint8_t type = d->data[position++];
+  if ((type != IRK_DECODE_INT && type != IRK_DECODE_DOUBLE) ||
+      !irk_decode_varint(d->data, &position, end, &len) ||
+      len > end - position) {
+    return false;
+  }
+  value->id = 0;
+  value->type = IRK_DECODE_HISTORY;
+  value->key = (const char *) d->data + position;
+  value->key_length = len;
+  position += len;
+
+  history->type = type;
+  history->data = d->data + position;
+  for (uint64_t i = 0; i < history->count; i++) {
+    uint64_t delta;
+    double sample;
+    if (!irk_decode_varint(d->data, &position, end, &delta) ||
+        (type == IRK_DECODE_INT &&
+         !irk_decode_varint(d->data, &position, end, &delta)) ||
+        (type == IRK_DECODE_DOUBLE &&
+         !irk_decode_double(d->data, &position, end, &sample))) {
+      return false;
+    }
+  }
+  history->length = d->data + position - history->data;
+  return true;
+}
+
+
+/** Reads the next value of the current values frame. */
+static int
+irk_decode_value(
+    struct irk_decoder *d,
+    struct irk_decode_value *value)
+{
+  size_t end = d->values_end;
+  uint64_t header;
+  if (!irk_decode_varint(d->data, &(d->position), end, &header)) {
+    return IRK_DECODE_ERROR;
+  }
+  d->value_id += (uint32_t) irk_decode_unzigzag(header >> 2);
+  d->values_left--;
+
+  value->id = d->value_id;
+  value->type = header & 0x3;
+  const struct irk_decode_key *key = irk_decode_key_find(d, d->value_id);
+  if (key != NULL) {
+    value->key = d->names + key->offset;
+    value->key_length = key->length;
+  } else {
+    value->key = NULL;
+    value->key_length = 0;
+  }
+
+  switch (value->type) {
+    case IRK_DECODE_INT: {
+      uint64_t i;
+      if (!irk_decode_varint(d->data, &(d->position), end, &i)) {
+        return IRK_DECODE_ERROR;
+      }
+      value->value.i = irk_decode_unzigzag(i);
+      break;
+    }
+    case IRK_DECODE_DOUBLE:
+      if (!irk_decode_double(
+              d->data, &(d->position), end, &(value->value.d))) {
+        return IRK_DECODE_ERROR;
+      }
+      break;
+    case IRK_DECODE_STRING: {
+      uint64_t len;
+      if (!irk_decode_varint(d->data, &(d->position), end, &len) ||
+          len > end - d->position) {
+        return IRK_DECODE_ERROR;
+      }
+      value->value.string.data = (const char *) d->data + d->position;
+      value->value.string.length = len;
+      d->position += len;
+      break;
+    }
+    case IRK_DECODE_VALUE_DISTRIBUTION:
+      if (!irk_decode_distribution(d->data, &(d->position), end, value)) {
+        return IRK_DECODE_ERROR;
+      }
+      break;
+  }
+
+  // Anything after the last value was added by a later version.
+  if (d->values_left == 0) {
+    d->position = end;
+  }
+  return IRK_DECODE_VALUE;
+}
+
+
+void
+irk_decode_init(
+    struct irk_decoder *d,
+    const uint8_t *data,
+    size_t length)
+{
+  memset(d, 0, sizeof(*d));
+  d->data = data;
+  d->length = length;
+}
+
+
+int
+irk_decode_next(
+    struct irk_decoder *d,
+    struct irk_decode_value *value)
+{
+  if (!d->started) {
+    if (d->length < sizeof(irk_decode_header)) {
+      return IRK_DECODE_TRUNCATED;
+    }
+    if (memcmp(d->data, irk_decode_header, sizeof(irk_decode_header))) {
+      return IRK_DECODE_ERROR;
+    }
+    d->position = sizeof(irk_decode_header);
+    d->started = true;
+  }
+
+  while (d->values_left == 0) {
+    if (d->position == d->length) {
+      return IRK_DECODE_END;
+    }
+
+    // Frames are only started once all of them is here, so truncation is
+    // always reported between frames.
+    size_t position = d->position + 1;
+    uint64_t len;
+    if (!irk_decode_varint(d->data, &position, d->length, &len)) {
+      // Either the length is cut short or it is longer than any varint.
+      return d->length - (d->position + 1) < IRK_DECODE_VARINT_MAX ?
+          IRK_DECODE_TRUNCATED : IRK_DECODE_ERROR;
+    }
+    if (len > d->length - position) {
+      return IRK_DECODE_TRUNCATED;
+    }
+    uint8_t tag = d->data[d->position];
+    size_t end = position + len;
+    d->position = end;
+
+    switch (tag) {
+      case IRK_DECODE_FRAME_MODULE:
+        if (!irk_decode_module(d, position, end)) {
+          return IRK_DECODE_ERROR;
+        }
+        return IRK_DECODE_MODULE;
+      case IRK_DECODE_FRAME_KEYS:
+        if (!irk_decode_keys(d, position, end)) {
+          return IRK_DECODE_ERROR;
+        }
+        break;
+      case IRK_DECODE_FRAME_VALUES:
+        if (d->root == NULL ||
+            !irk_decode_varint(d->data, &position, end, &(d->values_left))) {
+          return IRK_DECODE_ERROR;
+        }
+        d->position = position;
+        d->values_end = end;
+        d->value_id = 0;
+        d->keys_cursor = 0;
+        if (d->values_left == 0) {
+          d->position = end;
+        }
+        break;
+      case IRK_DECODE_FRAME_HISTORY:
+        if (!irk_decode_history(d, position, end, value)) {
+          return IRK_DECODE_ERROR;
+        }
+        return IRK_DECODE_VALUE;
+      default:
+        // Unknown frames are skipped.
+        break;
+    }
+  }
+
+  return irk_decode_value(d, value);
+}
+
+
+void
+irk_decode_refill(
+    struct irk_decoder *d,
+    const uint8_t *data,
+    size_t length)
+{
+  d->data = data;
+  d->length = length;
+  d->position = 0;
+}
+
+
+size_t
+irk_decode_consumed(
+    const struct irk_decoder *d)
+{
+  return d->position;
+}
+
+
+void
+irk_decode_bins_init(
+    struct irk_decode_bins *bins,
+    const struct irk_decode_distribution *dist)
+{
+  bins->data = dist->data;
+  bins->position = 0;
+  bins->length = dist->length;
+  bins->left = dist->bins;
+  bins->index = 0;
+}
+
+
+bool
+irk_decode_bins_next(
+    struct irk_decode_bins *bins,
+    int64_t *index,
+    uint64_t *count)
+{
+  uint64_t delta;
+  if (bins->left == 0 ||
+      !irk_decode_varint(bins->data, &(bins->position), bins->length, &delta) ||
+      !irk_decode_varint(bins->data, &(bins->position), bins->length, count)) {
+    return false;
+  }
+  bins->left--;
+  bins->index += irk_decode_unzigzag(delta);
+  *index = bins->index;
+  return true;
+}
+
+
+void
+irk_decode_points_init(
+    struct irk_decode_points *points,
+    const struct irk_decode_history *history)
+{
+  points->data = history->data;
+  points->position = 0;
+  points->length = history->length;
+  points->left = history->count;
+  points->type = history->type;
+  points->time = 0;
+  points->i = 0;
+}
+
+
+bool
+irk_decode_points_next(
+    struct irk_decode_points *points,
+    struct irk_decode_point *point)
+{
+  uint64_t delta;
+  if (points->left == 0 ||
+      !irk_decode_varint(
+          points->data, &(points->position), points->length, &delta)) {
+    return false;
+  }
+  points->time += irk_decode_unzigzag(delta);
+  point->time = points->time;
+
+  if (points->type == IRK_DECODE_DOUBLE) {
+    if (!irk_decode_double(
+            points->data, &(points->position), points->length,
+            &(point->value.d))) {
+      return false;
+    }
+  } else {
+    if (!irk_decode_varint(
+            points->data, &(points->position), points->length, &delta)) {
+      return false;
+    }
+    // Integers wrap around rather than overflow.
+    points->i = (int64_t) ((uint64_t) points->i +
+        (uint64_t) irk_decode_unzigzag(delta));
+    point->value.i = points->i;
+  }
+  points->left--;
+  return true;
+}
+
+
+double
+irk_decode_bin_value(
+    const struct irk_decode_distribution *dist,
+    int64_t index)
+{
+  if (dist->gamma != 0) {
+    return 2 * pow(dist->gamma, (double) index) / (dist->gamma + 1);
+  }
+  if (index <= 0) {
+    return ldexp(1, IRK_DECODE_HISTOGRAM_MIN_EXPONENT);
+  } else if (index >= IRK_DECODE_HISTOGRAM_OVERFLOW) {
+    return INFINITY;
+  }
+  int64_t sub = (index - 1) % IRK_DECODE_HISTOGRAM_SUB_BUCKETS;
+  int exponent = IRK_DECODE_HISTOGRAM_MIN_EXPONENT +
+      (int) ((index - 1) / IRK_DECODE_HISTOGRAM_SUB_BUCKETS);
+  return ldexp(
+      1 + (double) (sub + 1) / IRK_DECODE_HISTOGRAM_SUB_BUCKETS, exponent);
+}
+
+
+double
+irk_decode_quantile(
+    const struct irk_decode_distribution *dist,
+    double q)
+{
+  if (dist->count == 0) {
+    return NAN;
+  }
+  if (q < 0) {
+    q = 0;
+  } else if (q > 1) {
+    q = 1;
+  }
+
+  double rank = q * (double) (dist->count - 1);
+  struct irk_decode_bins bins;
+  int64_t index = 0;
+  uint64_t count;
+  uint64_t seen = 0;
+  irk_decode_bins_init(&bins, dist);
+  while (irk_decode_bins_next(&bins, &index, &count)) {
+    seen += count;
+    if ((double) seen > rank) {
+      break;
+    }
+  }
+  return irk_decode_bin_value(dist, index);
+}
+
+
+void
+irk_decode_free(
+    struct irk_decoder *d)
+{
+  free(d->keys);
+  free(d->names);
+  d->keys = NULL;
+  d->names = NULL;
+  d->root = NULL;
+}
@@ -0,0 +1,447 @@
+/*
+Copyright (C) 2012 Brady Catherman
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef __CLIENT_DECODE_H
+#define __CLIENT_DECODE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+  Decoder for irk's binary output ('?format=binary').
+
+  This has no dependencies on the rest of irk (it only needs libm) so it
+  can be built into whatever collects from irk. Values are returned one at
+  a time pointing into the response, the only allocation is a table of key
+  names that is grown as needed and reused from module to module.
+
+  Format (version 1)
+
+  Varints are unsigned LEB128: seven bits per byte, least significant
+  first, with the high bit set on every byte but the last. Signed numbers
+  are zigzag encoded first ((n << 1) ^ (n >> 63)) so that small negative
+  numbers stay short.
+
+  A response starts with the four bytes "IRK\x01", the last being the
+  version, followed by frames until the end of the response. Every frame
+  is:
+
+    tag (1 byte), payload length (varint), payload
+
+  so a reader can always find the end of a frame before looking inside it,
+  and frames with tags it does not know about can be skipped. The frames
+  are:
+
+    0x01 module: generation (varint), path length (varint), path.
+         Starts the output for a module. The generation is the one its
+         values were published in.
+
+    0x02 keys: count (varint), then for each key the change in key ID from
+         the previous key in this frame (zigzag varint, the first is
+         relative to 0), the key length (varint) and the key, relative to
+         the module's path.
+
+    0x03 values: count (varint), then for each value a header and the
+         value. The header is a varint holding the change in key ID from
+         the previous value in this frame (zigzag, the first is relative
+         to 0) shifted left by two bits, with the type of the value in the
+         low two bits:
+
+           0 integer: zigzag varint.
+           1 double: the 8 bytes of the IEEE 754 value, least significant
+             byte first.
+           2 string: length (varint) and the bytes of the string.
+           3 distribution: a kind byte, 0 for a histogram and 1 for a
+             sketch, then the number of values counted (varint), their
+             sum (8 byte double as above), for a sketch its gamma (8 byte
+             double), the number of bins (varint) and for each bin the
+             change in its index from the previous bin (zigzag varint, the
+             first is relative to 0) and its count (varint). Only bins
+             that are not empty are sent, in increasing order of index.
+
+    0x04 history: count (varint), a type byte (0 integer, 1 double), the
+         key length (varint) and the key, relative to the module's path,
+         then 'count' samples of that key, oldest first. Each sample is
+         its time in milliseconds since the Unix epoch as the change from
+         the previous sample (zigzag varint, the first is relative to 0),
+         then its value: for an integer the change from the previous
+         sample (zigzag varint, the first is relative to 0, wrapping
+         around in 64 bits), for a double the 8 byte double as above.
+
+  Histogram bins are the same for every histogram. Bin 0 holds everything
+  up to 2^-20, bin 513 everything over 2^44, and bin i in between holds
+  values greater than its lower bound up to and including its upper bound
+
+    2^(-20 + (i - 1) / 8) * (1 + ((i - 1) % 8 + 1) / 8)
+
+  (integer division), so each power of two is split into 8 buckets.
+  Sketch bins are those of a DDSketch: bin i holds values greater than
+  gamma^(i-1) up to and including gamma^i.
+
+  Key IDs are stable for the life of the irk process, so a client that
+  remembers them only needs the keys frame to learn new ones. Every module
+  frame is followed by the keys frame for its values and then the values
+  frame, in that order, except in responses to '?history=', where each
+  module frame is followed by a history frame for each of its series.
+ */
+
+
+/** The version byte this decoder understands. */
+#define IRK_DECODE_VERSION 1
+
+
+/** What irk_decode_next() found. */
+enum irk_decode_result {
+  /** A value was decoded. */
+  IRK_DECODE_VALUE,
+
+  /** A new module was started, see irk_decoder.root. */
+  IRK_DECODE_MODULE,
+
+  /**
+    All of the input has been decoded. When reading a response as it
+    arrives this is also returned if the input given so far ends exactly
+    between two frames.
+   */
+  IRK_DECODE_END,
+
+  /**
+    The input ends part way through a frame. More input can be given with
+    irk_decode_refill().
+   */
+  IRK_DECODE_TRUNCATED,
+
+  /**
+    The input is not valid or is a version this does not understand, or
+    allocation failed.
+   */
+  IRK_DECODE_ERROR,
+};
+
+
+/** The types of values. */
+enum irk_decode_type {
+  IRK_DECODE_INT = 0,
+  IRK_DECODE_DOUBLE = 1,
+  IRK_DECODE_STRING = 2,
+  IRK_DECODE_HISTOGRAM = 3,
+  IRK_DECODE_SKETCH = 4,
+
+  /** The samples of one key, see struct irk_decode_history. */
+  IRK_DECODE_HISTORY = 5,
+};
+
+
+/**
+  A histogram or sketch. The bins are read with irk_decode_bins_init()
+  and irk_decode_bins_next().
+ */
+struct irk_decode_distribution {
+  /** The number of values counted. */
+  uint64_t count;
+
+  /** Their sum. */
+  double sum;
+
+  /** The gamma of a sketch, 0 for a histogram. */
+  double gamma;
+
+  /** The number of bins that are not empty. */
+  uint64_t bins;
+
+  /** The encoded bins, pointing into the input. */
+  const uint8_t *data;
+  size_t length;
+};
+
+
+/** Iterates over the bins of an irk_decode_distribution. */
+struct irk_decode_bins {
+  const uint8_t *data;
+  size_t position;
+  size_t length;
+  uint64_t left;
+  int64_t index;
+};
+
+
+/**
+  The samples of one integer or double key from a history frame. The
+  samples are read with irk_decode_points_init() and
+  irk_decode_points_next().
+ */
+struct irk_decode_history {
+  /** IRK_DECODE_INT or IRK_DECODE_DOUBLE. */
+  int type;
+
+  /** The number of samples. */
+  uint64_t count;
+
+  /** The encoded samples, pointing into the input. */
+  const uint8_t *data;
+  size_t length;
+};
+
+
+/** A sample of an irk_decode_history. */
+struct irk_decode_point {
+  /** When it was collected, in milliseconds since the Unix epoch. */
+  int64_t time;
+
+  union {
+    int64_t i;
+    double d;
+  } value;
+};
+
+
+/** Iterates over the samples of an irk_decode_history. */
+struct irk_decode_points {
+  const uint8_t *data;
+  size_t position;
+  size_t length;
+  uint64_t left;
+  int type;
+  int64_t time;
+  int64_t i;
+};
+
+
+/** A single decoded value. */
+struct irk_decode_value {
+  /** The key ID, 0 for a history, which is sent without one. */
+  uint32_t id;
+
+  /**
+    The key relative to the module path, or NULL if it was not in the keys
+    frame. This is not NUL terminated.
+   */
+  const char *key;
+  size_t key_length;
+
+  /** An enum irk_decode_type. */
+  int type;
+
+  union {
+    int64_t i;
+    double d;
+    struct {
+      /** Points into the input, so this is not NUL terminated. */
+      const char *data;
+      size_t length;
+    } string;
+    struct irk_decode_distribution distribution;
+    struct irk_decode_history history;
+  } value;
+};
+
+
+/** Known keys, only used inside of the decoder. */
+struct irk_decode_key {
+  uint32_t id;
+  size_t offset;
+  size_t length;
+};
+
+
+/** Decoder state. Everything in here is read only for callers. */
+struct irk_decoder {
+  const uint8_t *data;
+  size_t length;
+  size_t position;
+
+  /** Set once the header has been checked. */
+  bool started;
+
+  /**
+    The path of the module the values belong to, or NULL before the first
+    module. This is not NUL terminated.
+   */
+  const char *root;
+  size_t root_length;
+  uint64_t generation;
+
+  /** The values left in the current values frame. */
+  uint64_t values_left;
+  size_t values_end;
+  uint32_t value_id;
+
+  /**
+    The keys from the last keys frame. Their names are copied to 'names',
+    after the module path, so they outlive the input given to
+    irk_decode_refill().
+   */
+  struct irk_decode_key *keys;
+  size_t keys_used;
+  size_t keys_capacity;
+  size_t keys_cursor;
+  char *names;
+  size_t names_used;
+  size_t names_capacity;
+};
+
+
+/**
+  Starts decoding a response.
+
+  Arguments:
+    d: The decoder to initialize.
+    data: The response, which must stay valid until it is replaced with
+          irk_decode_refill() or decoding is done. The header is checked
+          by the first call to irk_decode_next().
+    length: The length of data.
+ */
+void
+irk_decode_init(
+    struct irk_decoder *d,
+    const uint8_t *data,
+    size_t length);
+
+
+/**
+  Decodes the next value.
+
+  Arguments:
+    d: The decoder.
+    value: Filled in when IRK_DECODE_VALUE is returned. Any pointers in it
+           are valid until the next call.
+
+  Returns:
+    An enum irk_decode_result.
+ */
+int
+irk_decode_next(
+    struct irk_decoder *d,
+    struct irk_decode_value *value);
+
+
+/**
+  Continues decoding with more input.
+
+  This is for reading a response as it arrives. After IRK_DECODE_TRUNCATED
+  or IRK_DECODE_END the bytes from irk_decode_consumed() onwards have not
+  been used, and must be at the start of 'data' followed by whatever has
+  arrived since. It must not be called at any other time, as the values
+  of a frame are returned from the input without copying them.
+
+  Arguments:
+    d: The decoder.
+    data: The rest of the response.
+    length: The length of data.
+ */
+void
+irk_decode_refill(
+    struct irk_decoder *d,
+    const uint8_t *data,
+    size_t length);
+
+
+/** Returns how many bytes of the current input have been decoded. */
+size_t
+irk_decode_consumed(
+    const struct irk_decoder *d);
+
+
+/** Starts iterating over the bins of 'dist'. */
+void
+irk_decode_bins_init(
+    struct irk_decode_bins *bins,
+    const struct irk_decode_distribution *dist);
+
+
+/**
+  Returns the next bin.
+
+  Arguments:
+    bins: The iterator.
+    index: Receives the index of the bin.
+    count: Receives the number of values in it.
+
+  Returns:
+    true if a bin was returned, false if there are no more.
+ */
+bool
+irk_decode_bins_next(
+    struct irk_decode_bins *bins,
+    int64_t *index,
+    uint64_t *count);
+
+
+/** Starts iterating over the samples of 'history'. */
+void
+irk_decode_points_init(
+    struct irk_decode_points *points,
+    const struct irk_decode_history *history);
+
+
+/**
+  Returns the next sample.
+
+  Arguments:
+    points: The iterator.
+    point: Receives the sample, with value.i set for an integer history
+           and value.d for a double one.
+
+  Returns:
+    true if a sample was returned, false if there are no more.
+ */
+bool
+irk_decode_points_next(
+    struct irk_decode_points *points,
+    struct irk_decode_point *point);
+
+
+/**
+  Returns the value a bin stands for: the upper bound of a histogram bin
+  (infinity for the last), or for a sketch bin the value within the
+  sketch's relative accuracy of everything in it.
+
+  Arguments:
+    dist: The histogram or sketch.
+    index: The index of the bin.
+ */
+double
+irk_decode_bin_value(
+    const struct irk_decode_distribution *dist,
+    int64_t index);
+
+
+/**
+  Estimates quantile 'q' (0 to 1) of a histogram or sketch, as the value
+  of the bin it falls in.
+
+  Returns:
+    The estimate, or NaN if nothing was counted.
+ */
+double
+irk_decode_quantile(
+    const struct irk_decode_distribution *dist,
+    double q);
+
+
+/** Frees everything allocated by the decoder. */
+void
+irk_decode_free(
+    struct irk_decoder *d);
+
+#endif
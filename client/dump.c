@@ -0,0 +1,262 @@
+/*
+Copyright (C) 2012 Brady Catherman
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <client/decode.h>
+
+/*
+  irk-dump: Prints the values in a binary irk response, one per line.
+
+  The response is read from the named file or from stdin, so it can be fed
+  straight from curl:
+
+    curl -s 'http://host:port/?format=binary' | irk-dump
+
+  It is decoded as it is read, which also makes this a usable example of
+  irk_decode_refill().
+ */
+
+// Bytes read at a time. Frames larger than this grow the buffer.
+#define DUMP_READ_SIZE 65536
+
+
+static void
+dump_usage(
+    const char *name)
+{
+  fprintf(stderr, "Usage: %s [-i] [file]\n", name);
+  fprintf(stderr, "  -i  Show the key ID and generation of every value.\n");
+}
+
+
+/**
+  Prints 'string' with quotes, backslashes and control characters escaped
+  the way the JSON encoder does, so every value stays on one line.
+ */
+static void
+dump_escaped(
+    const char *string,
+    size_t len)
+{
+  size_t start = 0;
+  for (size_t i = 0; i < len; i++) {
+    unsigned char c = string[i];
+    if (c >= 0x20 && c != '"' && c != '\\') {
+      continue;
+    }
+    fwrite(string + start, 1, i - start, stdout);
+    if (c == '"' || c == '\\') {
+      printf("\\%c", c);
+    } else {
+      printf("\\u%04x", c);
+    }
+    start = i + 1;
+  }
+  fwrite(string + start, 1, len - start, stdout);
+}
+
+
+/** Prints a histogram or sketch as its count, sum and a few quantiles. */
+static void
+dump_distribution(
+    const struct irk_decode_distribution *dist)
+{
+  static const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+
+  printf("count=%llu sum=%.17g", (unsigned long long) dist->count, dist->sum);
+  for (size_t i = 0; i < sizeof(quantiles) / sizeof(quantiles[0]); i++) {
+    printf(" q%g=%.6g", quantiles[i], irk_decode_quantile(dist, quantiles[i]));
+  }
+}
+
+
+/** Prints every sample of a history as time=value pairs. */
+static void
+dump_history(
+    const struct irk_decode_history *history)
+{
+  struct irk_decode_points points;
+  struct irk_decode_point point;
+  irk_decode_points_init(&points, history);
+  bool first = true;
+  while (irk_decode_points_next(&points, &point)) {
+    printf(first ? "%lld=" : " %lld=", (long long) point.time);
+    if (history->type == IRK_DECODE_INT) {
+      printf("%lld", (long long) point.value.i);
+    } else {
+      printf("%.17g", point.value.d);
+    }
+    first = false;
+  }
+}
+
+
+static void
+dump_value(
+    const struct irk_decoder *d,
+    const struct irk_decode_value *v,
+    bool show_ids)
+{
+  if (v->key != NULL) {
+    printf(
+        "%.*s/%.*s ",
+        (int) d->root_length,
+        d->root,
+        (int) v->key_length,
+        v->key);
+  } else {
+    printf("%.*s/#%u ", (int) d->root_length, d->root, v->id);
+  }
+
+  switch (v->type) {
+    case IRK_DECODE_INT:
+      printf("%lld", (long long) v->value.i);
+      break;
+    case IRK_DECODE_DOUBLE:
+      printf("%.17g", v->value.d);
+      break;
+    case IRK_DECODE_STRING:
+      printf("\"");
+      dump_escaped(v->value.string.data, v->value.string.length);
+      printf("\"");
+      break;
+    case IRK_DECODE_HISTOGRAM:
+    case IRK_DECODE_SKETCH:
+      dump_distribution(&(v->value.distribution));
+      break;
+    case IRK_DECODE_HISTORY:
+      dump_history(&(v->value.history));
+      break;
+  }
+
+  if (show_ids) {
+    printf(
+        " id=%u generation=%llu",
+        v->id,
+        (unsigned long long) d->generation);
+  }
+  printf("\n");
+}
+
+
+int
+main(
+    int argc,
+    char **argv)
+{
+  bool show_ids = false;
+  int opt;
+  while ((opt = getopt(argc, argv, "i")) != -1) {
+    switch (opt) {
+      case 'i':
+        show_ids = true;
+        break;
+      default:
+        dump_usage(argv[0]);
+        return 1;
+    }
+  }
+
+  FILE *in = stdin;
+  if (optind < argc) {
+    in = fopen(argv[optind], "rb");
+    if (in == NULL) {
+      fprintf(stderr, "%s: %s\n", argv[optind], strerror(errno));
+      return 1;
+    }
+  }
+
+  size_t capacity = DUMP_READ_SIZE;
+  size_t used = 0;
+  uint8_t *buffer = malloc(capacity);
+  if (buffer == NULL) {
+    fprintf(stderr, "Out of memory.\n");
+    return 1;
+  }
+
+  struct irk_decoder d;
+  struct irk_decode_value v;
+  irk_decode_init(&d, buffer, 0);
+  bool eof = false;
+  int status = 0;
+
+  while (true) {
+    int result = irk_decode_next(&d, &v);
+    if (result == IRK_DECODE_VALUE) {
+      dump_value(&d, &v, show_ids);
+      continue;
+    } else if (result == IRK_DECODE_MODULE) {
+      continue;
+    } else if (result == IRK_DECODE_ERROR) {
+      fprintf(stderr, "Invalid or unsupported input.\n");
+      status = 1;
+      break;
+    } else if (eof) {
+      if (result == IRK_DECODE_TRUNCATED) {
+        fprintf(stderr, "Input ends part way through a frame.\n");
+        status = 1;
+      }
+      break;
+    }
+
+    // Keep whatever has not been decoded and read more after it.
+    size_t consumed = irk_decode_consumed(&d);
+    used -= consumed;
+    memmove(buffer, buffer + consumed, used);
+    if (capacity - used < DUMP_READ_SIZE) {
+      capacity *= 2;
+      uint8_t *grown = realloc(buffer, capacity);
+      if (grown == NULL) {
+        fprintf(stderr, "Out of memory.\n");
+        status = 1;
+        break;
+      }
+      buffer = grown;
+    }
+
+    size_t n = fread(buffer + used, 1, capacity - used, in);
+    if (n == 0) {
+      if (ferror(in)) {
+        fprintf(stderr, "Read failed: %s\n", strerror(errno));
+        status = 1;
+        break;
+      }
+      eof = true;
+    }
+    used += n;
+    irk_decode_refill(&d, buffer, used);
+  }
+
+  irk_decode_free(&d);
+  free(buffer);
+  if (in != stdin) {
+    fclose(in);
+  }
+  return status;
+}
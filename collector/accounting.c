@@ -0,0 +1,187 @@
+/*
+Copyright (C) 2012 Brady Catherman
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+// For RUSAGE_THREAD.
+#define _GNU_SOURCE
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <time.h>
+
+#include <collector/accounting.h>
+#include <common/config.h>
+#include <common/memory.h>
+#include <master/module.h>
+
+
+/** Reads the CPU time used by this thread so far. */
+static void
+accounting_cpu(
+    struct timeval *user,
+    struct timeval *system)
+{
+#ifdef RUSAGE_THREAD
+  struct rusage usage;
+  if (getrusage(RUSAGE_THREAD, &usage) == 0) {
+    *user = usage.ru_utime;
+    *system = usage.ru_stime;
+    return;
+  }
+#endif
+  // Without RUSAGE_THREAD there is no split between user and system time,
+  // so it is all counted as user time.
+  struct timespec cpu;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+  user->tv_sec = cpu.tv_sec;
+  user->tv_usec = cpu.tv_nsec / 1000;
+  system->tv_sec = 0;
+  system->tv_usec = 0;
+}
+
+
+/** Returns 'end' - 'start' in microseconds. */
+static uint64_t
+accounting_elapsed(
+    const struct timeval *start,
+    const struct timeval *end)
+{
+  int64_t us = (int64_t) (end->tv_sec - start->tv_sec) * 1000000 +
+      (end->tv_usec - start->tv_usec);
+  return us > 0 ? (uint64_t) us : 0;
+}
+
+
+/** Returns the accounting of 'mod', creating it if needed. */
+static struct accounting *
+accounting_find(
+    module *mod)
+{
+  struct accounting *a = __atomic_load_n(&(mod->accounting), __ATOMIC_ACQUIRE);
+  if (a != NULL) {
+    return a;
+  }
+
+  // Callbacks of one module can run on several threads at once, so the
+  // first to get here installs its copy and any others throw theirs away.
+  a = (struct accounting *) irk_calloc(1, sizeof(struct accounting));
+  if (a == NULL) {
+    return NULL;
+  }
+  a->wall = new_histogram();
+  a->cpu = new_histogram();
+  struct accounting *expected = NULL;
+  if (a->wall == NULL || a->cpu == NULL ||
+      !__atomic_compare_exchange_n(
+          &(mod->accounting), &expected, a, false,
+          __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+    free_histogram(a->wall);
+    free_histogram(a->cpu);
+    irk_free(a);
+    return expected;
+  }
+  return a;
+}
+
+
+bool
+accounting_start(
+    struct accounting_sample *sample)
+{
+  if (!config_accounting) {
+    return false;
+  }
+  if (config_accounting_allocations) {
+    memory_stats_get(&(sample->memory));
+  } else {
+    // accounting_stop() then finds no change in allocations.
+    memset(&(sample->memory), 0, sizeof(sample->memory));
+  }
+  accounting_cpu(&(sample->user), &(sample->system));
+  clock_gettime(CLOCK_MONOTONIC, &(sample->wall));
+  return true;
+}
+
+
+void
+accounting_stop(
+    module *mod,
+    const struct accounting_sample *sample)
+{
+  struct timespec wall;
+  clock_gettime(CLOCK_MONOTONIC, &wall);
+  struct timeval user, system;
+  accounting_cpu(&user, &system);
+  struct memory_stats memory = sample->memory;
+  if (config_accounting_allocations) {
+    memory_stats_get(&memory);
+  }
+
+  int64_t wall_ns = (int64_t) (wall.tv_sec - sample->wall.tv_sec) *
+      1000000000 + (wall.tv_nsec - sample->wall.tv_nsec);
+  uint64_t user_us = accounting_elapsed(&(sample->user), &user);
+  uint64_t system_us = accounting_elapsed(&(sample->system), &system);
+
+  // Anything allocated here is counted against this thread too, so it is
+  // done after everything has been read.
+  struct accounting *a = accounting_find(mod);
+  if (a == NULL) {
+    return;
+  }
+  struct accounting_totals *t = &(a->totals);
+  __atomic_fetch_add(&(t->calls), 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&(t->wall_us), wall_ns / 1000, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&(t->user_us), user_us, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&(t->system_us), system_us, __ATOMIC_RELAXED);
+  __atomic_fetch_add(
+      &(t->allocations),
+      memory.allocations - sample->memory.allocations,
+      __ATOMIC_RELAXED);
+  __atomic_fetch_add(
+      &(t->bytes), memory.bytes - sample->memory.bytes, __ATOMIC_RELAXED);
+  histogram_record(a->wall, wall_ns / 1e9);
+  histogram_record(a->cpu, (user_us + system_us) / 1e6);
+}
+
+
+const struct accounting *
+accounting_get(
+    const module *mod,
+    struct accounting_totals *totals)
+{
+  const struct accounting *a =
+      __atomic_load_n(&(mod->accounting), __ATOMIC_ACQUIRE);
+  if (a == NULL) {
+    return NULL;
+  }
+  const struct accounting_totals *t = &(a->totals);
+  totals->calls = __atomic_load_n(&(t->calls), __ATOMIC_RELAXED);
+  totals->wall_us = __atomic_load_n(&(t->wall_us), __ATOMIC_RELAXED);
+  totals->user_us = __atomic_load_n(&(t->user_us), __ATOMIC_RELAXED);
+  totals->system_us = __atomic_load_n(&(t->system_us), __ATOMIC_RELAXED);
+  totals->allocations =
+      __atomic_load_n(&(t->allocations), __ATOMIC_RELAXED);
+  totals->bytes = __atomic_load_n(&(t->bytes), __ATOMIC_RELAXED);
+  return a;
+}
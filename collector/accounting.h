@@ -0,0 +1,139 @@
+/*
+Copyright (C) 2012 Brady Catherman
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef __COLLECTOR_ACCOUNTING_H
+#define __COLLECTOR_ACCOUNTING_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/time.h>
+#include <time.h>
+
+#include <common/memory.h>
+#include <master/module.h>
+
+/**
+  What the callbacks of each module cost.
+
+  If config_accounting is set, every callback run by collector/workers.h
+  is timed with a monotonic clock and the CPU time of the thread running
+  it is taken from getrusage(RUSAGE_THREAD). If
+  config_accounting_allocations is set too, the bytes it allocated through
+  irk's allocators are read from the thread's counters, see
+  common/memory.h. So the cost of each module is known without a
+  profiler: which module is using the CPU on a machine is a matter of
+  reading /irk, see collector/self.h.
+
+  Measuring takes two getrusage() and two clock_gettime() calls per
+  callback, which adds about 1us to each. That is negligible for callbacks
+  that run every few seconds, so it is on by default, while counting
+  allocations has to be asked for.
+
+  Each module keeps running totals, and histograms of the wall and CPU
+  time of each call in seconds. They are updated with atomic adds by
+  whichever thread ran the callback, and created the first time a callback
+  of the module runs.
+ */
+
+
+/** The running totals of a module. */
+struct accounting_totals {
+  /** Callbacks run. */
+  uint64_t calls;
+
+  /** Time spent in them, in microseconds. */
+  uint64_t wall_us;
+
+  /** CPU time used by them, in microseconds. */
+  uint64_t user_us;
+  uint64_t system_us;
+
+  /** Allocations made by them through irk's allocators, and their bytes. */
+  uint64_t allocations;
+  uint64_t bytes;
+};
+
+
+/** The cost of a module, see module.accounting. */
+struct accounting {
+  struct accounting_totals totals;
+
+  /** The wall and CPU time of each call. */
+  irk_histogram *wall;
+  irk_histogram *cpu;
+};
+
+
+/** Where a thread was when a callback started. */
+struct accounting_sample {
+  struct timespec wall;
+  struct timeval user;
+  struct timeval system;
+  struct memory_stats memory;
+};
+
+
+/**
+  Starts measuring a callback about to run on this thread.
+
+  Arguments:
+    sample: Filled in, and passed to accounting_stop() afterwards.
+
+  Returns:
+    true if the callback is being measured, false if config_accounting is
+    not set, in which case accounting_stop() must not be called.
+ */
+bool
+accounting_start(
+    struct accounting_sample *sample);
+
+
+/**
+  Adds the cost of the callback of 'mod' started with 'sample' to the
+  totals of 'mod'. This must be called on the thread that ran it.
+
+  If the accounting of the module can not be allocated the call is not
+  counted.
+ */
+void
+accounting_stop(
+    module *mod,
+    const struct accounting_sample *sample);
+
+
+/**
+  Reads the cost of 'mod'.
+
+  Arguments:
+    mod: The module.
+    totals: Filled in with its totals.
+
+  Returns:
+    Its accounting, whose histograms may be read while they are being
+    recorded into, or NULL if none of its callbacks have run.
+ */
+const struct accounting *
+accounting_get(
+    const module *mod,
+    struct accounting_totals *totals);
+
+#endif
@@ -24,10 +24,52 @@ DEALINGS IN THE SOFTWARE.
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <syslog.h>
 #include <time.h>
 
+#include <collector/scheduler.h>
+#include <common/memory.h>
+#include <master/intern.h>
 #include <master/module.h>
+#include <master/schema.h>
+
+
+/**
+  Checks that a normalized path is acceptable as a module's root path.
+
+  The path must have at least one component, and no component may be empty
+  (from "//"), "." or "..".
+
+  Arguments:
+    path: The path with a leading '/' and no trailing '/'.
+
+  Returns:
+    true if the path is valid.
+ */
+static bool
+root_path_is_valid(
+    const char *path)
+{
+  if (path[1] == '\0') {
+    return false;
+  }
+
+  const char *component = path + 1;
+  while (true) {
+    const char *end = strchr(component, '/');
+    size_t len = (end == NULL) ? strlen(component) : (size_t) (end - component);
+    if (len == 0 ||
+        (len == 1 && component[0] == '.') ||
+        (len == 2 && component[0] == '.' && component[1] == '.')) {
+      return false;
+    }
+    if (end == NULL) {
+      return true;
+    }
+    component = end + 1;
+  }
+}
 
 
 module *
@@ -69,8 +111,74 @@ set_root_path(
     return EINVAL;
   }
 
-  // FIXME(brady)
-  return -1;
+  // Build the normalized path: always a leading '/', never a trailing one,
+  // and no empty, "." or ".." components.
+  size_t path_len = strlen(path);
+  while (path_len > 0 && path[path_len - 1] == '/') {
+    path_len--;
+  }
+  const char *start = path;
+  while (*start == '/' && path_len > 0) {
+    start++;
+    path_len--;
+  }
+
+  char *normalized = (char *) irk_malloc(path_len + 2);
+  if (normalized == NULL) {
+    errno = ENOMEM;
+    return ENOMEM;
+  }
+  normalized[0] = '/';
+  memcpy(normalized + 1, start, path_len);
+  normalized[path_len + 1] = '\0';
+
+  if (!root_path_is_valid(normalized)) {
+    syslog(
+        LOG_WARNING,
+        "%s(%p): Invalid path passed to set_root_path: %s",
+        mod->module_file->filename,
+        mod,
+        path);
+    irk_free(normalized);
+    errno = EINVAL;
+    return EINVAL;
+  }
+
+  int err = module_index_add(mod, normalized);
+  if (err != 0) {
+    if (err == EEXIST) {
+      syslog(
+          LOG_WARNING,
+          "%s(%p): Path %s, or one with the same Prometheus names, has "
+          "already been claimed by another module",
+          mod->module_file->filename,
+          mod,
+          normalized);
+    }
+    irk_free(normalized);
+    errno = err;
+    return err;
+  }
+
+  irk_free(mod->registered_path);
+  mod->registered_path = normalized;
+
+  // The phase of the timer is hashed from the path, so a timer registered
+  // before it was set has to be moved to the phase of the path.
+  if (mod->timer != NULL) {
+    err = scheduler_add(mod);
+    if (err != 0) {
+      syslog(
+          LOG_WARNING,
+          "Module %s(%p): Unable to schedule the timer callback: %s",
+          mod->module_file->filename,
+          mod,
+          strerror(err));
+      errno = err;
+      return err;
+    }
+  }
+  return 0;
 }
 
 
@@ -99,7 +207,21 @@ register_initial_callback(
   mod->register_initial_callback_called = true;
   mod->initial = initial;
   mod->initial_data = initial_data;
-  return 0;
+  if (initial == NULL) {
+    return 0;
+  }
+
+  int err = scheduler_initial(mod);
+  if (err != 0) {
+    syslog(
+        LOG_WARNING,
+        "Module %s(%p): Unable to queue the initial callback: %s",
+        mod->module_file->filename,
+        mod,
+        strerror(err));
+    errno = err;
+  }
+  return err;
 }
 
 
@@ -126,9 +248,66 @@ register_timer_callback(
         mod);
   }
 
+  if (timer != NULL && cycle_time == NULL) {
+    syslog(
+        LOG_WARNING,
+        "Module %s(%p): Call to register_timer_callback where "
+        "cycle_time == NULL",
+        mod->module_file->filename,
+        mod);
+    errno = EINVAL;
+    return EINVAL;
+  }
+
   mod->register_timer_callback_called = true;
   mod->timer = timer;
   mod->timer_data = timer_data;
+  if (timer == NULL) {
+    scheduler_remove(mod);
+    return 0;
+  }
+
+  mod->timer_delay = *cycle_time;
+  int err = scheduler_add(mod);
+  if (err != 0) {
+    syslog(
+        LOG_WARNING,
+        "Module %s(%p): Unable to schedule the timer callback: %s",
+        mod->module_file->filename,
+        mod,
+        strerror(err));
+    errno = err;
+  }
+  return err;
+}
+
+
+int
+set_timer_deadline(
+    module *mod,
+    struct timeval *deadline)
+{
+  if (mod == NULL) {
+    syslog(
+        LOG_WARNING,
+        "Unknown module: Call to set_timer_deadline where mod == NULL");
+    errno = EINVAL;
+    return EINVAL;
+  }
+
+  if (deadline == NULL || deadline->tv_sec < 0 || deadline->tv_usec < 0 ||
+      deadline->tv_usec >= 1000000 ||
+      (deadline->tv_sec == 0 && deadline->tv_usec == 0)) {
+    syslog(
+        LOG_WARNING,
+        "Module %s(%p): Invalid deadline passed to set_timer_deadline",
+        mod->module_file->filename,
+        mod);
+    errno = EINVAL;
+    return EINVAL;
+  }
+
+  mod->timer_deadline = *deadline;
   return 0;
 }
 
@@ -156,9 +335,28 @@ register_refresh_callback(
         mod);
   }
 
+  if (minimum_time != NULL &&
+      (minimum_time->tv_sec < 0 || minimum_time->tv_usec < 0 ||
+       minimum_time->tv_usec >= 1000000)) {
+    syslog(
+        LOG_WARNING,
+        "Module %s(%p): Invalid minimum_time passed to "
+        "register_refresh_callback",
+        mod->module_file->filename,
+        mod);
+    errno = EINVAL;
+    return EINVAL;
+  }
+
   mod->register_refresh_callback_called = true;
   mod->refresh = refresh;
   mod->refresh_data = refresh_data;
+  if (minimum_time != NULL) {
+    mod->refresh_minimum = *minimum_time;
+  } else {
+    mod->refresh_minimum.tv_sec = 0;
+    mod->refresh_minimum.tv_usec = 0;
+  }
   return 0;
 }
 
@@ -186,3 +384,76 @@ remove_from_default_view(
   mod->in_default_view = false;
   return 0;
 }
+
+
+uint32_t
+register_key(
+    module *mod,
+    const char *key)
+{
+  if (mod == NULL) {
+    syslog(
+        LOG_WARNING,
+        "Unknown module: Call to register_key where mod == NULL");
+    errno = EINVAL;
+    return 0;
+  }
+  if (key == NULL) {
+    syslog(
+        LOG_WARNING,
+        "Module %s(%p): Call to register_key where key == NULL",
+        mod->module_file->filename,
+        mod);
+    errno = EINVAL;
+    return 0;
+  }
+
+  uint32_t id = intern_key(mod, key, strlen(key));
+  if (id == 0) {
+    syslog(
+        LOG_WARNING,
+        "Module %s(%p): Unable to register key %s: %s",
+        mod->module_file->filename,
+        mod,
+        key,
+        strerror(errno));
+  }
+  return id;
+}
+
+
+int
+declare_metric(
+    module *mod,
+    const char *key,
+    enum irk_value_type type,
+    uint32_t *slot)
+{
+  if (mod == NULL) {
+    syslog(
+        LOG_WARNING,
+        "Unknown module: Call to declare_metric where mod == NULL");
+    return EINVAL;
+  }
+  if (key == NULL || slot == NULL) {
+    syslog(
+        LOG_WARNING,
+        "Module %s(%p): Call to declare_metric where %s == NULL",
+        mod->module_file->filename,
+        mod,
+        key == NULL ? "key" : "slot");
+    return EINVAL;
+  }
+
+  int err = schema_declare(mod, key, type, slot);
+  if (err != 0) {
+    syslog(
+        LOG_WARNING,
+        "Module %s(%p): Unable to declare metric %s: %s",
+        mod->module_file->filename,
+        mod,
+        key,
+        strerror(err));
+  }
+  return err;
+}
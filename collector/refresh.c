@@ -0,0 +1,194 @@
+/*
+Copyright (C) 2012 Brady Catherman
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include <errno.h>
+#include <event.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <collector/refresh.h>
+#include <collector/scheduler.h>
+#include <collector/waiter.h>
+#include <collector/workers.h>
+#include <common/logging.h>
+#include <common/memory.h>
+#include <master/module.h>
+#include <master/module_data.h>
+
+
+/** The refresh state of one module, see module.refresh_entry. */
+struct refresh_entry {
+  module *mod;
+
+  /** When the last refresh started, in microseconds, or 0 if none has. */
+  uint64_t started;
+
+  /** Set from when a refresh is queued until its data is handed back. */
+  bool in_flight;
+
+  /** Set once the refresh in flight has run past REFRESH_MAX_WAIT_SECONDS. */
+  bool expired;
+
+  /** Fires REFRESH_MAX_WAIT_SECONDS after a refresh starts. */
+  struct event *timeout;
+
+  /** The requests waiting on the refresh in flight, newest first. */
+  struct waiter *waiters;
+};
+
+
+// Set by refresh_init().
+static struct event_base *refresh_base = NULL;
+
+
+/** Publishes what a refresh callback returned, on the event loop. */
+static void
+refresh_collected(
+    module *mod,
+    module_data *md,
+    void *done_data)
+{
+  struct refresh_entry *entry = (struct refresh_entry *) done_data;
+  entry->in_flight = false;
+  if (entry->timeout != NULL) {
+    event_del(entry->timeout);
+  }
+  if (md != NULL && module_publish(mod, md) == 0) {
+    log_error("Unable to publish the data of a module, dropping it.");
+    free_module_data(md);
+  }
+  waiter_answer_all(&(entry->waiters));
+}
+
+
+/** Called when a refresh has kept requests waiting for too long. */
+static void
+refresh_timeout(
+    evutil_socket_t fd,
+    short flags,
+    void *user_data)
+{
+  struct refresh_entry *entry = (struct refresh_entry *) user_data;
+  const char *path = entry->mod->registered_path;
+  log_warning(
+      "Module %s(%p): Refresh is taking too long, answering from cache.",
+      path != NULL ? path : "", entry->mod);
+  entry->expired = true;
+  waiter_answer_all(&(entry->waiters));
+}
+
+
+int
+refresh_init(
+    struct event_base *eb)
+{
+  refresh_base = eb;
+  return 0;
+}
+
+
+bool
+refresh_request(
+    module *mod,
+    waiter_done_func done,
+    void *done_data)
+{
+  // The initial callback has to be published before anything else runs.
+  if (mod->refresh == NULL || mod->initial_pending) {
+    return false;
+  }
+  struct refresh_entry *entry = mod->refresh_entry;
+  if (entry == NULL) {
+    entry = (struct refresh_entry *) irk_calloc(
+        1, sizeof(struct refresh_entry));
+    if (entry == NULL) {
+      return false;
+    }
+    entry->mod = mod;
+    mod->refresh_entry = entry;
+  }
+
+  if (entry->in_flight && entry->expired) {
+    return false;
+  }
+  uint64_t now = waiter_now();
+  uint64_t minimum = (uint64_t) mod->refresh_minimum.tv_sec * 1000000 +
+      mod->refresh_minimum.tv_usec;
+  if (!entry->in_flight && entry->started != 0 &&
+      now - entry->started < minimum) {
+    return false;
+  }
+
+  // A refresh never runs alongside the module's timer callback, which
+  // could publish older data over it, or at all while the module is
+  // struggling, so that one stuck module can not tie up every worker. The
+  // request waits on the timer callback instead, if there is one running.
+  if (!entry->in_flight && scheduler_busy(mod)) {
+    return scheduler_wake(mod, done, done_data);
+  }
+
+  struct waiter *waiter = waiter_new(done, done_data);
+  if (waiter == NULL) {
+    return false;
+  }
+
+  if (!entry->in_flight) {
+    entry->in_flight = true;
+    entry->expired = false;
+    entry->started = now;
+    if (entry->timeout == NULL && refresh_base != NULL) {
+      entry->timeout = event_new(
+          refresh_base, -1, 0, refresh_timeout, entry);
+    }
+    if (entry->timeout != NULL) {
+      struct timeval wait = { .tv_sec = REFRESH_MAX_WAIT_SECONDS };
+      event_add(entry->timeout, &wait);
+    }
+
+    // Without worker threads this runs the callback, and
+    // refresh_collected, before returning, and the snapshot is as fresh
+    // as it gets.
+    if (workers_submit(
+            mod, mod->refresh, mod->refresh_data, refresh_collected, entry)) {
+      log_error("Unable to queue the refresh of a module, out of memory.");
+      entry->in_flight = false;
+      if (entry->timeout != NULL) {
+        event_del(entry->timeout);
+      }
+    }
+    if (!entry->in_flight) {
+      waiter_free(waiter);
+      return false;
+    }
+  }
+
+  waiter_push(&(entry->waiters), waiter);
+  return true;
+}
+
+
+bool
+refresh_in_flight(
+    const module *mod)
+{
+  return mod->refresh_entry != NULL && mod->refresh_entry->in_flight;
+}
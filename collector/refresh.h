@@ -0,0 +1,107 @@
+/*
+Copyright (C) 2012 Brady Catherman
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef __COLLECTOR_REFRESH_H
+#define __COLLECTOR_REFRESH_H
+
+#include <event.h>
+#include <stdbool.h>
+
+#include <collector/waiter.h>
+#include <master/module.h>
+
+/**
+  Refreshes of module data asked for by requests.
+
+  A request can ask for a module to be collected again before it is
+  answered, which calls the refresh callback registered by the module.
+  That may be expensive, and many pollers can ask at the same moment, so
+  there is at most one refresh of a module in flight: a request that asks
+  while one is running waits for that one, and every waiting request is
+  answered once it has been published. A request that asks within the
+  module's refresh_minimum of the last refresh starting is answered from
+  the current snapshot straight away.
+
+  Requests wait no longer than REFRESH_MAX_WAIT_SECONDS. A refresh that
+  takes longer still finishes and is published, but the requests waiting
+  on it are answered from the current snapshot, as are any that ask before
+  it finishes.
+
+  Refresh callbacks run on the worker threads like timer callbacks do,
+  see collector/workers.h, but never at the same time as the module's
+  timer or initial callback. A request that asks while the timer callback
+  is running waits on that instead, as scheduler_wake() does, and one that
+  asks while the module is backing off or stuck past its deadline, see
+  collector/scheduler.h, is answered from the current snapshot. The timer
+  callback in turn skips its cycle while a refresh is in flight.
+
+  Everything here must be called from the thread running the event loop.
+ */
+
+
+/** The longest a request waits on a refresh. */
+#define REFRESH_MAX_WAIT_SECONDS 5
+
+
+/**
+  Sets the event base that refreshes are timed on.
+
+  Returns:
+    0.
+ */
+int
+refresh_init(
+    struct event_base *eb);
+
+
+/**
+  Starts a refresh of 'mod', or joins the one in flight.
+
+  Arguments:
+    mod: The module to refresh.
+    done: Called once the refresh is published or the wait runs out, but
+          only if this returns true.
+    done_data: Passed to done.
+
+  Returns:
+    true if 'done' will be called, or false if the current snapshot should
+    be used as is, which is the case if the module has no refresh callback,
+    has not published its initial data, refreshed too recently, is taking
+    too long over the refresh in flight, is backing off or stuck in its
+    timer callback, or memory ran out.
+ */
+bool
+refresh_request(
+    module *mod,
+    waiter_done_func done,
+    void *done_data);
+
+
+/**
+  Returns true from when a refresh of 'mod' is queued until its data has
+  been handed back, even if the requests waiting on it have given up.
+ */
+bool
+refresh_in_flight(
+    const module *mod);
+
+#endif
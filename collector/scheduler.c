@@ -20,33 +20,851 @@ FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
 DEALINGS IN THE SOFTWARE.
 */
 
+#include <errno.h>
 #include <event.h>
-#include <stdio.h>
-#include <stdlib.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
 
+#include <collector/refresh.h>
+#include <collector/scheduler.h>
+#include <collector/waiter.h>
+#include <collector/workers.h>
+#include <common/config.h>
+#include <common/logging.h>
+#include <common/memory.h>
+#include <common/strhash.h>
+#include <master/module.h>
+#include <master/module_data.h>
 
-void scheduler_callback(
+#ifndef HOST_NAME_MAX
+#define HOST_NAME_MAX 255
+#endif
+
+
+struct scheduler_cycle;
+
+
+/** The scheduler's state for one module, see module.scheduler_entry. */
+struct scheduler_entry {
+  module *mod;
+
+  /** The batch the module is in and where. */
+  struct scheduler_batch *batch;
+  size_t index;
+
+  /**
+    Fires if the running callback reaches a deadline set by the module,
+    created the first time one is needed.
+   */
+  struct event *deadline;
+
+  /** Set from when the callback is queued until its data is handed back. */
+  bool running;
+
+  /** Set if the running callback has gone past its deadline. */
+  bool overdue;
+
+  /**
+    Set by scheduler_remove() while the callback was running, the entry
+    is freed once it returns.
+   */
+  bool removed;
+
+  /** Runs in a row that missed the deadline. */
+  uint32_t misses;
+
+  /** Cycles still to skip after the last miss. */
+  uint32_t backoff;
+
+  /** When a request last read the module, see waiter_now(). */
+  uint64_t accessed;
+
+  /**
+    Cycles between runs while the module is idle, 0 while it is not, and
+    how many of them are still to skip.
+   */
+  uint32_t stride;
+  uint32_t countdown;
+
+  /** Set once an idle module has stopped running altogether. */
+  bool paused;
+
+  /** Requests waiting on the callback running, see scheduler_wake(). */
+  struct waiter *waiters;
+
+  /** Fires SCHEDULER_WAKE_WAIT_MS after requests start waiting. */
+  struct event *wake_timeout;
+
+  struct scheduler_stats stats;
+};
+
+
+/** Every module with the same timer_delay and phase. */
+struct scheduler_batch {
+  struct scheduler_cycle *cycle;
+
+  /**
+    When in each cycle the batch runs, in microseconds after the times
+    that are a whole number of cycles since the epoch.
+   */
+  uint64_t phase;
+
+  /** The timer, created once there is an event base. */
+  struct event *event;
+
+  /** Set while the timer is added to the event base. */
+  bool armed;
+
+  /**
+    Set once the timer has fired for the first time, which it does at
+    the next time in the right phase, and has been set to fire every cycle
+    from then on.
+   */
+  bool aligned;
+
+  /** The modules in the batch, in no particular order. */
+  struct scheduler_entry **entries;
+  size_t count;
+  size_t capacity;
+};
+
+
+/** The batches for one timer_delay. */
+struct scheduler_cycle {
+  struct timeval cycle_time;
+  uint64_t cycle_us;
+
+  /** Created as modules need them. */
+  struct scheduler_batch *phases[SCHEDULER_PHASES];
+
+  struct scheduler_cycle *next;
+};
+
+
+// Set by scheduler_init().
+static struct event_base *scheduler_base = NULL;
+
+// Every cycle time in use, which is rarely more than a few so a list is
+// fine.
+static struct scheduler_cycle *scheduler_cycles = NULL;
+
+// Modules whose initial callback was registered before scheduler_init().
+struct scheduler_initial {
+  module *mod;
+  struct scheduler_initial *next;
+};
+static struct scheduler_initial *scheduler_initials = NULL;
+
+// Hash of this machine's name, see scheduler_phase_hash().
+static uint64_t scheduler_host_hash = 0;
+static bool scheduler_host_hashed = false;
+
+
+/** Answers every request waiting on 'entry'. */
+static void
+scheduler_answer(
+    struct scheduler_entry *entry)
+{
+  if (entry->wake_timeout != NULL) {
+    event_del(entry->wake_timeout);
+  }
+  waiter_answer_all(&(entry->waiters));
+}
+
+
+/** Frees 'entry', which is no longer in a batch or running. */
+static void
+scheduler_entry_free(
+    struct scheduler_entry *entry)
+{
+  if (entry->deadline != NULL) {
+    event_free(entry->deadline);
+  }
+  if (entry->wake_timeout != NULL) {
+    event_free(entry->wake_timeout);
+  }
+  irk_free(entry);
+}
+
+
+/** Publishes what a timer callback returned, on the event loop. */
+static void
+scheduler_collected(
+    module *mod,
+    module_data *md,
+    void *done_data)
+{
+  struct scheduler_entry *entry = (struct scheduler_entry *) done_data;
+  entry->running = false;
+  if (entry->deadline != NULL) {
+    event_del(entry->deadline);
+  }
+  if (entry->removed) {
+    free_module_data(md);
+    scheduler_answer(entry);
+    scheduler_entry_free(entry);
+    return;
+  }
+
+  if (entry->overdue) {
+    // Give a module that is struggling room to recover, more of it each
+    // time it misses again.
+    entry->backoff = 1;
+    for (uint32_t i = 1;
+         i < entry->misses && entry->backoff < SCHEDULER_MAX_BACKOFF; i++) {
+      entry->backoff *= 2;
+    }
+    entry->overdue = false;
+  } else {
+    entry->misses = 0;
+    entry->stats.stale = false;
+  }
+  entry->stats.backoff = entry->backoff;
+
+  // Late data is still the newest there is.
+  if (md != NULL && module_publish(mod, md) == 0) {
+    log_error("Unable to publish the data of a module, dropping it.");
+    free_module_data(md);
+  }
+  scheduler_answer(entry);
+}
+
+
+/** Called when requests have waited on a module for too long. */
+static void
+scheduler_wake_timeout(
+    evutil_socket_t fd,
+    short flags,
+    void *user_data)
+{
+  scheduler_answer((struct scheduler_entry *) user_data);
+}
+
+
+/**
+  Returns true if the module of 'entry' should sit out this cycle because
+  nothing has read it for a while.
+
+  An idle module runs every 2nd cycle, then every 4th and so on up to
+  every SCHEDULER_LAZY_MAX_STRIDE cycles, after which it pauses until it is
+  read again.
+ */
+static bool
+scheduler_lazy(
+    struct scheduler_entry *entry,
+    uint64_t now)
+{
+  uint64_t idle = (uint64_t) config_lazy_idle_seconds * 1000000;
+  if (idle == 0 || now - entry->accessed < idle) {
+    return false;
+  }
+  if (entry->paused) {
+    return true;
+  }
+  if (entry->countdown > 0) {
+    entry->countdown--;
+    return true;
+  }
+  if (entry->stride >= SCHEDULER_LAZY_MAX_STRIDE) {
+    entry->paused = true;
+    entry->stats.paused = true;
+    return true;
+  }
+  entry->stride = entry->stride ? entry->stride * 2 : 2;
+  entry->countdown = entry->stride - 1;
+  entry->stats.stride = entry->stride;
+  return false;
+}
+
+
+/** Marks the running callback of 'entry' as past its deadline. */
+static void
+scheduler_overdue(
+    struct scheduler_entry *entry)
+{
+  if (!entry->running || entry->overdue) {
+    return;
+  }
+  entry->overdue = true;
+  entry->misses++;
+  entry->stats.timeouts++;
+  entry->stats.stale = true;
+  const char *path = entry->mod->registered_path;
+  log_warning(
+      "Module %s(%p): Timer callback is past its deadline, marking it stale.",
+      path != NULL ? path : "", entry->mod);
+}
+
+
+/** Called when a timer callback reaches a deadline set by the module. */
+static void
+scheduler_deadline(
+    evutil_socket_t fd,
+    short flags,
+    void *user_data)
+{
+  scheduler_overdue((struct scheduler_entry *) user_data);
+}
+
+
+/**
+  Returns the deadline set for the timer callback of 'mod', or NULL if
+  it is the default of one cycle.
+ */
+static const struct timeval *
+scheduler_deadline_time(
+    const module *mod)
+{
+  const struct timeval *deadline = &(mod->timer_deadline);
+  if ((deadline->tv_sec == 0 && deadline->tv_usec == 0) ||
+      (deadline->tv_sec == mod->timer_delay.tv_sec &&
+       deadline->tv_usec == mod->timer_delay.tv_usec)) {
+    return NULL;
+  }
+  return deadline;
+}
+
+
+/**
+  Queues the timer callback of the module of 'entry', unless the last one
+  is still running or the module is backing off, or is idle and 'now' is
+  not 0.
+ */
+static void
+scheduler_start(
+    struct scheduler_entry *entry,
+    uint64_t now)
+{
+  module *mod = entry->mod;
+  const struct timeval *deadline = scheduler_deadline_time(mod);
+  if (mod->initial_pending) {
+    entry->stats.skips++;
+    return;
+  }
+  if (refresh_in_flight(mod)) {
+    // A refresh is collecting the module already, and publishing after it
+    // could replace its data with older data.
+    entry->stats.skips++;
+    return;
+  }
+  if (entry->running) {
+    // The default deadline is exactly now, so there is no need for an
+    // event per run to catch it.
+    if (deadline == NULL) {
+      scheduler_overdue(entry);
+    }
+    // Never queue behind a callback that is still going, so a module
+    // that is stuck holds up one worker at most.
+    entry->stats.skips++;
+    return;
+  }
+  if (entry->backoff > 0) {
+    entry->backoff--;
+    entry->stats.backoff = entry->backoff;
+    entry->stats.skips++;
+    return;
+  }
+  if (now != 0 && scheduler_lazy(entry, now)) {
+    return;
+  }
+
+  if (deadline != NULL) {
+    if (entry->deadline == NULL) {
+      entry->deadline = event_new(
+          scheduler_base, -1, 0, scheduler_deadline, entry);
+    }
+    if (entry->deadline != NULL) {
+      event_add(entry->deadline, deadline);
+    }
+  }
+  entry->running = true;
+  entry->stats.runs++;
+
+  // Without worker threads this runs the callback, and scheduler_collected,
+  // before returning.
+  if (workers_submit(
+          mod, mod->timer, mod->timer_data, scheduler_collected, entry)) {
+    log_error("Unable to queue the timer of a module, out of memory.");
+    entry->running = false;
+    entry->stats.runs--;
+    if (entry->deadline != NULL) {
+      event_del(entry->deadline);
+    }
+  }
+}
+
+
+/** Publishes what the initial callback of 'mod' returned. */
+static void
+scheduler_initial_done(
+    module *mod,
+    module_data *md,
+    void *done_data)
+{
+  mod->initial_pending = false;
+  if (md != NULL && module_publish(mod, md) == 0) {
+    log_error("Unable to publish the data of a module, dropping it.");
+    free_module_data(md);
+  }
+}
+
+
+/** Queues the initial callback of the module in 'user_data'. */
+static void
+scheduler_initial_run(
     evutil_socket_t fd,
     short flags,
-    void * _param)
+    void *user_data)
 {
-  // TODO(brady)
+  module *mod = (module *) user_data;
+  if (mod->initial == NULL) {
+    mod->initial_pending = false;
+    return;
+  }
+  if (workers_submit(
+          mod, mod->initial, mod->initial_data, scheduler_initial_done,
+          NULL)) {
+    log_error("Unable to queue the initial callback of a module, "
+              "out of memory.");
+    mod->initial_pending = false;
+  }
 }
 
 
-void scheduler_init(
+/** Runs the initial callback of 'mod' once the loop next comes round. */
+static int
+scheduler_initial_queue(
+    module *mod)
+{
+  struct timeval now = {0, 0};
+  if (event_base_once(
+          scheduler_base, -1, EV_TIMEOUT, scheduler_initial_run, mod,
+          &now) != 0) {
+    return ENOMEM;
+  }
+  return 0;
+}
+
+
+/** Returns the timeout that fires 'batch' every cycle. */
+static const struct timeval *
+scheduler_cycle_timeout(
+    struct scheduler_batch *batch)
+{
+  // libevent only has room for so many common timeouts, past that the
+  // timer just goes in the heap.
+  const struct timeval *timeout = event_base_init_common_timeout(
+      scheduler_base, &(batch->cycle->cycle_time));
+  if (timeout == NULL) {
+    timeout = &(batch->cycle->cycle_time);
+  }
+  return timeout;
+}
+
+
+/** Collects every module in 'batch', called when its timer fires. */
+static void
+scheduler_run(
+    evutil_socket_t fd,
+    short flags,
+    void *user_data)
+{
+  struct scheduler_batch *batch = (struct scheduler_batch *) user_data;
+
+  if (!batch->aligned) {
+    // The first run was the one lining the batch up with its phase, from
+    // now on it runs once a cycle.
+    if (event_add(batch->event, scheduler_cycle_timeout(batch)) != 0) {
+      log_error("Unable to reschedule a batch of module timers.");
+    }
+    batch->aligned = true;
+  }
+
+  uint64_t now = waiter_now();
+  for (size_t i = 0; i < batch->count; i++) {
+    scheduler_start(batch->entries[i], now);
+  }
+}
+
+
+/**
+  Adds the timer of 'batch' to the event base if there is one and the
+  batch has any modules.
+
+  The timer first fires at the next time that is 'phase' into a cycle,
+  counting cycles from the epoch, so that every irk with the same phase
+  for a module runs it at the same time whenever they were started.
+
+  Returns:
+    0 on success or ENOMEM.
+ */
+static int
+scheduler_arm(
+    struct scheduler_batch *batch)
+{
+  if (scheduler_base == NULL || batch->count == 0 || batch->armed) {
+    return 0;
+  }
+  if (batch->event == NULL) {
+    batch->event = event_new(
+        scheduler_base, -1, EV_PERSIST, scheduler_run, batch);
+    if (batch->event == NULL) {
+      return ENOMEM;
+    }
+  }
+
+  struct timeval now;
+  gettimeofday(&now, NULL);
+  uint64_t now_us = (uint64_t) now.tv_sec * 1000000 + now.tv_usec;
+  uint64_t cycle_us = batch->cycle->cycle_us;
+  uint64_t next_us = now_us - now_us % cycle_us + batch->phase;
+  if (next_us <= now_us) {
+    next_us += cycle_us;
+  }
+  struct timeval delay = {
+    .tv_sec = (next_us - now_us) / 1000000,
+    .tv_usec = (next_us - now_us) % 1000000,
+  };
+
+  if (event_add(batch->event, &delay) != 0) {
+    return ENOMEM;
+  }
+  batch->armed = true;
+  batch->aligned = false;
+  return 0;
+}
+
+
+/**
+  Returns the hash that picks the phase of 'mod'.
+
+  It is made from the name of this machine and the path of the module,
+  which keeps the phase the same across restarts while different modules
+  on one machine, and the same module on different machines, are spread
+  over the cycle. A module that has not set its path yet is hashed by
+  the file it was loaded from instead.
+ */
+static uint64_t
+scheduler_phase_hash(
+    const module *mod)
+{
+  if (!scheduler_host_hashed) {
+    char host[HOST_NAME_MAX + 1];
+    if (gethostname(host, sizeof(host)) != 0) {
+      host[0] = '\0';
+    }
+    host[HOST_NAME_MAX] = '\0';
+    scheduler_host_hash = strhash_hash(host, strlen(host));
+    scheduler_host_hashed = true;
+  }
+
+  const char *name = "";
+  if (mod->registered_path != NULL) {
+    name = mod->registered_path;
+  } else if (mod->module_file != NULL) {
+    name = mod->module_file->filename;
+  }
+  return scheduler_host_hash ^ strhash_hash(name, strlen(name));
+}
+
+
+/** Returns the batch for 'mod', creating it if there is none. */
+static struct scheduler_batch *
+scheduler_batch_find(
+    const module *mod)
+{
+  const struct timeval *cycle_time = &(mod->timer_delay);
+  struct scheduler_cycle *cycle = scheduler_cycles;
+  for (; cycle != NULL; cycle = cycle->next) {
+    if (cycle->cycle_time.tv_sec == cycle_time->tv_sec &&
+        cycle->cycle_time.tv_usec == cycle_time->tv_usec) {
+      break;
+    }
+  }
+  if (cycle == NULL) {
+    cycle = (struct scheduler_cycle *) irk_calloc(
+        1, sizeof(struct scheduler_cycle));
+    if (cycle == NULL) {
+      return NULL;
+    }
+    cycle->cycle_time = *cycle_time;
+    cycle->cycle_us =
+        (uint64_t) cycle_time->tv_sec * 1000000 + cycle_time->tv_usec;
+    cycle->next = scheduler_cycles;
+    scheduler_cycles = cycle;
+  }
+
+  // The phase is rounded down to one of SCHEDULER_PHASES points in the
+  // cycle, so however many modules there are each cycle time has at most
+  // that many timers.
+  uint64_t index = scheduler_phase_hash(mod) % SCHEDULER_PHASES;
+  struct scheduler_batch *batch = cycle->phases[index];
+  if (batch == NULL) {
+    batch = (struct scheduler_batch *) irk_calloc(
+        1, sizeof(struct scheduler_batch));
+    if (batch == NULL) {
+      return NULL;
+    }
+    batch->cycle = cycle;
+    batch->phase = cycle->cycle_us * index / SCHEDULER_PHASES;
+    cycle->phases[index] = batch;
+  }
+  return batch;
+}
+
+
+/** Takes 'entry' out of its batch, if it is in one. */
+static void
+scheduler_batch_remove(
+    struct scheduler_entry *entry)
+{
+  struct scheduler_batch *batch = entry->batch;
+  if (batch == NULL) {
+    return;
+  }
+
+  struct scheduler_entry *last = batch->entries[--batch->count];
+  batch->entries[entry->index] = last;
+  last->index = entry->index;
+  entry->batch = NULL;
+
+  // An empty batch is kept for the next module with its cycle time and
+  // phase, but its timer does not need to keep firing.
+  if (batch->count == 0 && batch->armed) {
+    event_del(batch->event);
+    batch->armed = false;
+  }
+}
+
+
+int
+scheduler_init(
     struct event_base *eb)
 {
-  struct event * e;
-  struct timeval tv;
+  scheduler_base = eb;
+  int err = 0;
+  struct scheduler_cycle *cycle = scheduler_cycles;
+  for (; cycle != NULL && err == 0; cycle = cycle->next) {
+    for (int i = 0; i < SCHEDULER_PHASES && err == 0; i++) {
+      if (cycle->phases[i] != NULL) {
+        err = scheduler_arm(cycle->phases[i]);
+      }
+    }
+  }
+  if (err != 0) {
+    log_error("Unable to start the module timers.");
+  }
+
+  while (scheduler_initials != NULL) {
+    struct scheduler_initial *initial = scheduler_initials;
+    scheduler_initials = initial->next;
+    if (scheduler_initial_queue(initial->mod) != 0) {
+      log_error("Unable to queue the initial callback of a module.");
+      initial->mod->initial_pending = false;
+      err = ENOMEM;
+    }
+    irk_free(initial);
+  }
+  return err;
+}
+
+
+int
+scheduler_initial(
+    module *mod)
+{
+  if (mod->initial_pending) {
+    return 0;
+  }
+  if (scheduler_base != NULL) {
+    int err = scheduler_initial_queue(mod);
+    if (err != 0) {
+      return err;
+    }
+  } else {
+    struct scheduler_initial *initial = (struct scheduler_initial *)
+        irk_malloc(sizeof(struct scheduler_initial));
+    if (initial == NULL) {
+      return ENOMEM;
+    }
+    initial->mod = mod;
+    initial->next = scheduler_initials;
+    scheduler_initials = initial;
+  }
+  mod->initial_pending = true;
+  return 0;
+}
+
 
-  void* user_data = NULL;
-  e = event_new(eb, -1, EV_PERSIST, scheduler_callback, user_data);
-  if (e == NULL) {
-    // TODO(brady): Log the error?
+int
+scheduler_add(
+    module *mod)
+{
+  const struct timeval *cycle_time = &(mod->timer_delay);
+  if (mod->timer == NULL || cycle_time->tv_sec < 0 ||
+      cycle_time->tv_usec < 0 || cycle_time->tv_usec >= 1000000 ||
+      (cycle_time->tv_sec == 0 && cycle_time->tv_usec == 0)) {
+    return EINVAL;
+  }
+
+  // Moving between batches keeps the counts and any callback running.
+  struct scheduler_entry *entry = mod->scheduler_entry;
+  if (entry != NULL) {
+    scheduler_batch_remove(entry);
+  } else {
+    entry = (struct scheduler_entry *) irk_calloc(
+        1, sizeof(struct scheduler_entry));
+    if (entry == NULL) {
+      return ENOMEM;
+    }
+    entry->mod = mod;
+    entry->accessed = waiter_now();
+    mod->scheduler_entry = entry;
+  }
+
+  struct scheduler_batch *batch = scheduler_batch_find(mod);
+  if (batch == NULL) {
+    scheduler_remove(mod);
+    return ENOMEM;
+  }
+  if (batch->count == batch->capacity) {
+    size_t capacity = batch->capacity ? batch->capacity * 2 : 16;
+    struct scheduler_entry **entries = (struct scheduler_entry **)
+        irk_realloc(batch->entries, capacity * sizeof(*entries));
+    if (entries == NULL) {
+      scheduler_remove(mod);
+      return ENOMEM;
+    }
+    batch->entries = entries;
+    batch->capacity = capacity;
+  }
+
+  entry->batch = batch;
+  entry->index = batch->count;
+  batch->entries[batch->count++] = entry;
+  entry->stats.phase_us = batch->phase;
+
+  int err = scheduler_arm(batch);
+  if (err != 0) {
+    scheduler_remove(mod);
+  }
+  return err;
+}
+
+
+void
+scheduler_remove(
+    module *mod)
+{
+  struct scheduler_entry *entry = mod->scheduler_entry;
+  if (entry == NULL) {
+    return;
   }
+  scheduler_batch_remove(entry);
+  mod->scheduler_entry = NULL;
 
-  if (event_add(e, &tv)) {
-    // TODO(brady): Log the error?
+  if (entry->running) {
+    entry->removed = true;
+  } else {
+    scheduler_entry_free(entry);
+  }
+}
+
+
+bool
+scheduler_touch(
+    module *mod)
+{
+  struct scheduler_entry *entry = mod->scheduler_entry;
+  if (entry == NULL) {
+    return false;
+  }
+  entry->accessed = waiter_now();
+  if (entry->stride == 0) {
+    // Anyone reading it while it is being woken up waits for that too.
+    return entry->waiters != NULL;
+  }
+  entry->stride = 0;
+  entry->countdown = 0;
+  entry->paused = false;
+  entry->stats.stride = 0;
+  entry->stats.paused = false;
+  return true;
+}
+
+
+bool
+scheduler_busy(
+    const module *mod)
+{
+  const struct scheduler_entry *entry = mod->scheduler_entry;
+  return entry != NULL &&
+      (entry->running || entry->overdue || entry->backoff > 0);
+}
+
+
+bool
+scheduler_wake(
+    module *mod,
+    waiter_done_func done,
+    void *done_data)
+{
+  // A module that is struggling gets no extra runs, and a request is
+  // better off without waiting on one that is stuck.
+  struct scheduler_entry *entry = mod->scheduler_entry;
+  if (entry == NULL || entry->backoff > 0 || entry->overdue) {
+    return false;
+  }
+  struct waiter *waiter = waiter_new(done, done_data);
+  if (waiter == NULL) {
+    return false;
+  }
+
+  // Without worker threads the callback has run, and been published, by
+  // the time this returns.
+  if (!entry->running) {
+    scheduler_start(entry, 0);
+  }
+  if (!entry->running) {
+    waiter_free(waiter);
+    return false;
+  }
+
+  if (entry->waiters == NULL) {
+    if (entry->wake_timeout == NULL) {
+      entry->wake_timeout = event_new(
+          scheduler_base, -1, 0, scheduler_wake_timeout, entry);
+    }
+    struct timeval wait = {
+      .tv_sec = SCHEDULER_WAKE_WAIT_MS / 1000,
+      .tv_usec = SCHEDULER_WAKE_WAIT_MS % 1000 * 1000,
+    };
+    if (entry->wake_timeout == NULL ||
+        event_add(entry->wake_timeout, &wait) != 0) {
+      waiter_free(waiter);
+      return false;
+    }
+  }
+  waiter_push(&(entry->waiters), waiter);
+  return true;
+}
+
+
+bool
+scheduler_get_stats(
+    const module *mod,
+    struct scheduler_stats *stats)
+{
+  struct scheduler_entry *entry = mod->scheduler_entry;
+  if (entry == NULL) {
+    return false;
   }
+  *stats = entry->stats;
+  stats->idle_us = waiter_now() - entry->accessed;
+  return true;
 }
@@ -0,0 +1,256 @@
+/*
+Copyright (C) 2012 Brady Catherman
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef __COLLECTOR_SCHEDULER_H
+#define __COLLECTOR_SCHEDULER_H
+
+#include <event.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <collector/waiter.h>
+#include <master/module.h>
+
+/**
+  Runs the timer callbacks of modules.
+
+  Modules are grouped into batches by their timer_delay and phase (see
+  below), and each batch is driven by a single persistent libevent timer.
+  When it fires every module in the batch is queued in one pass, so
+  thousands of modules that share a handful of cycle times cost at most a
+  few hundred timers rather than one each, and the timer work per tick
+  does not grow with the number of modules.
+
+  Across a fleet, irks started together, or modules that pick round
+  cycle times, would otherwise all collect at the same moment and hit
+  whatever shared servers the modules talk to at once. So every module
+  gets a phase, a point in its cycle picked by hashing the machine's name
+  and the module's path. It runs whenever that much time has passed since
+  a whole number of cycles since the epoch. The phase never changes for a
+  given machine and module, so neither does the cadence, but the load of
+  a fleet is spread evenly over the cycle. Phases are rounded to one of
+  SCHEDULER_PHASES points so that each cycle time needs at most that many
+  timers.
+
+  Batch timers are added as libevent common timeouts, which keep every
+  timer of the same duration in a queue rather than in the main heap, so
+  adding and firing them is O(1). Persistent timeouts are rescheduled from
+  when they were due rather than from when they ran, so a batch keeps its
+  cadence even if collecting it takes a while.
+
+  A module's initial callback, if it has one, is run on the workers once
+  the loop comes round after it was registered, so after the module's
+  init function has returned. Its timer callback does not run until what
+  the initial callback returned has been published.
+
+  A callback that is still running when its module's next cycle comes
+  round is not queued again, that cycle is skipped, and so is a cycle
+  that comes round while a refresh of the module is in flight, see
+  collector/refresh.h. If it is still running
+  at the module's deadline (its timer_deadline, or timer_delay if that is
+  not set) the module is marked stale, and once it does return the module
+  sits out the next cycle, then 2, 4 and so on up to SCHEDULER_MAX_BACKOFF
+  cycles for each deadline it misses in a row. Nothing can stop a stuck
+  callback, but this way it ties up one worker rather than all of them.
+
+  Requests record when they read each module with scheduler_touch(). If
+  config_lazy_idle_seconds is set, a module that nobody has read for that
+  long is collected less and less often, every 2nd cycle, then every 4th
+  and so on up to every SCHEDULER_LAZY_MAX_STRIDE cycles, and after that
+  not at all. The first request to read it again has it collected with
+  scheduler_wake() and waits up to SCHEDULER_WAKE_WAIT_MS for the result,
+  so a module that is only looked at now and then costs next to nothing
+  in between.
+
+  The callbacks themselves run on the worker threads, see
+  collector/workers.h, and what they return is published back on the
+  event loop.
+
+  Everything here must be called from the thread running the event loop,
+  or before the loop is started.
+ */
+
+
+/** The points in each cycle that modules can be spread over. */
+#define SCHEDULER_PHASES 64
+
+
+/** The most cycles in a row a module is skipped after missing deadlines. */
+#define SCHEDULER_MAX_BACKOFF 64
+
+
+/** The most cycles between runs of an idle module before it pauses. */
+#define SCHEDULER_LAZY_MAX_STRIDE 64
+
+
+/** The longest a request waits for an idle module to be collected. */
+#define SCHEDULER_WAKE_WAIT_MS 1000
+
+
+/** What the scheduler has done with a module. */
+struct scheduler_stats {
+  /**
+    How long after each whole number of cycles since the epoch the module
+    runs, in microseconds.
+   */
+  uint64_t phase_us;
+
+  /** Callbacks started. */
+  uint64_t runs;
+
+  /** Callbacks that went past their deadline. */
+  uint64_t timeouts;
+
+  /** Cycles skipped, while a callback was running or while backing off. */
+  uint64_t skips;
+
+  /** Cycles still to skip. */
+  uint32_t backoff;
+
+  /** Set from a missed deadline until a callback returns in time. */
+  bool stale;
+
+  /** Microseconds since a request last read the module. */
+  uint64_t idle_us;
+
+  /** Cycles between runs while the module is idle, 0 while it is not. */
+  uint32_t stride;
+
+  /** Set while an idle module is not being collected at all. */
+  bool paused;
+};
+
+
+/**
+  Starts running scheduled modules on 'eb'.
+
+  Modules may be added before this is called, their timers start here.
+
+  Arguments:
+    eb: The event base of the main loop.
+
+  Returns:
+    0 on success or ENOMEM.
+ */
+int
+scheduler_init(
+    struct event_base *eb);
+
+
+/**
+  Runs the initial callback of 'mod' once, see above.
+
+  Registering it again before it has run changes what is run but does not
+  run it twice.
+
+  Arguments:
+    mod: The module.
+
+  Returns:
+    0 on success or ENOMEM.
+ */
+int
+scheduler_initial(
+    module *mod);
+
+
+/**
+  Schedules the timer callback of 'mod' every mod->timer_delay.
+
+  A module that is already scheduled is moved to the batch for its current
+  timer_delay.
+
+  Arguments:
+    mod: The module, which must have a timer callback.
+
+  Returns:
+    0 on success.
+    EINVAL if mod has no timer callback or its timer_delay is not positive.
+    ENOMEM on allocation failure.
+ */
+int
+scheduler_add(
+    module *mod);
+
+
+/** Stops running the timer callback of 'mod', if it is scheduled. */
+void
+scheduler_remove(
+    module *mod);
+
+
+/**
+  Records that a request is reading 'mod', which stops it being idle.
+
+  Returns:
+    true if it was idle, or is being woken up, in which case its snapshot
+    may be many cycles old and the request should scheduler_wake() it.
+ */
+bool
+scheduler_touch(
+    module *mod);
+
+
+/**
+  Returns true if the timer callback of 'mod' is running, or the module is
+  backing off or stuck past its deadline. No other callback of the module
+  should be started then, see collector/refresh.h.
+ */
+bool
+scheduler_busy(
+    const module *mod);
+
+
+/**
+  Collects 'mod' now, or waits on the callback already running.
+
+  Arguments:
+    mod: The module to collect.
+    done: Called once the data is published or SCHEDULER_WAKE_WAIT_MS has
+          passed, but only if this returns true.
+    done_data: Passed to done.
+
+  Returns:
+    true if 'done' will be called, or false if the current snapshot should
+    be used as is, which is the case if the module is not scheduled, is
+    backing off or stuck past its deadline, is being refreshed, or memory
+    ran out.
+ */
+bool
+scheduler_wake(
+    module *mod,
+    waiter_done_func done,
+    void *done_data);
+
+
+/**
+  Copies the counts kept for 'mod' to 'stats'.
+
+  Returns:
+    true if the module is scheduled, otherwise false and stats is not set.
+ */
+bool
+scheduler_get_stats(
+    const module *mod,
+    struct scheduler_stats *stats);
+
+#endif
@@ -0,0 +1,250 @@
+/*
+Copyright (C) 2012 Brady Catherman
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include <errno.h>
+#include <event.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <collector/accounting.h>
+#include <collector/scheduler.h>
+#include <collector/self.h>
+#include <common/logging.h>
+#include <common/memory.h>
+#include <master/module.h>
+#include <master/module_data.h>
+
+
+static module self_module = {
+  .registered_path = SELF_PATH,
+  .in_default_view = true,
+};
+
+
+/**
+  Returns the key "modules<path>/<name>" for 'mod', which the caller
+  frees, or NULL if memory ran out.
+ */
+static char *
+self_key(
+    const module *mod,
+    const char *name)
+{
+  size_t len = strlen("modules") + strlen(mod->registered_path) + 1 +
+      strlen(name) + 1;
+  char *key = (char *) irk_malloc(len);
+  if (key != NULL) {
+    snprintf(key, len, "modules%s/%s", mod->registered_path, name);
+  }
+  return key;
+}
+
+
+/**
+  Adds the value 'name' for 'mod', see self_key().
+
+  Returns:
+    0 on success or ENOMEM.
+ */
+static int
+self_add_int(
+    module_data *md,
+    const module *mod,
+    const char *name,
+    int64_t value)
+{
+  char *key = self_key(mod, name);
+  if (key == NULL) {
+    return ENOMEM;
+  }
+  int err = add_int_value(md, key, value);
+  irk_free(key);
+  return err;
+}
+
+
+/** Same as self_add_int() for a histogram. */
+static int
+self_add_histogram(
+    module_data *md,
+    const module *mod,
+    const char *name,
+    const irk_histogram *h)
+{
+  char *key = self_key(mod, name);
+  if (key == NULL) {
+    return ENOMEM;
+  }
+  int err = add_histogram_value(md, key, h);
+  irk_free(key);
+  return err;
+}
+
+
+/** Adds what the scheduler has done with 'mod'. */
+static int
+self_add_schedule(
+    module_data *md,
+    const module *mod,
+    const struct scheduler_stats *stats)
+{
+  int err = self_add_int(
+      md, mod, "cycle_us",
+      (int64_t) mod->timer_delay.tv_sec * 1000000 + mod->timer_delay.tv_usec);
+  if (err == 0) {
+    err = self_add_int(md, mod, "phase_us", (int64_t) stats->phase_us);
+  }
+  if (err == 0) {
+    err = self_add_int(md, mod, "runs", (int64_t) stats->runs);
+  }
+  if (err == 0) {
+    err = self_add_int(md, mod, "timeouts", (int64_t) stats->timeouts);
+  }
+  if (err == 0) {
+    err = self_add_int(md, mod, "skips", (int64_t) stats->skips);
+  }
+  if (err == 0) {
+    err = self_add_int(md, mod, "backoff", stats->backoff);
+  }
+  if (err == 0) {
+    err = self_add_int(md, mod, "stale", stats->stale);
+  }
+  if (err == 0) {
+    err = self_add_int(
+        md, mod, "idle_s", (int64_t) (stats->idle_us / 1000000));
+  }
+  if (err == 0) {
+    err = self_add_int(md, mod, "stride", stats->stride);
+  }
+  if (err == 0) {
+    err = self_add_int(md, mod, "paused", stats->paused);
+  }
+  return err;
+}
+
+
+/** Adds what the callbacks of 'mod' have cost, if any have run. */
+static int
+self_add_cost(
+    module_data *md,
+    const module *mod)
+{
+  struct accounting_totals totals;
+  const struct accounting *a = accounting_get(mod, &totals);
+  if (a == NULL) {
+    return 0;
+  }
+  int err = self_add_int(md, mod, "calls", (int64_t) totals.calls);
+  if (err == 0) {
+    err = self_add_int(md, mod, "wall_us", (int64_t) totals.wall_us);
+  }
+  if (err == 0) {
+    err = self_add_int(md, mod, "user_us", (int64_t) totals.user_us);
+  }
+  if (err == 0) {
+    err = self_add_int(md, mod, "system_us", (int64_t) totals.system_us);
+  }
+  if (err == 0) {
+    err = self_add_int(
+        md, mod, "allocations", (int64_t) totals.allocations);
+  }
+  if (err == 0) {
+    err = self_add_int(md, mod, "allocated_bytes", (int64_t) totals.bytes);
+  }
+  if (err == 0) {
+    err = self_add_histogram(md, mod, "wall_seconds", a->wall);
+  }
+  if (err == 0) {
+    err = self_add_histogram(md, mod, "cpu_seconds", a->cpu);
+  }
+  return err;
+}
+
+
+/** Adds the metrics of one module, called for each by module_index_walk(). */
+static int
+self_add_module(
+    module *mod,
+    void *user_data)
+{
+  module_data *md = (module_data *) user_data;
+  if (mod == &self_module) {
+    return 0;
+  }
+  int err = 0;
+  struct scheduler_stats stats;
+  if (scheduler_get_stats(mod, &stats)) {
+    err = self_add_schedule(md, mod, &stats);
+  }
+  if (err == 0) {
+    err = self_add_cost(md, mod);
+  }
+  return err;
+}
+
+
+/** Collects and publishes irk's own metrics. */
+static void
+self_collect(
+    evutil_socket_t fd,
+    short flags,
+    void *user_data)
+{
+  module_data *md = new_module_data(0);
+  if (md == NULL) {
+    log_error("Unable to collect irk's own metrics, out of memory.");
+    return;
+  }
+  if (module_index_walk("/", self_add_module, md) != 0) {
+    log_error("Unable to collect irk's own metrics, out of memory.");
+    free_module_data(md);
+    return;
+  }
+  if (module_publish(&self_module, md) == 0) {
+    log_error("Unable to publish irk's own metrics.");
+    free_module_data(md);
+  }
+}
+
+
+int
+self_init(
+    struct event_base *eb)
+{
+  int err = module_index_add(&self_module, SELF_PATH);
+  if (err != 0) {
+    log_error("Unable to claim %s for irk's own metrics.", SELF_PATH);
+    return err;
+  }
+
+  struct event *e = event_new(eb, -1, EV_PERSIST, self_collect, NULL);
+  struct timeval cycle_time = {SELF_CYCLE_SECONDS, 0};
+  if (e == NULL || event_add(e, &cycle_time) != 0) {
+    module_index_remove(&self_module);
+    return ENOMEM;
+  }
+
+  // Publish straight away rather than leaving the path empty for a cycle.
+  self_collect(-1, 0, NULL);
+  return 0;
+}
@@ -0,0 +1,80 @@
+/*
+Copyright (C) 2012 Brady Catherman
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef __COLLECTOR_SELF_H
+#define __COLLECTOR_SELF_H
+
+#include <event.h>
+
+/**
+  Metrics about irk itself.
+
+  These are published by a module built into irk at SELF_PATH, so they
+  can be read like any other module's. For each module, under "modules/"
+  followed by the module's path, if it is scheduled:
+
+    cycle_us: The module's timer_delay.
+    phase_us: When in each cycle it runs, see collector/scheduler.h.
+    runs: Timer callbacks started.
+    timeouts: Callbacks that went past the module's deadline.
+    skips: Cycles skipped because a callback was still running or the
+           module was backing off after missing its deadline.
+    backoff: Cycles the module will still be skipped for.
+    stale: 1 from a missed deadline until a callback returns in time.
+    idle_s: Seconds since a request last read the module.
+    stride: Cycles between runs while the module is idle, 0 while it is
+            not.
+    paused: 1 while the module is too idle to be collected at all.
+
+  And unless config_accounting has been cleared, once any of its
+  callbacks have run, what they cost, see collector/accounting.h:
+
+    calls: Callbacks run, by the timer, refreshes or anything else.
+    wall_us: Time spent in them.
+    user_us, system_us: CPU time used by them.
+    allocations, allocated_bytes: What they allocated through irk, if
+        config_accounting_allocations is set.
+    wall_seconds, cpu_seconds: Histograms of the time of each call.
+
+  The module is collected on the event loop thread, since that is where
+  the state it reports lives, every SELF_CYCLE_SECONDS.
+ */
+
+
+/** The path of irk's own module. */
+#define SELF_PATH "/irk"
+
+/** How often irk's own module is collected. */
+#define SELF_CYCLE_SECONDS 10
+
+
+/**
+  Claims SELF_PATH and starts collecting irk's own metrics on 'eb'.
+
+  Returns:
+    0 on success, EEXIST if a module already claimed the path, or ENOMEM.
+ */
+int
+self_init(
+    struct event_base *eb);
+
+#endif
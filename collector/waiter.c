@@ -0,0 +1,86 @@
+/*
+Copyright (C) 2012 Brady Catherman
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include <stdint.h>
+#include <time.h>
+
+#include <collector/waiter.h>
+#include <common/memory.h>
+
+
+struct waiter *
+waiter_new(
+    waiter_done_func done,
+    void *done_data)
+{
+  struct waiter *w = (struct waiter *) irk_malloc(sizeof(struct waiter));
+  if (w == NULL) {
+    return NULL;
+  }
+  w->done = done;
+  w->done_data = done_data;
+  w->next = NULL;
+  return w;
+}
+
+
+void
+waiter_free(
+    struct waiter *w)
+{
+  irk_free(w);
+}
+
+
+void
+waiter_push(
+    struct waiter **list,
+    struct waiter *w)
+{
+  w->next = *list;
+  *list = w;
+}
+
+
+void
+waiter_answer_all(
+    struct waiter **list)
+{
+  // Taken off first since a done function may well start another wait.
+  struct waiter *w = *list;
+  *list = NULL;
+  while (w != NULL) {
+    struct waiter *next = w->next;
+    w->done(w->done_data);
+    irk_free(w);
+    w = next;
+  }
+}
+
+
+uint64_t
+waiter_now(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
@@ -0,0 +1,103 @@
+/*
+Copyright (C) 2012 Brady Catherman
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef __COLLECTOR_WAITER_H
+#define __COLLECTOR_WAITER_H
+
+#include <stdint.h>
+
+/**
+  Requests waiting for a module to be collected.
+
+  A request that asks for a refresh, see collector/refresh.h, or reads a
+  module that has been idle, see collector/scheduler.h, waits for a
+  callback of the module to be published before it is answered. Whatever
+  runs the callback keeps a list of the requests waiting on it and
+  answers them all at once when it is published or the wait runs out.
+
+  Everything here must be called from the thread running the event loop.
+ */
+
+
+/**
+  Called on the event loop once the callback a request waited on has been
+  published, or the wait ran out.
+
+  Arguments:
+    done_data: Passed through from refresh_request() or scheduler_wake().
+ */
+typedef void (*waiter_done_func)(
+    void *done_data);
+
+
+/** A request waiting on a callback, in a list linked through 'next'. */
+struct waiter {
+  waiter_done_func done;
+  void *done_data;
+  struct waiter *next;
+};
+
+
+/**
+  Allocates a waiter, which is either added to a list with waiter_push()
+  or freed with waiter_free().
+
+  Returns:
+    The waiter or NULL if memory ran out.
+ */
+struct waiter *
+waiter_new(
+    waiter_done_func done,
+    void *done_data);
+
+
+/** Frees a waiter that was never pushed. */
+void
+waiter_free(
+    struct waiter *w);
+
+
+/** Adds 'w' to the front of 'list'. */
+void
+waiter_push(
+    struct waiter **list,
+    struct waiter *w);
+
+
+/**
+  Calls the done function of every waiter in 'list', newest first, and
+  frees them. The list is emptied first, so a done function may start
+  another wait on it.
+ */
+void
+waiter_answer_all(
+    struct waiter **list);
+
+
+/**
+  Returns the time on a clock that never goes backwards, in microseconds,
+  which is what waits and everything else in the collector are timed on.
+ */
+uint64_t
+waiter_now(void);
+
+#endif
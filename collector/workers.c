@@ -0,0 +1,416 @@
+/*
+Copyright (C) 2012 Brady Catherman
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include <errno.h>
+#include <event.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <unistd.h>
+
+#include <collector/accounting.h>
+#include <collector/workers.h>
+#include <common/logging.h>
+#include <common/memory.h>
+#include <master/module.h>
+#include <master/module_data.h>
+
+
+/** A callback waiting to run or waiting to be handed back. */
+struct worker_job {
+  module *mod;
+  module_data *(*callback)(void *user_data);
+  void *user_data;
+  worker_done_func done;
+  void *done_data;
+
+  /** What callback returned. */
+  module_data *result;
+
+  /** The next job in the finished list. */
+  struct worker_job *next;
+};
+
+
+/** One worker thread and its deque. */
+struct worker {
+  pthread_t thread;
+
+  /** Protects the deque, which is only held for a push or pop. */
+  pthread_mutex_t lock;
+
+  /** A ring of 'capacity' jobs, 'count' of them starting at 'head'. */
+  struct worker_job **jobs;
+  size_t head;
+  size_t count;
+  size_t capacity;
+};
+
+
+// The pool, set up by workers_init().
+static struct worker *workers = NULL;
+static size_t workers_count = 0;
+
+// Which worker gets the next job, only used by the loop thread.
+static size_t workers_next = 0;
+
+// Jobs in any deque, changed atomically without holding any lock. Idle
+// workers check it and sleep on workers_wake under workers_idle_lock, and
+// workers_submit() signals while holding that lock after raising it, so a
+// worker can not miss a job between its check and its wait.
+static size_t workers_queued = 0;
+static pthread_mutex_t workers_idle_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t workers_wake = PTHREAD_COND_INITIALIZER;
+static bool workers_stopping = false;
+
+// Finished jobs, newest first. Workers push with a compare and swap and
+// the loop takes the whole list at once, so this needs no lock.
+static struct worker_job *workers_finished = NULL;
+
+// Written to by a worker that finds workers_finished empty, to wake the
+// loop. Both ends are non blocking.
+static int workers_pipe[2] = {-1, -1};
+static struct event *workers_pipe_event = NULL;
+
+
+/** Adds 'job' at the tail of the deque of 'w'. */
+static int
+workers_push(
+    struct worker *w,
+    struct worker_job *job)
+{
+  int err = 0;
+  pthread_mutex_lock(&(w->lock));
+  if (w->count == w->capacity) {
+    size_t capacity = w->capacity ? w->capacity * 2 : 16;
+    struct worker_job **jobs = (struct worker_job **) irk_malloc(
+        capacity * sizeof(struct worker_job *));
+    if (jobs == NULL) {
+      err = ENOMEM;
+    } else {
+      for (size_t i = 0; i < w->count; i++) {
+        jobs[i] = w->jobs[(w->head + i) % w->capacity];
+      }
+      irk_free(w->jobs);
+      w->jobs = jobs;
+      w->head = 0;
+      w->capacity = capacity;
+    }
+  }
+  if (err == 0) {
+    w->jobs[(w->head + w->count) % w->capacity] = job;
+    w->count++;
+  }
+  pthread_mutex_unlock(&(w->lock));
+  return err;
+}
+
+
+/**
+  Takes a job from the deque of 'w', the oldest if 'steal' is false and
+  the newest otherwise. Returns NULL if it is empty.
+ */
+static struct worker_job *
+workers_pop(
+    struct worker *w,
+    bool steal)
+{
+  struct worker_job *job = NULL;
+  pthread_mutex_lock(&(w->lock));
+  if (w->count > 0) {
+    w->count--;
+    if (steal) {
+      job = w->jobs[(w->head + w->count) % w->capacity];
+    } else {
+      job = w->jobs[w->head];
+      w->head = (w->head + 1) % w->capacity;
+    }
+  }
+  pthread_mutex_unlock(&(w->lock));
+  return job;
+}
+
+
+/** Takes the next job for 'w' to run, its own or a stolen one. */
+static struct worker_job *
+workers_take(
+    struct worker *w)
+{
+  struct worker_job *job = workers_pop(w, false);
+  size_t self = w - workers;
+  for (size_t i = 1; job == NULL && i < workers_count; i++) {
+    job = workers_pop(&workers[(self + i) % workers_count], true);
+  }
+  if (job != NULL) {
+    __atomic_fetch_sub(&workers_queued, 1, __ATOMIC_RELAXED);
+  }
+  return job;
+}
+
+
+/** Pushes 'job' onto the finished list, waking the loop if needed. */
+static void
+workers_finish(
+    struct worker_job *job)
+{
+  struct worker_job *head =
+      __atomic_load_n(&workers_finished, __ATOMIC_RELAXED);
+  do {
+    job->next = head;
+  } while (!__atomic_compare_exchange_n(
+      &workers_finished, &head, job, true,
+      __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+  // The loop only needs waking for the first job since it last looked,
+  // it takes every job on the list at once.
+  if (head == NULL) {
+    char byte = 0;
+    if (write(workers_pipe[1], &byte, 1) < 0 && errno != EAGAIN) {
+      log_error("Unable to wake the event loop: %d", errno);
+    }
+  }
+}
+
+
+static void *
+workers_main(
+    void *arg)
+{
+  struct worker *w = (struct worker *) arg;
+  while (true) {
+    struct worker_job *job = workers_take(w);
+    if (job != NULL) {
+      struct accounting_sample sample;
+      bool accounted = accounting_start(&sample);
+      job->result = job->callback(job->user_data);
+      if (accounted) {
+        accounting_stop(job->mod, &sample);
+      }
+      workers_finish(job);
+      continue;
+    }
+
+    pthread_mutex_lock(&workers_idle_lock);
+    while (__atomic_load_n(&workers_queued, __ATOMIC_RELAXED) == 0 &&
+           !workers_stopping) {
+      pthread_cond_wait(&workers_wake, &workers_idle_lock);
+    }
+    bool stop = workers_stopping &&
+        __atomic_load_n(&workers_queued, __ATOMIC_RELAXED) == 0;
+    pthread_mutex_unlock(&workers_idle_lock);
+    if (stop) {
+      return NULL;
+    }
+  }
+}
+
+
+/** Hands every finished job back to its done function. */
+static void
+workers_collect(
+    evutil_socket_t fd,
+    short flags,
+    void *user_data)
+{
+  // Drained before the list is taken, so a job finished after the list
+  // is taken always writes a fresh byte.
+  char buffer[64];
+  while (read(workers_pipe[0], buffer, sizeof(buffer)) > 0) {
+  }
+
+  struct worker_job *job =
+      __atomic_exchange_n(&workers_finished, NULL, __ATOMIC_ACQUIRE);
+
+  // The list is newest first, reverse it so results are published in the
+  // order they were produced.
+  struct worker_job *ordered = NULL;
+  while (job != NULL) {
+    struct worker_job *next = job->next;
+    job->next = ordered;
+    ordered = job;
+    job = next;
+  }
+
+  while (ordered != NULL) {
+    struct worker_job *next = ordered->next;
+    ordered->done(ordered->mod, ordered->result, ordered->done_data);
+    irk_free(ordered);
+    ordered = next;
+  }
+}
+
+
+/** Makes 'fd' non blocking and close on exec. */
+static int
+workers_pipe_setup(
+    int fd)
+{
+  int flags = fcntl(fd, F_GETFL);
+  if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0 ||
+      fcntl(fd, F_SETFD, FD_CLOEXEC) < 0) {
+    return errno;
+  }
+  return 0;
+}
+
+
+int
+workers_init(
+    struct event_base *eb,
+    size_t threads)
+{
+  if (threads == 0) {
+    return 0;
+  }
+
+  if (pipe(workers_pipe) != 0) {
+    return errno;
+  }
+  int err = workers_pipe_setup(workers_pipe[0]);
+  if (err == 0) {
+    err = workers_pipe_setup(workers_pipe[1]);
+  }
+  if (err != 0) {
+    return err;
+  }
+  workers_pipe_event = event_new(
+      eb, workers_pipe[0], EV_READ | EV_PERSIST, workers_collect, NULL);
+  if (workers_pipe_event == NULL ||
+      event_add(workers_pipe_event, NULL) != 0) {
+    return ENOMEM;
+  }
+
+  workers = (struct worker *) irk_calloc(threads, sizeof(struct worker));
+  if (workers == NULL) {
+    return ENOMEM;
+  }
+  for (size_t i = 0; i < threads; i++) {
+    pthread_mutex_init(&(workers[i].lock), NULL);
+  }
+  workers_stopping = false;
+  workers_count = threads;
+
+  for (size_t i = 0; i < threads; i++) {
+    err = pthread_create(
+        &(workers[i].thread), NULL, workers_main, &(workers[i]));
+    if (err != 0) {
+      log_error("Unable to start worker thread %zu: %d", i, err);
+      // Nothing has been submitted yet, so the workers that did start
+      // stop straight away.
+      pthread_mutex_lock(&workers_idle_lock);
+      workers_stopping = true;
+      pthread_cond_broadcast(&workers_wake);
+      pthread_mutex_unlock(&workers_idle_lock);
+      for (size_t j = 0; j < i; j++) {
+        pthread_join(workers[j].thread, NULL);
+      }
+      for (size_t j = 0; j < threads; j++) {
+        pthread_mutex_destroy(&(workers[j].lock));
+      }
+      irk_free(workers);
+      workers = NULL;
+      workers_count = 0;
+      return err;
+    }
+  }
+  return 0;
+}
+
+
+int
+workers_submit(
+    module *mod,
+    module_data *(*callback)(void *user_data),
+    void *user_data,
+    worker_done_func done,
+    void *done_data)
+{
+  if (workers_count == 0) {
+    struct accounting_sample sample;
+    bool accounted = accounting_start(&sample);
+    module_data *md = callback(user_data);
+    if (accounted) {
+      accounting_stop(mod, &sample);
+    }
+    done(mod, md, done_data);
+    return 0;
+  }
+
+  struct worker_job *job =
+      (struct worker_job *) irk_malloc(sizeof(struct worker_job));
+  if (job == NULL) {
+    return ENOMEM;
+  }
+  job->mod = mod;
+  job->callback = callback;
+  job->user_data = user_data;
+  job->done = done;
+  job->done_data = done_data;
+  job->result = NULL;
+
+  // Counted before it is pushed, a worker could otherwise take the job
+  // and decrement the count before it is incremented, wrapping it round.
+  // An idle worker that sees the count before the push just tries again.
+  __atomic_fetch_add(&workers_queued, 1, __ATOMIC_RELAXED);
+  struct worker *w = &workers[workers_next];
+  workers_next = (workers_next + 1) % workers_count;
+  if (workers_push(w, job) != 0) {
+    __atomic_fetch_sub(&workers_queued, 1, __ATOMIC_RELAXED);
+    irk_free(job);
+    return ENOMEM;
+  }
+
+  pthread_mutex_lock(&workers_idle_lock);
+  pthread_cond_signal(&workers_wake);
+  pthread_mutex_unlock(&workers_idle_lock);
+  return 0;
+}
+
+
+void
+workers_shutdown(void)
+{
+  if (workers_count == 0) {
+    return;
+  }
+  pthread_mutex_lock(&workers_idle_lock);
+  workers_stopping = true;
+  pthread_cond_broadcast(&workers_wake);
+  pthread_mutex_unlock(&workers_idle_lock);
+  for (size_t i = 0; i < workers_count; i++) {
+    pthread_join(workers[i].thread, NULL);
+  }
+
+  workers_collect(workers_pipe[0], EV_READ, NULL);
+  event_free(workers_pipe_event);
+  close(workers_pipe[0]);
+  close(workers_pipe[1]);
+  for (size_t i = 0; i < workers_count; i++) {
+    pthread_mutex_destroy(&(workers[i].lock));
+    irk_free(workers[i].jobs);
+  }
+  irk_free(workers);
+  workers = NULL;
+  workers_count = 0;
+  workers_next = 0;
+}
@@ -0,0 +1,117 @@
+/*
+Copyright (C) 2012 Brady Catherman
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef __COLLECTOR_WORKERS_H
+#define __COLLECTOR_WORKERS_H
+
+#include <event.h>
+#include <stddef.h>
+
+#include <master/module.h>
+
+/**
+  Runs module callbacks on a pool of worker threads.
+
+  Module callbacks are arbitrary code that may block for a long time, so
+  they are kept off the event loop that serves requests. Each worker has a
+  deque of jobs. The loop hands jobs out to the workers in turn, a worker
+  runs the oldest job in its own deque and, when that is empty, steals the
+  newest job from another worker's, so one slow callback only holds up
+  the jobs that could not be stolen away from behind it.
+
+  When a callback returns, its job is pushed onto a lock free list of
+  finished jobs and the loop is woken through a pipe, but only if the list
+  was empty, so a burst of results costs a single wakeup. The loop then
+  calls each job's done function, so everything that follows a callback,
+  publishing its data for one, happens on the loop thread.
+
+  With no worker threads callbacks are run directly by workers_submit().
+  Either way, if config_accounting is set, the cost of each callback is
+  added to its module's totals, see collector/accounting.h.
+
+  workers_init() and workers_submit() must be called from the thread
+  running the event loop, or before it is started.
+ */
+
+
+/**
+  Called on the event loop thread when a job has run.
+
+  Arguments:
+    mod: The module the job was for.
+    md: What the callback returned, which is now owned by this function.
+    done_data: Passed through from workers_submit().
+ */
+typedef void (*worker_done_func)(
+    module *mod,
+    module_data *md,
+    void *done_data);
+
+
+/**
+  Starts the worker threads.
+
+  Arguments:
+    eb: The event base of the main loop, where finished jobs are handled.
+    threads: The number of workers, 0 to run callbacks on the loop.
+
+  Returns:
+    0 on success, ENOMEM, or an error from pthread_create() or pipe().
+ */
+int
+workers_init(
+    struct event_base *eb,
+    size_t threads);
+
+
+/**
+  Runs 'callback' on a worker and then 'done' on the event loop.
+
+  Arguments:
+    mod: The module the callback belongs to.
+    callback: The module callback.
+    user_data: Passed to callback.
+    done: Called with the result.
+    done_data: Passed to done.
+
+  Returns:
+    0 on success or ENOMEM, in which case neither function is called.
+ */
+int
+workers_submit(
+    module *mod,
+    module_data *(*callback)(void *user_data),
+    void *user_data,
+    worker_done_func done,
+    void *done_data);
+
+
+/**
+  Stops the worker threads once every job submitted has run, then calls
+  the done function of every job that the loop has not handled yet.
+
+  This must be called from the thread running the event loop.
+ */
+void
+workers_shutdown(void);
+
+#endif
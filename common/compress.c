@@ -0,0 +1,468 @@
+/*
+Copyright (C) 2012 Brady Catherman
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <zlib.h>
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include <common/compress.h>
+#include <common/fragment.h>
+#include <common/memory.h>
+
+// Segments are compressed once and sent many times, so it is worth
+// spending a little more CPU than the fastest settings.
+#define COMPRESS_GZIP_LEVEL 6
+#define COMPRESS_ZSTD_LEVEL 3
+
+// The largest gzip stored block and zstd raw block.
+#define COMPRESS_GZIP_STORED_MAX 65535
+#define COMPRESS_ZSTD_RAW_MAX (128 * 1024)
+
+
+static const char *compress_names[COMPRESS_COUNT] = {
+  [COMPRESS_IDENTITY] = NULL,
+  [COMPRESS_GZIP] = "gzip",
+  [COMPRESS_ZSTD] = "zstd",
+};
+
+
+/** The codings understood by compress_negotiate(). */
+static const struct {
+  const char *name;
+  enum compress_encoding encoding;
+} compress_codings[] = {
+  {"identity", COMPRESS_IDENTITY},
+  {"gzip", COMPRESS_GZIP},
+  {"x-gzip", COMPRESS_GZIP},
+#ifdef HAVE_ZSTD
+  {"zstd", COMPRESS_ZSTD},
+#endif
+};
+
+
+/**
+  Compressors are expensive to set up, so each thread keeps one of each
+  for its whole life and resets it between uses.
+ */
+static __thread z_stream compress_deflate;
+static __thread bool compress_deflate_ready = false;
+#ifdef HAVE_ZSTD
+static __thread ZSTD_CCtx *compress_zstd = NULL;
+#endif
+
+
+const char *
+compress_encoding_name(
+    enum compress_encoding encoding)
+{
+  return compress_names[encoding];
+}
+
+
+enum compress_encoding
+compress_negotiate(
+    const char *accept_encoding)
+{
+  if (accept_encoding == NULL) {
+    return COMPRESS_IDENTITY;
+  }
+
+  // The q value given for each coding, or -1 if it was not mentioned.
+  double q[COMPRESS_COUNT];
+  double q_any = -1;
+  for (int i = 0; i < COMPRESS_COUNT; i++) {
+    q[i] = -1;
+  }
+
+  const char *p = accept_encoding;
+  while (*p != '\0') {
+    // Each entry looks like "coding;q=0.5".
+    while (*p == ' ' || *p == '\t' || *p == ',') {
+      p++;
+    }
+    const char *coding = p;
+    while (*p != '\0' && *p != ',' && *p != ';' && *p != ' ') {
+      p++;
+    }
+    size_t coding_len = p - coding;
+
+    double coding_q = 1;
+    while (*p != '\0' && *p != ',') {
+      if (*p == ';') {
+        p++;
+        while (*p == ' ') {
+          p++;
+        }
+        if ((p[0] == 'q' || p[0] == 'Q') && p[1] == '=') {
+          coding_q = strtod(p + 2, NULL);
+        }
+      } else {
+        p++;
+      }
+    }
+
+    if (coding_len == 1 && coding[0] == '*') {
+      q_any = coding_q;
+      continue;
+    }
+    size_t count = sizeof(compress_codings) / sizeof(compress_codings[0]);
+    for (size_t i = 0; i < count; i++) {
+      const char *name = compress_codings[i].name;
+      if (strlen(name) == coding_len &&
+          strncasecmp(name, coding, coding_len) == 0) {
+        q[compress_codings[i].encoding] = coding_q;
+      }
+    }
+  }
+
+  // Codings that were not mentioned get the q of "*" if there was one.
+  // Identity is used if nothing else is acceptable, even if it was refused,
+  // rather than failing the request.
+  for (int i = 0; i < COMPRESS_COUNT; i++) {
+    if (q[i] < 0) {
+      q[i] = q_any >= 0 ? q_any : 0;
+    }
+  }
+#ifndef HAVE_ZSTD
+  q[COMPRESS_ZSTD] = 0;
+#endif
+
+  enum compress_encoding best = COMPRESS_IDENTITY;
+  double best_q = q[COMPRESS_IDENTITY];
+  if (q[COMPRESS_GZIP] > 0 && q[COMPRESS_GZIP] >= best_q) {
+    best = COMPRESS_GZIP;
+    best_q = q[COMPRESS_GZIP];
+  }
+  if (q[COMPRESS_ZSTD] > 0 && q[COMPRESS_ZSTD] >= best_q) {
+    best = COMPRESS_ZSTD;
+  }
+  return best;
+}
+
+
+/** Lets zlib allocate through irk_malloc() so it is counted. */
+static voidpf
+compress_zalloc(
+    voidpf opaque,
+    uInt items,
+    uInt size)
+{
+  return irk_calloc(items, size);
+}
+
+
+static void
+compress_zfree(
+    voidpf opaque,
+    voidpf address)
+{
+  irk_free(address);
+}
+
+
+/** Appends 'data' to 'out' as raw deflate data ending in a sync flush. */
+static int
+compress_gzip(
+    const char *data,
+    size_t len,
+    fragment **out)
+{
+  z_stream *z = &compress_deflate;
+  if (!compress_deflate_ready) {
+    memset(z, 0, sizeof(*z));
+    z->zalloc = compress_zalloc;
+    z->zfree = compress_zfree;
+    // Negative window bits give raw deflate data without the zlib wrapper.
+    if (deflateInit2(
+            z,
+            COMPRESS_GZIP_LEVEL,
+            Z_DEFLATED,
+            -MAX_WBITS,
+            8,
+            Z_DEFAULT_STRATEGY) != Z_OK) {
+      return ENOMEM;
+    }
+    compress_deflate_ready = true;
+  } else if (deflateReset(z) != Z_OK) {
+    return ENOMEM;
+  }
+
+  z->next_in = (Bytef *) data;
+  z->avail_in = len;
+  // A sync flush adds a few bytes that deflateBound() does not count.
+  size_t room = deflateBound(z, len) + 16;
+  int ret;
+  do {
+    char *space = fragment_space(out, room);
+    if (space == NULL) {
+      return ENOMEM;
+    }
+    z->next_out = (Bytef *) space;
+    z->avail_out = room;
+    ret = deflate(z, Z_SYNC_FLUSH);
+    fragment_commit(*out, room - z->avail_out);
+  } while (ret == Z_OK && z->avail_out == 0);
+
+  return ret == Z_OK && z->avail_in == 0 ? 0 : ENOMEM;
+}
+
+
+#ifdef HAVE_ZSTD
+/** Appends 'data' to 'out' as a zstd frame. */
+static int
+compress_zstd_frame(
+    const char *data,
+    size_t len,
+    fragment **out)
+{
+  if (compress_zstd == NULL) {
+    compress_zstd = ZSTD_createCCtx();
+    if (compress_zstd == NULL) {
+      return ENOMEM;
+    }
+  }
+
+  size_t room = ZSTD_compressBound(len);
+  char *space = fragment_space(out, room);
+  if (space == NULL) {
+    return ENOMEM;
+  }
+  size_t written = ZSTD_compressCCtx(
+      compress_zstd, space, room, data, len, COMPRESS_ZSTD_LEVEL);
+  if (ZSTD_isError(written)) {
+    return ENOMEM;
+  }
+  fragment_commit(*out, written);
+  return 0;
+}
+#endif
+
+
+compress_segment *
+compress_segment_new(
+    enum compress_encoding encoding,
+    const char *data,
+    size_t len)
+{
+  // zlib counts in uInt.
+  if (len > UINT32_MAX) {
+    return NULL;
+  }
+  compress_segment *segment =
+      (compress_segment *) irk_malloc(sizeof(compress_segment));
+  if (segment == NULL) {
+    return NULL;
+  }
+  segment->length = len;
+  segment->crc = 0;
+  segment->data = fragment_new(len / 4);
+  if (segment->data == NULL) {
+    irk_free(segment);
+    return NULL;
+  }
+
+  int err = EINVAL;
+  switch (encoding) {
+    case COMPRESS_GZIP:
+      segment->crc = crc32(0, (const Bytef *) data, len);
+      err = compress_gzip(data, len, &(segment->data));
+      break;
+    case COMPRESS_ZSTD:
+#ifdef HAVE_ZSTD
+      err = compress_zstd_frame(data, len, &(segment->data));
+#endif
+      break;
+    default:
+      break;
+  }
+  if (err != 0) {
+    compress_segment_free(segment);
+    return NULL;
+  }
+  return segment;
+}
+
+
+void
+compress_segment_free(
+    compress_segment *segment)
+{
+  if (segment == NULL) {
+    return;
+  }
+  fragment_release(segment->data);
+  irk_free(segment);
+}
+
+
+int
+compress_stream_begin(
+    struct compress_stream *s,
+    enum compress_encoding encoding,
+    fragment **out)
+{
+  s->encoding = encoding;
+  s->crc = 0;
+  s->length = 0;
+  if (encoding == COMPRESS_GZIP) {
+    // No file name or modification time, OS unknown.
+    static const uint8_t header[] = {
+      0x1f, 0x8b, Z_DEFLATED, 0, 0, 0, 0, 0, 0, 0xff
+    };
+    return fragment_append(out, header, sizeof(header));
+  }
+  return 0;
+}
+
+
+void
+compress_stream_segment(
+    struct compress_stream *s,
+    const compress_segment *segment)
+{
+  if (s->encoding == COMPRESS_GZIP) {
+    s->crc = crc32_combine(s->crc, segment->crc, segment->length);
+  }
+  s->length += segment->length;
+}
+
+
+/** Appends 'data' to 'out' as deflate stored blocks. */
+static int
+compress_gzip_raw(
+    const char *data,
+    size_t len,
+    fragment **out)
+{
+  while (len > 0) {
+    size_t block = len;
+    if (block > COMPRESS_GZIP_STORED_MAX) {
+      block = COMPRESS_GZIP_STORED_MAX;
+    }
+    // Not the final block, stored, followed by LEN and its complement.
+    uint8_t header[5] = {
+      0x00,
+      block & 0xff,
+      block >> 8,
+      ~block & 0xff,
+      (~block >> 8) & 0xff,
+    };
+    if (fragment_append(out, header, sizeof(header)) != 0 ||
+        fragment_append(out, data, block) != 0) {
+      return ENOMEM;
+    }
+    data += block;
+    len -= block;
+  }
+  return 0;
+}
+
+
+/** Appends 'data' to 'out' as a zstd frame of raw blocks. */
+static int
+compress_zstd_raw(
+    const char *data,
+    size_t len,
+    fragment **out)
+{
+  // Magic number, a frame header without a content size or checksum and
+  // a window descriptor of 128KB, the largest block size.
+  static const uint8_t header[] = {0x28, 0xb5, 0x2f, 0xfd, 0x00, 0x38};
+  if (fragment_append(out, header, sizeof(header)) != 0) {
+    return ENOMEM;
+  }
+  do {
+    size_t block = len;
+    if (block > COMPRESS_ZSTD_RAW_MAX) {
+      block = COMPRESS_ZSTD_RAW_MAX;
+    }
+    // Last block flag, then the block type (0 is raw) and the size.
+    uint32_t block_header = (block << 3) | (block == len ? 1 : 0);
+    uint8_t bytes[3] = {
+      block_header & 0xff,
+      (block_header >> 8) & 0xff,
+      (block_header >> 16) & 0xff,
+    };
+    if (fragment_append(out, bytes, sizeof(bytes)) != 0 ||
+        fragment_append(out, data, block) != 0) {
+      return ENOMEM;
+    }
+    data += block;
+    len -= block;
+  } while (len > 0);
+  return 0;
+}
+
+
+int
+compress_stream_raw(
+    struct compress_stream *s,
+    const char *data,
+    size_t len,
+    fragment **out)
+{
+  if (len == 0) {
+    return 0;
+  }
+  int err = 0;
+  switch (s->encoding) {
+    case COMPRESS_GZIP:
+      s->crc = crc32(s->crc, (const Bytef *) data, len);
+      err = compress_gzip_raw(data, len, out);
+      break;
+    case COMPRESS_ZSTD:
+      err = compress_zstd_raw(data, len, out);
+      break;
+    default:
+      err = fragment_append(out, data, len);
+      break;
+  }
+  s->length += len;
+  return err;
+}
+
+
+int
+compress_stream_end(
+    struct compress_stream *s,
+    fragment **out)
+{
+  if (s->encoding != COMPRESS_GZIP) {
+    return 0;
+  }
+  // An empty final block with fixed codes, then the CRC and length of
+  // everything before compression.
+  uint8_t trailer[10] = {0x03, 0x00};
+  for (int i = 0; i < 4; i++) {
+    trailer[2 + i] = (uint8_t) (s->crc >> (8 * i));
+    trailer[6 + i] = (uint8_t) (s->length >> (8 * i));
+  }
+  return fragment_append(out, trailer, sizeof(trailer));
+}
@@ -0,0 +1,202 @@
+/*
+Copyright (C) 2012 Brady Catherman
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef __COMMON_COMPRESS_H
+#define __COMMON_COMPRESS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <common/fragment.h>
+
+/**
+  Compressed responses built from pieces compressed ahead of time.
+
+  Both gzip and zstd allow a stream to be put together from independently
+  compressed parts. Each part of a gzip stream is raw deflate data ending
+  on a byte boundary without the final block bit set, which is what
+  deflate produces with Z_SYNC_FLUSH, and the header and trailer are added
+  around them with the CRC of each part combined with crc32_combine(). A
+  zstd stream may be any number of frames one after another.
+
+  So the parts of a response that are the same for every client, like the
+  encoding of a whole module, are compressed once and kept as
+  compress_segments, and each response only adds a few bytes of framing
+  around them. Parts that are particular to one request are added without
+  compression (gzip stored blocks or zstd raw blocks) rather than spending
+  CPU on them per request.
+
+  zstd support is only built if HAVE_ZSTD is defined.
+ */
+
+
+/** Content codings, also used to index the per snapshot caches. */
+enum compress_encoding {
+  COMPRESS_IDENTITY,
+  COMPRESS_GZIP,
+  COMPRESS_ZSTD,
+  COMPRESS_COUNT
+};
+
+
+/** A compressed part of a response, see compress_segment_new(). */
+typedef struct compress_segment compress_segment;
+struct compress_segment {
+  /** The compressed bytes. */
+  fragment *data;
+
+  /** The length of the data before compression. */
+  size_t length;
+
+  /** The CRC-32 of the data before compression, only used by gzip. */
+  uint32_t crc;
+};
+
+
+/** The state of a response being built from segments. */
+struct compress_stream {
+  enum compress_encoding encoding;
+
+  /** The CRC-32 of everything written so far. */
+  uint32_t crc;
+
+  /** The length of everything written so far, before compression. */
+  uint64_t length;
+};
+
+
+/**
+  Returns the Content-Encoding for 'encoding'.
+
+  Returns:
+    The name, or NULL for COMPRESS_IDENTITY.
+ */
+const char *
+compress_encoding_name(
+    enum compress_encoding encoding);
+
+
+/**
+  Picks the content coding for an Accept-Encoding header.
+
+  The coding with the highest q value wins. Ties go to zstd, then gzip,
+  then identity.
+
+  Arguments:
+    accept_encoding: The value of the header, or NULL if there was none.
+
+  Returns:
+    The coding to use, COMPRESS_IDENTITY if there was no header or nothing
+    better is accepted.
+ */
+enum compress_encoding
+compress_negotiate(
+    const char *accept_encoding);
+
+
+/**
+  Compresses 'data' so it can be added to a compress_stream.
+
+  Arguments:
+    encoding: COMPRESS_GZIP or COMPRESS_ZSTD.
+    data: The bytes to compress.
+    len: The length of data.
+
+  Returns:
+    The segment, which is freed with compress_segment_free(), or NULL on
+    failure.
+ */
+compress_segment *
+compress_segment_new(
+    enum compress_encoding encoding,
+    const char *data,
+    size_t len);
+
+
+/** Frees 'segment', which may be NULL. */
+void
+compress_segment_free(
+    compress_segment *segment);
+
+
+/**
+  Starts a compressed stream.
+
+  Arguments:
+    s: The stream to initialize.
+    encoding: COMPRESS_GZIP or COMPRESS_ZSTD.
+    out: Receives any header the format needs.
+
+  Returns:
+    0 on success or ENOMEM.
+ */
+int
+compress_stream_begin(
+    struct compress_stream *s,
+    enum compress_encoding encoding,
+    fragment **out);
+
+
+/**
+  Adds the bytes of 'segment' to the stream.
+
+  The caller is expected to send segment->data right after whatever it
+  has sent for the stream so far.
+ */
+void
+compress_stream_segment(
+    struct compress_stream *s,
+    const compress_segment *segment);
+
+
+/**
+  Appends 'data' to 'out' framed so it can be sent as part of the stream,
+  without compressing it.
+
+  Returns:
+    0 on success or ENOMEM.
+ */
+int
+compress_stream_raw(
+    struct compress_stream *s,
+    const char *data,
+    size_t len,
+    fragment **out);
+
+
+/**
+  Ends the stream.
+
+  Arguments:
+    s: The stream.
+    out: Receives any trailer the format needs.
+
+  Returns:
+    0 on success or ENOMEM.
+ */
+int
+compress_stream_end(
+    struct compress_stream *s,
+    fragment **out);
+
+
+#endif
@@ -21,5 +21,24 @@ DEALINGS IN THE SOFTWARE.
 */
 
 #include <stdbool.h>
+#include <stddef.h>
 
 #include <common/config.h>
+
+// Counters take about 5 bytes a sample, so this keeps 10 to 15 minutes of
+// about 16000 values collected every 5 seconds.
+size_t config_history_bytes = 16 * 1024 * 1024;
+
+// Collection is mostly waiting on the kernel, so a couple of threads keep
+// a slow module from holding up the rest without irk getting heavy.
+size_t config_worker_threads = 2;
+
+// Off unless asked for, since a paused module has no history to show for
+// the time it was paused.
+size_t config_lazy_idle_seconds = 0;
+
+// Timing a callback costs about a microsecond, which is nothing next to
+// callbacks that run every few seconds. Counting allocations is left off
+// unless asked for since it reads every allocation counter twice a call.
+bool config_accounting = true;
+bool config_accounting_allocations = false;
@@ -24,6 +24,50 @@ DEALINGS IN THE SOFTWARE.
 #define __COMMON_CONFIG_H
 
 #include <stdbool.h>
+#include <stddef.h>
+
+/**
+  Settings shared by the whole process.
+
+  Each is a global with a default that main() may change before anything
+  is started, after which they are only read.
+ */
+
+
+/**
+  Bytes of history kept for all numeric values together, see
+  master/history.h. Zero turns history off.
+ */
+extern size_t config_history_bytes;
+
+
+/**
+  Threads that run module callbacks, see collector/workers.h. Zero runs
+  them on the event loop thread instead.
+ */
+extern size_t config_worker_threads;
+
+
+/**
+  Seconds a module can go without being read before its timer is slowed
+  down and then paused, see collector/scheduler.h. Zero collects every
+  module on every cycle whether it is read or not.
+ */
+extern size_t config_lazy_idle_seconds;
+
+
+/**
+  Measures the wall and CPU time of every module callback, see
+  collector/accounting.h. On by default, clearing it turns accounting off.
+ */
+extern bool config_accounting;
+
+
+/**
+  Also counts what each module callback allocates through irk's
+  allocators. Only used if config_accounting is set. Off by default.
+ */
+extern bool config_accounting_allocations;
 
 
 #endif
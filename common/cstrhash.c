@@ -0,0 +1,391 @@
+/*
+Copyright (C) 2012 Brady Catherman
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CSTRHASH_IS_NOT_VOID
+
+#include <common/cstrhash.h>
+#include <common/epoch.h>
+#include <common/logging.h>
+#include <common/memory.h>
+#include <common/strhash.h>
+
+
+/**
+  A single key in the table.
+
+  Everything but 'value' and 'next' is immutable once the node has been
+  published. Both of those are only ever changed with atomic stores so a
+  reader walking the chain always sees either the old or the new pointer.
+ */
+struct cstrhash_node {
+  uint64_t hash;
+  void *value;
+  struct cstrhash_node *next;
+  size_t key_len;
+  char key[];
+};
+
+
+/**
+  A bucket array.
+
+  When the table grows a complete new array (with new nodes) is built and
+  published in one store, and the old array is retired as a whole. Readers
+  that started on the old array finish their lookup there.
+ */
+struct cstrhash_table {
+  // Number of buckets minus one, the bucket count is a power of two.
+  size_t mask;
+  struct cstrhash_node *buckets[];
+};
+
+
+struct cstrhash {
+  // The currently published table.
+  struct cstrhash_table *table;
+
+  // The epoch domain that replaced memory is retired through.
+  epoch *e;
+
+  // Used to free replaced and removed values, may be NULL.
+  void (*free_func)(void *ptr);
+
+  // Serializes writers. Readers never take this.
+  pthread_mutex_t lock;
+
+  // Keeps track of the number of items in the table, protected by 'lock'.
+  size_t items;
+};
+
+
+static struct cstrhash_table *
+cstrhash_table_new(
+    size_t buckets)
+{
+  size_t size = sizeof(struct cstrhash_table) +
+                buckets * sizeof(struct cstrhash_node *);
+  struct cstrhash_table *t = (struct cstrhash_table *) irk_calloc(1, size);
+  if (t == NULL) {
+    log_debug("calloc(1, %zu) error: %s", size, strerror(errno));
+    return NULL;
+  }
+
+  t->mask = buckets - 1;
+  return t;
+}
+
+
+// Frees a retired table and all of its nodes, but not the values since
+// those are shared with the table that replaced it.
+static void
+cstrhash_table_free(
+    void *ptr)
+{
+  struct cstrhash_table *t = (struct cstrhash_table *) ptr;
+  for (size_t i = 0; i <= t->mask; i++) {
+    struct cstrhash_node *n = t->buckets[i];
+    while (n != NULL) {
+      struct cstrhash_node *n_next = n->next;
+      irk_free(n);
+      n = n_next;
+    }
+  }
+  irk_free(t);
+}
+
+
+static struct cstrhash_node *
+cstrhash_node_new(
+    const char *key,
+    size_t key_len,
+    uint64_t hash,
+    void *value)
+{
+  size_t size = sizeof(struct cstrhash_node) + key_len + 1;
+  struct cstrhash_node *n = (struct cstrhash_node *) irk_malloc(size);
+  if (n == NULL) {
+    log_debug("malloc(%zu) error: %s", size, strerror(errno));
+    return NULL;
+  }
+
+  n->hash = hash;
+  n->value = value;
+  n->next = NULL;
+  n->key_len = key_len;
+  memcpy(n->key, key, key_len);
+  n->key[key_len] = '\0';
+  return n;
+}
+
+
+cstrhash *
+cstrhash_init(
+    int table_size,
+    epoch *e,
+    void (*free_func)(void *ptr))
+{
+  cstrhash *s = (cstrhash *) irk_malloc(sizeof(cstrhash));
+  if (s == NULL) {
+    log_debug("malloc(%zu) error: %s", sizeof(cstrhash), strerror(errno));
+    return NULL;
+  }
+
+  size_t buckets = 16;
+  while (table_size > 0 && buckets < (size_t) table_size) {
+    buckets *= 2;
+  }
+
+  s->table = cstrhash_table_new(buckets);
+  if (s->table == NULL) {
+    irk_free(s);
+    return NULL;
+  }
+
+  int err = pthread_mutex_init(&(s->lock), NULL);
+  if (err != 0) {
+    log_debug("pthread_mutex_init() error: %s", strerror(err));
+    irk_free(s->table);
+    irk_free(s);
+    errno = err;
+    return NULL;
+  }
+
+  s->e = e;
+  s->free_func = free_func;
+  s->items = 0;
+  return s;
+}
+
+
+void *
+cstrhash_get(
+    cstrhash *s,
+    const char *key)
+{
+  size_t key_len = strlen(key);
+  return cstrhash_get_n(s, key, key_len, strhash_hash(key, key_len));
+}
+
+
+void *
+cstrhash_get_n(
+    cstrhash *s,
+    const char *key,
+    size_t key_len,
+    uint64_t hash)
+{
+  struct cstrhash_table *t = __atomic_load_n(&(s->table), __ATOMIC_ACQUIRE);
+  struct cstrhash_node *n =
+      __atomic_load_n(&(t->buckets[hash & t->mask]), __ATOMIC_ACQUIRE);
+
+  while (n != NULL) {
+    if (n->hash == hash &&
+        n->key_len == key_len &&
+        !memcmp(key, n->key, key_len)) {
+      return __atomic_load_n(&(n->value), __ATOMIC_ACQUIRE);
+    }
+    n = __atomic_load_n(&(n->next), __ATOMIC_ACQUIRE);
+  }
+
+  return NULL;
+}
+
+
+// Hands a value that readers may still see to the epoch domain.
+static void
+cstrhash_retire_value(
+    cstrhash *s,
+    void *value)
+{
+  if (s->free_func == NULL || value == NULL) {
+    return;
+  }
+
+  if (epoch_retire(s->e, value, s->free_func) != 0) {
+    // Leaking is the only safe option, a reader may still be using it.
+    log_error("cstrhash: unable to retire value %p, leaking it.", value);
+  }
+}
+
+
+/**
+  Doubles the number of buckets.
+
+  This copies every node into a new table and publishes it with a single
+  store. The lock must be held by the caller.
+
+  Returns:
+    0 on success, ENOMEM on failure in which case the old table remains.
+ */
+static int
+cstrhash_grow(
+    cstrhash *s)
+{
+  struct cstrhash_table *old = s->table;
+  struct cstrhash_table *t = cstrhash_table_new((old->mask + 1) * 2);
+  if (t == NULL) {
+    return ENOMEM;
+  }
+
+  for (size_t i = 0; i <= old->mask; i++) {
+    for (struct cstrhash_node *n = old->buckets[i]; n != NULL; n = n->next) {
+      struct cstrhash_node *copy =
+          cstrhash_node_new(n->key, n->key_len, n->hash, n->value);
+      if (copy == NULL) {
+        cstrhash_table_free(t);
+        return ENOMEM;
+      }
+      copy->next = t->buckets[n->hash & t->mask];
+      t->buckets[n->hash & t->mask] = copy;
+    }
+  }
+
+  __atomic_store_n(&(s->table), t, __ATOMIC_RELEASE);
+  if (epoch_retire(s->e, old, cstrhash_table_free) != 0) {
+    log_error("cstrhash: unable to retire old table, leaking it.");
+  }
+  return 0;
+}
+
+
+int
+cstrhash_put(
+    cstrhash *s,
+    const char *key,
+    void *value)
+{
+  size_t key_len = strlen(key);
+  return cstrhash_put_n(s, key, key_len, strhash_hash(key, key_len), value);
+}
+
+
+int
+cstrhash_put_n(
+    cstrhash *s,
+    const char *key,
+    size_t key_len,
+    uint64_t hash,
+    void *value)
+{
+  pthread_mutex_lock(&(s->lock));
+
+  struct cstrhash_table *t = s->table;
+  for (struct cstrhash_node *n = t->buckets[hash & t->mask];
+       n != NULL;
+       n = n->next) {
+    if (n->hash == hash &&
+        n->key_len == key_len &&
+        !memcmp(key, n->key, key_len)) {
+      void *old_value = n->value;
+      __atomic_store_n(&(n->value), value, __ATOMIC_RELEASE);
+      pthread_mutex_unlock(&(s->lock));
+      if (old_value != value) {
+        cstrhash_retire_value(s, old_value);
+      }
+      return 0;
+    }
+  }
+
+  // Growing is best effort, a table with long chains still works.
+  if (s->items > t->mask && cstrhash_grow(s) == 0) {
+    t = s->table;
+  }
+
+  struct cstrhash_node *n = cstrhash_node_new(key, key_len, hash, value);
+  if (n == NULL) {
+    pthread_mutex_unlock(&(s->lock));
+    return ENOMEM;
+  }
+
+  // The node must be fully written before it becomes reachable.
+  n->next = t->buckets[hash & t->mask];
+  __atomic_store_n(&(t->buckets[hash & t->mask]), n, __ATOMIC_RELEASE);
+  s->items++;
+
+  pthread_mutex_unlock(&(s->lock));
+  return 0;
+}
+
+
+bool
+cstrhash_remove(
+    cstrhash *s,
+    const char *key)
+{
+  size_t key_len = strlen(key);
+  uint64_t hash = strhash_hash(key, key_len);
+
+  pthread_mutex_lock(&(s->lock));
+
+  struct cstrhash_table *t = s->table;
+  struct cstrhash_node **p = &(t->buckets[hash & t->mask]);
+  while (*p != NULL) {
+    struct cstrhash_node *n = *p;
+    if (n->hash == hash &&
+        n->key_len == key_len &&
+        !memcmp(key, n->key, key_len)) {
+      // Readers currently on 'n' can still follow n->next, so the node is
+      // only unlinked here and freed once they are gone.
+      __atomic_store_n(p, n->next, __ATOMIC_RELEASE);
+      s->items--;
+      pthread_mutex_unlock(&(s->lock));
+
+      cstrhash_retire_value(s, n->value);
+      if (epoch_retire(s->e, n, irk_free) != 0) {
+        log_error("cstrhash: unable to retire node, leaking it.");
+      }
+      return true;
+    }
+    p = &(n->next);
+  }
+
+  pthread_mutex_unlock(&(s->lock));
+  return false;
+}
+
+
+void
+cstrhash_destroy(
+    cstrhash *s)
+{
+  struct cstrhash_table *t = s->table;
+  if (s->free_func != NULL) {
+    for (size_t i = 0; i <= t->mask; i++) {
+      for (struct cstrhash_node *n = t->buckets[i]; n != NULL; n = n->next) {
+        if (n->value != NULL) {
+          s->free_func(n->value);
+        }
+      }
+    }
+  }
+
+  cstrhash_table_free(t);
+  pthread_mutex_destroy(&(s->lock));
+  irk_free(s);
+}
@@ -0,0 +1,193 @@
+/*
+Copyright (C) 2012 Brady Catherman
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef __COMMON_CSTRHASH_H
+#define __COMMON_CSTRHASH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <common/epoch.h>
+
+// The cstrhash.c file uses an actual struct to store data, other classes
+// are only ever allowed to see void in order to prevent them from messing
+// with internals.
+#ifndef CSTRHASH_IS_NOT_VOID
+typedef void cstrhash;
+#else
+typedef struct cstrhash cstrhash;
+#endif
+
+
+/**
+  A concurrent, read mostly version of strhash.
+
+  This is intended for tables that are read far more often than they are
+  written, like the index of cached values that the HTTP server reads on
+  every request while the collectors update it once per cycle.
+
+  Lookups take no locks and never wait: they walk immutable chains of nodes
+  published with atomic stores. Writers are serialized with a mutex between
+  themselves but never block readers. Anything a writer replaces or removes
+  (nodes, old tables, old values) is handed to the epoch domain given to
+  cstrhash_init(), so readers must do every lookup, and every use of the
+  value it returns, between epoch_enter() and epoch_exit().
+
+  Keys are hashed with strhash_hash().
+ */
+
+
+/**
+  Creates a cstrhash structure using malloc.
+
+  Arguments:
+    table_size: The number of items the table should be able to hold before
+                it needs to grow.
+    e: The epoch domain used to reclaim memory. Readers of this table must
+       register with this domain.
+    free_func: Called (through the epoch domain) on values that are replaced
+               or removed, and on every value when the table is destroyed.
+               If this is NULL values are never freed by the table.
+
+  Returns:
+    An initialized cstrhash structure or NULL on error.
+ */
+cstrhash *
+cstrhash_init(
+    int table_size,
+    epoch *e,
+    void (*free_func)(void *ptr));
+
+
+/**
+  Returns the value associated with the given key.
+
+  This must be called inside an epoch_enter()/epoch_exit() section, and the
+  returned value is only guaranteed to remain valid until epoch_exit().
+
+  Arguments:
+    s: The cstrhash object created using cstrhash_init().
+    key: The '\0' terminated key to get the value for.
+
+  Returns:
+    The value associated with key or NULL if no key by that name exists.
+ */
+void *
+cstrhash_get(
+    cstrhash *s,
+    const char *key);
+
+
+/**
+  Same as cstrhash_get() but with an explicit key length and hash.
+
+  Arguments:
+    s: The cstrhash object created using cstrhash_init().
+    key: The key, this does not need to be '\0' terminated.
+    key_len: The number of bytes in key.
+    hash: The result of strhash_hash(key, key_len).
+
+  Returns:
+    The same as cstrhash_get().
+ */
+void *
+cstrhash_get_n(
+    cstrhash *s,
+    const char *key,
+    size_t key_len,
+    uint64_t hash);
+
+
+/**
+  Sets the value for a key, replacing any existing value.
+
+  Readers that are already inside a read section may continue to see the old
+  value, which is passed to free_func once they have all left.
+
+  Arguments:
+    s: The cstrhash object created using cstrhash_init().
+    key: The '\0' terminated key to set.
+    value: The new value.
+
+  Returns:
+    0 on success, ENOMEM on allocation failure.
+ */
+int
+cstrhash_put(
+    cstrhash *s,
+    const char *key,
+    void *value);
+
+
+/**
+  Same as cstrhash_put() but with an explicit key length and hash.
+
+  Arguments:
+    s: The cstrhash object created using cstrhash_init().
+    key: The key, this does not need to be '\0' terminated.
+    key_len: The number of bytes in key.
+    hash: The result of strhash_hash(key, key_len).
+    value: The new value.
+
+  Returns:
+    The same as cstrhash_put().
+ */
+int
+cstrhash_put_n(
+    cstrhash *s,
+    const char *key,
+    size_t key_len,
+    uint64_t hash,
+    void *value);
+
+
+/**
+  Removes a key from the table.
+
+  Arguments:
+    s: The cstrhash object created using cstrhash_init().
+    key: The '\0' terminated key to remove.
+
+  Returns:
+    true if the key was found and removed, false if it did not exist.
+ */
+bool
+cstrhash_remove(
+    cstrhash *s,
+    const char *key);
+
+
+/**
+  Frees the memory associated with the given cstrhash structure.
+
+  There must be no readers or writers using the table when this is called.
+
+  Arguments:
+    s: The cstrhash object created using cstrhash_init().
+ */
+void
+cstrhash_destroy(
+    cstrhash *s);
+
+
+#endif
@@ -0,0 +1,279 @@
+/*
+Copyright (C) 2012 Brady Catherman
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define EPOCH_IS_NOT_VOID
+
+#include <common/epoch.h>
+#include <common/logging.h>
+#include <common/memory.h>
+
+
+// Readers are padded out to a full cache line so that two threads entering
+// and exiting read sections never bounce the same line between cores.
+#define EPOCH_CACHE_LINE 64
+
+
+/**
+  A single reading thread.
+
+  'active' is the global epoch that was observed when the reader entered its
+  current read section, or 0 when the reader is not inside one.
+ */
+struct epoch_reader {
+  uint64_t active;
+
+  // The domain this reader is registered with.
+  epoch *e;
+
+  // Linked list of every reader in the domain.
+  epoch_reader *next;
+
+  char padding[EPOCH_CACHE_LINE - sizeof(uint64_t) - 2 * sizeof(void *)];
+};
+
+
+/** A piece of memory waiting for readers to move on. */
+struct epoch_retired {
+  void *ptr;
+  void (*free_func)(void *ptr);
+
+  // The global epoch at the time this was retired.
+  uint64_t retired_epoch;
+
+  struct epoch_retired *next;
+};
+
+
+struct epoch {
+  // The global epoch. This only ever increases, starting at 1 so that 0 can
+  // mean "not in a read section" for readers.
+  uint64_t current;
+
+  // Protects everything below. Only writers and reader registration ever
+  // take this lock.
+  pthread_mutex_t lock;
+
+  // All registered readers.
+  epoch_reader *readers;
+
+  // Memory waiting to be freed, newest first.
+  struct epoch_retired *retired;
+};
+
+
+epoch *
+epoch_init(void)
+{
+  epoch *e = (epoch *) irk_malloc(sizeof(epoch));
+  if (e == NULL) {
+    log_debug("malloc(%zu) error: %s", sizeof(epoch), strerror(errno));
+    return NULL;
+  }
+
+  int err = pthread_mutex_init(&(e->lock), NULL);
+  if (err != 0) {
+    log_debug("pthread_mutex_init() error: %s", strerror(err));
+    irk_free(e);
+    errno = err;
+    return NULL;
+  }
+
+  e->current = 1;
+  e->readers = NULL;
+  e->retired = NULL;
+  return e;
+}
+
+
+epoch_reader *
+epoch_reader_register(
+    epoch *e)
+{
+  epoch_reader *r = (epoch_reader *) irk_calloc(1, sizeof(epoch_reader));
+  if (r == NULL) {
+    log_debug(
+        "calloc(1, %zu) error: %s",
+        sizeof(epoch_reader),
+        strerror(errno));
+    return NULL;
+  }
+
+  r->e = e;
+  pthread_mutex_lock(&(e->lock));
+  r->next = e->readers;
+  e->readers = r;
+  pthread_mutex_unlock(&(e->lock));
+  return r;
+}
+
+
+void
+epoch_reader_unregister(
+    epoch_reader *r)
+{
+  epoch *e = r->e;
+  pthread_mutex_lock(&(e->lock));
+  for (epoch_reader **p = &(e->readers); *p != NULL; p = &((*p)->next)) {
+    if (*p == r) {
+      *p = r->next;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&(e->lock));
+  irk_free(r);
+}
+
+
+void
+epoch_enter(
+    epoch_reader *r)
+{
+  // Publishing the epoch must be ordered before any load of protected data,
+  // otherwise a writer could miss this reader and free something it is about
+  // to read. That is a store followed by loads, which needs a full fence.
+  __atomic_store_n(
+      &(r->active),
+      __atomic_load_n(&(r->e->current), __ATOMIC_ACQUIRE),
+      __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+
+void
+epoch_exit(
+    epoch_reader *r)
+{
+  __atomic_store_n(&(r->active), 0, __ATOMIC_RELEASE);
+}
+
+
+/**
+  Frees every retired item older than 'safe_epoch'.
+
+  The lock must be held by the caller.
+ */
+static void
+epoch_free_before(
+    epoch *e,
+    uint64_t safe_epoch)
+{
+  struct epoch_retired **p = &(e->retired);
+  while (*p != NULL) {
+    struct epoch_retired *r = *p;
+    if (r->retired_epoch < safe_epoch) {
+      *p = r->next;
+      r->free_func(r->ptr);
+      irk_free(r);
+    } else {
+      p = &(r->next);
+    }
+  }
+}
+
+
+static void
+epoch_reclaim_locked(
+    epoch *e)
+{
+  if (e->retired == NULL) {
+    return;
+  }
+
+  // Move the epoch forward. Anything retired before this point is now
+  // unreachable for readers that enter from here on.
+  uint64_t safe_epoch = __atomic_add_fetch(&(e->current), 1, __ATOMIC_SEQ_CST);
+
+  // A reader that entered at epoch N may hold anything retired at N or
+  // later, so only memory retired before the oldest active reader is safe.
+  for (epoch_reader *r = e->readers; r != NULL; r = r->next) {
+    uint64_t active = __atomic_load_n(&(r->active), __ATOMIC_ACQUIRE);
+    if (active != 0 && active < safe_epoch) {
+      safe_epoch = active;
+    }
+  }
+
+  epoch_free_before(e, safe_epoch);
+}
+
+
+int
+epoch_retire(
+    epoch *e,
+    void *ptr,
+    void (*free_func)(void *ptr))
+{
+  struct epoch_retired *r =
+      (struct epoch_retired *) irk_malloc(sizeof(struct epoch_retired));
+  if (r == NULL) {
+    log_debug(
+        "malloc(%zu) error: %s",
+        sizeof(struct epoch_retired),
+        strerror(errno));
+    return ENOMEM;
+  }
+
+  r->ptr = ptr;
+  r->free_func = (free_func == NULL) ? irk_free : free_func;
+
+  pthread_mutex_lock(&(e->lock));
+  r->retired_epoch = __atomic_load_n(&(e->current), __ATOMIC_SEQ_CST);
+  r->next = e->retired;
+  e->retired = r;
+  epoch_reclaim_locked(e);
+  pthread_mutex_unlock(&(e->lock));
+  return 0;
+}
+
+
+void
+epoch_reclaim(
+    epoch *e)
+{
+  pthread_mutex_lock(&(e->lock));
+  epoch_reclaim_locked(e);
+  pthread_mutex_unlock(&(e->lock));
+}
+
+
+void
+epoch_destroy(
+    epoch *e)
+{
+  epoch_free_before(e, UINT64_MAX);
+
+  epoch_reader *r = e->readers;
+  while (r != NULL) {
+    epoch_reader *r_next = r->next;
+    irk_free(r);
+    r = r_next;
+  }
+
+  pthread_mutex_destroy(&(e->lock));
+  irk_free(e);
+}
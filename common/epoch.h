@@ -0,0 +1,174 @@
+/*
+Copyright (C) 2012 Brady Catherman
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef __COMMON_EPOCH_H
+#define __COMMON_EPOCH_H
+
+#include <stdint.h>
+
+// The epoch.c file uses actual structs to store data, other classes are
+// only ever allowed to see void in order to prevent them from messing with
+// internals.
+#ifndef EPOCH_IS_NOT_VOID
+typedef void epoch;
+typedef void epoch_reader;
+#else
+typedef struct epoch epoch;
+typedef struct epoch_reader epoch_reader;
+#endif
+
+
+/**
+  Epoch based memory reclamation.
+
+  This allows data structures to be read by many threads without any locks
+  while a writer replaces parts of them. Readers wrap every access in
+  epoch_enter()/epoch_exit(), which costs a single store each. Writers never
+  free memory that a reader might still see directly; instead they unlink it
+  and hand it to epoch_retire(), which frees it once every reader that could
+  possibly have seen it has left its read section.
+
+  Readers never wait on writers. Writers never wait on readers either, they
+  just leave memory on the retired list a little longer.
+ */
+
+
+/**
+  Creates a new epoch domain.
+
+  Returns:
+    An initialized epoch object or NULL on error. This must be freed with
+    epoch_destroy().
+ */
+epoch *
+epoch_init(void);
+
+
+/**
+  Registers a reader with the epoch domain.
+
+  Each thread that reads data protected by this domain needs its own reader
+  object. Registration takes a lock so this should be done once when the
+  thread starts, not for every read.
+
+  Arguments:
+    e: The epoch object created with epoch_init().
+
+  Returns:
+    A reader object or NULL on error.
+ */
+epoch_reader *
+epoch_reader_register(
+    epoch *e);
+
+
+/**
+  Unregisters a reader, freeing it.
+
+  The reader must not be inside a read section.
+
+  Arguments:
+    r: The reader returned by epoch_reader_register().
+ */
+void
+epoch_reader_unregister(
+    epoch_reader *r);
+
+
+/**
+  Starts a read section.
+
+  Any memory reachable from the protected data structure at any point after
+  this call will stay valid until epoch_exit() is called. Read sections must
+  not be nested.
+
+  Arguments:
+    r: The reader returned by epoch_reader_register().
+ */
+void
+epoch_enter(
+    epoch_reader *r);
+
+
+/**
+  Ends a read section started with epoch_enter().
+
+  Arguments:
+    r: The reader returned by epoch_reader_register().
+ */
+void
+epoch_exit(
+    epoch_reader *r);
+
+
+/**
+  Schedules memory to be freed once no reader can be using it.
+
+  The caller must already have made 'ptr' unreachable for new readers, for
+  example by swapping a pointer to a replacement. This also attempts to
+  reclaim anything retired previously.
+
+  Arguments:
+    e: The epoch object created with epoch_init().
+    ptr: The memory to free.
+    free_func: Called with 'ptr' once it is safe to free. If this is NULL then
+               irk_free() is used.
+
+  Returns:
+    0 on success, ENOMEM if the retired list could not be extended, in which
+    case the caller still owns 'ptr'.
+ */
+int
+epoch_retire(
+    epoch *e,
+    void *ptr,
+    void (*free_func)(void *ptr));
+
+
+/**
+  Frees any retired memory that is no longer visible to readers.
+
+  This is called automatically by epoch_retire() but may also be called
+  periodically by a writer to release memory sooner.
+
+  Arguments:
+    e: The epoch object created with epoch_init().
+ */
+void
+epoch_reclaim(
+    epoch *e);
+
+
+/**
+  Frees the epoch domain and everything still waiting to be reclaimed.
+
+  There must be no readers inside a read section when this is called.
+
+  Arguments:
+    e: The epoch object created with epoch_init().
+ */
+void
+epoch_destroy(
+    epoch *e);
+
+
+#endif
@@ -0,0 +1,205 @@
+/*
+Copyright (C) 2012 Brady Catherman
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define FRAGMENT_IS_NOT_VOID
+#include <common/fragment.h>
+#include <common/memory.h>
+
+// The smallest data area allocated, to avoid growing tiny fragments often.
+#define FRAGMENT_MIN_CAPACITY 64
+
+
+struct fragment {
+  /** Number of references held. */
+  uint32_t refs;
+
+  /** Bytes of data in use. */
+  size_t length;
+
+  /** Bytes allocated for data. */
+  size_t capacity;
+
+  char data[];
+};
+
+
+fragment *
+fragment_new(
+    size_t capacity)
+{
+  if (capacity < FRAGMENT_MIN_CAPACITY) {
+    capacity = FRAGMENT_MIN_CAPACITY;
+  }
+
+  fragment *f = (fragment *) irk_malloc(sizeof(fragment) + capacity);
+  if (f == NULL) {
+    return NULL;
+  }
+  f->refs = 1;
+  f->length = 0;
+  f->capacity = capacity;
+  return f;
+}
+
+
+/** Makes room for 'len' more bytes in '*f'. */
+static int
+fragment_reserve(
+    fragment **f,
+    size_t len)
+{
+  fragment *old = *f;
+  if (old->capacity - old->length >= len) {
+    return 0;
+  }
+
+  size_t capacity = old->capacity * 2;
+  while (capacity - old->length < len) {
+    capacity *= 2;
+  }
+  fragment *grown = (fragment *) irk_realloc(old, sizeof(fragment) + capacity);
+  if (grown == NULL) {
+    return ENOMEM;
+  }
+  grown->capacity = capacity;
+  *f = grown;
+  return 0;
+}
+
+
+int
+fragment_append(
+    fragment **f,
+    const void *data,
+    size_t len)
+{
+  if (fragment_reserve(f, len) != 0) {
+    return ENOMEM;
+  }
+  memcpy((*f)->data + (*f)->length, data, len);
+  (*f)->length += len;
+  return 0;
+}
+
+
+int
+fragment_appendf(
+    fragment **f,
+    const char *format,
+    ...)
+{
+  va_list args;
+  va_start(args, format);
+  size_t room = (*f)->capacity - (*f)->length;
+  int len = vsnprintf((*f)->data + (*f)->length, room, format, args);
+  va_end(args);
+  if (len < 0) {
+    return EINVAL;
+  }
+
+  // Most values fit in the space already there, otherwise grow and format
+  // again.
+  if ((size_t) len >= room) {
+    if (fragment_reserve(f, len + 1) != 0) {
+      return ENOMEM;
+    }
+    va_start(args, format);
+    vsnprintf((*f)->data + (*f)->length, len + 1, format, args);
+    va_end(args);
+  }
+  (*f)->length += len;
+  return 0;
+}
+
+
+char *
+fragment_space(
+    fragment **f,
+    size_t len)
+{
+  if (fragment_reserve(f, len) != 0) {
+    return NULL;
+  }
+  return (*f)->data + (*f)->length;
+}
+
+
+void
+fragment_commit(
+    fragment *f,
+    size_t len)
+{
+  f->length += len;
+}
+
+
+void
+fragment_truncate(
+    fragment *f,
+    size_t len)
+{
+  f->length = len;
+}
+
+
+const char *
+fragment_data(
+    const fragment *f)
+{
+  return f->data;
+}
+
+
+size_t
+fragment_length(
+    const fragment *f)
+{
+  return f->length;
+}
+
+
+fragment *
+fragment_ref(
+    fragment *f)
+{
+  __atomic_add_fetch(&(f->refs), 1, __ATOMIC_RELAXED);
+  return f;
+}
+
+
+void
+fragment_release(
+    fragment *f)
+{
+  if (f == NULL) {
+    return;
+  }
+  if (__atomic_sub_fetch(&(f->refs), 1, __ATOMIC_ACQ_REL) == 0) {
+    irk_free(f);
+  }
+}
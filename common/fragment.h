@@ -0,0 +1,163 @@
+/*
+Copyright (C) 2012 Brady Catherman
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef __COMMON_FRAGMENT_H
+#define __COMMON_FRAGMENT_H
+
+#include <stddef.h>
+
+// The fragment.c file uses an actual struct to store data, other classes are
+// only ever allowed to see void in order to prevent them from messing with
+// internals.
+#ifndef FRAGMENT_IS_NOT_VOID
+typedef void fragment;
+#else
+typedef struct fragment fragment;
+#endif
+
+
+/**
+  Reference counted, immutable blocks of bytes.
+
+  A fragment is built once with fragment_append() and friends and from then
+  on is only read. Anything that wants to keep it around, like an evbuffer
+  that will send it later, takes a reference with fragment_ref() and drops
+  it with fragment_release(). The last release frees it. References may be
+  taken and released from any thread, but appending is only allowed while
+  the builder holds the only reference.
+ */
+
+
+/**
+  Creates an empty fragment with one reference.
+
+  Arguments:
+    capacity: The number of bytes expected, it grows as needed.
+
+  Returns:
+    The new fragment or NULL on allocation failure.
+ */
+fragment *
+fragment_new(
+    size_t capacity);
+
+
+/**
+  Appends 'len' bytes of 'data' to the fragment.
+
+  Arguments:
+    f: A pointer to the fragment, which is updated if it has to be moved
+       to grow it.
+    data: The bytes to append.
+    len: The number of bytes.
+
+  Returns:
+    0 on success or ENOMEM. On failure the fragment is left as it was.
+ */
+int
+fragment_append(
+    fragment **f,
+    const void *data,
+    size_t len);
+
+
+/** Same as fragment_append() but with printf() style formatting. */
+int
+fragment_appendf(
+    fragment **f,
+    const char *format,
+    ...) __attribute__((format(printf, 2, 3)));
+
+
+/**
+  Returns room for at least 'len' more bytes at the end of the fragment.
+
+  This is for code that writes its output in place, like a compressor.
+  Nothing is added to the fragment until fragment_commit() is called with
+  the number of bytes actually written.
+
+  Returns:
+    The start of the free space, or NULL on allocation failure.
+ */
+char *
+fragment_space(
+    fragment **f,
+    size_t len);
+
+
+/**
+  Adds 'len' bytes written to the space returned by fragment_space().
+
+  Arguments:
+    f: The fragment.
+    len: At most the number of bytes that was asked of fragment_space().
+ */
+void
+fragment_commit(
+    fragment *f,
+    size_t len);
+
+
+/**
+  Drops everything after the first 'len' bytes of the fragment, for
+  builders that take back part of what they appended.
+
+  Arguments:
+    f: The fragment.
+    len: At most its current length.
+ */
+void
+fragment_truncate(
+    fragment *f,
+    size_t len);
+
+
+/** Returns the bytes in 'f'. */
+const char *
+fragment_data(
+    const fragment *f);
+
+
+/** Returns the number of bytes in 'f'. */
+size_t
+fragment_length(
+    const fragment *f);
+
+
+/** Takes another reference to 'f' and returns it. */
+fragment *
+fragment_ref(
+    fragment *f);
+
+
+/**
+  Drops a reference to 'f', freeing it if this was the last one.
+
+  Arguments:
+    f: The fragment, may be NULL.
+ */
+void
+fragment_release(
+    fragment *f);
+
+
+#endif
@@ -27,11 +27,27 @@ DEALINGS IN THE SOFTWARE.
 #include <common/logging.h>
 
 
+// Messages more verbose than this are dropped.
+static enum log_level log_level = LOG_LEVEL_DEBUG;
+
+
+void
+log_set_level(
+  enum log_level level)
+{
+  log_level = level;
+}
+
+
 void
 log_error(
   const char *message,
   ...)
 {
+  if (log_level < LOG_LEVEL_ERROR) {
+    return;
+  }
+
   va_list args;
   va_start(args, message);
 
@@ -50,6 +66,10 @@ log_warning(
   const char *message,
   ...)
 {
+  if (log_level < LOG_LEVEL_WARNING) {
+    return;
+  }
+
   va_list args;
   va_start(args, message);
 
@@ -69,6 +89,10 @@ log_info(
   const char *message,
   ...)
 {
+  if (log_level < LOG_LEVEL_INFO) {
+    return;
+  }
+
   va_list args;
   va_start(args, message);
 
@@ -87,6 +111,10 @@ log_debug(
   const char *message,
   ...)
 {
+  if (log_level < LOG_LEVEL_DEBUG) {
+    return;
+  }
+
   va_list args;
   va_start(args, message);
 
@@ -105,6 +133,10 @@ log_security(
   const char *message,
   ...)
 {
+  if (log_level < LOG_LEVEL_WARNING) {
+    return;
+  }
+
   va_list args;
   va_start(args, message);
 
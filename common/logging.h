@@ -23,6 +23,32 @@ DEALINGS IN THE SOFTWARE.
 #ifndef __COMMON_LOGGING_H
 #define __COMMON_LOGGING_H
 
+/**
+  Levels of logging output, each level includes everything above it.
+
+  Security messages are logged at LOG_LEVEL_WARNING.
+ */
+enum log_level {
+  LOG_LEVEL_ERROR,
+  LOG_LEVEL_WARNING,
+  LOG_LEVEL_INFO,
+  LOG_LEVEL_DEBUG
+};
+
+
+/**
+  Sets the most verbose level of message that will be logged.
+
+  The default is LOG_LEVEL_DEBUG, which logs everything.
+
+  Arguments:
+    level: The new level.
+ */
+void
+log_set_level(
+  enum log_level level);
+
+
 // TODO: FIXME!
 void
 log_error(
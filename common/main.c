@@ -24,6 +24,10 @@ DEALINGS IN THE SOFTWARE.
 #include <stdio.h>
 #include <stdlib.h>
 
+#include <collector/refresh.h>
+#include <collector/scheduler.h>
+#include <collector/self.h>
+#include <collector/workers.h>
 #include <common/config.h>
 #include <master/module.h>
 #include <security/security.h>
@@ -35,6 +39,13 @@ void httpserver_main(void) {
   // Create the event server structure.
   eb = event_init();
 
+  // Start collecting the modules with timers, on threads of their own.
+  if (workers_init(eb, config_worker_threads) != 0 ||
+      scheduler_init(eb) != 0 || refresh_init(eb) != 0 ||
+      self_init(eb) != 0) {
+    exit(1);
+  }
+
   // TODO(brady): Do stuff here!
 
   // Hand off work to the event loop.
@@ -0,0 +1,103 @@
+/*
+Copyright (C) 2012 Brady Catherman
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <common/memory.h>
+
+
+// Each thread has its own totals so that counting never needs atomics.
+static __thread struct memory_stats memory_thread_stats;
+
+
+void *
+irk_malloc(
+    size_t size)
+{
+  void *p = malloc(size);
+  if (p != NULL) {
+    memory_thread_stats.allocations++;
+    memory_thread_stats.bytes += size;
+  }
+  return p;
+}
+
+
+void *
+irk_calloc(
+    size_t count,
+    size_t size)
+{
+  void *p = calloc(count, size);
+  if (p != NULL) {
+    memory_thread_stats.allocations++;
+    memory_thread_stats.bytes += count * size;
+  }
+  return p;
+}
+
+
+void *
+irk_realloc(
+    void *ptr,
+    size_t size)
+{
+  void *p = realloc(ptr, size);
+  if (p != NULL) {
+    memory_thread_stats.allocations++;
+    memory_thread_stats.bytes += size;
+  }
+  return p;
+}
+
+
+char *
+irk_strdup(
+    const char *string)
+{
+  size_t size = strlen(string) + 1;
+  char *p = (char *) irk_malloc(size);
+  if (p != NULL) {
+    memcpy(p, string, size);
+  }
+  return p;
+}
+
+
+void
+irk_free(
+    void *ptr)
+{
+  if (ptr != NULL) {
+    memory_thread_stats.frees++;
+    free(ptr);
+  }
+}
+
+
+void
+memory_stats_get(
+    struct memory_stats *stats)
+{
+  *stats = memory_thread_stats;
+}
@@ -0,0 +1,100 @@
+/*
+Copyright (C) 2012 Brady Catherman
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef __COMMON_MEMORY_H
+#define __COMMON_MEMORY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+/**
+  Allocation wrappers used throughout irk.
+
+  These behave exactly like their libc counterparts but also keep per thread
+  counts of how many allocations were made and how many bytes were asked
+  for. Since each thread only ever touches its own counters this costs a
+  couple of adds per call and no synchronization.
+
+  The counters make it possible to see how much a particular piece of code
+  allocates by reading them before and after it runs, which is what the
+  benchmarks and the per module accounting do.
+ */
+
+
+/** Running allocation totals for a single thread. */
+struct memory_stats {
+  /** Number of successful calls to irk_malloc, irk_calloc, etc. */
+  uint64_t allocations;
+
+  /** Total bytes requested by those calls. */
+  uint64_t bytes;
+
+  /** Number of calls to irk_free() with a non NULL pointer. */
+  uint64_t frees;
+};
+
+
+/** Same as malloc(). */
+void *
+irk_malloc(
+    size_t size);
+
+
+/** Same as calloc(). */
+void *
+irk_calloc(
+    size_t count,
+    size_t size);
+
+
+/** Same as realloc(), a successful call counts as an allocation of size. */
+void *
+irk_realloc(
+    void *ptr,
+    size_t size);
+
+
+/** Same as strdup(). */
+char *
+irk_strdup(
+    const char *string);
+
+
+/** Same as free(). */
+void
+irk_free(
+    void *ptr);
+
+
+/**
+  Returns the allocation totals for the calling thread.
+
+  Arguments:
+    stats: Filled in with the totals since the thread started.
+ */
+void
+memory_stats_get(
+    struct memory_stats *stats);
+
+
+#endif
@@ -0,0 +1,562 @@
+/*
+Copyright (C) 2012 Brady Catherman
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PATHTRIE_IS_NOT_VOID
+
+#include <common/logging.h>
+#include <common/memory.h>
+#include <common/pathtrie.h>
+
+
+/**
+  A node in the trie.
+
+  Each node is reached from its parent through an edge labeled with one or
+  more characters, stored inline at the end of the node. Nodes that have no
+  value always have at least two children (except the root), which is what
+  keeps the trie compressed: chains of single children are merged into one
+  edge.
+ */
+struct pathtrie_node {
+  // The value stored at this node, NULL if there is none.
+  void *value;
+
+  // Children, sorted by the first character of their label. No two children
+  // share a first character.
+  struct pathtrie_node **children;
+  int child_count;
+  int child_capacity;
+
+  // The edge label leading to this node.
+  size_t label_len;
+  char label[];
+};
+
+
+struct pathtrie {
+  // The root has an empty label.
+  struct pathtrie_node *root;
+};
+
+
+// Allocates a node with room for a label of 'label_len' bytes, the label
+// itself is left for the caller to fill in.
+static struct pathtrie_node *
+pathtrie_node_alloc(
+    size_t label_len)
+{
+  size_t size = sizeof(struct pathtrie_node) + label_len;
+  struct pathtrie_node *n = (struct pathtrie_node *) irk_malloc(size);
+  if (n == NULL) {
+    log_debug("malloc(%zu) error: %s", size, strerror(errno));
+    return NULL;
+  }
+
+  n->value = NULL;
+  n->children = NULL;
+  n->child_count = 0;
+  n->child_capacity = 0;
+  n->label_len = label_len;
+  return n;
+}
+
+
+static struct pathtrie_node *
+pathtrie_node_new(
+    const char *label,
+    size_t label_len)
+{
+  struct pathtrie_node *n = pathtrie_node_alloc(label_len);
+  if (n != NULL) {
+    memcpy(n->label, label, label_len);
+  }
+  return n;
+}
+
+
+static void
+pathtrie_node_free(
+    struct pathtrie_node *n,
+    void (*free_func)(void *ptr))
+{
+  for (int i = 0; i < n->child_count; i++) {
+    pathtrie_node_free(n->children[i], free_func);
+  }
+  if (free_func != NULL && n->value != NULL) {
+    free_func(n->value);
+  }
+  irk_free(n->children);
+  irk_free(n);
+}
+
+
+/**
+  Binary searches the children of 'n' for one starting with 'c'.
+
+  Returns:
+    The index of the matching child, or if there is none the index that a
+    child starting with 'c' should be inserted at, negated and minus one.
+ */
+static int
+pathtrie_find_child(
+    const struct pathtrie_node *n,
+    unsigned char c)
+{
+  int low = 0;
+  int high = n->child_count - 1;
+  while (low <= high) {
+    int mid = (low + high) / 2;
+    unsigned char mid_c = (unsigned char) n->children[mid]->label[0];
+    if (mid_c == c) {
+      return mid;
+    } else if (mid_c < c) {
+      low = mid + 1;
+    } else {
+      high = mid - 1;
+    }
+  }
+  return -low - 1;
+}
+
+
+static int
+pathtrie_insert_child(
+    struct pathtrie_node *n,
+    int index,
+    struct pathtrie_node *child)
+{
+  if (n->child_count == n->child_capacity) {
+    int capacity = n->child_capacity == 0 ? 2 : n->child_capacity * 2;
+    struct pathtrie_node **children = (struct pathtrie_node **) irk_realloc(
+        n->children, capacity * sizeof(struct pathtrie_node *));
+    if (children == NULL) {
+      log_debug("realloc() error: %s", strerror(errno));
+      return ENOMEM;
+    }
+    n->children = children;
+    n->child_capacity = capacity;
+  }
+
+  memmove(
+      &(n->children[index + 1]),
+      &(n->children[index]),
+      (n->child_count - index) * sizeof(struct pathtrie_node *));
+  n->children[index] = child;
+  n->child_count++;
+  return 0;
+}
+
+
+static void
+pathtrie_remove_child(
+    struct pathtrie_node *n,
+    int index)
+{
+  n->child_count--;
+  memmove(
+      &(n->children[index]),
+      &(n->children[index + 1]),
+      (n->child_count - index) * sizeof(struct pathtrie_node *));
+}
+
+
+// Returns the length of the common prefix of a and b.
+static size_t
+pathtrie_common(
+    const char *a,
+    size_t a_len,
+    const char *b,
+    size_t b_len)
+{
+  size_t max = a_len < b_len ? a_len : b_len;
+  size_t i = 0;
+  while (i < max && a[i] == b[i]) {
+    i++;
+  }
+  return i;
+}
+
+
+pathtrie *
+pathtrie_init(void)
+{
+  pathtrie *t = (pathtrie *) irk_malloc(sizeof(pathtrie));
+  if (t == NULL) {
+    log_debug("malloc(%zu) error: %s", sizeof(pathtrie), strerror(errno));
+    return NULL;
+  }
+
+  t->root = pathtrie_node_new("", 0);
+  if (t->root == NULL) {
+    irk_free(t);
+    return NULL;
+  }
+  return t;
+}
+
+
+int
+pathtrie_add(
+    pathtrie *t,
+    const char *path,
+    void *value)
+{
+  if (value == NULL) {
+    return EINVAL;
+  }
+
+  struct pathtrie_node *n = t->root;
+  const char *rest = path;
+  size_t rest_len = strlen(path);
+
+  while (rest_len > 0) {
+    int index = pathtrie_find_child(n, (unsigned char) rest[0]);
+    if (index < 0) {
+      // Nothing shares a prefix with the rest of the path, so it becomes a
+      // single new leaf.
+      struct pathtrie_node *leaf = pathtrie_node_new(rest, rest_len);
+      if (leaf == NULL) {
+        return ENOMEM;
+      }
+      if (pathtrie_insert_child(n, -index - 1, leaf) != 0) {
+        irk_free(leaf);
+        return ENOMEM;
+      }
+      leaf->value = value;
+      return 0;
+    }
+
+    struct pathtrie_node *child = n->children[index];
+    size_t common =
+        pathtrie_common(child->label, child->label_len, rest, rest_len);
+    if (common < child->label_len) {
+      // The path diverges part way along this edge, so split it with a new
+      // node holding the shared part of the label.
+      struct pathtrie_node *split = pathtrie_node_new(child->label, common);
+      if (split == NULL) {
+        return ENOMEM;
+      }
+      if (pathtrie_insert_child(split, 0, child) != 0) {
+        irk_free(split);
+        return ENOMEM;
+      }
+      child->label_len -= common;
+      memmove(child->label, child->label + common, child->label_len);
+      n->children[index] = split;
+      child = split;
+    }
+
+    n = child;
+    rest += common;
+    rest_len -= common;
+  }
+
+  if (n->value != NULL) {
+    return EEXIST;
+  }
+  n->value = value;
+  return 0;
+}
+
+
+/**
+  Finds the node for exactly 'path', or NULL if there is no such node.
+ */
+static struct pathtrie_node *
+pathtrie_find(
+    const pathtrie *t,
+    const char *path)
+{
+  struct pathtrie_node *n = t->root;
+  size_t rest_len = strlen(path);
+
+  while (rest_len > 0) {
+    int index = pathtrie_find_child(n, (unsigned char) path[0]);
+    if (index < 0) {
+      return NULL;
+    }
+    n = n->children[index];
+    if (n->label_len > rest_len || memcmp(n->label, path, n->label_len)) {
+      return NULL;
+    }
+    path += n->label_len;
+    rest_len -= n->label_len;
+  }
+
+  return n;
+}
+
+
+void *
+pathtrie_get(
+    pathtrie *t,
+    const char *path)
+{
+  struct pathtrie_node *n = pathtrie_find(t, path);
+  return n == NULL ? NULL : n->value;
+}
+
+
+void *
+pathtrie_longest_prefix(
+    pathtrie *t,
+    const char *path,
+    size_t *match_len)
+{
+  struct pathtrie_node *n = t->root;
+  const char *rest = path;
+  size_t rest_len = strlen(path);
+  void *best = n->value;
+  size_t best_len = 0;
+
+  while (rest_len > 0) {
+    int index = pathtrie_find_child(n, (unsigned char) rest[0]);
+    if (index < 0) {
+      break;
+    }
+    n = n->children[index];
+    if (n->label_len > rest_len || memcmp(n->label, rest, n->label_len)) {
+      break;
+    }
+    rest += n->label_len;
+    rest_len -= n->label_len;
+    if (n->value != NULL) {
+      best = n->value;
+      best_len = rest - path;
+    }
+  }
+
+  if (match_len != NULL) {
+    *match_len = best_len;
+  }
+  return best;
+}
+
+
+/**
+  Removes 'rest' from below 'n', compressing the trie on the way back up.
+
+  Returns:
+    The removed value or NULL if it was not found.
+ */
+static void *
+pathtrie_remove_from(
+    struct pathtrie_node *n,
+    const char *rest,
+    size_t rest_len)
+{
+  int index = pathtrie_find_child(n, (unsigned char) rest[0]);
+  if (index < 0) {
+    return NULL;
+  }
+
+  struct pathtrie_node *child = n->children[index];
+  if (child->label_len > rest_len ||
+      memcmp(child->label, rest, child->label_len)) {
+    return NULL;
+  }
+
+  void *value;
+  if (child->label_len == rest_len) {
+    value = child->value;
+    child->value = NULL;
+  } else {
+    value = pathtrie_remove_from(
+        child,
+        rest + child->label_len,
+        rest_len - child->label_len);
+  }
+
+  if (value == NULL || child->value != NULL) {
+    return value;
+  }
+
+  if (child->child_count == 0) {
+    // Nothing is left below this edge at all.
+    pathtrie_remove_child(n, index);
+    irk_free(child->children);
+    irk_free(child);
+  } else if (child->child_count == 1) {
+    // A valueless node with one child is merged into that child so that
+    // the trie stays compressed. If this fails the trie is still correct,
+    // just slightly larger than it needs to be.
+    struct pathtrie_node *only = child->children[0];
+    struct pathtrie_node *merged =
+        pathtrie_node_alloc(child->label_len + only->label_len);
+    if (merged != NULL) {
+      memcpy(merged->label, child->label, child->label_len);
+      memcpy(merged->label + child->label_len, only->label, only->label_len);
+      merged->value = only->value;
+      merged->children = only->children;
+      merged->child_count = only->child_count;
+      merged->child_capacity = only->child_capacity;
+      n->children[index] = merged;
+      irk_free(child->children);
+      irk_free(child);
+      irk_free(only);
+    }
+  }
+
+  return value;
+}
+
+
+void *
+pathtrie_remove(
+    pathtrie *t,
+    const char *path)
+{
+  size_t path_len = strlen(path);
+  if (path_len == 0) {
+    void *value = t->root->value;
+    t->root->value = NULL;
+    return value;
+  }
+
+  return pathtrie_remove_from(t->root, path, path_len);
+}
+
+
+// State shared by every level of a walk.
+struct pathtrie_walk_state {
+  char *buffer;
+  size_t buffer_size;
+  pathtrie_walk_func callback;
+  void *user_data;
+};
+
+
+/**
+  Visits 'n' and everything below it. 'len' bytes of the buffer hold the
+  path up to, but not including, the label of 'n'.
+ */
+static int
+pathtrie_walk_node(
+    struct pathtrie_walk_state *state,
+    const struct pathtrie_node *n,
+    size_t len)
+{
+  size_t new_len = len + n->label_len;
+  if (new_len + 1 > state->buffer_size) {
+    size_t size = state->buffer_size * 2;
+    while (size < new_len + 1) {
+      size *= 2;
+    }
+    char *buffer = (char *) irk_realloc(state->buffer, size);
+    if (buffer == NULL) {
+      log_debug("realloc(%zu) error: %s", size, strerror(errno));
+      return ENOMEM;
+    }
+    state->buffer = buffer;
+    state->buffer_size = size;
+  }
+  memcpy(state->buffer + len, n->label, n->label_len);
+
+  if (n->value != NULL) {
+    state->buffer[new_len] = '\0';
+    int err = state->callback(
+        state->buffer,
+        new_len,
+        n->value,
+        state->user_data);
+    if (err != 0) {
+      return err;
+    }
+  }
+
+  for (int i = 0; i < n->child_count; i++) {
+    int err = pathtrie_walk_node(state, n->children[i], new_len);
+    if (err != 0) {
+      return err;
+    }
+  }
+  return 0;
+}
+
+
+int
+pathtrie_walk(
+    pathtrie *t,
+    const char *prefix,
+    pathtrie_walk_func callback,
+    void *user_data)
+{
+  // Find the topmost node whose path starts with 'prefix'. The prefix may
+  // end part way along an edge, in which case everything below that edge
+  // matches. 'parent_len' tracks the length of the path leading up to, but
+  // not including, the label of 'n'.
+  struct pathtrie_node *n = t->root;
+  size_t prefix_len = strlen(prefix);
+  size_t parent_len = 0;
+  size_t pos = 0;
+  while (pos < prefix_len) {
+    int index = pathtrie_find_child(n, (unsigned char) prefix[pos]);
+    if (index < 0) {
+      return 0;
+    }
+    struct pathtrie_node *child = n->children[index];
+    size_t common = pathtrie_common(
+        child->label,
+        child->label_len,
+        prefix + pos,
+        prefix_len - pos);
+    if (common < child->label_len && common < prefix_len - pos) {
+      return 0;
+    }
+    parent_len = pos;
+    pos += child->label_len;
+    n = child;
+  }
+
+  struct pathtrie_walk_state state;
+  state.buffer_size = 256;
+  while (state.buffer_size < parent_len + 1) {
+    state.buffer_size *= 2;
+  }
+  state.buffer = (char *) irk_malloc(state.buffer_size);
+  if (state.buffer == NULL) {
+    log_debug("malloc(%zu) error: %s", state.buffer_size, strerror(errno));
+    return ENOMEM;
+  }
+  state.callback = callback;
+  state.user_data = user_data;
+
+  memcpy(state.buffer, prefix, parent_len);
+  int err = pathtrie_walk_node(&state, n, parent_len);
+  irk_free(state.buffer);
+  return err;
+}
+
+
+void
+pathtrie_destroy(
+    pathtrie *t,
+    void (*free_func)(void *ptr))
+{
+  pathtrie_node_free(t->root, free_func);
+  irk_free(t);
+}
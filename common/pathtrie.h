@@ -0,0 +1,193 @@
+/*
+Copyright (C) 2012 Brady Catherman
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef __COMMON_PATHTRIE_H
+#define __COMMON_PATHTRIE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// The pathtrie.c file uses an actual struct to store data, other classes
+// are only ever allowed to see void in order to prevent them from messing
+// with internals.
+#ifndef PATHTRIE_IS_NOT_VOID
+typedef void pathtrie;
+#else
+typedef struct pathtrie pathtrie;
+#endif
+
+
+/**
+  A compressed radix trie keyed by path.
+
+  Unlike strhash this keeps keys in sorted order and shares common prefixes,
+  which lets it answer "everything under /net/" by walking only the matching
+  subtree. Lookups cost time proportional to the length of the path, and a
+  prefix walk costs time proportional to the size of its answer.
+
+  Keys are arbitrary '\0' terminated strings, nothing in here treats '/'
+  specially. A prefix of "/net" matches "/network" as well as "/net/dev",
+  callers that want a directory style match should pass "/net/".
+ */
+
+
+/**
+  Called for each item visited by pathtrie_walk().
+
+  Arguments:
+    path: The full key of this item. This is only valid during the callback.
+    path_len: The length of path.
+    value: The value stored at path.
+    user_data: The user_data passed to pathtrie_walk().
+
+  Returns:
+    0 to continue walking, anything else stops the walk and is returned
+    from pathtrie_walk().
+ */
+typedef int (*pathtrie_walk_func)(
+    const char *path,
+    size_t path_len,
+    void *value,
+    void *user_data);
+
+
+/**
+  Creates an empty pathtrie.
+
+  Returns:
+    An initialized pathtrie or NULL on error. This must be freed with
+    pathtrie_destroy().
+ */
+pathtrie *
+pathtrie_init(void);
+
+
+/**
+  Adds a value to the trie.
+
+  Arguments:
+    t: The pathtrie object created using pathtrie_init().
+    path: The '\0' terminated key.
+    value: The value to store, this may not be NULL.
+
+  Returns:
+    0 on success.
+    EEXIST if path already has a value, the existing value is untouched.
+    EINVAL if value is NULL.
+    ENOMEM on allocation failure.
+ */
+int
+pathtrie_add(
+    pathtrie *t,
+    const char *path,
+    void *value);
+
+
+/**
+  Returns the value stored at exactly 'path'.
+
+  Arguments:
+    t: The pathtrie object created using pathtrie_init().
+    path: The '\0' terminated key.
+
+  Returns:
+    The value or NULL if nothing is stored at path.
+ */
+void *
+pathtrie_get(
+    pathtrie *t,
+    const char *path);
+
+
+/**
+  Finds the value with the longest key that is a prefix of 'path'.
+
+  This is used to find the owner of a path, for example the module that
+  registered "/net/dev" owns "/net/dev/eth0/rx_bytes".
+
+  Arguments:
+    t: The pathtrie object created using pathtrie_init().
+    path: The '\0' terminated path to look up.
+    match_len: If not NULL this is set to the length of the matched key.
+
+  Returns:
+    The value or NULL if no key is a prefix of path.
+ */
+void *
+pathtrie_longest_prefix(
+    pathtrie *t,
+    const char *path,
+    size_t *match_len);
+
+
+/**
+  Removes a value from the trie.
+
+  Arguments:
+    t: The pathtrie object created using pathtrie_init().
+    path: The '\0' terminated key.
+
+  Returns:
+    The removed value or NULL if nothing was stored at path.
+ */
+void *
+pathtrie_remove(
+    pathtrie *t,
+    const char *path);
+
+
+/**
+  Visits every item whose key starts with 'prefix', in sorted order.
+
+  Arguments:
+    t: The pathtrie object created using pathtrie_init().
+    prefix: The '\0' terminated prefix, "" visits everything.
+    callback: Called once for each matching item. The trie must not be
+              modified from within the callback.
+    user_data: Passed through to callback.
+
+  Returns:
+    0 if the walk completed, ENOMEM if the path buffer could not be grown,
+    or the first non zero value returned by callback.
+ */
+int
+pathtrie_walk(
+    pathtrie *t,
+    const char *prefix,
+    pathtrie_walk_func callback,
+    void *user_data);
+
+
+/**
+  Frees the memory associated with the given pathtrie.
+
+  Arguments:
+    t: The pathtrie object created using pathtrie_init().
+    free_func: If not NULL this is called on every value in the trie.
+ */
+void
+pathtrie_destroy(
+    pathtrie *t,
+    void (*free_func)(void *ptr));
+
+
+#endif
@@ -0,0 +1,184 @@
+/*
+Copyright (C) 2012 Brady Catherman
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SLAB_IS_NOT_VOID
+
+#include <common/logging.h>
+#include <common/memory.h>
+#include <common/slab.h>
+
+
+// Object sizes handed out by the slab. Each class is a multiple of 16 so
+// that every object is suitably aligned for any type.
+static const size_t slab_class_sizes[] = {32, 48, 64, 96, 128, 192, 256};
+
+#define SLAB_CLASSES (sizeof(slab_class_sizes) / sizeof(slab_class_sizes[0]))
+
+// The size of the chunks that objects are carved from.
+#define SLAB_CHUNK_SIZE 16384
+
+
+/** A free object, the link is stored in the object itself. */
+struct slab_free_object {
+  struct slab_free_object *next;
+};
+
+
+/** A chunk of memory that objects are carved from. */
+struct slab_chunk {
+  struct slab_chunk *next;
+
+  // Padding keeps the objects that follow 16 byte aligned.
+  char padding[16 - sizeof(void *)];
+  char data[];
+};
+
+
+struct slab {
+  // Freed objects, one list per size class.
+  struct slab_free_object *free_lists[SLAB_CLASSES];
+
+  // The chunk currently being carved up, and how much of it has been used.
+  struct slab_chunk *current;
+  size_t current_used;
+
+  // Every chunk ever allocated, including 'current'.
+  struct slab_chunk *chunks;
+};
+
+
+// Returns the size class for 'size', or SLAB_CLASSES if it is too big.
+static inline size_t
+slab_class(
+    size_t size)
+{
+  size_t c = 0;
+  while (c < SLAB_CLASSES && slab_class_sizes[c] < size) {
+    c++;
+  }
+  return c;
+}
+
+
+slab *
+slab_init(void)
+{
+  slab *s = (slab *) irk_calloc(1, sizeof(slab));
+  if (s == NULL) {
+    log_debug("calloc(1, %zu) error: %s", sizeof(slab), strerror(errno));
+    return NULL;
+  }
+  return s;
+}
+
+
+void *
+slab_alloc(
+    slab *s,
+    size_t size)
+{
+  size_t c = slab_class(size);
+  if (c == SLAB_CLASSES) {
+    return irk_malloc(size);
+  }
+
+  struct slab_free_object *o = s->free_lists[c];
+  if (o != NULL) {
+    s->free_lists[c] = o->next;
+    return o;
+  }
+
+  size_t class_size = slab_class_sizes[c];
+  size_t data_size = SLAB_CHUNK_SIZE - sizeof(struct slab_chunk);
+  if (s->current == NULL || s->current_used + class_size > data_size) {
+    // Whatever is left of the current chunk is too small for this class.
+    // Hand it out to smaller classes rather than wasting it.
+    while (s->current != NULL) {
+      size_t left = data_size - s->current_used;
+      size_t small = slab_class(left + 1);
+      if (small == 0) {
+        break;
+      }
+      small--;
+      struct slab_free_object *f =
+          (struct slab_free_object *) (s->current->data + s->current_used);
+      f->next = s->free_lists[small];
+      s->free_lists[small] = f;
+      s->current_used += slab_class_sizes[small];
+    }
+
+    struct slab_chunk *chunk =
+        (struct slab_chunk *) irk_malloc(SLAB_CHUNK_SIZE);
+    if (chunk == NULL) {
+      log_debug("malloc(%d) error: %s", SLAB_CHUNK_SIZE, strerror(errno));
+      return NULL;
+    }
+    chunk->next = s->chunks;
+    s->chunks = chunk;
+    s->current = chunk;
+    s->current_used = 0;
+  }
+
+  void *p = s->current->data + s->current_used;
+  s->current_used += class_size;
+  return p;
+}
+
+
+void
+slab_free(
+    slab *s,
+    void *ptr,
+    size_t size)
+{
+  if (ptr == NULL) {
+    return;
+  }
+
+  size_t c = slab_class(size);
+  if (c == SLAB_CLASSES) {
+    irk_free(ptr);
+    return;
+  }
+
+  struct slab_free_object *o = (struct slab_free_object *) ptr;
+  o->next = s->free_lists[c];
+  s->free_lists[c] = o;
+}
+
+
+void
+slab_destroy(
+    slab *s)
+{
+  struct slab_chunk *chunk = s->chunks;
+  while (chunk != NULL) {
+    struct slab_chunk *chunk_next = chunk->next;
+    irk_free(chunk);
+    chunk = chunk_next;
+  }
+  irk_free(s);
+}
@@ -0,0 +1,110 @@
+/*
+Copyright (C) 2012 Brady Catherman
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef __COMMON_SLAB_H
+#define __COMMON_SLAB_H
+
+#include <stddef.h>
+
+// The slab.c file uses an actual struct to store data, other classes are
+// only ever allowed to see void in order to prevent them from messing with
+// internals.
+#ifndef SLAB_IS_NOT_VOID
+typedef void slab;
+#else
+typedef struct slab slab;
+#endif
+
+
+/**
+  A small object allocator with fixed size classes.
+
+  Memory is carved out of large chunks and freed objects are kept on a free
+  list per size class, so a workload that frees and allocates objects of
+  similar sizes (like a cache whose keys churn every cycle) stops calling
+  malloc() once it reaches its high water mark. Chunks are only returned to
+  the system by slab_destroy().
+
+  Requests larger than the biggest size class fall through to malloc().
+
+  A slab is not thread safe, it is intended to be owned by a single data
+  structure which already serializes its writers.
+ */
+
+
+/**
+  Creates an empty slab allocator.
+
+  Returns:
+    An initialized slab or NULL on error. This must be freed with
+    slab_destroy().
+ */
+slab *
+slab_init(void);
+
+
+/**
+  Allocates 'size' bytes.
+
+  Arguments:
+    s: The slab created with slab_init().
+    size: The number of bytes needed.
+
+  Returns:
+    A pointer aligned for any type, or NULL on error.
+ */
+void *
+slab_alloc(
+    slab *s,
+    size_t size);
+
+
+/**
+  Returns memory allocated with slab_alloc() to the slab.
+
+  Arguments:
+    s: The slab created with slab_init().
+    ptr: The pointer returned by slab_alloc(), NULL is ignored.
+    size: The same size that was passed to slab_alloc().
+ */
+void
+slab_free(
+    slab *s,
+    void *ptr,
+    size_t size);
+
+
+/**
+  Frees the slab and every chunk it allocated.
+
+  Any outstanding objects from the slab become invalid, objects large enough
+  to have come from malloc() must still be freed with slab_free() first.
+
+  Arguments:
+    s: The slab created with slab_init().
+ */
+void
+slab_destroy(
+    slab *s);
+
+
+#endif
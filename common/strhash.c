@@ -22,51 +22,585 @@ DEALINGS IN THE SOFTWARE.
 
 #include <errno.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #define STRHASH_IS_NOT_VOID
 
 #include <common/logging.h>
+#include <common/memory.h>
+#include <common/slab.h>
 #include <common/strhash.h>
 
 
-// TODO(brady): Document this!
+// The table is probed one group of control bytes at a time. Sixteen bytes
+// is exactly one SSE2 register which lets us test a whole group for a match
+// with a single compare.
+#define STRHASH_GROUP_WIDTH 16
+
+// Control byte values. A slot that is in use stores the low seven bits of
+// its hash (H2) in its control byte, which is always a positive value, so
+// special states are all negative.
+#define STRHASH_CTRL_EMPTY ((int8_t) -128)
+
+// A slot whose item was removed. Lookups have to probe past these (the key
+// being searched for may have been inserted after the removed one), but
+// insertions can reuse them.
+#define STRHASH_CTRL_DELETED ((int8_t) -2)
+
+// Tables are never allowed to get more than 7/8ths full. Past that point
+// probe sequences get long quickly.
+#define STRHASH_MAX_LOAD_NUMERATOR 7
+#define STRHASH_MAX_LOAD_DENOMINATOR 8
+
+
+/**
+  Stores a single key and its associated value.
+
+  The key is stored inline at the end of the node so that each entry in the
+  table costs exactly one allocation, and so that comparing keys touches
+  the same cache lines as fetching the value. Nodes come from the table's
+  slab so keys that are removed and added again every cycle recycle the
+  same memory.
+ */
 struct strhash_node {
-  unsigned long hash;
-  struct strhash_node *next;
-  void * value;
+  // The value given by the caller.
+  void *value;
+
+  // Length of key, not including the trailing '\0'.
+  size_t key_len;
+
+  // The '\0' terminated key.
   char key[];
 };
 
 
-// TODO(brady): Document this!
+/**
+  A single slot in the table.
+
+  The full hash is kept next to the node pointer so that a false positive
+  match on the control byte can be rejected without dereferencing the node.
+ */
+struct strhash_slot {
+  uint64_t hash;
+  struct strhash_node *node;
+};
+
+
+/**
+  An open addressing hash table in the style of the "Swiss table".
+
+  Slots are grouped into runs of STRHASH_GROUP_WIDTH. Each slot has one
+  control byte which is either STRHASH_CTRL_EMPTY, STRHASH_CTRL_DELETED or
+  the low 7 bits of the hash of the key stored there. A lookup hashes the
+  key, picks a starting group from the high bits of the hash and then checks
+  every control byte in the group at once. Only slots whose control byte
+  matches need to have their keys compared, so most lookups touch one group
+  of control bytes and a single node.
+ */
 struct strhash {
-  // Stores the actual table for the strhash pointers.
-  struct strhash_node ** table;
+  // One control byte per slot, 'capacity' bytes long.
+  int8_t *ctrl;
 
-  // Size of the table.
-  int table_size;
+  // The slots themselves, 'capacity' entries long.
+  struct strhash_slot *slots;
+
+  // Number of slots in the table. This is always a power of two and at
+  // least STRHASH_GROUP_WIDTH.
+  size_t capacity;
 
   // Keeps track of the number of items in the table.
-  int items;
+  size_t items;
+
+  // The number of empty slots that can be filled before the table must
+  // grow or be cleaned of deleted slots.
+  size_t growth_left;
+
+  // Allocator for the nodes.
+  slab *nodes;
 };
 
 
-unsigned long
-strhash_djb2(
-    const char *string)
+// Mixing secrets used by strhash_hash(). These are the defaults from
+// wyhash, chosen to have good avalanche properties when multiplied.
+static const uint64_t strhash_secret[4] = {
+  0x2d358dccaa6c78a5ull,
+  0x8bb84b93962eacc9ull,
+  0x4b33a62ed433d4a3ull,
+  0x4d5a2da51de1aa47ull
+};
+
+
+// Multiplies a and b, returning the low 64 bits in a and the high in b.
+static inline void
+strhash_mum(
+    uint64_t *a,
+    uint64_t *b)
+{
+#ifdef __SIZEOF_INT128__
+  __uint128_t r = (__uint128_t) *a * *b;
+  *a = (uint64_t) r;
+  *b = (uint64_t) (r >> 64);
+#else
+  uint64_t ha = *a >> 32, hb = *b >> 32;
+  uint64_t la = (uint32_t) *a, lb = (uint32_t) *b;
+  uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+  uint64_t t = rl + (rm0 << 32);
+  uint64_t c = t < rl;
+  uint64_t lo = t + (rm1 << 32);
+  c += lo < t;
+  *a = lo;
+  *b = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+#endif
+}
+
+
+// Folds the 128 bit product of a and b down to 64 bits.
+static inline uint64_t
+strhash_mix(
+    uint64_t a,
+    uint64_t b)
+{
+  strhash_mum(&a, &b);
+  return a ^ b;
+}
+
+
+// Unaligned little endian style reads. memcpy compiles down to a single
+// load on every platform we care about.
+static inline uint64_t
+strhash_read8(
+    const uint8_t *p)
 {
-  // Daniel J. Bernstein's popular DJB2 function.
-  char *string_p = (char *) string;
-  unsigned long hash = 5381;
-  int c;
+  uint64_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
 
-  while ( (c = *string_p++) != 0) {
-    hash = ((hash << 5) + hash) + c;
+static inline uint64_t
+strhash_read4(
+    const uint8_t *p)
+{
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+
+uint64_t
+strhash_hash(
+    const char *key,
+    size_t key_len)
+{
+  // This is the wyhash algorithm. Keys are consumed 16 or 48 bytes at a
+  // time and every block goes through a full 64x64->128 bit multiply, so
+  // long keys that differ only near the end (like metric paths sharing a
+  // long prefix) still spread evenly over the table.
+  const uint8_t *p = (const uint8_t *) key;
+  uint64_t seed = strhash_mix(strhash_secret[0], strhash_secret[1]);
+  uint64_t a, b;
+
+  if (key_len <= 16) {
+    if (key_len >= 4) {
+      size_t shift = (key_len >> 3) << 2;
+      a = (strhash_read4(p) << 32) | strhash_read4(p + shift);
+      b = (strhash_read4(p + key_len - 4) << 32) |
+          strhash_read4(p + key_len - 4 - shift);
+    } else if (key_len > 0) {
+      a = ((uint64_t) p[0] << 16) |
+          ((uint64_t) p[key_len >> 1] << 8) |
+          p[key_len - 1];
+      b = 0;
+    } else {
+      a = b = 0;
+    }
+  } else {
+    size_t i = key_len;
+    if (i > 48) {
+      uint64_t see1 = seed, see2 = seed;
+      do {
+        seed = strhash_mix(
+            strhash_read8(p) ^ strhash_secret[1],
+            strhash_read8(p + 8) ^ seed);
+        see1 = strhash_mix(
+            strhash_read8(p + 16) ^ strhash_secret[2],
+            strhash_read8(p + 24) ^ see1);
+        see2 = strhash_mix(
+            strhash_read8(p + 32) ^ strhash_secret[3],
+            strhash_read8(p + 40) ^ see2);
+        p += 48;
+        i -= 48;
+      } while (i > 48);
+      seed ^= see1 ^ see2;
+    }
+    while (i > 16) {
+      seed = strhash_mix(
+          strhash_read8(p) ^ strhash_secret[1],
+          strhash_read8(p + 8) ^ seed);
+      p += 16;
+      i -= 16;
+    }
+    a = strhash_read8(p + i - 16);
+    b = strhash_read8(p + i - 8);
   }
 
-  return hash;
+  a ^= strhash_secret[1];
+  b ^= seed;
+  strhash_mum(&a, &b);
+  return strhash_mix(a ^ strhash_secret[0] ^ key_len, b ^ strhash_secret[1]);
+}
+
+
+// The upper bits of the hash select the group that probing starts at.
+static inline size_t
+strhash_h1(
+    uint64_t hash)
+{
+  return (size_t) (hash >> 7);
+}
+
+
+// The lower 7 bits of the hash are stored in the control byte.
+static inline int8_t
+strhash_h2(
+    uint64_t hash)
+{
+  return (int8_t) (hash & 0x7f);
+}
+
+
+// Returns a bit mask with bit 'i' set for each control byte in the group
+// that is equal to 'value'.
+static inline uint32_t
+strhash_group_match(
+    const int8_t *group,
+    int8_t value)
+{
+#ifdef __SSE2__
+  __m128i ctrl = _mm_loadu_si128((const __m128i *) group);
+  __m128i match = _mm_set1_epi8(value);
+  return (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(match, ctrl));
+#else
+  uint32_t mask = 0;
+  for (int i = 0; i < STRHASH_GROUP_WIDTH; i++) {
+    if (group[i] == value) {
+      mask |= (uint32_t) 1 << i;
+    }
+  }
+  return mask;
+#endif
+}
+
+
+// Returns a bit mask with bit 'i' set for each control byte in the group
+// that is either empty or deleted.
+static inline uint32_t
+strhash_group_match_free(
+    const int8_t *group)
+{
+#ifdef __SSE2__
+  // Every special control byte is negative, so the sign bits are the mask.
+  __m128i ctrl = _mm_loadu_si128((const __m128i *) group);
+  return (uint32_t) _mm_movemask_epi8(ctrl);
+#else
+  uint32_t mask = 0;
+  for (int i = 0; i < STRHASH_GROUP_WIDTH; i++) {
+    if (group[i] < 0) {
+      mask |= (uint32_t) 1 << i;
+    }
+  }
+  return mask;
+#endif
+}
+
+
+// Returns the index of the lowest set bit in a non zero mask.
+static inline int
+strhash_mask_first(
+    uint32_t mask)
+{
+  return __builtin_ctz(mask);
+}
+
+
+// Number of items a table of 'capacity' slots may hold before growing.
+static inline size_t
+strhash_max_items(
+    size_t capacity)
+{
+  return capacity / STRHASH_MAX_LOAD_DENOMINATOR * STRHASH_MAX_LOAD_NUMERATOR;
+}
+
+
+/**
+  Allocates the control bytes and slots for a table of 'capacity' slots.
+
+  Both arrays live in a single allocation with the slots first, which keeps
+  the slots pointer aligned for the platform and means resizing is a single
+  malloc/free pair.
+
+  Returns:
+    0 on success, ENOMEM if the allocation failed.
+ */
+static int
+strhash_alloc_table(
+    strhash *s,
+    size_t capacity)
+{
+  size_t slots_size = capacity * sizeof(struct strhash_slot);
+  char *p = (char *) irk_malloc(slots_size + capacity);
+  if (p == NULL) {
+    log_debug(
+        "malloc(%zu) error: %s",
+        slots_size + capacity,
+        strerror(errno));
+    return ENOMEM;
+  }
+
+  s->slots = (struct strhash_slot *) p;
+  s->ctrl = (int8_t *) (p + slots_size);
+  memset(s->ctrl, STRHASH_CTRL_EMPTY, capacity);
+  s->capacity = capacity;
+  s->growth_left = strhash_max_items(capacity) - s->items;
+  return 0;
+}
+
+
+// The number of bytes needed for a node holding a key of 'key_len' bytes.
+static inline size_t
+strhash_node_size(
+    size_t key_len)
+{
+  return sizeof(struct strhash_node) + key_len + 1;
+}
+
+
+/**
+  Finds the first empty or deleted slot in the probe sequence for 'hash'.
+
+  This is only used on insertion once it is known that the key is not
+  already in the table, so no key comparisons are needed.
+ */
+static size_t
+strhash_find_free(
+    const strhash *s,
+    uint64_t hash)
+{
+  size_t group_mask = s->capacity / STRHASH_GROUP_WIDTH - 1;
+  size_t group = strhash_h1(hash) & group_mask;
+
+  // Triangular probing over groups visits every group exactly once when the
+  // number of groups is a power of two.
+  for (size_t i = 1; /* No check */ ; i++) {
+    size_t offset = group * STRHASH_GROUP_WIDTH;
+    uint32_t free_slots = strhash_group_match_free(s->ctrl + offset);
+    if (free_slots != 0) {
+      return offset + strhash_mask_first(free_slots);
+    }
+    group = (group + i) & group_mask;
+  }
+}
+
+
+/**
+  Finds the slot holding 'key', or returns NULL if the key is not present.
+ */
+static struct strhash_slot *
+strhash_find(
+    const strhash *s,
+    const char *key,
+    size_t key_len,
+    uint64_t hash)
+{
+  size_t group_mask = s->capacity / STRHASH_GROUP_WIDTH - 1;
+  size_t group = strhash_h1(hash) & group_mask;
+  int8_t h2 = strhash_h2(hash);
+
+  for (size_t i = 1; i <= group_mask + 1; i++) {
+    size_t offset = group * STRHASH_GROUP_WIDTH;
+    const int8_t *ctrl = s->ctrl + offset;
+
+    uint32_t match = strhash_group_match(ctrl, h2);
+    while (match != 0) {
+      size_t index = offset + strhash_mask_first(match);
+      struct strhash_slot *slot = &(s->slots[index]);
+      if (slot->hash == hash &&
+          slot->node->key_len == key_len &&
+          !memcmp(key, slot->node->key, key_len)) {
+        return slot;
+      }
+      match &= match - 1;
+    }
+
+    // An empty slot in the group means the key would have been placed here
+    // had it been inserted, so there is no need to keep probing.
+    if (strhash_group_match(ctrl, STRHASH_CTRL_EMPTY) != 0) {
+      return NULL;
+    }
+    group = (group + i) & group_mask;
+  }
+
+  return NULL;
+}
+
+
+/**
+  Doubles the size of the table, rehashing all the existing slots.
+
+  The nodes themselves are not touched, only the slots that point to them
+  are moved, so pointers to keys stay valid across a resize.
+
+  Returns:
+    0 on success, ENOMEM if the new table could not be allocated. On failure
+    the existing table is left untouched.
+ */
+static int
+strhash_grow(
+    strhash *s)
+{
+  int8_t *old_ctrl = s->ctrl;
+  struct strhash_slot *old_slots = s->slots;
+  size_t old_capacity = s->capacity;
+
+  if (strhash_alloc_table(s, old_capacity * 2) != 0) {
+    s->ctrl = old_ctrl;
+    s->slots = old_slots;
+    return ENOMEM;
+  }
+
+  for (size_t i = 0; i < old_capacity; i++) {
+    if (old_ctrl[i] < 0) {
+      continue;
+    }
+    size_t index = strhash_find_free(s, old_slots[i].hash);
+    s->ctrl[index] = old_ctrl[i];
+    s->slots[index] = old_slots[i];
+  }
+
+  // The control bytes are part of the slots allocation.
+  irk_free(old_slots);
+  return 0;
+}
+
+
+/**
+  Rehashes the table at its current size, clearing out deleted slots.
+
+  A cache that removes and adds keys every cycle fills up with deleted
+  slots without ever growing. This reclaims them without allocating: every
+  item is first marked as deleted, then each one is moved to the first free
+  slot in its probe sequence, swapping with other not yet placed items
+  where needed.
+ */
+static void
+strhash_rehash_in_place(
+    strhash *s)
+{
+  for (size_t i = 0; i < s->capacity; i++) {
+    if (s->ctrl[i] == STRHASH_CTRL_DELETED) {
+      s->ctrl[i] = STRHASH_CTRL_EMPTY;
+    } else if (s->ctrl[i] >= 0) {
+      s->ctrl[i] = STRHASH_CTRL_DELETED;
+    }
+  }
+
+  // Past this point STRHASH_CTRL_DELETED means "item waiting to be placed".
+  for (size_t i = 0; i < s->capacity; i++) {
+    if (s->ctrl[i] != STRHASH_CTRL_DELETED) {
+      continue;
+    }
+
+    uint64_t hash = s->slots[i].hash;
+    size_t target = strhash_find_free(s, hash);
+    if (target / STRHASH_GROUP_WIDTH == i / STRHASH_GROUP_WIDTH) {
+      // Already in the first group it can go in.
+      s->ctrl[i] = strhash_h2(hash);
+    } else if (s->ctrl[target] == STRHASH_CTRL_EMPTY) {
+      s->slots[target] = s->slots[i];
+      s->ctrl[target] = strhash_h2(hash);
+      s->ctrl[i] = STRHASH_CTRL_EMPTY;
+    } else {
+      // The target holds another item that has not been placed yet. Swap
+      // them and go around again to place the item that landed in 'i'.
+      struct strhash_slot tmp = s->slots[target];
+      s->slots[target] = s->slots[i];
+      s->slots[i] = tmp;
+      s->ctrl[target] = strhash_h2(hash);
+      i--;
+    }
+  }
+
+  s->growth_left = strhash_max_items(s->capacity) - s->items;
+}
+
+
+/**
+  Makes sure there is room to add at least one more item.
+
+  If most of the used slots are deleted ones the table is cleaned in place,
+  otherwise it doubles in size.
+
+  Returns:
+    0 on success, ENOMEM if the table needed to grow and could not.
+ */
+static int
+strhash_make_room(
+    strhash *s)
+{
+  if (s->items < strhash_max_items(s->capacity) / 2) {
+    strhash_rehash_in_place(s);
+    return 0;
+  }
+  return strhash_grow(s);
+}
+
+
+/**
+  Adds a key that is known not to be in the table.
+
+  Returns:
+    0 on success, ENOMEM on allocation failure.
+ */
+static int
+strhash_insert(
+    strhash *s,
+    const char *key,
+    size_t key_len,
+    uint64_t hash,
+    void *value)
+{
+  if (s->growth_left == 0 && strhash_make_room(s) != 0) {
+    return ENOMEM;
+  }
+
+  size_t node_size = strhash_node_size(key_len);
+  struct strhash_node *n =
+      (struct strhash_node *) slab_alloc(s->nodes, node_size);
+  if (n == NULL) {
+    log_debug("slab_alloc(%zu) error: %s", node_size, strerror(errno));
+    return ENOMEM;
+  }
+
+  n->value = value;
+  n->key_len = key_len;
+  memcpy(n->key, key, key_len);
+  n->key[key_len] = '\0';
+
+  size_t index = strhash_find_free(s, hash);
+  if (s->ctrl[index] == STRHASH_CTRL_EMPTY) {
+    s->growth_left--;
+  }
+  s->ctrl[index] = strhash_h2(hash);
+  s->slots[index].hash = hash;
+  s->slots[index].node = n;
+  s->items++;
+  return 0;
 }
 
 
@@ -74,26 +608,31 @@ strhash *
 strhash_init(
     const int table_size)
 {
-  strhash *p = (strhash *) malloc(sizeof(strhash));
+  strhash *p = (strhash *) irk_malloc(sizeof(strhash));
   if (p == NULL) {
     log_debug("malloc(%d) error: %s", sizeof(strhash), strerror(errno));
     return NULL;
   }
 
-  p->table = (struct strhash_node **)
-             calloc(table_size, sizeof(struct strhash_node *));
-  if (p->table == NULL) {
-    log_debug(
-        "calloc(%d, %d) error: %s",
-        table_size,
-        sizeof(struct strhash_node),
-        strerror(errno));
-    free(p);
+  // Size the table so that 'table_size' items fit without a resize.
+  size_t capacity = STRHASH_GROUP_WIDTH;
+  while (table_size > 0 && strhash_max_items(capacity) < (size_t) table_size) {
+    capacity *= 2;
+  }
+
+  p->nodes = slab_init();
+  if (p->nodes == NULL) {
+    irk_free(p);
     return NULL;
   }
 
-  p->table_size = table_size;
   p->items = 0;
+  if (strhash_alloc_table(p, capacity) != 0) {
+    slab_destroy(p->nodes);
+    irk_free(p);
+    return NULL;
+  }
+
   return p;
 }
 
@@ -104,29 +643,115 @@ strhash_add(
     const char *key,
     void *value)
 {
-  unsigned long hash = strhash_djb2(key);
-  struct strhash_node ** p = &(s->table[hash % s->table_size]);
-  while (*p != NULL) {
-    if ((*p)->hash == hash && !strcmp(key, (*p)->key)) {
-      // The keys are the same, we can not overwrite the value as that might
-      // be creating a memory leak.
-      return (*p)->value;
+  size_t key_len = strlen(key);
+  return strhash_add_n(s, key, key_len, strhash_hash(key, key_len), value);
+}
+
+
+void *
+strhash_add_n(
+    strhash *s,
+    const char *key,
+    size_t key_len,
+    uint64_t hash,
+    void *value)
+{
+  struct strhash_slot *slot = strhash_find(s, key, key_len, hash);
+  if (slot != NULL) {
+    // The keys are the same, we can not overwrite the value as that might
+    // be creating a memory leak.
+    return slot->node->value;
+  }
+
+  if (strhash_insert(s, key, key_len, hash, value) != 0) {
+    return NULL;
+  }
+  return value;
+}
+
+
+int
+strhash_replace(
+    strhash *s,
+    const char *key,
+    void *value,
+    void **old_value)
+{
+  size_t key_len = strlen(key);
+  return strhash_replace_n(
+      s,
+      key,
+      key_len,
+      strhash_hash(key, key_len),
+      value,
+      old_value);
+}
+
+
+int
+strhash_replace_n(
+    strhash *s,
+    const char *key,
+    size_t key_len,
+    uint64_t hash,
+    void *value,
+    void **old_value)
+{
+  struct strhash_slot *slot = strhash_find(s, key, key_len, hash);
+  if (slot != NULL) {
+    if (old_value != NULL) {
+      *old_value = slot->node->value;
     }
+    slot->node->value = value;
+    return 0;
   }
 
-  int key_len = strlen(key);
-  size_t malloc_size = sizeof(struct strhash_node) + key_len;
-  struct strhash_node *n = (struct strhash_node *) malloc(malloc_size);
-  if (n == NULL) {
+  if (old_value != NULL) {
+    *old_value = NULL;
+  }
+  return strhash_insert(s, key, key_len, hash, value);
+}
+
+
+void *
+strhash_remove(
+    strhash *s,
+    const char *key)
+{
+  size_t key_len = strlen(key);
+  return strhash_remove_n(s, key, key_len, strhash_hash(key, key_len));
+}
+
+
+void *
+strhash_remove_n(
+    strhash *s,
+    const char *key,
+    size_t key_len,
+    uint64_t hash)
+{
+  struct strhash_slot *slot = strhash_find(s, key, key_len, hash);
+  if (slot == NULL) {
     return NULL;
   }
 
-  n->hash = hash;
-  n->value = value;
-  n->next = NULL;
-  memcpy(n->key, key, key_len + 1);
-  *p = n;
-  s->items++;
+  size_t index = slot - s->slots;
+  size_t offset = index - (index % STRHASH_GROUP_WIDTH);
+
+  // A group that still has an empty slot has never been full, so no probe
+  // sequence ever continued past it and the slot can go straight back to
+  // empty. Otherwise lookups need to know to keep probing.
+  if (strhash_group_match(s->ctrl + offset, STRHASH_CTRL_EMPTY) != 0) {
+    s->ctrl[index] = STRHASH_CTRL_EMPTY;
+    s->growth_left++;
+  } else {
+    s->ctrl[index] = STRHASH_CTRL_DELETED;
+  }
+  s->items--;
+
+  struct strhash_node *n = slot->node;
+  void *value = n->value;
+  slab_free(s->nodes, n, strhash_node_size(n->key_len));
   return value;
 }
 
@@ -136,17 +761,19 @@ strhash_haskey(
     strhash *s,
     const char *key)
 {
-  unsigned long hash = strhash_djb2(key);
-  struct strhash_node ** p = &(s->table[hash % s->table_size]);
-  while (*p != NULL) {
-    if ((*p)->hash == hash && !strcmp(key, (*p)->key)) {
-      // The keys are the same, we can not overwrite the value as that might
-      // be creating a memory leak.
-      return true;
-    }
-  }
+  size_t key_len = strlen(key);
+  return strhash_find(s, key, key_len, strhash_hash(key, key_len)) != NULL;
+}
 
-  return false;
+
+bool
+strhash_haskey_n(
+    strhash *s,
+    const char *key,
+    size_t key_len,
+    uint64_t hash)
+{
+  return strhash_find(s, key, key_len, hash) != NULL;
 }
 
 
@@ -155,17 +782,24 @@ strhash_get(
     strhash *s,
     const char *key)
 {
-  unsigned long hash = strhash_djb2(key);
-  struct strhash_node ** p = &(s->table[hash % s->table_size]);
-  while (*p != NULL) {
-    if ((*p)->hash == hash && !strcmp(key, (*p)->key)) {
-      // The keys are the same, we can not overwrite the value as that might
-      // be creating a memory leak.
-      return (*p)->value;
-    }
+  size_t key_len = strlen(key);
+  return strhash_get_n(s, key, key_len, strhash_hash(key, key_len));
+}
+
+
+void *
+strhash_get_n(
+    strhash *s,
+    const char *key,
+    size_t key_len,
+    uint64_t hash)
+{
+  struct strhash_slot *slot = strhash_find(s, key, key_len, hash);
+  if (slot == NULL) {
+    return NULL;
   }
 
-  return NULL;
+  return slot->node->value;
 }
 
 
@@ -190,14 +824,17 @@ strhash_destroy(
     free_func = do_nothing;
   }
 
-  for (int i = 0; i < s->table_size; i++) {
-    struct strhash_node *p = s->table[i];
-    while (p != NULL) {
-      struct strhash_node *p_next = p->next;
-      free_func(p->value);
-      free(p);
-      p = p_next;
+  for (size_t i = 0; i < s->capacity; i++) {
+    if (s->ctrl[i] < 0) {
+      continue;
     }
+    struct strhash_node *n = s->slots[i].node;
+    free_func(n->value);
+    slab_free(s->nodes, n, strhash_node_size(n->key_len));
   }
-  free(s);
+
+  // The control bytes are part of the slots allocation.
+  irk_free(s->slots);
+  slab_destroy(s->nodes);
+  irk_free(s);
 }
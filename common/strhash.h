@@ -24,6 +24,8 @@ DEALINGS IN THE SOFTWARE.
 #define __COMMON_STRHASH_H
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
 // The strhash.c file uses an actual struct to store data, other classes
 // are only ever allowed to see void in order to prevent them from messing
@@ -36,20 +38,27 @@ typedef struct strhash strhash;
 
 
 /**
-  An implementation of the djb2 hash function.
+  Hashes a key for use in the strhash table.
 
-  This is a simple implementation of the djb2 hash function which is used
-  to has input strings in order to put them in the hash table.
+  This is an implementation of wyhash. It reads the key a word at a time
+  rather than a byte at a time, and mixes with a full width multiply so that
+  keys which share a long prefix (such as "/proc/net/dev/eth0/rx_bytes" and
+  "/proc/net/dev/eth1/rx_bytes") still distribute evenly.
+
+  Callers that look up the same key repeatedly can compute this once and
+  pass it to the _n variants of the table functions.
 
   Arguments:
-    string: A '\0' terminated character string to use for hashing.
+    key: The key to hash. This does not need to be '\0' terminated.
+    key_len: The number of bytes in key.
 
   Returns:
-    A hash.
+    A 64 bit hash.
  */
-unsigned long
-strhash_djb2(
-    const char *string);
+uint64_t
+strhash_hash(
+    const char *key,
+    size_t key_len);
 
 
 /**
@@ -59,11 +68,15 @@ strhash_djb2(
   results of this function, if not NULL, will need to be destroyed using the
   strhash_destroy call otherwise a memory leak will be created.
 
+  The table uses open addressing with one control byte per slot. Control
+  bytes are scanned a group at a time, so lookups rarely need to compare
+  more than one key.
+
   Arguments:
-    table_size: The initial size of the hash table. This should be roughly
-                three times larger than the expected data size or there will
-                be a performance penalty on all operations. Ideally this should
-                also be a prime number.
+    table_size: The number of items the table should be able to hold
+                before it needs to grow. The table grows automatically as
+                items are added so this is only a hint, but sizing it right
+                avoids rehashing while the table fills up.
 
   Returns:
     An initialized strhash structure.
@@ -108,6 +121,122 @@ strhash_add(
     void *value);
 
 
+/**
+  Same as strhash_add() but with an explicit key length and hash.
+
+  This skips both the strlen() of the key and the hashing, which matters
+  when the caller already knows them, for example when the key was
+  interned or was hashed for a previous call.
+
+  Arguments:
+    s: The strhash object created using strhash_init().
+    key: The key, this does not need to be '\0' terminated.
+    key_len: The number of bytes in key.
+    hash: The result of strhash_hash(key, key_len).
+    value: The value to add.
+
+  Returns:
+    The same as strhash_add().
+ */
+void *
+strhash_add_n(
+    strhash *s,
+    const char *key,
+    size_t key_len,
+    uint64_t hash,
+    void *value);
+
+
+/**
+  Sets the value for a key, replacing any existing value.
+
+  Unlike strhash_add() this will overwrite an existing value, handing the old
+  one back to the caller so that it can be freed. Replacing the value of an
+  existing key never allocates.
+
+  Arguments:
+    s: The strhash object created using strhash_init().
+    key: The '\0' terminated key to set the value at.
+    value: The new value.
+    old_value: If not NULL this is set to the value previously stored at key,
+               or NULL if the key was not in the table.
+
+  Returns:
+    0 on success, ENOMEM if the key was new and could not be added.
+ */
+int
+strhash_replace(
+    strhash *s,
+    const char *key,
+    void *value,
+    void **old_value);
+
+
+/**
+  Same as strhash_replace() but with an explicit key length and hash.
+
+  Arguments:
+    s: The strhash object created using strhash_init().
+    key: The key, this does not need to be '\0' terminated.
+    key_len: The number of bytes in key.
+    hash: The result of strhash_hash(key, key_len).
+    value: The new value.
+    old_value: Set the same way as in strhash_replace().
+
+  Returns:
+    The same as strhash_replace().
+ */
+int
+strhash_replace_n(
+    strhash *s,
+    const char *key,
+    size_t key_len,
+    uint64_t hash,
+    void *value,
+    void **old_value);
+
+
+/**
+  Removes a key from the table.
+
+  The memory used by the key is kept by the table and reused for keys added
+  later, so removing and re-adding keys does not call malloc() once the
+  table has reached its normal size.
+
+  Arguments:
+    s: The strhash object created using strhash_init().
+    key: The '\0' terminated key to remove.
+
+  Returns:
+    The value that was stored at key, or NULL if the key was not in the
+    table. The caller is responsible for freeing it.
+ */
+void *
+strhash_remove(
+    strhash *s,
+    const char *key);
+
+
+/**
+  Same as strhash_remove() but with an explicit key length and hash.
+
+  Arguments:
+    s: The strhash object created using strhash_init().
+    key: The key, this does not need to be '\0' terminated.
+    key_len: The number of bytes in key.
+    hash: The result of strhash_hash(key, key_len).
+
+  Returns:
+    The same as strhash_remove().
+ */
+void *
+strhash_remove_n(
+    strhash *s,
+    const char *key,
+    size_t key_len,
+    uint64_t hash);
+
+
 /**
   Returns true if a value is associated with the key already.
 
@@ -128,6 +257,28 @@ strhash_haskey(
     const char *key);
 
 
+/**
+  Same as strhash_haskey() but with an explicit key length and hash.
+
+  See strhash_add_n() for when these are worth using.
+
+  Arguments:
+    s: The strhash object created using strhash_init().
+    key: The key, this does not need to be '\0' terminated.
+    key_len: The number of bytes in key.
+    hash: The result of strhash_hash(key, key_len).
+
+  Returns:
+    The same as strhash_haskey().
+ */
+bool
+strhash_haskey_n(
+    strhash *s,
+    const char *key,
+    size_t key_len,
+    uint64_t hash);
+
+
 /**
   Returns the value associated with the given key.
 
@@ -149,6 +300,28 @@ strhash_get(
     const char *key);
 
 
+/**
+  Same as strhash_get() but with an explicit key length and hash.
+
+  See strhash_add_n() for when these are worth using.
+
+  Arguments:
+    s: The strhash object created using strhash_init().
+    key: The key, this does not need to be '\0' terminated.
+    key_len: The number of bytes in key.
+    hash: The result of strhash_hash(key, key_len).
+
+  Returns:
+    The same as strhash_get().
+ */
+void *
+strhash_get_n(
+    strhash *s,
+    const char *key,
+    size_t key_len,
+    uint64_t hash);
+
+
 /**
   Frees the memory associated with the given strhash structure.
 
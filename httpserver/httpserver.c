@@ -20,24 +20,972 @@ FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
 DEALINGS IN THE SOFTWARE.
 */
 
+#include <errno.h>
 #include <event.h>
 #include <evhttp.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/queue.h>
+#include <sys/time.h>
 
+#include <collector/refresh.h>
+#include <collector/scheduler.h>
+#include <common/compress.h>
+#include <common/fragment.h>
+#include <common/logging.h>
+#include <common/memory.h>
+#include <common/strhash.h>
+#include <httpserver/httpserver.h>
+#include <master/encoder.h>
+#include <master/history.h>
+#include <master/module.h>
+#include <master/module_data.h>
 
-void generic_request_handler(struct evhttp_request *req, void *arg)
+
+/** State for building a single response. */
+struct httpserver_response {
+  /** The body being built. */
+  struct evbuffer *body;
+
+  /** The decoded request path, without a trailing '/'. */
+  const char *path;
+
+  /** The format of the response. */
+  const struct encoder *encoder;
+
+  /** The content coding of the response. */
+  enum compress_encoding encoding;
+
+  /** Tracks the compressed body, unless encoding is COMPRESS_IDENTITY. */
+  struct compress_stream stream;
+
+  /** Only values changed after this generation are returned. */
+  uint64_t since;
+
+  /**
+    If not 0 the history of each value is returned instead, from this
+    many milliseconds ago.
+   */
+  int64_t history;
+
+  /** The time history starts at, in milliseconds since the epoch. */
+  int64_t history_after;
+
+  /** True if the request was for "/", which hides some modules. */
+  bool default_view;
+
+  /** True if the modules asked for should be refreshed first. */
+  bool refresh;
+
+  /** Number of values written to body so far. */
+  size_t values;
+
+  /** Number of modules that matched the request path. */
+  size_t modules;
+
+  /** Hash of the snapshots of every module that matched, see ETag below. */
+  uint64_t etag;
+};
+
+
+/** Called by libevent once it no longer needs a fragment's bytes. */
+static void
+httpserver_fragment_cleanup(
+    const void *data,
+    size_t len,
+    void *extra)
+{
+  fragment_release((fragment *) extra);
+}
+
+
+/**
+  Adds 'f' to the response body without copying it.
+
+  The body takes its own reference, so the caller keeps theirs.
+ */
+static int
+httpserver_add_reference(
+    struct httpserver_response *r,
+    fragment *f)
+{
+  fragment_ref(f);
+  if (evbuffer_add_reference(
+          r->body,
+          fragment_data(f),
+          fragment_length(f),
+          httpserver_fragment_cleanup,
+          f) != 0) {
+    fragment_release(f);
+    return ENOMEM;
+  }
+  return 0;
+}
+
+
+/**
+  Adds bytes that were produced for this response alone to the body.
+
+  They are framed for the content coding of the response, but they are
+  not compressed, that is only done to bytes that are shared between
+  requests.
+ */
+static int
+httpserver_add_bytes(
+    struct httpserver_response *r,
+    const char *data,
+    size_t len)
+{
+  if (r->encoding == COMPRESS_IDENTITY) {
+    return evbuffer_add(r->body, data, len) == 0 ? 0 : ENOMEM;
+  }
+  fragment *f = fragment_new(len + 16);
+  if (f == NULL) {
+    return ENOMEM;
+  }
+  int err = compress_stream_raw(&(r->stream), data, len, &f);
+  if (err == 0) {
+    err = httpserver_add_reference(r, f);
+  }
+  fragment_release(f);
+  return err;
+}
+
+
+/** Adds the separator if values have already been added. */
+static int
+httpserver_add_separator(
+    struct httpserver_response *r)
+{
+  if (r->values == 0) {
+    return 0;
+  }
+  const char *separator = r->encoder->separator;
+  return httpserver_add_bytes(r, separator, strlen(separator));
+}
+
+
+/** Adds the encoded values in 'f' to the response body. */
+static int
+httpserver_add_fragment(
+    struct httpserver_response *r,
+    fragment *f)
+{
+  if (fragment_length(f) == 0) {
+    return 0;
+  }
+  int err = httpserver_add_separator(r);
+  if (err != 0) {
+    return err;
+  }
+  if (r->encoding == COMPRESS_IDENTITY) {
+    return httpserver_add_reference(r, f);
+  }
+  return httpserver_add_bytes(r, fragment_data(f), fragment_length(f));
+}
+
+
+/** Adds the precompressed values in 'segment' to the response body. */
+static int
+httpserver_add_segment(
+    struct httpserver_response *r,
+    const compress_segment *segment)
+{
+  if (segment->length == 0) {
+    return 0;
+  }
+  int err = httpserver_add_separator(r);
+  if (err == 0) {
+    err = httpserver_add_reference(r, segment->data);
+  }
+  if (err == 0) {
+    compress_stream_segment(&(r->stream), segment);
+  }
+  return err;
+}
+
+
+/** Adds the header of the content coding, if it has one, to the body. */
+static int
+httpserver_stream_begin(
+    struct httpserver_response *r)
+{
+  if (r->encoding == COMPRESS_IDENTITY) {
+    return 0;
+  }
+  fragment *f = fragment_new(0);
+  if (f == NULL) {
+    return ENOMEM;
+  }
+  int err = compress_stream_begin(&(r->stream), r->encoding, &f);
+  if (err == 0 && fragment_length(f) > 0) {
+    err = httpserver_add_reference(r, f);
+  }
+  fragment_release(f);
+  return err;
+}
+
+
+/** Adds the trailer of the content coding, if it has one, to the body. */
+static int
+httpserver_stream_end(
+    struct httpserver_response *r)
+{
+  if (r->encoding == COMPRESS_IDENTITY) {
+    return 0;
+  }
+  fragment *f = fragment_new(0);
+  if (f == NULL) {
+    return ENOMEM;
+  }
+  int err = compress_stream_end(&(r->stream), &f);
+  if (err == 0 && fragment_length(f) > 0) {
+    err = httpserver_add_reference(r, f);
+  }
+  fragment_release(f);
+  return err;
+}
+
+
+/**
+  Starts the ETag of a response.
+
+  The same snapshots give different bytes depending on the arguments and
+  the negotiated format and coding, so those go into the tag too.
+ */
+static uint64_t
+httpserver_etag_seed(
+    const struct httpserver_response *r)
+{
+  uint64_t words[3] = {r->encoder->format, r->encoding, r->since};
+  return strhash_hash((const char *) words, sizeof(words));
+}
+
+
+/**
+  Adds the snapshot of 'mod' to an ETag.
+
+  Generations are never reused, so the generation alone tells snapshots
+  apart. The module is added as well so that modules that have not
+  published anything yet still count.
+ */
+static uint64_t
+httpserver_etag_mix(
+    uint64_t etag,
+    const module *mod,
+    const module_data *md)
+{
+  uint64_t words[3] = {
+    etag, (uintptr_t) mod, md != NULL ? md->generation : 0
+  };
+  return strhash_hash((const char *) words, sizeof(words));
+}
+
+
+/**
+  Works out the ETag of a response without building it.
+
+  This is a module_index_walk() callback. It matches modules exactly like
+  httpserver_add_module() and mixes them into the tag the same way.
+ */
+static int
+httpserver_etag_module(
+    module *mod,
+    void *user_data)
+{
+  struct httpserver_response *r = (struct httpserver_response *) user_data;
+  if (r->default_view && !mod->in_default_view) {
+    return 0;
+  }
+  r->modules++;
+  r->etag = httpserver_etag_mix(r->etag, mod, module_snapshot(mod));
+  return 0;
+}
+
+
+/**
+  Returns true if 'etag' is one of the tags in an If-None-Match header.
+
+  Tags are compared weakly, as RFC 7232 asks for If-None-Match.
+ */
+static bool
+httpserver_etag_matches(
+    const char *if_none_match,
+    const char *etag)
+{
+  size_t etag_len = strlen(etag);
+  const char *p = if_none_match;
+  while (*p != '\0') {
+    while (*p == ' ' || *p == '\t' || *p == ',') {
+      p++;
+    }
+    if (*p == '*') {
+      return true;
+    }
+    if (p[0] == 'W' && p[1] == '/') {
+      p += 2;
+    }
+    const char *tag = p;
+    while (*p != '\0' && *p != ',' && *p != ' ' && *p != '\t') {
+      p++;
+    }
+    if ((size_t) (p - tag) == etag_len && memcmp(tag, etag, etag_len) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+
+/** Collects the history of one module, see httpserver_add_history(). */
+struct httpserver_history {
+  struct httpserver_response *r;
+  fragment *f;
+  strhash *names;
+  size_t values;
+};
+
+
+/** Encodes the history of a value, this is a history_walk() callback. */
+static int
+httpserver_history_series(
+    module *mod,
+    const char *key,
+    size_t key_len,
+    uint8_t type,
+    const struct history_point *points,
+    size_t count,
+    void *user_data)
+{
+  struct httpserver_history *h = (struct httpserver_history *) user_data;
+  return h->r->encoder->write_history(
+      &(h->f), mod, key, key_len, type, points, count, h->names,
+      &(h->values));
+}
+
+
+/** Appends the history of the values of 'mod' below 'prefix'. */
+static int
+httpserver_add_history(
+    struct httpserver_response *r,
+    module *mod,
+    const char *prefix,
+    size_t prefix_len)
+{
+  struct httpserver_history h = {r, fragment_new(0), strhash_init(16), 0};
+  if (h.f == NULL || h.names == NULL) {
+    fragment_release(h.f);
+    if (h.names != NULL) {
+      strhash_destroy(h.names, NULL);
+    }
+    return ENOMEM;
+  }
+  // The separator between modules is added by httpserver_add_fragment(),
+  // so the first value of this module is encoded as if it was the first
+  // of the response.
+  int err = history_walk(
+      mod,
+      prefix,
+      prefix_len,
+      r->history_after,
+      httpserver_history_series,
+      &h);
+  if (err == 0) {
+    err = httpserver_add_fragment(r, h.f);
+  }
+  if (err == 0) {
+    r->values += h.values;
+  }
+  fragment_release(h.f);
+  strhash_destroy(h.names, NULL);
+  return err;
+}
+
+
+/**
+  Appends the values of 'mod' selected by the request to the response.
+
+  This must be called inside a module snapshot read section.
+
+  Returns:
+    0 so it can be used as a module_index_walk() callback, or ENOMEM.
+ */
+static int
+httpserver_add_module(
+    module *mod,
+    void *user_data)
+{
+  struct httpserver_response *r = (struct httpserver_response *) user_data;
+  if (r->default_view && !mod->in_default_view) {
+    return 0;
+  }
+  r->modules++;
+
+  // Nothing in a snapshot can have changed after it was published.
+  const module_data *md = module_snapshot(mod);
+  r->etag = httpserver_etag_mix(r->etag, mod, md);
+  if (md == NULL || (r->since != 0 && md->generation <= r->since)) {
+    return 0;
+  }
+
+  // Work out which part of the module the request is asking for.
+  size_t root_len = strlen(mod->registered_path);
+  const char *prefix = "";
+  if (strlen(r->path) > root_len) {
+    prefix = r->path + root_len + 1;
+  }
+  size_t prefix_len = strlen(prefix);
+
+  if (r->history != 0) {
+    return httpserver_add_history(r, mod, prefix, prefix_len);
+  }
+
+  // The encoding of the whole module is cached in the snapshot, both as
+  // is and compressed.
+  if (prefix_len == 0 && r->since == 0 &&
+      r->encoding != COMPRESS_IDENTITY) {
+    const compress_segment *cached =
+        encoder_module_compressed(r->encoder, r->encoding, mod, md);
+    if (cached == NULL) {
+      return ENOMEM;
+    }
+    int err = httpserver_add_segment(r, cached);
+    if (err == 0 && cached->length > 0) {
+      r->values += md->items;
+    }
+    return err;
+  } else if (prefix_len == 0 && r->since == 0) {
+    fragment *cached =
+        encoder_module_fragment(r->encoder, mod, md);
+    if (cached == NULL) {
+      return ENOMEM;
+    }
+    int err = httpserver_add_fragment(r, cached);
+    if (err == 0 && fragment_length(cached) > 0) {
+      r->values += md->items;
+    }
+    return err;
+  }
+
+  fragment *f = fragment_new(0);
+  if (f == NULL) {
+    return ENOMEM;
+  }
+  size_t values = 0;
+  int err = r->encoder->write(
+      &f, mod, md, prefix, prefix_len, r->since, &values);
+  if (err == 0) {
+    err = httpserver_add_fragment(r, f);
+  }
+  if (err == 0) {
+    r->values += values;
+  }
+  fragment_release(f);
+  return err;
+}
+
+
+/**
+  Parses a duration such as "90", "15m" or "2h", in seconds unless it
+  ends in 's', 'm', 'h' or 'd'.
+
+  Returns:
+    The duration in milliseconds, or -1 if it is not valid.
+ */
+static int64_t
+httpserver_parse_duration(
+    const char *value)
+{
+  char *end;
+  errno = 0;
+  long long parsed = strtoll(value, &end, 10);
+  if (errno != 0 || end == value || parsed < 0) {
+    return -1;
+  }
+  int64_t unit = 1000;
+  switch (*end) {
+    case '\0':
+    case 's':
+      break;
+    case 'm':
+      unit = 60 * 1000;
+      break;
+    case 'h':
+      unit = 60 * 60 * 1000;
+      break;
+    case 'd':
+      unit = 24 * 60 * 60 * 1000;
+      break;
+    default:
+      return -1;
+  }
+  if ((*end != '\0' && end[1] != '\0') || parsed > INT64_MAX / unit) {
+    return -1;
+  }
+  return parsed * unit;
+}
+
+
+/**
+  Removes every bare 'flag', one without a value, from 'query'.
+
+  libevent refuses to parse query strings with arguments that have no
+  value, so flags like "?refresh" are taken out before it sees them.
+
+  Returns:
+    true if 'flag' was found.
+ */
+static bool
+httpserver_take_flag(
+    char *query,
+    const char *flag)
+{
+  bool found = false;
+  size_t flag_len = strlen(flag);
+  char *arg = query;
+  while (*arg != '\0') {
+    size_t len = strcspn(arg, "&");
+    if (len == flag_len && memcmp(arg, flag, len) == 0) {
+      found = true;
+      // Drop the flag and the '&' after it, or the one before it if it
+      // was the last argument.
+      if (arg[len] == '&') {
+        memmove(arg, arg + len + 1, strlen(arg + len + 1) + 1);
+      } else {
+        if (arg != query) {
+          arg--;
+        }
+        *arg = '\0';
+      }
+      continue;
+    }
+    arg += len;
+    if (*arg == '&') {
+      arg++;
+    }
+  }
+  return found;
+}
+
+
+/**
+  Parses the arguments of a request.
+
+  Arguments:
+    req: The request.
+    r: The response, the since, history, refresh, encoder and encoding
+       members are set.
+
+  Returns:
+    0 if the arguments are valid, otherwise the HTTP status to fail the
+    request with.
+ */
+static int
+httpserver_parse_arguments(
+    struct evhttp_request *req,
+    struct httpserver_response *r)
+{
+  const char *raw_query =
+      evhttp_uri_get_query(evhttp_request_get_evhttp_uri(req));
+  struct evkeyvalq params;
+  TAILQ_INIT(&params);
+  r->refresh = false;
+  if (raw_query != NULL) {
+    size_t len = strlen(raw_query);
+    char *query = (char *) irk_malloc(len + 1);
+    if (query == NULL) {
+      return HTTP_SERVUNAVAIL;
+    }
+    memcpy(query, raw_query, len + 1);
+    r->refresh = httpserver_take_flag(query, "refresh");
+    int err = evhttp_parse_query_str(query, &params);
+    irk_free(query);
+    if (err != 0) {
+      return HTTP_BADREQUEST;
+    }
+  }
+
+  // "?refresh=1" works as well as "?refresh".
+  if (evhttp_find_header(&params, "refresh") != NULL) {
+    r->refresh = true;
+  }
+
+  int status = 0;
+  r->since = 0;
+  const char *value = evhttp_find_header(&params, "since");
+  if (value != NULL) {
+    char *end;
+    errno = 0;
+    unsigned long long parsed = strtoull(value, &end, 10);
+    if (errno != 0 || end == value || *end != '\0' || value[0] == '-') {
+      status = HTTP_BADREQUEST;
+    } else {
+      r->since = parsed;
+    }
+  }
+
+  r->history = 0;
+  value = evhttp_find_header(&params, "history");
+  if (value != NULL) {
+    r->history = httpserver_parse_duration(value);
+    if (r->history <= 0 || r->since != 0) {
+      status = HTTP_BADREQUEST;
+    }
+  }
+
+  // An explicit format wins over the Accept header, which is handy from a
+  // browser or curl.
+  value = evhttp_find_header(&params, "format");
+  if (value != NULL) {
+    r->encoder = encoder_find(value);
+    if (r->encoder == NULL) {
+      status = HTTP_BADREQUEST;
+    }
+  } else {
+    r->encoder = encoder_negotiate(evhttp_find_header(
+        evhttp_request_get_input_headers(req), "Accept"));
+    if (r->encoder == NULL) {
+      status = 406;
+    }
+  }
+
+  if (r->history != 0 && r->encoder != NULL &&
+      r->encoder->write_history == NULL) {
+    status = HTTP_BADREQUEST;
+  }
+
+  r->encoding = compress_negotiate(evhttp_find_header(
+      evhttp_request_get_input_headers(req), "Accept-Encoding"));
+
+  evhttp_clear_headers(&params);
+  return status;
+}
+
+
+/**
+  Adds the headers that both full and 304 responses carry. 'etag' may be
+  NULL if the response has none.
+ */
+static void
+httpserver_add_headers(
+    struct evhttp_request *req,
+    uint64_t generation,
+    const char *etag)
+{
+  char generation_header[24];
+  snprintf(
+      generation_header, sizeof(generation_header), "%" PRIu64, generation);
+  struct evkeyvalq *headers = evhttp_request_get_output_headers(req);
+  if (etag != NULL) {
+    evhttp_add_header(headers, "ETag", etag);
+  }
+  evhttp_add_header(headers, "Vary", "Accept, Accept-Encoding");
+  evhttp_add_header(headers, "X-Irk-Generation", generation_header);
+}
+
+
+/**
+  Answers 'req' from the current snapshots.
+
+  Arguments:
+    req: The request.
+    r: The parsed arguments of the request.
+    path: The decoded request path, which is freed.
+ */
+static void
+httpserver_respond(
+    struct evhttp_request *req,
+    struct httpserver_response *r,
+    char *path)
 {
-  struct evbuffer *returnbuffer = evbuffer_new();
+  r->body = evbuffer_new();
+  if (r->body == NULL) {
+    free(path);
+    evhttp_send_error(req, HTTP_SERVUNAVAIL, NULL);
+    return;
+  }
+  r->path = path;
+  r->default_view = strcmp(path, "/") == 0;
+
+  if (module_snapshot_enter() != 0) {
+    free(path);
+    evbuffer_free(r->body);
+    evhttp_send_error(req, HTTP_SERVUNAVAIL, NULL);
+    return;
+  }
+
+  // Taken before any snapshot is looked at, so a client passing this back
+  // as since can never miss a change. At worst it sees one twice.
+  uint64_t generation = module_current_generation();
+  module *owner = module_index_find(path);
+  char etag[24];
 
-  evbuffer_add_printf(returnbuffer, "%s", req->uri);
-  evhttp_send_reply(req, HTTP_OK, "Client", returnbuffer);
-  evbuffer_free(returnbuffer);
-  return;
+  // Most polls come back before anything has changed, those are answered
+  // from the generations alone without encoding anything.
+  const char *if_none_match = evhttp_find_header(
+      evhttp_request_get_input_headers(req), "If-None-Match");
+  if (if_none_match != NULL && r->history == 0) {
+    r->etag = httpserver_etag_seed(r);
+    int err = 0;
+    if (owner != NULL) {
+      httpserver_etag_module(owner, r);
+    } else {
+      err = module_index_walk(path, httpserver_etag_module, r);
+    }
+    snprintf(etag, sizeof(etag), "\"%016" PRIx64 "\"", r->etag);
+    if (err == 0 && r->modules > 0 &&
+        httpserver_etag_matches(if_none_match, etag)) {
+      module_snapshot_exit();
+      free(path);
+      evbuffer_free(r->body);
+      httpserver_add_headers(req, generation, etag);
+      evhttp_send_reply(req, 304, "Not Modified", NULL);
+      return;
+    }
+    r->modules = 0;
+  }
+
+  if (r->history != 0) {
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    r->history_after =
+        (int64_t) now.tv_sec * 1000 + now.tv_usec / 1000 - r->history;
+  }
+
+  // The tag sent is worked out from the snapshots actually used, which
+  // may be newer than the ones checked above.
+  r->etag = httpserver_etag_seed(r);
+  const struct encoder *e = r->encoder;
+  int err = httpserver_stream_begin(r);
+  if (err == 0) {
+    err = httpserver_add_bytes(r, e->prologue, strlen(e->prologue));
+  }
+  if (err == 0) {
+    if (owner != NULL) {
+      err = httpserver_add_module(owner, r);
+    } else {
+      err = module_index_walk(path, httpserver_add_module, r);
+    }
+  }
+  if (err == 0) {
+    err = httpserver_add_bytes(r, e->epilogue, strlen(e->epilogue));
+  }
+  if (err == 0) {
+    err = httpserver_stream_end(r);
+  }
+  module_snapshot_exit();
+  free(path);
+
+  if (err != 0) {
+    evbuffer_free(r->body);
+    evhttp_send_error(req, HTTP_SERVUNAVAIL, NULL);
+    return;
+  }
+  if (r->modules == 0) {
+    evbuffer_free(r->body);
+    evhttp_send_error(req, HTTP_NOTFOUND, NULL);
+    return;
+  }
+
+  snprintf(etag, sizeof(etag), "\"%016" PRIx64 "\"", r->etag);
+  struct evkeyvalq *headers = evhttp_request_get_output_headers(req);
+  evhttp_add_header(headers, "Content-Type", e->content_type);
+  if (r->encoding != COMPRESS_IDENTITY) {
+    evhttp_add_header(
+        headers, "Content-Encoding", compress_encoding_name(r->encoding));
+  }
+  httpserver_add_headers(req, generation, r->history == 0 ? etag : NULL);
+  evhttp_send_reply(req, HTTP_OK, "OK", r->body);
+  evbuffer_free(r->body);
+}
+
+
+/** A request waiting on modules to be collected before it is answered. */
+struct httpserver_wait {
+  struct evhttp_request *req;
+  struct httpserver_response r;
+  char *path;
+
+  /** The number of collections still to finish. */
+  size_t pending;
+};
+
+
+/** Called as each collection a request waits on finishes. */
+static void
+httpserver_collected(
+    void *done_data)
+{
+  struct httpserver_wait *wait = (struct httpserver_wait *) done_data;
+  if (--wait->pending > 0) {
+    return;
+  }
+  httpserver_respond(wait->req, &(wait->r), wait->path);
+  irk_free(wait);
+}
+
+
+/** State for httpserver_collect_module(). */
+struct httpserver_collect {
+  struct evhttp_request *req;
+  struct httpserver_response *r;
+  char *path;
+
+  /** Created by the first module that has to be waited on. */
+  struct httpserver_wait *wait;
+};
+
+
+/**
+  Notes that a module is being read and, if it was asked to be refreshed
+  or has not been collected lately, has it collected, called for each by
+  module_index_walk().
+
+  Returns:
+    0, or ENOMEM if the request could not be made to wait.
+ */
+static int
+httpserver_collect_module(
+    module *mod,
+    void *user_data)
+{
+  struct httpserver_collect *c = (struct httpserver_collect *) user_data;
+  if (c->r->default_view && !mod->in_default_view) {
+    return 0;
+  }
+  bool idle = scheduler_touch(mod);
+  if (!idle && !c->r->refresh) {
+    return 0;
+  }
+
+  if (c->wait == NULL) {
+    c->wait = (struct httpserver_wait *) irk_malloc(
+        sizeof(struct httpserver_wait));
+    if (c->wait == NULL) {
+      return ENOMEM;
+    }
+    c->wait->req = c->req;
+    c->wait->r = *(c->r);
+    c->wait->path = c->path;
+
+    // Held until every collection has been started, so that one
+    // finishing straight away can not answer the request early.
+    c->wait->pending = 1;
+  }
+
+  // Modules that can not be collected now are simply answered from their
+  // current snapshot.
+  bool waiting = false;
+  if (c->r->refresh) {
+    waiting = refresh_request(mod, httpserver_collected, c->wait);
+  }
+  if (!waiting && idle) {
+    waiting = scheduler_wake(mod, httpserver_collected, c->wait);
+  }
+  if (waiting) {
+    c->wait->pending++;
+  }
+  return 0;
+}
+
+
+/**
+  Serves every request.
+
+  The path selects what is returned: a path owned by a module returns that
+  module's values below it, any other path returns every module registered
+  below it. "/" returns every module in the default view.
+
+  The format is picked with '?format=' (json, prometheus or binary) or the
+  Accept header, and defaults to JSON, see master/encoder.h. Responses are
+  compressed with gzip or zstd if Accept-Encoding allows it, using the
+  compressed encoding of whole modules kept in each snapshot so that
+  nothing is compressed per request, see common/compress.h.
+
+  Every response carries an X-Irk-Generation header. Passing that back as
+  '?since=' returns only the values that changed after it was taken.
+  Values that disappear are not reported by such a request.
+
+  Every response also carries an ETag made from the generations of the
+  modules in it. A request with a matching If-None-Match gets a 304
+  without anything being encoded.
+
+  '?history=15m' returns every sample of each numeric value taken over
+  the last 15 minutes (or "90s", "2h" and so on, see master/history.h)
+  rather than only the latest, in any format. These
+  responses change as time passes even if nothing is published, so they
+  have no ETag.
+
+  '?refresh' collects the modules asked for again before answering, by
+  calling their refresh callbacks. At most one refresh of a module runs at
+  a time and every request that asks while it does is answered from its
+  result, see collector/refresh.h.
+  Modules that have not been read for a while may not have been collected
+  lately, see collector/scheduler.h, and are collected before answering
+  too.
+ */
+static void
+httpserver_request_handler(
+    struct evhttp_request *req,
+    void *arg)
+{
+  enum evhttp_cmd_type command = evhttp_request_get_command(req);
+  if (command != EVHTTP_REQ_GET && command != EVHTTP_REQ_HEAD) {
+    evhttp_send_error(req, 405, "Method Not Allowed");
+    return;
+  }
+
+  struct httpserver_response r;
+  memset(&r, 0, sizeof(r));
+  int status = httpserver_parse_arguments(req, &r);
+  if (status != 0) {
+    evhttp_send_error(req, status, NULL);
+    return;
+  }
+
+  const struct evhttp_uri *uri = evhttp_request_get_evhttp_uri(req);
+  const char *raw_path = evhttp_uri_get_path(uri);
+  if (raw_path == NULL || raw_path[0] == '\0') {
+    raw_path = "/";
+  }
+  char *path = evhttp_uridecode(raw_path, 0, NULL);
+  if (path == NULL) {
+    evhttp_send_error(req, HTTP_BADREQUEST, "Invalid path");
+    return;
+  }
+  size_t path_len = strlen(path);
+  while (path_len > 1 && path[path_len - 1] == '/') {
+    path[--path_len] = '\0';
+  }
+
+  r.default_view = strcmp(path, "/") == 0;
+  struct httpserver_collect c = {
+    .req = req,
+    .r = &r,
+    .path = path,
+  };
+  module *owner = module_index_find(path);
+  if (owner != NULL) {
+    httpserver_collect_module(owner, &c);
+  } else {
+    module_index_walk(path, httpserver_collect_module, &c);
+  }
+  if (c.wait != NULL) {
+    httpserver_collected(c.wait);
+  } else {
+    httpserver_respond(req, &r, path);
+  }
 }
 
 
-void httpserver_init(
+int
+httpserver_init(
     struct event_base *eb,
-    char *addr,
+    const char *addr,
     int port)
 {
   struct evhttp *http = NULL;
@@ -45,12 +993,16 @@ void httpserver_init(
   // Start the HTTP server.
   http = evhttp_new(eb);
   if (http == NULL) {
-    // FIXME(brady): Log the error?
+    log_error("Unable to create the HTTP server.");
+    return ENOMEM;
   }
 
   if (evhttp_bind_socket(http, addr, port) != 0) {
-    // FIXME(brady): Log the error?
+    log_error("Unable to bind the HTTP server to %s:%d", addr, port);
+    evhttp_free(http);
+    return EADDRINUSE;
   }
 
-  evhttp_set_gencb(http, generic_request_handler, NULL);
+  evhttp_set_gencb(http, httpserver_request_handler, NULL);
+  return 0;
 }
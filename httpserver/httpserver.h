@@ -23,8 +23,30 @@ DEALINGS IN THE SOFTWARE.
 #ifndef __HTTPSERVER_HTTPSERVER_H
 #define __HTTPSERVER_HTTPSERVER_H
 
-
-int httpserver_main(int port, char *addr);
+#include <event.h>
+
+
+/**
+  Starts serving module data over HTTP.
+
+  Requests are handled on the event loop of 'eb'. See
+  httpserver_request_handler() for what is served.
+
+  Arguments:
+    eb: The event base to serve requests from.
+    addr: The address to listen on.
+    port: The port to listen on.
+
+  Returns:
+    0 on success.
+    ENOMEM if the server could not be created.
+    EADDRINUSE if the address could not be bound.
+ */
+int
+httpserver_init(
+    struct event_base *eb,
+    const char *addr,
+    int port);
 
 
 #endif
@@ -23,22 +23,458 @@ DEALINGS IN THE SOFTWARE.
 #ifndef __IRK_API_H
 #define __IRK_API_H
 
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/time.h>
+
 #ifndef IRK_MODULE_DATA_DEFINED
 #define IRK_MODULE_DATA_DEFINED
 // TODO(brady): Document me!
 typedef void module;
 // TODO(brady): Document me!
 typedef void module_data;
+/** A histogram with fixed buckets, see new_histogram(). */
+typedef void irk_histogram;
+/** A quantile sketch, see new_sketch(). */
+typedef void irk_sketch;
 #endif
 
 // TODO(brady): Document me!
 enum irk_value_type {
   IRK_STRING,
   IRK_INT,
-  IRK_DOUBLE
+  IRK_DOUBLE,
+  IRK_HISTOGRAM,
+  IRK_SKETCH
 };
 
 
+/**
+  Creates an empty module_data object.
+
+  Every callback registered by a module returns one of these holding the
+  values collected by that call. Values are appended with add_string_value(),
+  add_int_value() and add_double_value() and irk takes ownership of the
+  object once it is returned from the callback.
+
+  All of the values are packed together into a single block of memory, so
+  passing in roughly how many values will be added avoids having to grow it
+  while they are added.
+
+  Arguments:
+    size_hint: The expected number of values, or 0 if unknown.
+
+  Returns:
+    A new module_data object, or NULL on failure.
+ */
+module_data *
+new_module_data(
+    size_t size_hint);
+
+
+/**
+  Adds a string value to a module_data object.
+
+  Both the key and value are copied. Keys are not checked for duplicates so
+  each key should only be added once.
+
+  Arguments:
+    md: The module_data object returned from new_module_data().
+    key: The name of the value, relative to the module's root path.
+    value: The string to store.
+
+  Returns:
+    0 on success.
+    EINVAL if any argument is NULL or the key is longer than 65535 bytes.
+    ENOMEM on allocation failure.
+ */
+int
+add_string_value(
+    module_data *md,
+    const char *key,
+    const char *value);
+
+
+/**
+  Adds an integer value to a module_data object.
+
+  Arguments and return values are the same as add_string_value().
+ */
+int
+add_int_value(
+    module_data *md,
+    const char *key,
+    int64_t value);
+
+
+/**
+  Adds a floating point value to a module_data object.
+
+  Arguments and return values are the same as add_string_value().
+ */
+int
+add_double_value(
+    module_data *md,
+    const char *key,
+    double value);
+
+
+/**
+  Returns a numeric ID for one of this module's keys.
+
+  Modules normally export the same keys every cycle. Looking each key up
+  once when the module is initialized and then adding values with
+  add_string_value_by_id() and friends avoids copying, hashing and
+  comparing the key on every cycle. The ID stays valid for the life of the
+  process.
+
+  Arguments:
+    mod:
+      The module reference that this is associated with. This is passed in
+      to the irk_module_init function that is called to setup the module.
+    key: The name of the value, relative to the module's root path.
+
+  Returns:
+    A non zero ID on success, or 0 on failure with errno set to EINVAL if
+    mod or key is NULL or key is too long, or ENOMEM.
+ */
+uint32_t
+register_key(
+    module *mod,
+    const char *key);
+
+
+/**
+  Same as add_string_value() but with a key from register_key().
+
+  Returns:
+    The same as add_string_value(), EINVAL if key_id is not valid.
+ */
+int
+add_string_value_by_id(
+    module_data *md,
+    uint32_t key_id,
+    const char *value);
+
+
+/**
+  Same as add_int_value() but with a key from register_key().
+
+  Returns:
+    The same as add_int_value(), EINVAL if key_id is not valid.
+ */
+int
+add_int_value_by_id(
+    module_data *md,
+    uint32_t key_id,
+    int64_t value);
+
+
+/**
+  Same as add_double_value() but with a key from register_key().
+
+  Returns:
+    The same as add_double_value(), EINVAL if key_id is not valid.
+ */
+int
+add_double_value_by_id(
+    module_data *md,
+    uint32_t key_id,
+    double value);
+
+
+/**
+  Declares a metric that this module exports every cycle.
+
+  A module whose keys are the same every cycle can declare them all once,
+  normally in irk_module_init, and then build each cycle's data with
+  new_schema_data() and set_int_slot() and friends. The keys are never
+  looked at again and irk works out how each one is written out ahead of
+  time, so a cycle costs one store per value.
+
+  Metrics can not be declared once new_schema_data() has been called.
+
+  Arguments:
+    mod:
+      The module reference that this is associated with. This is passed in
+      to the irk_module_init function that is called to setup the module.
+    key: The name of the value, relative to the module's root path.
+    type: IRK_STRING, IRK_INT or IRK_DOUBLE.
+    slot: Set to the index to pass to the set_*_slot() calls. Slots are
+          numbered from 0 in the order they are declared.
+
+  Returns:
+    0 on success.
+    EINVAL if any argument is NULL, the key is longer than 65535 bytes or
+      the type can not be declared.
+    EEXIST if the key has already been declared.
+    EBUSY if new_schema_data() has already been called.
+    ENOMEM on allocation failure.
+    ENOSPC if the process has run out of key IDs.
+ */
+int
+declare_metric(
+    module *mod,
+    const char *key,
+    enum irk_value_type type,
+    uint32_t *slot);
+
+
+/**
+  Creates a module_data object holding every metric declared with
+  declare_metric().
+
+  Every value starts out as 0, 0.0 or the empty string and is filled in
+  with set_int_slot() and friends. More values can still be appended with
+  add_string_value() and the rest. The object is returned from a callback
+  like any other, and once irk is done with it the memory is handed back
+  to a later call of this.
+
+  Arguments:
+    mod: The module the metrics were declared for.
+
+  Returns:
+    A new module_data object, or NULL with errno set to EINVAL if no
+    metrics were declared, or ENOMEM.
+ */
+module_data *
+new_schema_data(
+    module *mod);
+
+
+/**
+  Sets the value of a metric declared as an IRK_STRING.
+
+  The value is copied.
+
+  Arguments:
+    md: The module_data object returned from new_schema_data().
+    slot: The slot returned from declare_metric().
+    value: The string to store.
+
+  Returns:
+    0 on success.
+    EINVAL if md was not made by new_schema_data(), value is NULL, or slot
+      is not a declared metric of this type.
+    ENOMEM on allocation failure.
+ */
+int
+set_string_slot(
+    module_data *md,
+    uint32_t slot,
+    const char *value);
+
+
+/**
+  Sets the value of a metric declared as an IRK_INT.
+
+  Arguments and return values are the same as set_string_slot(), this
+  never fails with ENOMEM.
+ */
+int
+set_int_slot(
+    module_data *md,
+    uint32_t slot,
+    int64_t value);
+
+
+/**
+  Sets the value of a metric declared as an IRK_DOUBLE.
+
+  Arguments and return values are the same as set_int_slot().
+ */
+int
+set_double_slot(
+    module_data *md,
+    uint32_t slot,
+    double value);
+
+
+/**
+  Creates an empty histogram.
+
+  Histograms count values in fixed log-linear buckets: every power of two
+  from 2^-20 to 2^44 is split into 8 equal buckets, with one more bucket
+  each for everything below and above that range. So a bucket is never
+  more than 12.5% wide, and as every histogram has the same buckets any
+  two can be merged.
+
+  A module keeps its histograms for as long as it likes, recording into
+  them with histogram_record() from any thread, and adds a copy of one to
+  each module_data with add_histogram_value(). Like a counter, a histogram
+  holds everything recorded since it was created.
+
+  Returns:
+    The histogram, or NULL on allocation failure.
+ */
+irk_histogram *
+new_histogram(void);
+
+
+/**
+  Counts 'value' in a histogram.
+
+  This takes no locks and never allocates, it is a single atomic increment
+  plus an atomic update of the sum, so it is cheap enough for hot paths
+  and safe to call from many threads at once. NaN is ignored.
+
+  Arguments:
+    h: The histogram.
+    value: The value to count.
+ */
+void
+histogram_record(
+    irk_histogram *h,
+    double value);
+
+
+/**
+  Adds everything counted in 'from' to 'h'.
+
+  Like histogram_record() this may be called while either histogram is
+  being recorded into.
+
+  Returns:
+    0 on success, EINVAL if either histogram is NULL.
+ */
+int
+histogram_merge(
+    irk_histogram *h,
+    const irk_histogram *from);
+
+
+/** Frees a histogram, which may be NULL. */
+void
+free_histogram(
+    irk_histogram *h);
+
+
+/**
+  Creates an empty quantile sketch.
+
+  A sketch answers quantile queries (the median, 99th percentile and so
+  on) to within a relative accuracy, so with 0.01 the reported 99th
+  percentile is within 1% of the true one. It uses about 1.15 / accuracy
+  bins per factor of 10 between min_value and max_value, allocated here so
+  that recording never has to. Values outside of that range are counted
+  as the nearest end of it.
+
+  Sketches with the same accuracy can be merged with sketch_merge(), and
+  are used the same way as histograms.
+
+  Arguments:
+    relative_accuracy: Greater than 0 and less than 1.
+    min_value: The smallest value to be recorded accurately, above 0.
+    max_value: The largest value to be recorded accurately.
+
+  Returns:
+    The sketch, or NULL with errno set to EINVAL if the arguments are not
+    valid or the range needs more than 65536 bins, or ENOMEM.
+ */
+irk_sketch *
+new_sketch(
+    double relative_accuracy,
+    double min_value,
+    double max_value);
+
+
+/**
+  Counts 'value' in a sketch.
+
+  This costs a log() and the same atomic updates as histogram_record().
+ */
+void
+sketch_record(
+    irk_sketch *s,
+    double value);
+
+
+/**
+  Adds everything counted in 'from' to 's'.
+
+  Returns:
+    0 on success, EINVAL if either sketch is NULL or they were created with
+    a different relative accuracy.
+ */
+int
+sketch_merge(
+    irk_sketch *s,
+    const irk_sketch *from);
+
+
+/** Frees a sketch, which may be NULL. */
+void
+free_sketch(
+    irk_sketch *s);
+
+
+/**
+  Adds a copy of a histogram to a module_data object.
+
+  Only the buckets that are not empty are copied, and 'h' may be recorded
+  into while this runs.
+
+  Arguments and return values are the same as add_string_value().
+ */
+int
+add_histogram_value(
+    module_data *md,
+    const char *key,
+    const irk_histogram *h);
+
+
+/**
+  Same as add_histogram_value() but with a key from register_key().
+
+  Returns:
+    The same as add_histogram_value(), EINVAL if key_id is not valid.
+ */
+int
+add_histogram_value_by_id(
+    module_data *md,
+    uint32_t key_id,
+    const irk_histogram *h);
+
+
+/**
+  Adds a copy of a sketch to a module_data object.
+
+  Arguments and return values are the same as add_histogram_value().
+ */
+int
+add_sketch_value(
+    module_data *md,
+    const char *key,
+    const irk_sketch *s);
+
+
+/**
+  Same as add_sketch_value() but with a key from register_key().
+
+  Returns:
+    The same as add_sketch_value(), EINVAL if key_id is not valid.
+ */
+int
+add_sketch_value_by_id(
+    module_data *md,
+    uint32_t key_id,
+    const irk_sketch *s);
+
+
+/**
+  Frees a module_data object.
+
+  This is only needed if the module decides not to return an object it has
+  created, irk frees the ones returned from callbacks itself.
+
+  Arguments:
+    md: The module_data object to free, may be NULL.
+ */
+void
+free_module_data(
+    module_data *md);
+
+
 /**
   Creates a new module object.
 
@@ -86,7 +522,10 @@ new_module_object(
 
   Returns:
     0 on success.
-    EINVAL if mod is NULL.
+    EINVAL if mod or path is NULL, or path is not a valid path.
+    EEXIST if another module has already claimed this path.
+    ENOMEM if the timer callback of the module could not be rescheduled
+    for the new path, see register_timer_callback().
  */
 int
 set_root_path(
@@ -109,6 +548,13 @@ set_root_path(
   complicate the irk runtime, or even introduce instability. If not carefully
   considered it may also introduce non-consistent monitoring output.
 
+  Note:
+    The callback runs on one of irk's worker threads, not the thread that
+    called irk_module_init, and may run after this returns. None of the
+    other callbacks of this module run until it has returned. Callbacks of
+    other modules, including other instances loaded from the same file,
+    do run at the same time, so any state they share must be locked.
+
   Arguments:
     mod:
       The module reference that this is associated with. This is passed in
@@ -124,6 +570,7 @@ set_root_path(
   Returns:
     0 on success.
     EINVAL if mod is NULL.
+    ENOMEM if the callback could not be queued.
  */
 int
 register_initial_callback(
@@ -139,6 +586,18 @@ register_initial_callback(
   by the variable 'cycle_time'. There is no assurances that the time between
   runs will match cycle_time, as various things can delay execution.
 
+  Modules with the same cycle_time are collected together, one after the
+  other, so a few common cycle times are cheaper than many slightly
+  different ones.
+
+  Note:
+    The callback runs on one of irk's worker threads, which need not be
+    the same one each time. A call never starts while the previous one, or
+    the module's initial or refresh callback, is still running, so the
+    callbacks of one module never overlap and need no locking between
+    themselves. Callbacks of other modules, including other instances
+    loaded from the same file, do run at the same time.
+
   Arguments:
     mod:
       The module reference that this is associated with. This is passed in
@@ -153,6 +612,7 @@ register_initial_callback(
   Returns:
     0 on success,
     EINVAL if cycle_time is not valid or mod is NULL.
+    ENOMEM on allocation failure.
  */
 int
 register_timer_callback(
@@ -162,6 +622,34 @@ register_timer_callback(
     struct timeval *cycle_time);
 
 
+/**
+  Sets how long the timer callback of this module may run.
+
+  A callback still running at its deadline marks the module's data as
+  stale. Cycles that come round while it is still running are skipped
+  rather than queued, and once it returns the module is skipped for a
+  cycle, then 2, 4 and so on up to 64 cycles for each deadline missed in a
+  row, so that a module stuck on something like a hung NFS mount does not
+  take the rest of the collection down with it.
+
+  By default the deadline is the module's cycle_time.
+
+  Arguments:
+    mod:
+      The module reference that this is associated with. This is passed in
+      to the irk_module_init function that is called to setup the module.
+    deadline: The longest a single call of the timer callback should take.
+
+  Returns:
+    0 on success,
+    EINVAL if deadline is not valid or mod is NULL.
+ */
+int
+set_timer_deadline(
+    module *mod,
+    struct timeval *deadline);
+
+
 /**
   Sets the function to call when the client requests refreshed data.
 
@@ -179,6 +667,13 @@ register_timer_callback(
     You can completely disable refreshing for this module by specifically
     setting this function to NULL.
 
+  Note:
+    The callback runs on one of irk's worker threads, like the timer
+    callback. It is never started while the module's initial or timer
+    callback, or another refresh, is running. A request that asks for a
+    refresh then waits on the call already running instead, so the
+    callbacks of one module never overlap.
+
   Arguments:
     mod:
       The module reference that this is associated with. This is passed in
@@ -191,7 +686,9 @@ register_timer_callback(
       the function specified by 'refresh' as 'user_data'. This data will
       not be used in any other way by irk.
     minimum_time:
-      The minimum time that must pass between calls to the refresh function.
+      The minimum time that must pass between calls to the refresh function,
+      or NULL for no minimum. Requests for a refresh that come sooner are
+      answered with the data already cached.
 
   Returns:
     0 on success.
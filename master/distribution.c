@@ -0,0 +1,406 @@
+/*
+Copyright (C) 2012 Brady Catherman
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include <errno.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <common/memory.h>
+#include <master/distribution.h>
+
+// Sketches are allocated up front, this keeps a silly range from taking
+// all of memory. At 1% accuracy it still covers 2^-500 to 2^500.
+#define DISTRIBUTION_SKETCH_MAX_BINS 65536
+
+// The last histogram bucket, which holds everything too large.
+#define DISTRIBUTION_HISTOGRAM_OVERFLOW (DISTRIBUTION_HISTOGRAM_BUCKETS - 1)
+
+
+const struct distribution_reported
+distribution_quantiles[DISTRIBUTION_QUANTILES] = {
+  {"0.5", 0.5},
+  {"0.9", 0.9},
+  {"0.99", 0.99},
+  {"0.999", 0.999},
+};
+
+
+/**
+  Adds 'value' to the double held in the bits at 'sum'.
+
+  There is no atomic add for doubles, so this retries a compare and swap
+  of the bits until no other thread got in first.
+ */
+static void
+distribution_add_sum(
+    uint64_t *sum,
+    double value)
+{
+  uint64_t old_bits = __atomic_load_n(sum, __ATOMIC_RELAXED);
+  uint64_t new_bits;
+  do {
+    double d;
+    memcpy(&d, &old_bits, sizeof(d));
+    d += value;
+    memcpy(&new_bits, &d, sizeof(d));
+  } while (!__atomic_compare_exchange_n(
+      sum, &old_bits, new_bits, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+
+/** Returns the double held in the bits at 'sum'. */
+static double
+distribution_load_sum(
+    const uint64_t *sum)
+{
+  uint64_t bits = __atomic_load_n(sum, __ATOMIC_RELAXED);
+  double d;
+  memcpy(&d, &bits, sizeof(d));
+  return d;
+}
+
+
+/**
+  Returns the histogram bucket 'value' falls in.
+
+  The exponent and top mantissa bits of a double already are a log-linear
+  bucket number. The bits of the next smaller double are used so that a
+  value exactly on a bucket boundary goes in the bucket below, making the
+  upper bound of each bucket inclusive as Prometheus expects.
+ */
+static size_t
+distribution_histogram_index(
+    double value)
+{
+  if (!(value > 0)) {
+    return 0;
+  }
+  uint64_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  bits--;
+  int exponent = (int) (bits >> 52) - 1023;
+  if (exponent < DISTRIBUTION_HISTOGRAM_MIN_EXPONENT) {
+    return 0;
+  } else if (exponent > DISTRIBUTION_HISTOGRAM_MAX_EXPONENT) {
+    return DISTRIBUTION_HISTOGRAM_OVERFLOW;
+  }
+  size_t sub = (bits >> (52 - DISTRIBUTION_HISTOGRAM_SUB_BITS)) &
+      ((1 << DISTRIBUTION_HISTOGRAM_SUB_BITS) - 1);
+  return 1 + (((size_t) (exponent - DISTRIBUTION_HISTOGRAM_MIN_EXPONENT)) <<
+      DISTRIBUTION_HISTOGRAM_SUB_BITS) + sub;
+}
+
+
+irk_histogram *
+new_histogram(void)
+{
+  return (irk_histogram *) irk_calloc(1, sizeof(irk_histogram));
+}
+
+
+void
+histogram_record(
+    irk_histogram *h,
+    double value)
+{
+  if (h == NULL || isnan(value)) {
+    return;
+  }
+  __atomic_fetch_add(
+      &(h->buckets[distribution_histogram_index(value)]), 1,
+      __ATOMIC_RELAXED);
+  distribution_add_sum(&(h->sum), value);
+}
+
+
+int
+histogram_merge(
+    irk_histogram *h,
+    const irk_histogram *from)
+{
+  if (h == NULL || from == NULL) {
+    return EINVAL;
+  }
+  for (size_t i = 0; i < DISTRIBUTION_HISTOGRAM_BUCKETS; i++) {
+    uint64_t count = __atomic_load_n(&(from->buckets[i]), __ATOMIC_RELAXED);
+    if (count != 0) {
+      __atomic_fetch_add(&(h->buckets[i]), count, __ATOMIC_RELAXED);
+    }
+  }
+  distribution_add_sum(&(h->sum), distribution_load_sum(&(from->sum)));
+  return 0;
+}
+
+
+void
+free_histogram(
+    irk_histogram *h)
+{
+  irk_free(h);
+}
+
+
+irk_sketch *
+new_sketch(
+    double relative_accuracy,
+    double min_value,
+    double max_value)
+{
+  if (!(relative_accuracy > 0 && relative_accuracy < 1) ||
+      !(min_value > 0 && min_value < max_value) || isinf(max_value)) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  double gamma = (1 + relative_accuracy) / (1 - relative_accuracy);
+  double log_gamma = log(gamma);
+  double min_index = ceil(log(min_value) / log_gamma);
+  double max_index = ceil(log(max_value) / log_gamma);
+  if (max_index - min_index + 1 > DISTRIBUTION_SKETCH_MAX_BINS) {
+    errno = EINVAL;
+    return NULL;
+  }
+  uint32_t bins = (uint32_t) (max_index - min_index + 1);
+
+  irk_sketch *s = (irk_sketch *) irk_calloc(
+      1, sizeof(irk_sketch) + bins * sizeof(uint64_t));
+  if (s == NULL) {
+    errno = ENOMEM;
+    return NULL;
+  }
+  s->gamma = gamma;
+  s->log_gamma = log_gamma;
+  s->min_index = (int64_t) min_index;
+  s->bins = bins;
+  return s;
+}
+
+
+/** Returns the bin of 's' that holds values in index 'index'. */
+static uint32_t
+distribution_sketch_bin(
+    const irk_sketch *s,
+    int64_t index)
+{
+  if (index < s->min_index) {
+    return 0;
+  } else if (index - s->min_index >= s->bins) {
+    return s->bins - 1;
+  }
+  return (uint32_t) (index - s->min_index);
+}
+
+
+void
+sketch_record(
+    irk_sketch *s,
+    double value)
+{
+  if (s == NULL || isnan(value)) {
+    return;
+  }
+  // Anything outside of the range given to new_sketch(), including zero
+  // and negative values, is counted in the bin at that end.
+  uint32_t bin = 0;
+  if (value > 0) {
+    double index = ceil(log(value) / s->log_gamma);
+    if (index >= (double) (s->min_index + s->bins)) {
+      bin = s->bins - 1;
+    } else if (index > (double) s->min_index) {
+      bin = (uint32_t) ((int64_t) index - s->min_index);
+    }
+  }
+  __atomic_fetch_add(&(s->counts[bin]), 1, __ATOMIC_RELAXED);
+  distribution_add_sum(&(s->sum), value);
+}
+
+
+int
+sketch_merge(
+    irk_sketch *s,
+    const irk_sketch *from)
+{
+  if (s == NULL || from == NULL || s->gamma != from->gamma) {
+    return EINVAL;
+  }
+  for (uint32_t i = 0; i < from->bins; i++) {
+    uint64_t count = __atomic_load_n(&(from->counts[i]), __ATOMIC_RELAXED);
+    if (count != 0) {
+      uint32_t bin = distribution_sketch_bin(s, from->min_index + i);
+      __atomic_fetch_add(&(s->counts[bin]), count, __ATOMIC_RELAXED);
+    }
+  }
+  distribution_add_sum(&(s->sum), distribution_load_sum(&(from->sum)));
+  return 0;
+}
+
+
+void
+free_sketch(
+    irk_sketch *s)
+{
+  irk_free(s);
+}
+
+
+/**
+  Writes the bins of 'counts' that are not empty after a header to 'out',
+  returning the bytes written.
+ */
+static size_t
+distribution_store(
+    const uint64_t *counts,
+    size_t bins,
+    int64_t first_index,
+    const uint64_t *sum,
+    double gamma,
+    char *out)
+{
+  struct distribution_header header = {
+    .count = 0,
+    .gamma = gamma,
+    .bins = 0,
+  };
+  char *p = out + sizeof(header);
+  for (size_t i = 0; i < bins; i++) {
+    // Each count is read once so the bins and total always agree, even
+    // while values are being recorded.
+    uint64_t count = __atomic_load_n(&(counts[i]), __ATOMIC_RELAXED);
+    if (count == 0) {
+      continue;
+    }
+    struct distribution_bin bin = {
+      .index = first_index + (int64_t) i,
+      .count = count,
+    };
+    memcpy(p, &bin, sizeof(bin));
+    p += sizeof(bin);
+    header.count += count;
+    header.bins++;
+  }
+  header.sum = distribution_load_sum(sum);
+  memcpy(out, &header, sizeof(header));
+  return p - out;
+}
+
+
+size_t
+distribution_histogram_size(
+    const irk_histogram *h)
+{
+  return sizeof(struct distribution_header) +
+      DISTRIBUTION_HISTOGRAM_BUCKETS * sizeof(struct distribution_bin);
+}
+
+
+size_t
+distribution_histogram_store(
+    const irk_histogram *h,
+    char *out)
+{
+  return distribution_store(
+      h->buckets, DISTRIBUTION_HISTOGRAM_BUCKETS, 0, &(h->sum), 0, out);
+}
+
+
+size_t
+distribution_sketch_size(
+    const irk_sketch *s)
+{
+  return sizeof(struct distribution_header) +
+      s->bins * sizeof(struct distribution_bin);
+}
+
+
+size_t
+distribution_sketch_store(
+    const irk_sketch *s,
+    char *out)
+{
+  return distribution_store(
+      s->counts, s->bins, s->min_index, &(s->sum), s->gamma, out);
+}
+
+
+double
+distribution_histogram_bound(
+    int64_t index)
+{
+  if (index <= 0) {
+    return ldexp(1, DISTRIBUTION_HISTOGRAM_MIN_EXPONENT);
+  } else if (index >= DISTRIBUTION_HISTOGRAM_OVERFLOW) {
+    return INFINITY;
+  }
+  int64_t sub = (index - 1) & ((1 << DISTRIBUTION_HISTOGRAM_SUB_BITS) - 1);
+  int exponent = DISTRIBUTION_HISTOGRAM_MIN_EXPONENT +
+      (int) ((index - 1) >> DISTRIBUTION_HISTOGRAM_SUB_BITS);
+  return ldexp(
+      1 + (double) (sub + 1) / (1 << DISTRIBUTION_HISTOGRAM_SUB_BITS),
+      exponent);
+}
+
+
+double
+distribution_sketch_value(
+    double gamma,
+    int64_t index)
+{
+  // The point with the same relative distance to both ends of the bin.
+  return 2 * pow(gamma, (double) index) / (gamma + 1);
+}
+
+
+double
+distribution_quantile(
+    const char *stored,
+    double q)
+{
+  struct distribution_header header;
+  memcpy(&header, stored, sizeof(header));
+  if (header.count == 0) {
+    return NAN;
+  }
+  if (q < 0) {
+    q = 0;
+  } else if (q > 1) {
+    q = 1;
+  }
+
+  double rank = q * (double) (header.count - 1);
+  const char *p = stored + sizeof(header);
+  struct distribution_bin bin;
+  uint64_t seen = 0;
+  for (uint64_t i = 0; i < header.bins; i++) {
+    memcpy(&bin, p, sizeof(bin));
+    p += sizeof(bin);
+    seen += bin.count;
+    if ((double) seen > rank) {
+      break;
+    }
+  }
+  if (header.gamma == 0) {
+    return distribution_histogram_bound(bin.index);
+  }
+  return distribution_sketch_value(header.gamma, bin.index);
+}
@@ -0,0 +1,216 @@
+/*
+Copyright (C) 2012 Brady Catherman
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef __MASTER_DISTRIBUTION_H
+#define __MASTER_DISTRIBUTION_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <master/module.h>
+
+/**
+  Histograms and quantile sketches.
+
+  Both count how many recorded values fall into each of a fixed set of
+  bins, which is what lets recording be a single relaxed atomic increment
+  with no locks and no allocation:
+
+  An irk_histogram has fixed log-linear buckets. Every power of two from
+  2^DISTRIBUTION_HISTOGRAM_MIN_EXPONENT up to
+  2^(DISTRIBUTION_HISTOGRAM_MAX_EXPONENT + 1) is split into 8 equal
+  buckets, so a bucket is at most 12.5% wide. Bucket 0 holds everything
+  below that range (including zero and negative values) and the last
+  bucket everything above it. Every histogram has the same buckets, so
+  they can always be added together.
+
+  An irk_sketch is a DDSketch: bin i holds values in (gamma^(i-1),
+  gamma^i] where gamma = (1 + a) / (1 - a) for a relative accuracy a, so
+  any quantile read from it is within a of the true value. Bins are
+  allocated for the range of values given when it is created. Sketches
+  with the same gamma can be merged by adding the counts of equal bins.
+
+  Values are recorded as 'cumulative since created', like a counter, and
+  add_histogram_value() and add_sketch_value() copy the bins that are not
+  empty into a module_data. In the module_data the value is a
+  distribution_header followed by the bins, stored like a long string.
+ */
+
+
+/** Every power of two in a histogram is split into 2^this buckets. */
+#define DISTRIBUTION_HISTOGRAM_SUB_BITS 3
+
+/** The range of powers of two covered by histogram buckets. */
+#define DISTRIBUTION_HISTOGRAM_MIN_EXPONENT (-20)
+#define DISTRIBUTION_HISTOGRAM_MAX_EXPONENT 43
+
+/** The number of histogram buckets, including the two out of range ones. */
+#define DISTRIBUTION_HISTOGRAM_BUCKETS \
+  (2 + ((DISTRIBUTION_HISTOGRAM_MAX_EXPONENT - \
+         DISTRIBUTION_HISTOGRAM_MIN_EXPONENT + 1) << \
+        DISTRIBUTION_HISTOGRAM_SUB_BITS))
+
+
+struct irk_histogram {
+  /** The count of values in each bucket. */
+  uint64_t buckets[DISTRIBUTION_HISTOGRAM_BUCKETS];
+
+  /** The bits of the double holding the sum of all values. */
+  uint64_t sum;
+};
+
+
+struct irk_sketch {
+  /** The base of the bins, see above. */
+  double gamma;
+
+  /** log(gamma), kept so recording is a single log(). */
+  double log_gamma;
+
+  /** The index of the first bin. */
+  int64_t min_index;
+
+  /** The number of bins. */
+  uint32_t bins;
+
+  /** The bits of the double holding the sum of all values. */
+  uint64_t sum;
+
+  /** The count of values in each bin. */
+  uint64_t counts[];
+};
+
+
+/** The start of a histogram or sketch value stored in a module_data. */
+struct distribution_header {
+  /** The number of values recorded. */
+  uint64_t count;
+
+  /** Their sum. */
+  double sum;
+
+  /** The gamma of a sketch, 0 for a histogram. */
+  double gamma;
+
+  /** The number of distribution_bins that follow. */
+  uint64_t bins;
+};
+
+
+/** A bin that is not empty, in increasing order of index. */
+struct distribution_bin {
+  int64_t index;
+  uint64_t count;
+};
+
+
+/** The quantiles the encoders report for sketches. */
+#define DISTRIBUTION_QUANTILES 4
+struct distribution_reported {
+  /** The quantile as text, for use as a name or label. */
+  const char *label;
+  double q;
+};
+extern const struct distribution_reported
+distribution_quantiles[DISTRIBUTION_QUANTILES];
+
+
+/**
+  Returns the most bytes a stored copy of 'h' can take.
+
+  Histograms are usually sparse, so once stored they normally take much
+  less than this.
+ */
+size_t
+distribution_histogram_size(
+    const irk_histogram *h);
+
+
+/**
+  Copies 'h' to 'out' in its stored form.
+
+  Arguments:
+    h: The histogram, which may be recorded into at the same time.
+    out: At least distribution_histogram_size() bytes, not necessarily
+         aligned.
+
+  Returns:
+    The number of bytes written.
+ */
+size_t
+distribution_histogram_store(
+    const irk_histogram *h,
+    char *out);
+
+
+/** Same as distribution_histogram_size() for a sketch. */
+size_t
+distribution_sketch_size(
+    const irk_sketch *s);
+
+
+/** Same as distribution_histogram_store() for a sketch. */
+size_t
+distribution_sketch_store(
+    const irk_sketch *s,
+    char *out);
+
+
+/**
+  Returns the upper bound of histogram bucket 'index', which is included
+  in the bucket, or infinity for the last bucket.
+ */
+double
+distribution_histogram_bound(
+    int64_t index);
+
+
+/**
+  Returns the value reported for sketch bin 'index', which is within the
+  sketch's relative accuracy of every value in the bin.
+ */
+double
+distribution_sketch_value(
+    double gamma,
+    int64_t index);
+
+
+/**
+  Estimates quantile 'q' (0 to 1) of a stored value.
+
+  For a histogram this is the upper bound of the bucket the quantile falls
+  in, for a sketch it is within the sketch's relative accuracy.
+
+  Arguments:
+    stored: The stored value, not necessarily aligned.
+    q: The quantile.
+
+  Returns:
+    The estimate, or NaN if nothing was recorded.
+ */
+double
+distribution_quantile(
+    const char *stored,
+    double q);
+
+
+#endif
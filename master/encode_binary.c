@@ -0,0 +1,439 @@
+/*
+Copyright (C) 2012 Brady Catherman
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <common/fragment.h>
+#include <master/distribution.h>
+#include <master/encoder.h>
+#include <master/intern.h>
+#include <master/module_data.h>
+
+/**
+  Compact binary output.
+
+  The format is described in client/decode.h, which is the decoder for it.
+  Each module with selected values is written as three frames: a module
+  frame with its path and generation, a keys frame naming every key ID
+  used and a values frame with the values themselves. Key IDs are the ones
+  from intern_key(), so keys that were registered with register_key() are
+  never hashed or compared here.
+
+  History is written as a module frame followed by a history frame for
+  each series, which carries its key itself since series are not kept by
+  key ID.
+ */
+
+#define ENCODE_BINARY_FRAME_MODULE 0x01
+#define ENCODE_BINARY_FRAME_KEYS 0x02
+#define ENCODE_BINARY_FRAME_VALUES 0x03
+#define ENCODE_BINARY_FRAME_HISTORY 0x04
+
+// Low two bits of each value header.
+#define ENCODE_BINARY_VALUE_INT 0
+#define ENCODE_BINARY_VALUE_DOUBLE 1
+#define ENCODE_BINARY_VALUE_STRING 2
+#define ENCODE_BINARY_VALUE_DISTRIBUTION 3
+
+// The byte that starts a distribution value.
+#define ENCODE_BINARY_DISTRIBUTION_HISTOGRAM 0
+#define ENCODE_BINARY_DISTRIBUTION_SKETCH 1
+
+// The longest a varint can be.
+#define ENCODE_BINARY_VARINT_MAX 10
+
+
+/** Writes 'value' to 'buffer' as a varint, returning its length. */
+static size_t
+encode_binary_varint_bytes(
+    uint8_t *buffer,
+    uint64_t value)
+{
+  size_t len = 0;
+  while (value >= 0x80) {
+    buffer[len++] = (uint8_t) value | 0x80;
+    value >>= 7;
+  }
+  buffer[len++] = (uint8_t) value;
+  return len;
+}
+
+
+/** Appends 'value' to 'out' as a varint. */
+static int
+encode_binary_varint(
+    fragment **out,
+    uint64_t value)
+{
+  uint8_t buffer[ENCODE_BINARY_VARINT_MAX];
+  size_t len = encode_binary_varint_bytes(buffer, value);
+  return fragment_append(out, buffer, len);
+}
+
+
+/** Zigzag encoding keeps small negative numbers short as varints. */
+static uint64_t
+encode_binary_zigzag(
+    int64_t value)
+{
+  return ((uint64_t) value << 1) ^ (uint64_t) (value >> 63);
+}
+
+
+/** Appends the 8 bytes of 'value' to 'out', least significant first. */
+static int
+encode_binary_double(
+    fragment **out,
+    double value)
+{
+  uint64_t bits;
+  uint8_t bytes[8];
+  memcpy(&bits, &value, sizeof(bits));
+  for (int i = 0; i < 8; i++) {
+    bytes[i] = (uint8_t) (bits >> (8 * i));
+  }
+  return fragment_append(out, bytes, sizeof(bytes));
+}
+
+
+/**
+  Appends a frame to 'out'.
+
+  The payload is 'count' as a varint followed by the bytes of 'body'.
+ */
+static int
+encode_binary_frame(
+    fragment **out,
+    uint8_t tag,
+    uint64_t count,
+    const fragment *body)
+{
+  uint8_t header[1 + 2 * ENCODE_BINARY_VARINT_MAX];
+  uint8_t count_bytes[ENCODE_BINARY_VARINT_MAX];
+  size_t count_len = encode_binary_varint_bytes(count_bytes, count);
+
+  header[0] = tag;
+  size_t len = 1 + encode_binary_varint_bytes(
+      header + 1, count_len + fragment_length(body));
+  memcpy(header + len, count_bytes, count_len);
+  len += count_len;
+
+  int err = fragment_append(out, header, len);
+  if (err == 0) {
+    err = fragment_append(out, fragment_data(body), fragment_length(body));
+  }
+  return err;
+}
+
+
+/** Appends the module frame for 'mod' to 'out'. */
+static int
+encode_binary_module_frame(
+    fragment **out,
+    const module *mod,
+    uint64_t generation)
+{
+  size_t root_len = strlen(mod->registered_path);
+  uint8_t header[1 + 3 * ENCODE_BINARY_VARINT_MAX];
+  uint8_t payload[2 * ENCODE_BINARY_VARINT_MAX];
+  size_t payload_len = encode_binary_varint_bytes(payload, generation);
+  payload_len += encode_binary_varint_bytes(payload + payload_len, root_len);
+
+  header[0] = ENCODE_BINARY_FRAME_MODULE;
+  size_t len = 1 + encode_binary_varint_bytes(
+      header + 1, payload_len + root_len);
+  memcpy(header + len, payload, payload_len);
+  len += payload_len;
+
+  int err = fragment_append(out, header, len);
+  if (err == 0) {
+    err = fragment_append(out, mod->registered_path, root_len);
+  }
+  return err;
+}
+
+
+/**
+  Appends the stored histogram or sketch 'stored' to 'out'.
+
+  The bins are in order of index, so each index is written as the change
+  from the one before, which is nearly always small.
+ */
+static int
+encode_binary_distribution(
+    fragment **out,
+    const char *stored)
+{
+  struct distribution_header header;
+  memcpy(&header, stored, sizeof(header));
+  uint8_t kind = ENCODE_BINARY_DISTRIBUTION_HISTOGRAM;
+  if (header.gamma != 0) {
+    kind = ENCODE_BINARY_DISTRIBUTION_SKETCH;
+  }
+
+  int err = fragment_append(out, &kind, 1);
+  if (err == 0) {
+    err = encode_binary_varint(out, header.count);
+  }
+  if (err == 0) {
+    err = encode_binary_double(out, header.sum);
+  }
+  if (err == 0 && kind == ENCODE_BINARY_DISTRIBUTION_SKETCH) {
+    err = encode_binary_double(out, header.gamma);
+  }
+  if (err == 0) {
+    err = encode_binary_varint(out, header.bins);
+  }
+
+  const char *p = stored + sizeof(header);
+  int64_t previous = 0;
+  for (uint64_t i = 0; i < header.bins && err == 0; i++) {
+    struct distribution_bin bin;
+    memcpy(&bin, p, sizeof(bin));
+    p += sizeof(bin);
+    err = encode_binary_varint(out, encode_binary_zigzag(bin.index - previous));
+    if (err == 0) {
+      err = encode_binary_varint(out, bin.count);
+    }
+    previous = bin.index;
+  }
+  return err;
+}
+
+
+/**
+  Appends the value of 'slot' to 'out', headed by the change in key ID
+  from the previous value.
+ */
+static int
+encode_binary_value(
+    fragment **out,
+    const module_data *md,
+    const module_data_slot *slot,
+    int64_t id_delta)
+{
+  static const uint8_t types[] = {
+    [IRK_STRING] = ENCODE_BINARY_VALUE_STRING,
+    [IRK_INT] = ENCODE_BINARY_VALUE_INT,
+    [IRK_DOUBLE] = ENCODE_BINARY_VALUE_DOUBLE,
+    [IRK_HISTOGRAM] = ENCODE_BINARY_VALUE_DISTRIBUTION,
+    [IRK_SKETCH] = ENCODE_BINARY_VALUE_DISTRIBUTION,
+  };
+
+  int err = encode_binary_varint(
+      out, (encode_binary_zigzag(id_delta) << 2) | types[slot->type]);
+  if (err != 0) {
+    return err;
+  }
+
+  switch (slot->type) {
+    case IRK_STRING:
+      err = encode_binary_varint(out, slot->string_length);
+      if (err == 0) {
+        err = fragment_append(
+            out, module_data_string(md, slot), slot->string_length);
+      }
+      break;
+    case IRK_INT:
+      err = encode_binary_varint(out, encode_binary_zigzag(slot->value.i));
+      break;
+    case IRK_DOUBLE:
+      err = encode_binary_double(out, slot->value.d);
+      break;
+    case IRK_HISTOGRAM:
+    case IRK_SKETCH:
+      err = encode_binary_distribution(
+          out, module_data_distribution(md, slot));
+      break;
+  }
+  return err;
+}
+
+
+static int
+encode_binary_write(
+    fragment **out,
+    module *mod,
+    const module_data *md,
+    const char *prefix,
+    size_t prefix_len,
+    uint64_t since,
+    size_t *values)
+{
+  // The counts lead each frame, so the entries are gathered first.
+  fragment *keys = fragment_new(0);
+  fragment *vals = fragment_new(0);
+  if (keys == NULL || vals == NULL) {
+    fragment_release(keys);
+    fragment_release(vals);
+    return ENOMEM;
+  }
+
+  const module_data_slot *slots = module_data_slots(md);
+  uint32_t previous_id = 0;
+  size_t count = 0;
+  int err = 0;
+
+  for (uint32_t i = 0; i < md->items && err == 0; i++) {
+    const module_data_slot *slot = &slots[i];
+    if (since != 0 && slot->changed <= since) {
+      continue;
+    }
+    const char *key = module_data_key(md, slot);
+    if (!encoder_key_selected(key, slot->key_length, prefix, prefix_len)) {
+      continue;
+    }
+
+    // Published snapshots have their keys interned already, see
+    // module_data_intern_keys().
+    uint32_t id = slot->key_offset;
+    if (!(slot->flags & MODULE_DATA_SLOT_KEY_ID)) {
+      id = intern_key(mod, key, slot->key_length);
+      if (id == 0) {
+        err = ENOMEM;
+        break;
+      }
+    }
+
+    // Modules add their keys in about the same order every cycle and
+    // IDs are handed out in that order, so the deltas are mostly 1.
+    int64_t delta = (int64_t) id - (int64_t) previous_id;
+    err = encode_binary_varint(&keys, encode_binary_zigzag(delta));
+    if (err == 0) {
+      err = encode_binary_varint(&keys, slot->key_length);
+    }
+    if (err == 0) {
+      err = fragment_append(&keys, key, slot->key_length);
+    }
+    if (err == 0) {
+      err = encode_binary_value(&vals, md, slot, delta);
+    }
+    previous_id = id;
+    count++;
+  }
+
+  // Modules with nothing selected are left out entirely.
+  if (err == 0 && count > 0) {
+    err = encode_binary_module_frame(out, mod, md->generation);
+    if (err == 0) {
+      err = encode_binary_frame(out, ENCODE_BINARY_FRAME_KEYS, count, keys);
+    }
+    if (err == 0) {
+      err = encode_binary_frame(
+          out, ENCODE_BINARY_FRAME_VALUES, count, vals);
+    }
+    if (err == 0) {
+      *values += count;
+    }
+  }
+
+  fragment_release(keys);
+  fragment_release(vals);
+  return err;
+}
+
+
+static int
+encode_binary_write_history(
+    fragment **out,
+    module *mod,
+    const char *key,
+    size_t key_len,
+    uint8_t type,
+    const struct history_point *points,
+    size_t count,
+    strhash *names,
+    size_t *values)
+{
+  // The history of each module is encoded as if it started the response,
+  // so the first series of a module brings its module frame.
+  int err = 0;
+  if (*values == 0) {
+    err = encode_binary_module_frame(
+        out, mod, __atomic_load_n(&(mod->generation), __ATOMIC_ACQUIRE));
+    if (err != 0) {
+      return err;
+    }
+  }
+
+  fragment *body = fragment_new(key_len + count * 4);
+  if (body == NULL) {
+    return ENOMEM;
+  }
+  uint8_t kind = ENCODE_BINARY_VALUE_INT;
+  if (type == IRK_DOUBLE) {
+    kind = ENCODE_BINARY_VALUE_DOUBLE;
+  }
+  err = fragment_append(&body, &kind, 1);
+  if (err == 0) {
+    err = encode_binary_varint(&body, key_len);
+  }
+  if (err == 0) {
+    err = fragment_append(&body, key, key_len);
+  }
+
+  // Samples are taken once a cycle and counters mostly go up by a little,
+  // so both times and integers are written as the change from the one
+  // before.
+  int64_t previous_time = 0;
+  int64_t previous_i = 0;
+  for (size_t i = 0; i < count && err == 0; i++) {
+    err = encode_binary_varint(
+        &body, encode_binary_zigzag(points[i].time - previous_time));
+    previous_time = points[i].time;
+    if (err != 0) {
+      break;
+    }
+    if (type == IRK_DOUBLE) {
+      err = encode_binary_double(&body, points[i].value.d);
+    } else {
+      err = encode_binary_varint(
+          &body, encode_binary_zigzag(
+              (int64_t) ((uint64_t) points[i].value.i - (uint64_t) previous_i)));
+      previous_i = points[i].value.i;
+    }
+  }
+
+  if (err == 0) {
+    err = encode_binary_frame(out, ENCODE_BINARY_FRAME_HISTORY, count, body);
+  }
+  if (err == 0) {
+    (*values)++;
+  }
+  fragment_release(body);
+  return err;
+}
+
+
+const struct encoder encoder_binary = {
+  .name = "binary",
+  .format = ENCODER_BINARY,
+  .content_type = "application/x-irk",
+  .prologue = "IRK\x01",
+  .separator = "",
+  .epilogue = "",
+  .write = encode_binary_write,
+  .write_history = encode_binary_write_history,
+  .write_name = NULL,
+};
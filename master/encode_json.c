@@ -0,0 +1,378 @@
+/*
+Copyright (C) 2012 Brady Catherman
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include <errno.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <common/fragment.h>
+#include <master/distribution.h>
+#include <master/encoder.h>
+#include <master/module_data.h>
+
+/**
+  JSON output.
+
+  A response is a single JSON object mapping the full path of each value
+  (the module's registered_path, a '/', then the key) to the value. NaN
+  and infinite doubles have no JSON representation and are written as
+  null.
+
+  Histograms and sketches are objects:
+
+    {"count":12,"sum":3.5,"buckets":[[0.25,10],[0.28125,2]]}
+
+  where each bucket that is not empty is its inclusive upper bound (null
+  for the last, unbounded one) and count, and
+
+    {"count":12,"sum":3.5,"quantiles":{"0.5":0.24,...},"gamma":1.02,
+     "bins":[[-70,10],[-64,2]]}
+
+  where the quantiles are estimates and the bins are the DDSketch bin
+  index and count, so that sketches can be merged by whatever reads them.
+
+  History maps the path of each value to its samples, each being the time
+  in milliseconds since the epoch and the value:
+
+    {"/net/dev/eth0/rx_bytes":[[1352000000000,10],[1352000005000,12]]}
+ */
+
+
+/**
+  Appends 'string' to 'out' escaped for use inside a JSON string.
+
+  Runs of characters that need no escaping are copied in one go, which for
+  metric names is usually the whole string.
+ */
+static int
+encode_json_escaped(
+    fragment **out,
+    const char *string,
+    size_t len)
+{
+  size_t start = 0;
+  int err = 0;
+  for (size_t i = 0; i < len && err == 0; i++) {
+    unsigned char c = string[i];
+    if (c >= 0x20 && c != '"' && c != '\\') {
+      continue;
+    }
+    err = fragment_append(out, string + start, i - start);
+    if (err == 0 && (c == '"' || c == '\\')) {
+      err = fragment_appendf(out, "\\%c", c);
+    } else if (err == 0) {
+      err = fragment_appendf(out, "\\u%04x", c);
+    }
+    start = i + 1;
+  }
+  if (err != 0) {
+    return err;
+  }
+  return fragment_append(out, string + start, len - start);
+}
+
+
+/** Appends 'value' to 'out', or null if it is not finite. */
+static int
+encode_json_double(
+    fragment **out,
+    double value)
+{
+  if (isfinite(value)) {
+    return encoder_append_double(out, value);
+  }
+  return fragment_append(out, "null", 4);
+}
+
+
+/** Appends the stored histogram or sketch 'stored' to 'out'. */
+static int
+encode_json_distribution(
+    fragment **out,
+    const char *stored)
+{
+  struct distribution_header header;
+  memcpy(&header, stored, sizeof(header));
+  bool sketch = header.gamma != 0;
+
+  int err = fragment_append(out, "{\"count\":", 9);
+  if (err == 0) {
+    err = encoder_append_int(out, (int64_t) header.count);
+  }
+  if (err == 0) {
+    err = fragment_append(out, ",\"sum\":", 7);
+  }
+  if (err == 0) {
+    err = encode_json_double(out, header.sum);
+  }
+  if (sketch) {
+    for (int i = 0; i < DISTRIBUTION_QUANTILES && err == 0; i++) {
+      err = fragment_appendf(
+          out,
+          "%s\"%s\":",
+          i == 0 ? ",\"quantiles\":{" : ",",
+          distribution_quantiles[i].label);
+      if (err == 0) {
+        err = encode_json_double(
+            out, distribution_quantile(stored, distribution_quantiles[i].q));
+      }
+    }
+    if (err == 0) {
+      err = fragment_append(out, "},\"gamma\":", 10);
+    }
+    if (err == 0) {
+      err = encoder_append_double(out, header.gamma);
+    }
+    if (err == 0) {
+      err = fragment_append(out, ",\"bins\":[", 9);
+    }
+  } else if (err == 0) {
+    err = fragment_append(out, ",\"buckets\":[", 12);
+  }
+
+  const char *p = stored + sizeof(header);
+  for (uint64_t i = 0; i < header.bins && err == 0; i++) {
+    struct distribution_bin bin;
+    memcpy(&bin, p, sizeof(bin));
+    p += sizeof(bin);
+
+    err = fragment_append(out, i == 0 ? "[" : ",[", i == 0 ? 1 : 2);
+    if (err == 0 && sketch) {
+      err = encoder_append_int(out, bin.index);
+    } else if (err == 0) {
+      err = encode_json_double(out, distribution_histogram_bound(bin.index));
+    }
+    if (err == 0) {
+      err = fragment_append(out, ",", 1);
+    }
+    if (err == 0) {
+      err = encoder_append_int(out, (int64_t) bin.count);
+    }
+    if (err == 0) {
+      err = fragment_append(out, "]", 1);
+    }
+  }
+  if (err == 0) {
+    err = fragment_append(out, "]}", 2);
+  }
+  return err;
+}
+
+
+/** Appends the value of 'slot' to 'out' as JSON. */
+static int
+encode_json_value(
+    fragment **out,
+    const module_data *md,
+    const module_data_slot *slot)
+{
+  int err = 0;
+  switch (slot->type) {
+    case IRK_STRING:
+      err = fragment_append(out, "\"", 1);
+      if (err == 0) {
+        err = encode_json_escaped(
+            out, module_data_string(md, slot), slot->string_length);
+      }
+      if (err == 0) {
+        err = fragment_append(out, "\"", 1);
+      }
+      break;
+    case IRK_INT:
+      err = encoder_append_int(out, slot->value.i);
+      break;
+    case IRK_DOUBLE:
+      err = encode_json_double(out, slot->value.d);
+      break;
+    case IRK_HISTOGRAM:
+    case IRK_SKETCH:
+      err = encode_json_distribution(out, module_data_distribution(md, slot));
+      break;
+  }
+  return err;
+}
+
+
+/**
+  Appends the full path of a value as an object member name, preceded by a
+  ',' unless it is the first value in the response.
+ */
+static int
+encode_json_name(
+    fragment **out,
+    const char *root,
+    size_t root_len,
+    const char *key,
+    size_t key_len,
+    size_t values)
+{
+  int err = 0;
+  if (values != 0) {
+    err = fragment_append(out, ",", 1);
+  }
+  if (err == 0) {
+    err = fragment_append(out, "\"", 1);
+  }
+  if (err == 0) {
+    err = encode_json_escaped(out, root, root_len);
+  }
+  if (err == 0) {
+    err = fragment_append(out, "/", 1);
+  }
+  if (err == 0) {
+    err = encode_json_escaped(out, key, key_len);
+  }
+  if (err == 0) {
+    err = fragment_append(out, "\":", 2);
+  }
+  return err;
+}
+
+
+/** Appends a name from encode_json_write_name() like encode_json_name(). */
+static int
+encode_json_name_copy(
+    fragment **out,
+    const char *name,
+    size_t name_len,
+    size_t values)
+{
+  if (values != 0 && fragment_append(out, ",", 1) != 0) {
+    return ENOMEM;
+  }
+  return fragment_append(out, name, name_len);
+}
+
+
+static int
+encode_json_write(
+    fragment **out,
+    module *mod,
+    const module_data *md,
+    const char *prefix,
+    size_t prefix_len,
+    uint64_t since,
+    size_t *values)
+{
+  const char *root = mod->registered_path;
+  size_t root_len = strlen(root);
+  const module_data_slot *slots = module_data_slots(md);
+
+  for (uint32_t i = 0; i < md->items; i++) {
+    const module_data_slot *slot = &slots[i];
+    if (since != 0 && slot->changed <= since) {
+      continue;
+    }
+    const char *key = module_data_key(md, slot);
+    if (!encoder_key_selected(key, slot->key_length, prefix, prefix_len)) {
+      continue;
+    }
+
+    // Declared metrics have their names ready to copy.
+    size_t name_len;
+    const char *name =
+        encoder_schema_name(&encoder_json, mod, md, i, &name_len);
+    int err;
+    if (name != NULL) {
+      err = encode_json_name_copy(out, name, name_len, *values);
+    } else {
+      err = encode_json_name(
+          out, root, root_len, key, slot->key_length, *values);
+    }
+    if (err == 0) {
+      err = encode_json_value(out, md, slot);
+    }
+    if (err != 0) {
+      return err;
+    }
+    (*values)++;
+  }
+  return 0;
+}
+
+
+static int
+encode_json_write_history(
+    fragment **out,
+    module *mod,
+    const char *key,
+    size_t key_len,
+    uint8_t type,
+    const struct history_point *points,
+    size_t count,
+    strhash *names,
+    size_t *values)
+{
+  const char *root = mod->registered_path;
+  int err = encode_json_name(out, root, strlen(root), key, key_len, *values);
+  for (size_t i = 0; i < count && err == 0; i++) {
+    err = fragment_append(out, i == 0 ? "[[" : ",[", 2);
+    if (err == 0) {
+      err = encoder_append_int(out, points[i].time);
+    }
+    if (err == 0) {
+      err = fragment_append(out, ",", 1);
+    }
+    if (err == 0 && type == IRK_INT) {
+      err = encoder_append_int(out, points[i].value.i);
+    } else if (err == 0) {
+      err = encode_json_double(out, points[i].value.d);
+    }
+    if (err == 0) {
+      err = fragment_append(out, "]", 1);
+    }
+  }
+  if (err == 0) {
+    err = fragment_append(out, "]", 1);
+  }
+  if (err == 0) {
+    (*values)++;
+  }
+  return err;
+}
+
+
+static int
+encode_json_write_name(
+    fragment **out,
+    module *mod,
+    const char *key,
+    size_t key_len)
+{
+  const char *root = mod->registered_path;
+  return encode_json_name(out, root, strlen(root), key, key_len, 0);
+}
+
+
+const struct encoder encoder_json = {
+  .name = "json",
+  .format = ENCODER_JSON,
+  .content_type = "application/json",
+  .prologue = "{",
+  .separator = ",",
+  .epilogue = "}\n",
+  .write = encode_json_write,
+  .write_history = encode_json_write_history,
+  .write_name = encode_json_write_name,
+};
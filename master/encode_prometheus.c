@@ -0,0 +1,853 @@
+/*
+Copyright (C) 2012 Brady Catherman
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include <errno.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <common/fragment.h>
+#include <common/strhash.h>
+#include <master/distribution.h>
+#include <master/encoder.h>
+#include <master/module_data.h>
+
+/**
+  Prometheus text exposition format (version 0.0.4).
+
+  Each value is written as one sample line, after a "# TYPE" line naming
+  it a gauge since irk does not know which values only ever go up. The
+  metric name is the full path of the value with the leading '/' dropped
+  and every character that is not allowed in a Prometheus name (anything
+  but letters, digits, '_' and ':') replaced by '_', so "/net/dev/eth0.rx"
+  becomes "net_dev_eth0_rx". Prometheus samples are numeric, so string
+  values are written as a sample of 1 with the string in a "value" label.
+
+  Different paths can give the same name, and a name may only be used by
+  one metric family in a response. Modules whose paths start the same
+  name, like "/a.b" and "/a_b", are kept apart when they are registered,
+  see encoder_prometheus_claim(). A name that starts with the converted
+  path of a longer module, "net_dev_" for "/net/dev", belongs to that
+  module, so "/net" does not write its key "dev.x" while "/net/dev" is
+  registered, whatever its keys; the encoding of a snapshot is cached, so
+  a module registered later takes its names from the next snapshot of the
+  other. Within a module the first value with a name wins, so only one of
+  the keys "a.b" and "a_b" is written, and a histogram "x" keeps a gauge
+  "x_sum" from being written after it.
+
+  Histograms are written the way Prometheus expects a histogram: a
+  cumulative "_bucket" sample for the upper bound of every bucket that is
+  not empty plus "+Inf", then "_sum" and "_count". Sketches are written as
+  a summary, with a sample per reported quantile. Each is typed as one
+  metric family.
+
+  History is written as one sample per line with its timestamp, in
+  milliseconds since the epoch, after the value.
+
+  OpenMetrics is not produced, so a request that accepts nothing else
+  gets a 406, see encoder_negotiate().
+ */
+
+
+/** Returns true if 'c' may appear in a metric name. */
+static bool
+encode_prometheus_name_char(
+    char c)
+{
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+      (c >= '0' && c <= '9') || c == '_' || c == ':';
+}
+
+
+/**
+  Appends 'name' to 'out' with every invalid character replaced by '_'.
+
+  Runs of valid characters are appended in one go.
+ */
+static int
+encode_prometheus_name_part(
+    fragment **out,
+    const char *name,
+    size_t len)
+{
+  size_t start = 0;
+  int err = 0;
+  for (size_t i = 0; i < len && err == 0; i++) {
+    if (encode_prometheus_name_char(name[i])) {
+      continue;
+    }
+    err = fragment_append(out, name + start, i - start);
+    if (err == 0) {
+      err = fragment_append(out, "_", 1);
+    }
+    start = i + 1;
+  }
+  if (err != 0) {
+    return err;
+  }
+  return fragment_append(out, name + start, len - start);
+}
+
+
+/** Appends 'value' to 'out' escaped for use as a label value. */
+static int
+encode_prometheus_label_value(
+    fragment **out,
+    const char *value,
+    size_t len)
+{
+  size_t start = 0;
+  int err = 0;
+  for (size_t i = 0; i < len && err == 0; i++) {
+    const char *escaped;
+    switch (value[i]) {
+      case '\\':
+        escaped = "\\\\";
+        break;
+      case '"':
+        escaped = "\\\"";
+        break;
+      case '\n':
+        escaped = "\\n";
+        break;
+      default:
+        continue;
+    }
+    err = fragment_append(out, value + start, i - start);
+    if (err == 0) {
+      err = fragment_append(out, escaped, 2);
+    }
+    start = i + 1;
+  }
+  if (err != 0) {
+    return err;
+  }
+  return fragment_append(out, value + start, len - start);
+}
+
+
+/** Appends 'value' to 'out' as a sample value, with the leading space. */
+static int
+encode_prometheus_double(
+    fragment **out,
+    double value)
+{
+  if (isnan(value)) {
+    return fragment_append(out, " NaN", 4);
+  } else if (isinf(value)) {
+    return fragment_append(out, value > 0 ? " +Inf" : " -Inf", 5);
+  }
+  if (fragment_append(out, " ", 1) != 0) {
+    return ENOMEM;
+  }
+  return encoder_append_double(out, value);
+}
+
+
+/** Appends the name of a value, 'name' being the converted root. */
+static int
+encode_prometheus_name(
+    fragment **out,
+    const fragment *name,
+    const char *key,
+    size_t key_len)
+{
+  int err = fragment_append(out, fragment_data(name), fragment_length(name));
+  if (err == 0) {
+    err = encode_prometheus_name_part(out, key, key_len);
+  }
+  return err;
+}
+
+
+/** Appends the "# TYPE" line of the metric family 'family'. */
+static int
+encode_prometheus_type(
+    fragment **out,
+    const char *family,
+    size_t family_len,
+    const char *type)
+{
+  int err = fragment_append(out, "# TYPE ", 7);
+  if (err == 0) {
+    err = fragment_append(out, family, family_len);
+  }
+  if (err == 0) {
+    err = fragment_appendf(out, " %s\n", type);
+  }
+  return err;
+}
+
+
+/**
+  Appends the stored histogram or sketch 'stored' as the metric family
+  'family', each sample being a line of its own.
+ */
+static int
+encode_prometheus_distribution(
+    fragment **out,
+    const char *family,
+    size_t family_len,
+    const char *stored)
+{
+  struct distribution_header header;
+  memcpy(&header, stored, sizeof(header));
+  int err = encode_prometheus_type(
+      out, family, family_len, header.gamma != 0 ? "summary" : "histogram");
+
+  if (header.gamma != 0) {
+    for (int i = 0; i < DISTRIBUTION_QUANTILES && err == 0; i++) {
+      err = fragment_append(out, family, family_len);
+      if (err == 0) {
+        err = fragment_appendf(
+            out, "{quantile=\"%s\"}", distribution_quantiles[i].label);
+      }
+      if (err == 0) {
+        err = encode_prometheus_double(
+            out, distribution_quantile(stored, distribution_quantiles[i].q));
+      }
+      if (err == 0) {
+        err = fragment_append(out, "\n", 1);
+      }
+    }
+  } else {
+    const char *p = stored + sizeof(header);
+    uint64_t cumulative = 0;
+    for (uint64_t i = 0; i < header.bins && err == 0; i++) {
+      struct distribution_bin bin;
+      memcpy(&bin, p, sizeof(bin));
+      p += sizeof(bin);
+      cumulative += bin.count;
+      double bound = distribution_histogram_bound(bin.index);
+      if (isinf(bound)) {
+        // Counted in the "+Inf" bucket below.
+        break;
+      }
+
+      err = fragment_append(out, family, family_len);
+      if (err == 0) {
+        err = fragment_append(out, "_bucket{le=\"", 12);
+      }
+      if (err == 0) {
+        err = encoder_append_double(out, bound);
+      }
+      if (err == 0) {
+        err = fragment_append(out, "\"} ", 3);
+      }
+      if (err == 0) {
+        err = encoder_append_int(out, (int64_t) cumulative);
+      }
+      if (err == 0) {
+        err = fragment_append(out, "\n", 1);
+      }
+    }
+    if (err == 0) {
+      err = fragment_append(out, family, family_len);
+    }
+    if (err == 0) {
+      err = fragment_append(out, "_bucket{le=\"+Inf\"} ", 19);
+    }
+    if (err == 0) {
+      err = encoder_append_int(out, (int64_t) header.count);
+    }
+    if (err == 0) {
+      err = fragment_append(out, "\n", 1);
+    }
+  }
+
+  if (err == 0) {
+    err = fragment_append(out, family, family_len);
+  }
+  if (err == 0) {
+    err = fragment_append(out, "_sum", 4);
+  }
+  if (err == 0) {
+    err = encode_prometheus_double(out, header.sum);
+  }
+  if (err == 0) {
+    err = fragment_append(out, "\n", 1);
+  }
+  if (err == 0) {
+    err = fragment_append(out, family, family_len);
+  }
+  if (err == 0) {
+    err = fragment_append(out, "_count ", 7);
+  }
+  if (err == 0) {
+    err = encoder_append_int(out, (int64_t) header.count);
+  }
+  if (err == 0) {
+    err = fragment_append(out, "\n", 1);
+  }
+  return err;
+}
+
+
+/** Appends the sample value of 'slot' to 'out'. */
+static int
+encode_prometheus_value(
+    fragment **out,
+    const module_data *md,
+    const module_data_slot *slot)
+{
+  switch (slot->type) {
+    case IRK_STRING: {
+      int err = fragment_append(out, "{value=\"", 8);
+      if (err == 0) {
+        err = encode_prometheus_label_value(
+            out, module_data_string(md, slot), slot->string_length);
+      }
+      if (err == 0) {
+        err = fragment_append(out, "\"} 1", 4);
+      }
+      return err;
+    }
+    case IRK_INT:
+      if (fragment_append(out, " ", 1) != 0) {
+        return ENOMEM;
+      }
+      return encoder_append_int(out, slot->value.i);
+    case IRK_DOUBLE:
+      return encode_prometheus_double(out, slot->value.d);
+  }
+  return 0;
+}
+
+
+/**
+  Returns the start of the name of every value of a module at 'path': the
+  path converted to a name, followed by a '_'.
+
+  Returns:
+    The name, to be released with fragment_release(), or NULL.
+ */
+static fragment *
+encode_prometheus_root(
+    const char *path)
+{
+  size_t path_len = strlen(path);
+  fragment *name = fragment_new(path_len + 1);
+  if (name == NULL) {
+    return NULL;
+  }
+  int err = 0;
+  if (path[1] >= '0' && path[1] <= '9') {
+    // Names may not start with a digit.
+    err = fragment_append(&name, "_", 1);
+  }
+  if (err == 0) {
+    err = encode_prometheus_name_part(&name, path + 1, path_len - 1);
+  }
+  if (err == 0) {
+    err = fragment_append(&name, "_", 1);
+  }
+  if (err != 0) {
+    fragment_release(name);
+    return NULL;
+  }
+  return name;
+}
+
+
+/**
+  The module holding each root, see encoder_prometheus_claim(), and for
+  every start of a root that ends in a '_' the number of longer roots
+  that begin with it, so modules that no other is nested in need not look.
+
+  Like the module index these are only used on the thread that registers
+  modules and answers requests.
+ */
+static strhash *encode_prometheus_roots = NULL;
+static strhash *encode_prometheus_inner = NULL;
+
+
+/**
+  Adds 'change' to the count in encode_prometheus_inner of every shorter
+  start of 'root'. Counts left too high only cost lookups.
+ */
+static int
+encode_prometheus_count_inner(
+    const char *root,
+    size_t len,
+    int change)
+{
+  for (size_t i = 0; i + 1 < len; i++) {
+    if (root[i] != '_') {
+      continue;
+    }
+    uint64_t hash = strhash_hash(root, i + 1);
+    uintptr_t count = (uintptr_t) strhash_get_n(
+        encode_prometheus_inner, root, i + 1, hash);
+    count += change;
+    if (count == 0) {
+      strhash_remove_n(encode_prometheus_inner, root, i + 1, hash);
+    } else if (strhash_replace_n(
+                   encode_prometheus_inner,
+                   root,
+                   i + 1,
+                   hash,
+                   (void *) count,
+                   NULL) != 0) {
+      return ENOMEM;
+    }
+  }
+  return 0;
+}
+
+
+/** Releases the root of 'path' if 'mod' holds it. */
+static void
+encode_prometheus_unclaim(
+    module *mod,
+    const char *path)
+{
+  if (encode_prometheus_roots == NULL) {
+    return;
+  }
+  fragment *root = encode_prometheus_root(path);
+  if (root == NULL) {
+    // Left held, which only keeps another module from the same root.
+    return;
+  }
+  const char *data = fragment_data(root);
+  size_t len = fragment_length(root);
+  uint64_t hash = strhash_hash(data, len);
+  if (strhash_get_n(encode_prometheus_roots, data, len, hash) == mod) {
+    strhash_remove_n(encode_prometheus_roots, data, len, hash);
+    encode_prometheus_count_inner(data, len, -1);
+  }
+  fragment_release(root);
+}
+
+
+int
+encoder_prometheus_claim(
+    module *mod,
+    const char *path)
+{
+  if (encode_prometheus_roots == NULL) {
+    encode_prometheus_roots = strhash_init(64);
+    encode_prometheus_inner = strhash_init(64);
+    if (encode_prometheus_roots == NULL || encode_prometheus_inner == NULL) {
+      if (encode_prometheus_roots != NULL) {
+        strhash_destroy(encode_prometheus_roots, NULL);
+        encode_prometheus_roots = NULL;
+      }
+      if (encode_prometheus_inner != NULL) {
+        strhash_destroy(encode_prometheus_inner, NULL);
+        encode_prometheus_inner = NULL;
+      }
+      return ENOMEM;
+    }
+  }
+
+  fragment *root = encode_prometheus_root(path);
+  if (root == NULL) {
+    return ENOMEM;
+  }
+  const char *data = fragment_data(root);
+  size_t len = fragment_length(root);
+  uint64_t hash = strhash_hash(data, len);
+  bool held = strhash_get_n(encode_prometheus_roots, data, len, hash) == mod;
+  void *owner = strhash_add_n(encode_prometheus_roots, data, len, hash, mod);
+  int err = 0;
+  if (owner == NULL) {
+    err = ENOMEM;
+  } else if (owner != mod) {
+    err = EEXIST;
+  } else if (!held) {
+    err = encode_prometheus_count_inner(data, len, 1);
+    if (err != 0) {
+      strhash_remove_n(encode_prometheus_roots, data, len, hash);
+    }
+  }
+
+  if (err == 0 && !held && mod->registered_path != NULL) {
+    // Moving from "/a.b" to "/a_b" keeps the root it already holds.
+    encode_prometheus_unclaim(mod, mod->registered_path);
+  }
+  fragment_release(root);
+  return err;
+}
+
+
+void
+encoder_prometheus_release(
+    module *mod)
+{
+  if (mod->registered_path != NULL) {
+    encode_prometheus_unclaim(mod, mod->registered_path);
+  }
+}
+
+
+/** The names written so far for the values of one module. */
+struct encode_prometheus_names {
+  /** The length of the module's root. */
+  size_t root_len;
+
+  /** True if the roots of other modules begin with the module's. */
+  bool nested;
+
+  /** Every name written, keyed by itself. */
+  strhash *written;
+
+  /** Where the names of samples are put together, NULL until needed. */
+  fragment *sample;
+};
+
+
+/**
+  Returns true if 'name' starts with a longer root than that of the module
+  being written, and so belongs to the module holding that root.
+ */
+static bool
+encode_prometheus_owned(
+    const struct encode_prometheus_names *names,
+    const char *name,
+    size_t len)
+{
+  if (!names->nested) {
+    return false;
+  }
+  for (size_t i = names->root_len; i < len; i++) {
+    if (name[i] == '_' &&
+        strhash_get_n(
+            encode_prometheus_roots,
+            name,
+            i + 1,
+            strhash_hash(name, i + 1)) != NULL) {
+      return true;
+    }
+  }
+  return false;
+}
+
+
+/**
+  Claims a metric family and the names of its samples, which are the name
+  of the family followed by each of 'suffixes', ending with NULL.
+
+  Arguments:
+    names: The names written so far.
+    family: The name of the family.
+    family_len: The length of family.
+    suffixes: See above.
+    id: Anything that is unique to the family, stored with its names.
+
+  Returns:
+    0 if the family may be written, EEXIST if one of its names is taken,
+    or ENOMEM.
+ */
+static int
+encode_prometheus_family(
+    struct encode_prometheus_names *names,
+    const char *family,
+    size_t family_len,
+    const char *const *suffixes,
+    const void *id)
+{
+  // A family of one sample, which most are, is claimed in one lookup.
+  if (suffixes[1] == NULL) {
+    if (encode_prometheus_owned(names, family, family_len)) {
+      return EEXIST;
+    }
+    void *added = strhash_add_n(
+        names->written,
+        family,
+        family_len,
+        strhash_hash(family, family_len),
+        (void *) id);
+    if (added == NULL) {
+      return ENOMEM;
+    }
+    return added == id ? 0 : EEXIST;
+  }
+
+  if (names->sample == NULL) {
+    names->sample = fragment_new(0);
+    if (names->sample == NULL) {
+      return ENOMEM;
+    }
+  }
+  fragment_truncate(names->sample, 0);
+  int err = 0;
+  for (int i = 0; suffixes[i] != NULL && err == 0; i++) {
+    size_t start = fragment_length(names->sample);
+    err = fragment_append(&(names->sample), family, family_len);
+    if (err == 0) {
+      err = fragment_append(
+          &(names->sample), suffixes[i], strlen(suffixes[i]));
+    }
+    if (err != 0) {
+      break;
+    }
+    const char *sample = fragment_data(names->sample) + start;
+    size_t len = fragment_length(names->sample) - start;
+    if (strhash_haskey_n(
+            names->written, sample, len, strhash_hash(sample, len)) ||
+        encode_prometheus_owned(names, sample, len)) {
+      err = EEXIST;
+    }
+  }
+
+  const char *sample = fragment_data(names->sample);
+  for (int i = 0; suffixes[i] != NULL && err == 0; i++) {
+    size_t len = family_len + strlen(suffixes[i]);
+    if (strhash_add_n(
+            names->written,
+            sample,
+            len,
+            strhash_hash(sample, len),
+            (void *) id) == NULL) {
+      err = ENOMEM;
+    }
+    sample += len;
+  }
+  return err;
+}
+
+
+/** The names written for each kind of metric family. */
+static const char *const encode_prometheus_gauge[] = {"", NULL};
+static const char *const encode_prometheus_histogram[] = {
+  "", "_bucket", "_sum", "_count", NULL
+};
+static const char *const encode_prometheus_summary[] = {
+  "", "_sum", "_count", NULL
+};
+
+
+/**
+  Sets up 'names' for writing the values of 'mod', with 'written' holding
+  the names already written.
+
+  Returns:
+    The root of 'mod', to be released with fragment_release(), or NULL.
+ */
+static fragment *
+encode_prometheus_names_init(
+    struct encode_prometheus_names *names,
+    module *mod,
+    strhash *written)
+{
+  fragment *root = encode_prometheus_root(mod->registered_path);
+  if (root == NULL) {
+    return NULL;
+  }
+  names->root_len = fragment_length(root);
+  names->nested = encode_prometheus_inner != NULL &&
+      strhash_get_n(
+          encode_prometheus_inner,
+          fragment_data(root),
+          names->root_len,
+          strhash_hash(fragment_data(root), names->root_len)) != NULL;
+  names->written = written;
+  names->sample = NULL;
+  return root;
+}
+
+
+static int
+encode_prometheus_write(
+    fragment **out,
+    module *mod,
+    const module_data *md,
+    const char *prefix,
+    size_t prefix_len,
+    uint64_t since,
+    size_t *values)
+{
+  strhash *written =
+      strhash_init(prefix_len == 0 && since == 0 ? md->items : 0);
+  if (written == NULL) {
+    return ENOMEM;
+  }
+  // Every name starts with the root, so only convert it once.
+  struct encode_prometheus_names names;
+  fragment *root = encode_prometheus_names_init(&names, mod, written);
+  fragment *name = fragment_new(0);
+  int err = root != NULL && name != NULL ? 0 : ENOMEM;
+
+  const module_data_slot *slots = module_data_slots(md);
+  for (uint32_t i = 0; i < md->items && err == 0; i++) {
+    const module_data_slot *slot = &slots[i];
+    if (since != 0 && slot->changed <= since) {
+      continue;
+    }
+    const char *key = module_data_key(md, slot);
+    if (!encoder_key_selected(key, slot->key_length, prefix, prefix_len)) {
+      continue;
+    }
+
+    // Declared metrics have their names ready to copy.
+    size_t family_len;
+    const char *family =
+        encoder_schema_name(&encoder_prometheus, mod, md, i, &family_len);
+    if (family == NULL) {
+      fragment_truncate(name, 0);
+      err = encode_prometheus_name(&name, root, key, slot->key_length);
+      family = fragment_data(name);
+      family_len = fragment_length(name);
+    }
+
+    const char *const *suffixes = encode_prometheus_gauge;
+    if (slot->type == IRK_HISTOGRAM) {
+      suffixes = encode_prometheus_histogram;
+    } else if (slot->type == IRK_SKETCH) {
+      suffixes = encode_prometheus_summary;
+    }
+    if (err == 0) {
+      err = encode_prometheus_family(
+          &names, family, family_len, suffixes, slot);
+    }
+    if (err == EEXIST) {
+      // Another value or module already has the name.
+      err = 0;
+      continue;
+    }
+
+    if (err == 0 && suffixes != encode_prometheus_gauge) {
+      err = encode_prometheus_distribution(
+          out, family, family_len, module_data_distribution(md, slot));
+    } else if (err == 0) {
+      err = encode_prometheus_type(out, family, family_len, "gauge");
+      if (err == 0) {
+        err = fragment_append(out, family, family_len);
+      }
+      if (err == 0) {
+        err = encode_prometheus_value(out, md, slot);
+      }
+      if (err == 0) {
+        err = fragment_append(out, "\n", 1);
+      }
+    }
+    (*values)++;
+  }
+
+  fragment_release(name);
+  fragment_release(root);
+  if (root != NULL) {
+    fragment_release(names.sample);
+  }
+  strhash_destroy(written, NULL);
+  return err;
+}
+
+
+static int
+encode_prometheus_write_history(
+    fragment **out,
+    module *mod,
+    const char *key,
+    size_t key_len,
+    uint8_t type,
+    const struct history_point *points,
+    size_t count,
+    strhash *written,
+    size_t *values)
+{
+  struct encode_prometheus_names names;
+  fragment *root = encode_prometheus_names_init(&names, mod, written);
+  if (root == NULL) {
+    return ENOMEM;
+  }
+  fragment *name = fragment_new(0);
+  int err = name != NULL ? 0 : ENOMEM;
+  if (err == 0) {
+    err = encode_prometheus_name(&name, root, key, key_len);
+  }
+  const char *family = err == 0 ? fragment_data(name) : NULL;
+  size_t family_len = err == 0 ? fragment_length(name) : 0;
+  if (err == 0) {
+    err = encode_prometheus_family(
+        &names, family, family_len, encode_prometheus_gauge, key);
+  }
+  if (err == EEXIST) {
+    // Another series or module already has the name.
+    err = 0;
+    count = 0;
+    family = NULL;
+  }
+
+  if (err == 0 && family != NULL) {
+    err = encode_prometheus_type(out, family, family_len, "gauge");
+  }
+  for (size_t i = 0; i < count && err == 0; i++) {
+    err = fragment_append(out, family, family_len);
+    if (err == 0 && type == IRK_INT) {
+      err = fragment_append(out, " ", 1);
+      if (err == 0) {
+        err = encoder_append_int(out, points[i].value.i);
+      }
+    } else if (err == 0) {
+      err = encode_prometheus_double(out, points[i].value.d);
+    }
+    if (err == 0) {
+      err = fragment_append(out, " ", 1);
+    }
+    if (err == 0) {
+      err = encoder_append_int(out, points[i].time);
+    }
+    if (err == 0) {
+      err = fragment_append(out, "\n", 1);
+    }
+  }
+  if (family != NULL) {
+    (*values)++;
+  }
+  fragment_release(name);
+  fragment_release(names.sample);
+  fragment_release(root);
+  return err;
+}
+
+
+static int
+encode_prometheus_write_name(
+    fragment **out,
+    module *mod,
+    const char *key,
+    size_t key_len)
+{
+  fragment *name = encode_prometheus_root(mod->registered_path);
+  if (name == NULL) {
+    return ENOMEM;
+  }
+  int err = encode_prometheus_name(out, name, key, key_len);
+  fragment_release(name);
+  return err;
+}
+
+
+const struct encoder encoder_prometheus = {
+  .name = "prometheus",
+  .format = ENCODER_PROMETHEUS,
+  .content_type = "text/plain; version=0.0.4; charset=utf-8",
+  .prologue = "",
+  .separator = "",
+  .epilogue = "",
+  .write = encode_prometheus_write,
+  .write_history = encode_prometheus_write_history,
+  .write_name = encode_prometheus_write_name,
+};
@@ -0,0 +1,333 @@
+/*
+Copyright (C) 2012 Brady Catherman
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include <common/compress.h>
+#include <common/fragment.h>
+#include <common/memory.h>
+#include <master/encoder.h>
+#include <master/intern.h>
+#include <master/module_data.h>
+#include <master/schema.h>
+
+// Rough size of one encoded value, used to size fragments up front.
+#define ENCODER_BYTES_PER_VALUE 48
+
+
+/** Every encoder, indexed by format. */
+static const struct encoder *encoders[ENCODER_COUNT] = {
+  &encoder_json,
+  &encoder_prometheus,
+  &encoder_binary,
+};
+
+
+/** The media types understood by encoder_negotiate(). */
+static const struct {
+  const char *media_type;
+  const struct encoder *encoder;
+} encoder_media_types[] = {
+  {"application/json", &encoder_json},
+  {"text/plain", &encoder_prometheus},
+  {"application/x-irk", &encoder_binary},
+  {"application/*", &encoder_json},
+  {"text/*", &encoder_prometheus},
+  {"*/*", &encoder_json},
+};
+
+
+const struct encoder *
+encoder_find(
+    const char *name)
+{
+  for (int i = 0; i < ENCODER_COUNT; i++) {
+    if (strcmp(encoders[i]->name, name) == 0) {
+      return encoders[i];
+    }
+  }
+  return NULL;
+}
+
+
+/** Returns the encoder for a media range, or NULL. */
+static const struct encoder *
+encoder_for_media_type(
+    const char *media_type,
+    size_t len)
+{
+  size_t count = sizeof(encoder_media_types) / sizeof(encoder_media_types[0]);
+  for (size_t i = 0; i < count; i++) {
+    const char *known = encoder_media_types[i].media_type;
+    if (strlen(known) == len && strncasecmp(known, media_type, len) == 0) {
+      return encoder_media_types[i].encoder;
+    }
+  }
+  return NULL;
+}
+
+
+const struct encoder *
+encoder_negotiate(
+    const char *accept)
+{
+  if (accept == NULL) {
+    return &encoder_json;
+  }
+
+  const struct encoder *best = NULL;
+  double best_q = 0;
+  const char *p = accept;
+  while (*p != '\0') {
+    // Each media range looks like "type/subtype;param=value;q=0.5".
+    while (*p == ' ' || *p == '\t' || *p == ',') {
+      p++;
+    }
+    const char *type = p;
+    while (*p != '\0' && *p != ',' && *p != ';' && *p != ' ') {
+      p++;
+    }
+    size_t type_len = p - type;
+
+    double q = 1;
+    while (*p != '\0' && *p != ',') {
+      if (*p == ';') {
+        p++;
+        while (*p == ' ') {
+          p++;
+        }
+        if ((p[0] == 'q' || p[0] == 'Q') && p[1] == '=') {
+          q = strtod(p + 2, NULL);
+        }
+      } else {
+        p++;
+      }
+    }
+
+    const struct encoder *e = encoder_for_media_type(type, type_len);
+    if (e != NULL && q > best_q) {
+      best = e;
+      best_q = q;
+    }
+  }
+  return best;
+}
+
+
+fragment *
+encoder_module_fragment(
+    const struct encoder *e,
+    module *mod,
+    const module_data *md)
+{
+  // Snapshots are otherwise immutable, the cache is the one thing that is
+  // filled in after publication.
+  fragment **cache = (fragment **) &(md->encoded[e->format]);
+  fragment *f = __atomic_load_n(cache, __ATOMIC_ACQUIRE);
+  if (f != NULL) {
+    return f;
+  }
+
+  f = fragment_new(md->items * ENCODER_BYTES_PER_VALUE);
+  if (f == NULL) {
+    return NULL;
+  }
+  size_t values = 0;
+  if (e->write(&f, mod, md, "", 0, 0, &values) != 0) {
+    fragment_release(f);
+    return NULL;
+  }
+
+  fragment *expected = NULL;
+  if (!__atomic_compare_exchange_n(
+          cache, &expected, f, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+    // Another thread got there first.
+    fragment_release(f);
+    return expected;
+  }
+  return f;
+}
+
+
+const compress_segment *
+encoder_module_compressed(
+    const struct encoder *e,
+    enum compress_encoding encoding,
+    module *mod,
+    const module_data *md)
+{
+  compress_segment **cache =
+      (compress_segment **) &(md->compressed[e->format][encoding]);
+  compress_segment *segment = __atomic_load_n(cache, __ATOMIC_ACQUIRE);
+  if (segment != NULL) {
+    return segment;
+  }
+
+  fragment *f = encoder_module_fragment(e, mod, md);
+  if (f == NULL) {
+    return NULL;
+  }
+  segment = compress_segment_new(
+      encoding, fragment_data(f), fragment_length(f));
+  if (segment == NULL) {
+    return NULL;
+  }
+
+  compress_segment *expected = NULL;
+  if (!__atomic_compare_exchange_n(
+          cache,
+          &expected,
+          segment,
+          false,
+          __ATOMIC_ACQ_REL,
+          __ATOMIC_ACQUIRE)) {
+    compress_segment_free(segment);
+    return expected;
+  }
+  return segment;
+}
+
+
+/** Encodes the name of every slot in 'schema', returning NULL on failure. */
+static struct module_schema_names *
+encoder_schema_names(
+    const struct encoder *e,
+    module *mod,
+    const module_schema *schema)
+{
+  struct module_schema_names *names = (struct module_schema_names *)
+      irk_malloc(sizeof(*names) + (schema->count + 1) * sizeof(uint32_t));
+  if (names == NULL) {
+    return NULL;
+  }
+  names->data = fragment_new(schema->count * ENCODER_BYTES_PER_VALUE);
+  if (names->data == NULL) {
+    irk_free(names);
+    return NULL;
+  }
+
+  for (uint32_t i = 0; i < schema->count; i++) {
+    const module_data_slot *slot = &(schema->template[i]);
+    size_t key_len;
+    const char *key = intern_key_string(slot->key_offset, &key_len);
+    names->offsets[i] = fragment_length(names->data);
+    if (e->write_name(&(names->data), mod, key, key_len) != 0) {
+      fragment_release(names->data);
+      irk_free(names);
+      return NULL;
+    }
+  }
+  names->offsets[schema->count] = fragment_length(names->data);
+  return names;
+}
+
+
+const char *
+encoder_schema_name(
+    const struct encoder *e,
+    module *mod,
+    const module_data *md,
+    uint32_t index,
+    size_t *len)
+{
+  module_schema *schema = md->schema;
+  if (schema == NULL || index >= schema->count || e->write_name == NULL) {
+    return NULL;
+  }
+
+  struct module_schema_names **cache = &(schema->names[e->format]);
+  struct module_schema_names *names = __atomic_load_n(cache, __ATOMIC_ACQUIRE);
+  if (names == NULL) {
+    names = encoder_schema_names(e, mod, schema);
+    if (names == NULL) {
+      return NULL;
+    }
+    struct module_schema_names *expected = NULL;
+    if (!__atomic_compare_exchange_n(
+            cache, &expected, names, false,
+            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+      fragment_release(names->data);
+      irk_free(names);
+      names = expected;
+    }
+  }
+
+  *len = names->offsets[index + 1] - names->offsets[index];
+  return fragment_data(names->data) + names->offsets[index];
+}
+
+
+bool
+encoder_key_selected(
+    const char *key,
+    size_t key_len,
+    const char *prefix,
+    size_t prefix_len)
+{
+  if (prefix_len == 0) {
+    return true;
+  }
+  if (key_len < prefix_len || memcmp(key, prefix, prefix_len) != 0) {
+    return false;
+  }
+  return key_len == prefix_len || key[prefix_len] == '/';
+}
+
+
+int
+encoder_append_int(
+    fragment **out,
+    int64_t value)
+{
+  char buffer[24];
+  char *p = buffer + sizeof(buffer);
+  // Work with the magnitude as unsigned so INT64_MIN does not overflow.
+  uint64_t magnitude = value < 0 ? -(uint64_t) value : (uint64_t) value;
+  do {
+    *--p = '0' + magnitude % 10;
+    magnitude /= 10;
+  } while (magnitude != 0);
+  if (value < 0) {
+    *--p = '-';
+  }
+  return fragment_append(out, p, buffer + sizeof(buffer) - p);
+}
+
+
+int
+encoder_append_double(
+    fragment **out,
+    double value)
+{
+  // Whole numbers are common (counters kept as doubles) and much cheaper
+  // to print as integers.
+  if (value >= -9007199254740992.0 && value <= 9007199254740992.0 &&
+      value == (double) (int64_t) value && (value != 0 || !signbit(value))) {
+    return encoder_append_int(out, (int64_t) value);
+  }
+  return fragment_appendf(out, "%.17g", value);
+}
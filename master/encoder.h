@@ -0,0 +1,349 @@
+/*
+Copyright (C) 2012 Brady Catherman
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef __MASTER_ENCODER_H
+#define __MASTER_ENCODER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <common/compress.h>
+#include <common/fragment.h>
+#include <common/strhash.h>
+#include <master/history.h>
+#include <master/module.h>
+
+/**
+  Output formats for module data.
+
+  An encoder turns the values in a module_data into bytes. A response is
+  built from the encoder's prologue, then the output for each module
+  joined by its separator, then its epilogue. The output for a whole
+  module is encoded at most once per snapshot and cached in the snapshot,
+  see encoder_module_fragment(), so requests in any format for whole
+  modules send stored bytes.
+ */
+
+
+/** Every encoder, also used to index the per snapshot caches. */
+enum encoder_format {
+  ENCODER_JSON,
+  ENCODER_PROMETHEUS,
+  ENCODER_BINARY,
+  ENCODER_COUNT
+};
+
+
+/**
+  Appends the selected values of a snapshot to 'out'.
+
+  Arguments:
+    out: The fragment to append to.
+    mod: The module 'md' belongs to, which must have a registered_path.
+    md: The snapshot to encode.
+    prefix: Only keys equal to this or below it (followed by a '/') are
+            written. An empty prefix selects every key.
+    prefix_len: The length of prefix.
+    since: Only values changed after this generation are written, or 0 to
+           write values regardless of when they changed.
+    values: The number of values already written to the response, which
+            some formats need to place separators. This is updated.
+
+  Returns:
+    0 on success or ENOMEM.
+ */
+typedef int (*encoder_write_func)(
+    fragment **out,
+    module *mod,
+    const module_data *md,
+    const char *prefix,
+    size_t prefix_len,
+    uint64_t since,
+    size_t *values);
+
+
+/**
+  Appends the history of one value to 'out'.
+
+  Arguments:
+    out: The fragment to append to.
+    mod: The module the value belongs to.
+    key: The key of the value, relative to the module's path.
+    key_len: The length of key.
+    type: IRK_INT or IRK_DOUBLE.
+    points: The samples, oldest first.
+    count: The number of samples.
+    names: The names already written for the module's history, for
+           formats that must not write a name twice. Encoders add the
+           names they write.
+    values: The number of values already written to the response, as for
+            encoder_write_func. Each history counts as one.
+
+  Returns:
+    0 on success or ENOMEM.
+ */
+typedef int (*encoder_history_func)(
+    fragment **out,
+    module *mod,
+    const char *key,
+    size_t key_len,
+    uint8_t type,
+    const struct history_point *points,
+    size_t count,
+    strhash *names,
+    size_t *values);
+
+
+/**
+  Appends the name of a value the way it is written before the value
+  itself, without any separator.
+
+  Used to work out the names of declared metrics once, see
+  encoder_schema_name().
+
+  Arguments:
+    out: The fragment to append to.
+    mod: The module the value belongs to.
+    key: The key of the value, relative to the module's path.
+    key_len: The length of key.
+
+  Returns:
+    0 on success or ENOMEM.
+ */
+typedef int (*encoder_name_func)(
+    fragment **out,
+    module *mod,
+    const char *key,
+    size_t key_len);
+
+
+struct encoder {
+  /** The value of '?format=' that selects this encoder. */
+  const char *name;
+
+  /** The index of this encoder's cache in each snapshot. */
+  enum encoder_format format;
+
+  /** The Content-Type of responses. */
+  const char *content_type;
+
+  /** Written once at the start of a response. */
+  const char *prologue;
+
+  /** Written between the output of two modules that both wrote values. */
+  const char *separator;
+
+  /** Written once at the end of a response. */
+  const char *epilogue;
+
+  /** Encodes values. */
+  encoder_write_func write;
+
+  /** Encodes history, NULL if this format can not hold it. */
+  encoder_history_func write_history;
+
+  /** Encodes the name of a value, NULL if this format has no use for it. */
+  encoder_name_func write_name;
+};
+
+
+extern const struct encoder encoder_json;
+extern const struct encoder encoder_prometheus;
+extern const struct encoder encoder_binary;
+
+
+/**
+  Finds an encoder by name.
+
+  Arguments:
+    name: The name given in a '?format=' argument.
+
+  Returns:
+    The encoder or NULL if there is no encoder with that name.
+ */
+const struct encoder *
+encoder_find(
+    const char *name);
+
+
+/**
+  Picks the encoder for an Accept header.
+
+  Media ranges are tried in order of their q value, earliest first when
+  tied, and the first one an encoder can produce wins.
+
+  Arguments:
+    accept: The value of the Accept header, or NULL if there was none.
+
+  Returns:
+    The encoder, JSON if there was no header or it allows anything, or
+    NULL if nothing acceptable can be produced.
+ */
+const struct encoder *
+encoder_negotiate(
+    const char *accept);
+
+
+/**
+  Returns the encoding of every value in 'md'.
+
+  The first call for each encoder encodes the snapshot and caches the
+  result in it, so every later request for the same snapshot in the same
+  format is free. Two threads racing to fill the cache both encode but only
+  one result is kept.
+
+  Arguments:
+    e: The encoder.
+    mod: The module 'md' belongs to, which must have a registered_path.
+    md: A published snapshot, which must stay pinned while the result is
+        used unless the caller takes a reference to it.
+
+  Returns:
+    The encoded values, or NULL on allocation failure.
+ */
+fragment *
+encoder_module_fragment(
+    const struct encoder *e,
+    module *mod,
+    const module_data *md);
+
+
+/**
+  Returns the encoding of every value in 'md', compressed.
+
+  Like encoder_module_fragment() this is done once per snapshot, format and
+  content coding, and cached in the snapshot.
+
+  Arguments:
+    e: The encoder.
+    encoding: COMPRESS_GZIP or COMPRESS_ZSTD.
+    mod: The module 'md' belongs to, which must have a registered_path.
+    md: A published snapshot, which must stay pinned while the result is
+        used unless the caller takes a reference to its data.
+
+  Returns:
+    The compressed values, or NULL on failure.
+ */
+const compress_segment *
+encoder_module_compressed(
+    const struct encoder *e,
+    enum compress_encoding encoding,
+    module *mod,
+    const module_data *md);
+
+
+/**
+  Returns the name of slot 'index' of 'md' as written by 'e', if it is a
+  declared metric (see master/schema.h).
+
+  The names of every declared metric of a module are only encoded the
+  first time one of them is needed in each format, and then reused for
+  every snapshot the module publishes.
+
+  Arguments:
+    e: The encoder.
+    mod: The module 'md' belongs to, whose registered_path must not change
+         from then on.
+    md: The snapshot.
+    index: The slot.
+    len: Set to the length of the name.
+
+  Returns:
+    The name, which is not NUL terminated, or NULL if the slot is not a
+    declared metric, the encoder has no write_name or on allocation
+    failure. The caller then writes the name itself.
+ */
+const char *
+encoder_schema_name(
+    const struct encoder *e,
+    module *mod,
+    const module_data *md,
+    uint32_t index,
+    size_t *len);
+
+
+/**
+  Claims the start of the Prometheus names of a module at 'path'.
+
+  Every Prometheus name starts with the path of its module converted to a
+  name, and different paths such as "/a.b" and "/a_b" convert to the same
+  start. Only one module may hold each start, so two modules never write
+  the same name. The start held for the module's current registered_path,
+  if it is a different one, is released.
+
+  This is only called on the thread that registers modules and answers
+  requests, see module_index_add().
+
+  Arguments:
+    mod: The module.
+    path: The normalized path it is registering.
+
+  Returns:
+    0 on success, including when 'mod' already holds the start.
+    EEXIST if another module holds it.
+    ENOMEM on allocation failure.
+ */
+int
+encoder_prometheus_claim(
+    module *mod,
+    const char *path);
+
+
+/** Releases what encoder_prometheus_claim() claimed for 'mod'. */
+void
+encoder_prometheus_release(
+    module *mod);
+
+
+/**
+  Returns true if 'key' is 'prefix' or below it.
+
+  Shared by the encoders to implement the prefix argument of
+  encoder_write_func.
+ */
+bool
+encoder_key_selected(
+    const char *key,
+    size_t key_len,
+    const char *prefix,
+    size_t prefix_len);
+
+
+/** Appends 'value' to 'out' in decimal, without going through printf(). */
+int
+encoder_append_int(
+    fragment **out,
+    int64_t value);
+
+
+/**
+  Appends the finite 'value' to 'out' with enough digits that parsing it
+  gives back exactly the same double.
+ */
+int
+encoder_append_double(
+    fragment **out,
+    double value);
+
+
+#endif
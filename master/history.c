@@ -0,0 +1,680 @@
+/*
+Copyright (C) 2012 Brady Catherman
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <common/config.h>
+#include <common/memory.h>
+#include <master/encoder.h>
+#include <master/history.h>
+#include <master/intern.h>
+#include <master/module_data.h>
+
+// The most bits a sample can take: a 4 bit timestamp prefix and 32 bits,
+// then a 2 bit value prefix, 5 and 6 bit lengths and 64 bits.
+#define HISTORY_MAX_SAMPLE_BITS (4 + 32 + 2 + 5 + 6 + 64)
+
+// Marks the XOR window of a series as not set yet.
+#define HISTORY_NO_WINDOW 0xff
+
+
+// Blocks allocated by every module, out of the budget set by
+// config_history_bytes.
+static size_t history_blocks_used = 0;
+
+
+/** Part of a series. */
+struct history_block {
+  /** The first sample, which is not in 'data'. */
+  int64_t first_time;
+  uint64_t first_value;
+
+  /** The time of the last sample, so old blocks can be skipped. */
+  int64_t last_time;
+
+  /** The samples in this block, including the first. */
+  uint32_t samples;
+
+  /** Bits of 'data' in use. */
+  uint32_t bits;
+
+  /** The rest of the samples, most significant bit first. */
+  uint8_t data[];
+};
+
+
+/** The history of one key. */
+struct history_series {
+  uint32_t key_id;
+
+  /** IRK_INT or IRK_DOUBLE, a series that changes type starts over. */
+  uint8_t type;
+
+  /** The block being written to. */
+  uint8_t newest;
+
+  /** The length of zero runs at either end of the last XOR written. */
+  uint8_t leading;
+  uint8_t trailing;
+
+  /** The last sample written and the interval before it. */
+  int64_t time;
+  int64_t delta;
+  uint64_t value;
+
+  /** The value of history.publishes when the key was last published. */
+  uint64_t seen;
+
+  /** Allocated as they are first needed, then reused. */
+  struct history_block *blocks[HISTORY_BLOCKS];
+};
+
+
+struct history {
+  /** Held while recording and while walking. */
+  pthread_mutex_t lock;
+
+  /** Every series, in the order their keys were first seen. */
+  struct history_series *series;
+  size_t series_used;
+  size_t series_capacity;
+
+  /** Where the last series was found, see history_series_find(). */
+  size_t cursor;
+
+  /** Snapshots recorded. */
+  uint64_t publishes;
+
+  /** Scratch space for history_walk(). */
+  struct history_point *points;
+  size_t points_capacity;
+};
+
+
+/** Reads and writes the bits of a block. */
+struct history_bits {
+  uint8_t *data;
+  uint32_t position;
+};
+
+
+static void
+history_put(
+    struct history_bits *b,
+    uint64_t value,
+    int bits)
+{
+  for (int i = bits - 1; i >= 0; i--) {
+    uint8_t *byte = &(b->data[b->position >> 3]);
+    uint8_t mask = 0x80 >> (b->position & 7);
+    if ((value >> i) & 1) {
+      *byte |= mask;
+    } else {
+      *byte &= ~mask;
+    }
+    b->position++;
+  }
+}
+
+
+static uint64_t
+history_get(
+    struct history_bits *b,
+    int bits)
+{
+  uint64_t value = 0;
+  for (int i = 0; i < bits; i++) {
+    uint8_t byte = b->data[b->position >> 3];
+    value = (value << 1) | ((byte >> (7 - (b->position & 7))) & 1);
+    b->position++;
+  }
+  return value;
+}
+
+
+/** Returns the history of 'mod', creating it the first time. */
+static history *
+history_get_module(
+    module *mod)
+{
+  history *h = __atomic_load_n(&(mod->history), __ATOMIC_ACQUIRE);
+  if (h != NULL) {
+    return h;
+  }
+
+  h = (history *) irk_calloc(1, sizeof(history));
+  if (h == NULL) {
+    return NULL;
+  }
+  pthread_mutex_init(&(h->lock), NULL);
+
+  history *expected = NULL;
+  if (!__atomic_compare_exchange_n(
+          &(mod->history), &expected, h, false,
+          __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+    history_free(h);
+    return expected;
+  }
+  return h;
+}
+
+
+/**
+  Finds the series for 'key_id', adding it if there is none.
+
+  Modules publish their keys in the same order every time, so the series
+  after the last one found is nearly always the right one.
+ */
+static struct history_series *
+history_series_find(
+    history *h,
+    uint32_t key_id)
+{
+  if (h->cursor < h->series_used && h->series[h->cursor].key_id == key_id) {
+    return &(h->series[h->cursor++]);
+  }
+  for (size_t i = 0; i < h->series_used; i++) {
+    if (h->series[i].key_id == key_id) {
+      h->cursor = i + 1;
+      return &(h->series[i]);
+    }
+  }
+
+  if (h->series_used == h->series_capacity) {
+    size_t capacity = h->series_capacity ? h->series_capacity * 2 : 16;
+    struct history_series *series = (struct history_series *) irk_realloc(
+        h->series, capacity * sizeof(struct history_series));
+    if (series == NULL) {
+      return NULL;
+    }
+    h->series = series;
+    h->series_capacity = capacity;
+  }
+  struct history_series *s = &(h->series[h->series_used++]);
+  memset(s, 0, sizeof(*s));
+  s->key_id = key_id;
+  h->cursor = h->series_used;
+  return s;
+}
+
+
+/**
+  Allocates a block if the budget allows it.
+
+  Returns:
+    The block, or NULL if the budget is used up or memory ran out.
+ */
+static struct history_block *
+history_block_new(void)
+{
+  size_t budget = config_history_bytes /
+      (sizeof(struct history_block) + HISTORY_BLOCK_BYTES);
+  if (__atomic_add_fetch(&history_blocks_used, 1, __ATOMIC_RELAXED) >
+      budget) {
+    __atomic_sub_fetch(&history_blocks_used, 1, __ATOMIC_RELAXED);
+    return NULL;
+  }
+  struct history_block *b = (struct history_block *) irk_malloc(
+      sizeof(struct history_block) + HISTORY_BLOCK_BYTES);
+  if (b == NULL) {
+    __atomic_sub_fetch(&history_blocks_used, 1, __ATOMIC_RELAXED);
+  }
+  return b;
+}
+
+
+/** Frees a block from history_block_new(), which may be NULL. */
+static void
+history_block_free(
+    struct history_block *b)
+{
+  if (b != NULL) {
+    irk_free(b);
+    __atomic_sub_fetch(&history_blocks_used, 1, __ATOMIC_RELAXED);
+  }
+}
+
+
+/**
+  Returns the index of the oldest block of 's', the first after the
+  newest, or HISTORY_BLOCKS if it has none.
+ */
+static int
+history_series_oldest(
+    const struct history_series *s)
+{
+  for (int i = 1; i <= HISTORY_BLOCKS; i++) {
+    int index = (s->newest + i) % HISTORY_BLOCKS;
+    if (s->blocks[index] != NULL) {
+      return index;
+    }
+  }
+  return HISTORY_BLOCKS;
+}
+
+
+/**
+  Takes the oldest block of the series of 'h' with the most blocks, as
+  long as that leaves it at least one.
+
+  Returns:
+    The block, or NULL if no series has more than one.
+ */
+static struct history_block *
+history_block_steal(
+    history *h)
+{
+  struct history_series *donor = NULL;
+  int most = 1;
+  for (size_t i = 0; i < h->series_used; i++) {
+    struct history_series *s = &(h->series[i]);
+    int count = 0;
+    for (int j = 0; j < HISTORY_BLOCKS; j++) {
+      count += s->blocks[j] != NULL;
+    }
+    if (count > most) {
+      donor = s;
+      most = count;
+    }
+  }
+  if (donor == NULL) {
+    return NULL;
+  }
+  int oldest = history_series_oldest(donor);
+  struct history_block *b = donor->blocks[oldest];
+  donor->blocks[oldest] = NULL;
+  return b;
+}
+
+
+/** Empties every block of 's'. */
+static void
+history_series_clear(
+    struct history_series *s)
+{
+  for (int i = 0; i < HISTORY_BLOCKS; i++) {
+    if (s->blocks[i] != NULL) {
+      s->blocks[i]->samples = 0;
+    }
+  }
+}
+
+
+/**
+  Starts the next block of 's' with a sample, clearing the oldest block if
+  they are all in use or the budget allows no more.
+
+  Returns:
+    0 on success, ENOSPC if the budget is used up and 's' has no block,
+    or ENOMEM.
+ */
+static int
+history_block_start(
+    history *h,
+    struct history_series *s,
+    int64_t time,
+    uint64_t value)
+{
+  struct history_block *current = s->blocks[s->newest];
+  if (current != NULL && current->samples > 0) {
+    s->newest = (s->newest + 1) % HISTORY_BLOCKS;
+  }
+
+  struct history_block *b = s->blocks[s->newest];
+  if (b == NULL) {
+    b = history_block_new();
+  }
+  if (b == NULL) {
+    // Out of budget, reuse the oldest block, or take one from another
+    // series if this one has none yet.
+    int oldest = history_series_oldest(s);
+    if (oldest != HISTORY_BLOCKS) {
+      s->newest = oldest;
+      b = s->blocks[oldest];
+    } else {
+      b = history_block_steal(h);
+      if (b == NULL) {
+        return ENOSPC;
+      }
+    }
+  }
+  s->blocks[s->newest] = b;
+  b->first_time = time;
+  b->first_value = value;
+  b->last_time = time;
+  b->samples = 1;
+  b->bits = 0;
+
+  s->time = time;
+  s->delta = 0;
+  s->value = value;
+  s->leading = HISTORY_NO_WINDOW;
+  s->trailing = 0;
+  return 0;
+}
+
+
+/**
+  Drops the series of 'h' whose keys have not been published for as many
+  snapshots as they hold samples, handing their blocks back to the budget.
+ */
+static void
+history_evict(
+    history *h)
+{
+  size_t kept = 0;
+  for (size_t i = 0; i < h->series_used; i++) {
+    struct history_series *s = &(h->series[i]);
+    if (s->seen != h->publishes) {
+      uint64_t samples = 0;
+      for (int j = 0; j < HISTORY_BLOCKS; j++) {
+        if (s->blocks[j] != NULL) {
+          samples += s->blocks[j]->samples;
+        }
+      }
+      if (h->publishes - s->seen >= samples) {
+        for (int j = 0; j < HISTORY_BLOCKS; j++) {
+          history_block_free(s->blocks[j]);
+        }
+        continue;
+      }
+    }
+    if (kept != i) {
+      h->series[kept] = *s;
+    }
+    kept++;
+  }
+  h->series_used = kept;
+}
+
+
+/** Appends a sample to 's'. */
+static int
+history_series_append(
+    history *h,
+    struct history_series *s,
+    uint8_t type,
+    int64_t time,
+    uint64_t value)
+{
+  if (s->type != type) {
+    history_series_clear(s);
+    s->type = type;
+  }
+
+  struct history_block *b = s->blocks[s->newest];
+  int64_t delta = time - s->time;
+  int64_t dod = delta - s->delta;
+  if (b == NULL || b->samples == 0 ||
+      b->bits + HISTORY_MAX_SAMPLE_BITS > HISTORY_BLOCK_BYTES * 8 ||
+      delta < 0 || dod < INT32_MIN || dod > INT32_MAX) {
+    return history_block_start(h, s, time, value);
+  }
+
+  struct history_bits bits = {b->data, b->bits};
+  if (dod == 0) {
+    history_put(&bits, 0x0, 1);
+  } else if (dod >= -63 && dod <= 64) {
+    history_put(&bits, 0x2, 2);
+    history_put(&bits, dod + 63, 7);
+  } else if (dod >= -255 && dod <= 256) {
+    history_put(&bits, 0x6, 3);
+    history_put(&bits, dod + 255, 9);
+  } else if (dod >= -2047 && dod <= 2048) {
+    history_put(&bits, 0xe, 4);
+    history_put(&bits, dod + 2047, 12);
+  } else {
+    history_put(&bits, 0xf, 4);
+    history_put(&bits, (uint32_t) dod, 32);
+  }
+
+  uint64_t xor = value ^ s->value;
+  if (xor == 0) {
+    history_put(&bits, 0x0, 1);
+  } else {
+    int leading = __builtin_clzll(xor);
+    int trailing = __builtin_ctzll(xor);
+    if (leading > 31) {
+      leading = 31;
+    }
+    if (s->leading != HISTORY_NO_WINDOW && leading >= s->leading &&
+        trailing >= s->trailing) {
+      // Fits in the window of the previous value, so reuse its lengths.
+      history_put(&bits, 0x2, 2);
+      history_put(
+          &bits, xor >> s->trailing, 64 - s->leading - s->trailing);
+    } else {
+      int significant = 64 - leading - trailing;
+      history_put(&bits, 0x3, 2);
+      history_put(&bits, leading, 5);
+      history_put(&bits, significant & 0x3f, 6);
+      history_put(&bits, xor >> trailing, significant);
+      s->leading = leading;
+      s->trailing = trailing;
+    }
+  }
+
+  b->bits = bits.position;
+  b->samples++;
+  b->last_time = time;
+  s->time = time;
+  s->delta = delta;
+  s->value = value;
+  return 0;
+}
+
+
+int
+history_record(
+    module *mod,
+    const module_data *md)
+{
+  if (config_history_bytes == 0) {
+    return 0;
+  }
+  history *h = history_get_module(mod);
+  if (h == NULL) {
+    return ENOMEM;
+  }
+
+  int64_t time = (int64_t) md->published.tv_sec * 1000 +
+      md->published.tv_usec / 1000;
+  const module_data_slot *slots = module_data_slots(md);
+  int err = 0;
+
+  pthread_mutex_lock(&(h->lock));
+  h->cursor = 0;
+  h->publishes++;
+  for (uint32_t i = 0; i < md->items; i++) {
+    const module_data_slot *slot = &slots[i];
+    if (slot->type != IRK_INT && slot->type != IRK_DOUBLE) {
+      continue;
+    }
+    // module_publish() has interned every key it could, so this only
+    // hashes keys that failed there.
+    uint32_t key_id = slot->key_offset;
+    if (!(slot->flags & MODULE_DATA_SLOT_KEY_ID)) {
+      key_id = intern_key(mod, module_data_key(md, slot), slot->key_length);
+      if (key_id == 0) {
+        err = ENOMEM;
+        continue;
+      }
+    }
+    struct history_series *s = history_series_find(h, key_id);
+    if (s == NULL) {
+      err = ENOMEM;
+      continue;
+    }
+
+    // Both are kept as their bits, XOR works as well on either.
+    uint64_t value;
+    memcpy(&value, &(slot->value), sizeof(value));
+    s->seen = h->publishes;
+    int append_err = history_series_append(h, s, slot->type, time, value);
+    if (append_err == ENOMEM) {
+      err = ENOMEM;
+    }
+  }
+  history_evict(h);
+  pthread_mutex_unlock(&(h->lock));
+  return err;
+}
+
+
+/**
+  Decodes the samples of 'b' taken after 'after' into h->points, starting
+  at h->points[*count].
+
+  Returns:
+    0 on success or ENOMEM.
+ */
+static int
+history_block_read(
+    history *h,
+    const struct history_block *b,
+    int64_t after,
+    size_t *count)
+{
+  if (*count + b->samples > h->points_capacity) {
+    size_t capacity = h->points_capacity ? h->points_capacity : 64;
+    while (capacity < *count + b->samples) {
+      capacity *= 2;
+    }
+    struct history_point *points = (struct history_point *) irk_realloc(
+        h->points, capacity * sizeof(struct history_point));
+    if (points == NULL) {
+      return ENOMEM;
+    }
+    h->points = points;
+    h->points_capacity = capacity;
+  }
+
+  struct history_bits bits = {(uint8_t *) b->data, 0};
+  int64_t time = b->first_time;
+  int64_t delta = 0;
+  uint64_t value = b->first_value;
+  int leading = 0;
+  int trailing = 0;
+
+  for (uint32_t i = 0; i < b->samples; i++) {
+    if (i > 0) {
+      int64_t dod;
+      if (history_get(&bits, 1) == 0) {
+        dod = 0;
+      } else if (history_get(&bits, 1) == 0) {
+        dod = (int64_t) history_get(&bits, 7) - 63;
+      } else if (history_get(&bits, 1) == 0) {
+        dod = (int64_t) history_get(&bits, 9) - 255;
+      } else if (history_get(&bits, 1) == 0) {
+        dod = (int64_t) history_get(&bits, 12) - 2047;
+      } else {
+        dod = (int32_t) history_get(&bits, 32);
+      }
+      delta += dod;
+      time += delta;
+
+      if (history_get(&bits, 1) == 1) {
+        if (history_get(&bits, 1) == 1) {
+          leading = history_get(&bits, 5);
+          int significant = history_get(&bits, 6);
+          if (significant == 0) {
+            significant = 64;
+          }
+          trailing = 64 - leading - significant;
+        }
+        value ^= history_get(&bits, 64 - leading - trailing) << trailing;
+      }
+    }
+
+    if (time > after) {
+      struct history_point *p = &(h->points[(*count)++]);
+      p->time = time;
+      memcpy(&(p->value), &value, sizeof(value));
+    }
+  }
+  return 0;
+}
+
+
+int
+history_walk(
+    module *mod,
+    const char *prefix,
+    size_t prefix_len,
+    int64_t after,
+    history_func callback,
+    void *user_data)
+{
+  history *h = __atomic_load_n(&(mod->history), __ATOMIC_ACQUIRE);
+  if (h == NULL) {
+    return 0;
+  }
+
+  int err = 0;
+  pthread_mutex_lock(&(h->lock));
+  for (size_t i = 0; i < h->series_used && err == 0; i++) {
+    const struct history_series *s = &(h->series[i]);
+    size_t key_len;
+    const char *key = intern_key_string(s->key_id, &key_len);
+    if (!encoder_key_selected(key, key_len, prefix, prefix_len)) {
+      continue;
+    }
+
+    // Oldest block first.
+    size_t count = 0;
+    for (int j = 1; j <= HISTORY_BLOCKS && err == 0; j++) {
+      const struct history_block *b =
+          s->blocks[(s->newest + j) % HISTORY_BLOCKS];
+      if (b != NULL && b->samples > 0 && b->last_time > after) {
+        err = history_block_read(h, b, after, &count);
+      }
+    }
+    if (err == 0 && count > 0) {
+      err = callback(mod, key, key_len, s->type, h->points, count, user_data);
+    }
+  }
+  pthread_mutex_unlock(&(h->lock));
+  return err;
+}
+
+
+void
+history_free(
+    history *h)
+{
+  if (h == NULL) {
+    return;
+  }
+  for (size_t i = 0; i < h->series_used; i++) {
+    for (int j = 0; j < HISTORY_BLOCKS; j++) {
+      history_block_free(h->series[i].blocks[j]);
+    }
+  }
+  pthread_mutex_destroy(&(h->lock));
+  irk_free(h->series);
+  irk_free(h->points);
+  irk_free(h);
+}
@@ -0,0 +1,165 @@
+/*
+Copyright (C) 2012 Brady Catherman
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef __MASTER_HISTORY_H
+#define __MASTER_HISTORY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <master/module.h>
+
+/**
+  Recent history of every numeric value.
+
+  Each time a module publishes a snapshot, every IRK_INT and IRK_DOUBLE
+  value in it is appended to a series for its key, so a client that polls
+  less often than the module collects can still get every sample with
+  '?history='. Strings, histograms and sketches are not kept.
+
+  Series are compressed the way Gorilla (Pelkonen et al., VLDB 2015) does
+  it. Timestamps are stored as the change in the interval between samples,
+  which for a module collected on a timer is nearly always a few bits.
+  Values are stored as the XOR with the previous value, which is zero
+  when nothing changed and otherwise usually has long runs of zero bits
+  at both ends that are left out. A typical sample takes a few bytes
+  rather than sixteen.
+
+  Series are written in blocks of HISTORY_BLOCK_BYTES, up to
+  HISTORY_BLOCKS of them, one after another. When the last block is full
+  the oldest one is cleared and reused, so how far back history goes
+  depends on how well the series compresses.
+
+  Every block of every module comes out of a single budget of
+  config_history_bytes for the whole process. Once it is used up, series
+  stop growing and keep reusing the blocks they have, and a new series
+  takes the oldest block of the series of its module that has the most.
+  A series whose key has not been published for as many snapshots as it
+  holds samples, so that its history would have been overwritten by now
+  had it carried on, is dropped and its blocks go back to the budget. So
+  keys that come and go do not hold on to memory.
+ */
+
+
+/** The most blocks a series is split into. */
+#define HISTORY_BLOCKS 4
+
+
+/** The size of the data in each block. */
+#define HISTORY_BLOCK_BYTES 256
+
+
+/** The history of one module. */
+typedef struct history history;
+
+
+/** A sample from a series. */
+struct history_point {
+  /** When the snapshot holding it was published, in ms since the epoch. */
+  int64_t time;
+
+  union {
+    int64_t i;
+    double d;
+  } value;
+};
+
+
+/**
+  Called by history_walk() for each series.
+
+  Arguments:
+    mod: The module.
+    key: The key of the series, relative to the module's path.
+    key_len: The length of key.
+    type: IRK_INT or IRK_DOUBLE.
+    points: The samples, oldest first.
+    count: The number of samples, never 0.
+    user_data: Passed through from history_walk().
+
+  Returns:
+    0 to carry on, anything else stops the walk and is returned from it.
+ */
+typedef int (*history_func)(
+    module *mod,
+    const char *key,
+    size_t key_len,
+    uint8_t type,
+    const struct history_point *points,
+    size_t count,
+    void *user_data);
+
+
+/**
+  Appends the numeric values in 'md' to the history of 'mod'.
+
+  This is called by module_publish() once 'md' is published, and does
+  nothing if config_history_bytes is 0.
+
+  Arguments:
+    mod: The module.
+    md: The snapshot just published.
+
+  Returns:
+    0 on success or ENOMEM, in which case some values were not recorded.
+ */
+int
+history_record(
+    module *mod,
+    const module_data *md);
+
+
+/**
+  Calls 'callback' with the recent history of each selected series.
+
+  The module's history is locked while this runs, so the callback should
+  be quick and must not publish to the same module.
+
+  Arguments:
+    mod: The module.
+    prefix: Only keys equal to this or below it (followed by a '/') are
+            selected. An empty prefix selects every key.
+    prefix_len: The length of prefix.
+    after: Only samples taken after this time (in ms since the epoch)
+           are returned. Series with none are skipped.
+    callback: Called with the samples of each series.
+    user_data: Passed through to callback.
+
+  Returns:
+    0 on success, ENOMEM, or whatever callback returned.
+ */
+int
+history_walk(
+    module *mod,
+    const char *prefix,
+    size_t prefix_len,
+    int64_t after,
+    history_func callback,
+    void *user_data);
+
+
+/** Frees the history of a module, which may be NULL. */
+void
+history_free(
+    history *h);
+
+#endif
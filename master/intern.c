@@ -0,0 +1,281 @@
+/*
+Copyright (C) 2012 Brady Catherman
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <common/cstrhash.h>
+#include <common/epoch.h>
+#include <common/logging.h>
+#include <common/memory.h>
+#include <common/strhash.h>
+#include <master/intern.h>
+
+/**
+  IDs index into a two level table: a fixed array of chunk pointers, each
+  chunk holding INTERN_CHUNK_SIZE entries. Chunks never move once they are
+  allocated, which is what lets intern_key_string() run without a lock
+  while another thread is interning new keys.
+ */
+#define INTERN_CHUNK_BITS 10
+#define INTERN_CHUNK_SIZE (1 << INTERN_CHUNK_BITS)
+#define INTERN_MAX_CHUNKS ((INTERN_MAX_KEYS >> INTERN_CHUNK_BITS) + 1)
+
+// Composite keys shorter than this are built on the stack.
+#define INTERN_STACK_KEY 256
+
+
+struct intern_entry {
+  module *mod;
+  char *key;
+  size_t key_len;
+};
+
+
+/**
+  Serializes assigning new IDs. Keys that already have one are found in
+  intern_table without it, and lookups by ID do not take it either.
+ */
+static pthread_mutex_t intern_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+  Maps the module pointer followed by the key bytes to the ID. Read by
+  every collector and the HTTP thread, so it is read without locks inside
+  intern_epoch. IDs are not pointers, so nothing but the table's own nodes
+  is ever retired.
+ */
+static cstrhash *intern_table = NULL;
+static epoch *intern_epoch = NULL;
+static pthread_once_t intern_once = PTHREAD_ONCE_INIT;
+
+/** This thread's reader of intern_epoch, registered on first use. */
+static __thread epoch_reader *intern_reader = NULL;
+
+static struct intern_entry *intern_chunks[INTERN_MAX_CHUNKS];
+
+/** The next ID to hand out. Only modified with intern_lock held. */
+static uint32_t intern_next_id = 1;
+
+
+/** Returns the entry for an assigned 'id', or NULL. */
+static struct intern_entry *
+intern_entry_get(
+    uint32_t id)
+{
+  if (id == 0 || id >= __atomic_load_n(&intern_next_id, __ATOMIC_ACQUIRE)) {
+    return NULL;
+  }
+  struct intern_entry *chunk = __atomic_load_n(
+      &intern_chunks[id >> INTERN_CHUNK_BITS], __ATOMIC_ACQUIRE);
+  return &chunk[id & (INTERN_CHUNK_SIZE - 1)];
+}
+
+
+/**
+  Assigns the next ID to 'key' and stores its entry. Called with
+  intern_lock held once the key is known to be new.
+
+  Returns:
+    The ID or 0 with errno set.
+ */
+static uint32_t
+intern_assign(
+    module *mod,
+    const char *key,
+    size_t key_len,
+    const char *composite,
+    size_t composite_len,
+    uint64_t hash)
+{
+  uint32_t id = intern_next_id;
+  if (id > INTERN_MAX_KEYS) {
+    log_error("Unable to intern key, all %d IDs are in use", INTERN_MAX_KEYS);
+    errno = ENOSPC;
+    return 0;
+  }
+
+  uint32_t chunk_index = id >> INTERN_CHUNK_BITS;
+  struct intern_entry *chunk = intern_chunks[chunk_index];
+  if (chunk == NULL) {
+    chunk = (struct intern_entry *) irk_calloc(
+        INTERN_CHUNK_SIZE, sizeof(struct intern_entry));
+    if (chunk == NULL) {
+      errno = ENOMEM;
+      return 0;
+    }
+    __atomic_store_n(&intern_chunks[chunk_index], chunk, __ATOMIC_RELEASE);
+  }
+
+  struct intern_entry *entry = &chunk[id & (INTERN_CHUNK_SIZE - 1)];
+  entry->key = (char *) irk_malloc(key_len + 1);
+  if (entry->key == NULL) {
+    errno = ENOMEM;
+    return 0;
+  }
+  memcpy(entry->key, key, key_len);
+  entry->key[key_len] = '\0';
+  entry->key_len = key_len;
+  entry->mod = mod;
+
+  // Publishing the new count is what makes the entry visible to lookups by
+  // ID. It is done before the key can be found in intern_table so that
+  // anyone who gets the ID there can also look it up.
+  __atomic_store_n(&intern_next_id, id + 1, __ATOMIC_RELEASE);
+
+  void *value = (void *) (uintptr_t) id;
+  if (cstrhash_put_n(intern_table, composite, composite_len, hash, value)
+      != 0) {
+    // Nobody else can have been given the ID yet, so it is handed out again.
+    __atomic_store_n(&intern_next_id, id, __ATOMIC_RELEASE);
+    irk_free(entry->key);
+    entry->key = NULL;
+    errno = ENOMEM;
+    return 0;
+  }
+  return id;
+}
+
+
+static void
+intern_init(void)
+{
+  intern_epoch = epoch_init();
+  if (intern_epoch == NULL) {
+    return;
+  }
+  intern_table = cstrhash_init(0, intern_epoch, NULL);
+  if (intern_table == NULL) {
+    epoch_destroy(intern_epoch);
+    intern_epoch = NULL;
+  }
+}
+
+
+/**
+  Returns the ID 'composite' already has, or 0. Takes no locks once this
+  thread has registered with intern_epoch.
+ */
+static uint32_t
+intern_find(
+    const char *composite,
+    size_t composite_len,
+    uint64_t hash)
+{
+  if (intern_reader == NULL) {
+    intern_reader = epoch_reader_register(intern_epoch);
+    if (intern_reader == NULL) {
+      return 0;
+    }
+  }
+  epoch_enter(intern_reader);
+  void *value = cstrhash_get_n(intern_table, composite, composite_len, hash);
+  epoch_exit(intern_reader);
+  return (uint32_t) (uintptr_t) value;
+}
+
+
+uint32_t
+intern_key(
+    module *mod,
+    const char *key,
+    size_t key_len)
+{
+  if (key == NULL || key_len > UINT16_MAX) {
+    errno = EINVAL;
+    return 0;
+  }
+
+  // The table is keyed on the module pointer followed by the key so that
+  // the same key in two modules gets two IDs.
+  char stack_key[INTERN_STACK_KEY];
+  char *composite = stack_key;
+  size_t composite_len = sizeof(mod) + key_len;
+  if (composite_len > sizeof(stack_key)) {
+    composite = (char *) irk_malloc(composite_len);
+    if (composite == NULL) {
+      errno = ENOMEM;
+      return 0;
+    }
+  }
+  memcpy(composite, &mod, sizeof(mod));
+  memcpy(composite + sizeof(mod), key, key_len);
+  uint64_t hash = strhash_hash(composite, composite_len);
+
+  uint32_t id = 0;
+  pthread_once(&intern_once, intern_init);
+  if (intern_table == NULL) {
+    errno = ENOMEM;
+  } else {
+    id = intern_find(composite, composite_len, hash);
+  }
+
+  // Only a new key takes the lock. It is looked up again under it since
+  // another thread may have assigned it in the meantime. Writers are
+  // serialized by the lock, so this lookup needs no read section.
+  if (id == 0 && intern_table != NULL) {
+    pthread_mutex_lock(&intern_lock);
+    void *value =
+        cstrhash_get_n(intern_table, composite, composite_len, hash);
+    if (value != NULL) {
+      id = (uint32_t) (uintptr_t) value;
+    } else {
+      id = intern_assign(
+          mod, key, key_len, composite, composite_len, hash);
+    }
+    pthread_mutex_unlock(&intern_lock);
+  }
+
+  if (composite != stack_key) {
+    irk_free(composite);
+  }
+  return id;
+}
+
+
+const char *
+intern_key_string(
+    uint32_t id,
+    size_t *key_len)
+{
+  struct intern_entry *entry = intern_entry_get(id);
+  if (entry == NULL) {
+    return NULL;
+  }
+  if (key_len != NULL) {
+    *key_len = entry->key_len;
+  }
+  return entry->key;
+}
+
+
+module *
+intern_key_module(
+    uint32_t id)
+{
+  struct intern_entry *entry = intern_entry_get(id);
+  if (entry == NULL) {
+    return NULL;
+  }
+  return entry->mod;
+}
@@ -0,0 +1,98 @@
+/*
+Copyright (C) 2012 Brady Catherman
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef __MASTER_INTERN_H
+#define __MASTER_INTERN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <master/module.h>
+
+/**
+  Interning of metric keys.
+
+  Modules export the same keys every cycle, so rather than copying, hashing
+  and comparing "cpu0.user" every time each distinct (module, key) pair is
+  given a small numeric ID the first time it is seen. IDs are never reused
+  or forgotten, so a module can look its keys up once when it is loaded and
+  report values by ID from then on.
+
+  IDs start at 1, 0 is never a valid ID. Looking up the key for an ID, or
+  the ID of a key that already has one, does not take any locks and is
+  safe from any thread. Only assigning a new ID is serialized.
+ */
+
+
+/** The most keys that can be interned. */
+#define INTERN_MAX_KEYS ((1 << 22) - 1)
+
+
+/**
+  Returns the ID for 'key' in 'mod', assigning a new one if needed.
+
+  Arguments:
+    mod: The module that exports the key.
+    key: The key, which need not be NUL terminated.
+    key_len: The length of key, at most 65535.
+
+  Returns:
+    The ID, or 0 with errno set to EINVAL if the key is too long, ENOMEM on
+    allocation failure or ENOSPC once INTERN_MAX_KEYS keys are in use.
+ */
+uint32_t
+intern_key(
+    module *mod,
+    const char *key,
+    size_t key_len);
+
+
+/**
+  Returns the NUL terminated key that 'id' was assigned to.
+
+  Arguments:
+    id: An ID returned from intern_key().
+    key_len: If not NULL this is set to the length of the key.
+
+  Returns:
+    The key, or NULL if id has not been assigned.
+ */
+const char *
+intern_key_string(
+    uint32_t id,
+    size_t *key_len);
+
+
+/**
+  Returns the module that 'id' was assigned for.
+
+  Arguments:
+    id: An ID returned from intern_key().
+
+  Returns:
+    The module, or NULL if id has not been assigned.
+ */
+module *
+intern_key_module(
+    uint32_t id);
+
+#endif
@@ -22,21 +22,46 @@ DEALINGS IN THE SOFTWARE.
 
 #include <errno.h>
 #include <fts.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 #include <sys/types.h>
 #include <string.h>
 
 #include <common/config.h>
+#include <common/epoch.h>
 #include <common/logging.h>
+#include <common/memory.h>
+#include <common/pathtrie.h>
 #include <common/strhash.h>
+#include <master/encoder.h>
+#include <master/history.h>
 #include <master/module.h>
+#include <master/module_data.h>
 #include <security/security.h>
 
 
 
+// Every module that has claimed a path, keyed by registered_path.
+static pathtrie *module_index = NULL;
+
+// Protects every module's snapshot, created on first use.
+static epoch *module_epoch = NULL;
+static pthread_once_t module_epoch_once = PTHREAD_ONCE_INIT;
+
+// Serializes module_publish() so generations are published in order.
+static pthread_mutex_t module_publish_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// The most recent generation published by any module.
+static uint64_t module_generation = 0;
+
+// This thread's registration with module_epoch.
+static __thread epoch_reader *module_epoch_reader = NULL;
+
+
 struct module_file_list {
   // The actual module_file structure we are storing.
   module_file data;
@@ -61,9 +86,9 @@ free_module_file_list(
   while (p != NULL) {
     struct module_file_list *p_next = p->next;
     if (p->data.filename != NULL) {
-      free(p->data.filename);
+      irk_free(p->data.filename);
     }
-    free(p);
+    irk_free(p);
     p = p_next;
   }
 }
@@ -90,16 +115,16 @@ modules_load_add(
     int *length)
 {
   struct module_file_list *m =
-      (struct module_file_list *) malloc(sizeof(struct module_file_list));
+      (struct module_file_list *) irk_malloc(sizeof(struct module_file_list));
   if (m == NULL) {
     errno = ENOMEM;
     return ENOMEM;
   }
 
   // Filename.
-  m->data.filename = (char *) malloc(f->fts_pathlen + 1);
+  m->data.filename = (char *) irk_malloc(f->fts_pathlen + 1);
   if (m->data.filename == NULL) {
-    free(m);
+    irk_free(m);
     errno = ENOMEM;
     return ENOMEM;
   }
@@ -301,3 +326,267 @@ modules_load(
   // TODO
   return 0;
 }
+
+
+int
+module_index_add(
+    module *mod,
+    const char *path)
+{
+  if (module_index == NULL) {
+    module_index = pathtrie_init();
+    if (module_index == NULL) {
+      return ENOMEM;
+    }
+  }
+
+  // Claiming the same path again changes nothing, and the entry must not
+  // be removed below as the old path.
+  if (pathtrie_get(module_index, path) == mod) {
+    return 0;
+  }
+
+  int err = pathtrie_add(module_index, path, mod);
+  if (err != 0) {
+    return err;
+  }
+
+  // Paths such as "/a.b" and "/a_b" differ but would write the same
+  // Prometheus names.
+  err = encoder_prometheus_claim(mod, path);
+  if (err != 0) {
+    pathtrie_remove(module_index, path);
+    return err;
+  }
+
+  if (mod->registered_path != NULL && mod->registered_path != path) {
+    pathtrie_remove(module_index, mod->registered_path);
+  }
+  return 0;
+}
+
+
+void
+module_index_remove(
+    module *mod)
+{
+  if (module_index == NULL || mod->registered_path == NULL) {
+    return;
+  }
+
+  if (pathtrie_get(module_index, mod->registered_path) == mod) {
+    pathtrie_remove(module_index, mod->registered_path);
+  }
+  encoder_prometheus_release(mod);
+}
+
+
+module *
+module_index_find(
+    const char *path)
+{
+  if (module_index == NULL) {
+    return NULL;
+  }
+
+  // Walk back through shorter and shorter prefixes until one of them ends
+  // on a component boundary. This is almost always the first match.
+  char *buffer = NULL;
+  const char *p = path;
+  while (true) {
+    size_t match_len;
+    module *mod = pathtrie_longest_prefix(module_index, p, &match_len);
+    if (mod == NULL || p[match_len] == '/' || p[match_len] == '\0') {
+      irk_free(buffer);
+      return mod;
+    }
+
+    // "/net" matched "/network", try again with only "/net".
+    if (buffer == NULL) {
+      buffer = irk_strdup(path);
+      if (buffer == NULL) {
+        return NULL;
+      }
+      p = buffer;
+    }
+    buffer[match_len - 1] = '\0';
+  }
+}
+
+
+struct module_index_walk_state {
+  const char *path;
+  size_t path_len;
+  int (*callback)(module *mod, void *user_data);
+  void *user_data;
+};
+
+
+static int
+module_index_walk_callback(
+    const char *path,
+    size_t path_len,
+    void *value,
+    void *user_data)
+{
+  struct module_index_walk_state *state =
+      (struct module_index_walk_state *) user_data;
+
+  // Skip siblings that merely share a prefix, like "/network" for "/net".
+  if (path_len > state->path_len &&
+      state->path[state->path_len - 1] != '/' &&
+      path[state->path_len] != '/') {
+    return 0;
+  }
+
+  return state->callback((module *) value, state->user_data);
+}
+
+
+int
+module_index_walk(
+    const char *path,
+    int (*callback)(module *mod, void *user_data),
+    void *user_data)
+{
+  if (module_index == NULL) {
+    return 0;
+  }
+
+  struct module_index_walk_state state;
+  state.path = path;
+  state.path_len = strlen(path);
+  state.callback = callback;
+  state.user_data = user_data;
+
+  if (state.path_len == 0) {
+    state.path = "/";
+    state.path_len = 1;
+  }
+
+  return pathtrie_walk(
+      module_index,
+      state.path,
+      module_index_walk_callback,
+      &state);
+}
+
+
+static void
+module_epoch_init(void)
+{
+  module_epoch = epoch_init();
+  if (module_epoch == NULL) {
+    log_error("Unable to create the module snapshot epoch.");
+  }
+}
+
+
+/** Frees a snapshot once the epoch says no reader can see it. */
+static void
+module_snapshot_free(
+    void *ptr)
+{
+  free_module_data((module_data *) ptr);
+}
+
+
+uint64_t
+module_publish(
+    module *mod,
+    module_data *md)
+{
+  pthread_once(&module_epoch_once, module_epoch_init);
+  if (module_epoch == NULL) {
+    errno = ENOMEM;
+    return 0;
+  }
+
+  // Keys are interned before anything reads md, so that history and the
+  // encoders use their IDs. The snapshot being replaced is only read inside
+  // the epoch since another publisher could retire it.
+  const module_data *previous = NULL;
+  bool entered = module_snapshot_enter() == 0;
+  if (entered) {
+    previous = module_snapshot(mod);
+  }
+  int err = module_data_intern_keys(md, mod, previous);
+  if (err != 0) {
+    log_error("Unable to intern the keys of a module: %s", strerror(err));
+  }
+  if (entered) {
+    module_snapshot_exit();
+  }
+
+  // Encoding the default format up front means requests for the whole
+  // module just send these bytes. It is done before taking the lock since
+  // it is the most expensive part of publishing. Other formats are encoded
+  // when first asked for.
+  if (mod->registered_path != NULL) {
+    encoder_module_fragment(&encoder_json, mod, md);
+  }
+
+  // History is recorded outside of the lock too, and before md is
+  // published since once it is another publisher could free it.
+  gettimeofday(&(md->published), NULL);
+  if (history_record(mod, md) != 0) {
+    log_error("Unable to record the history of a module, out of memory.");
+  }
+
+  pthread_mutex_lock(&module_publish_lock);
+  uint64_t generation = module_generation + 1;
+  md->generation = generation;
+  module_data_set_changed(md, mod->snapshot, generation);
+  module_data *old = __atomic_exchange_n(
+      &(mod->snapshot), md, __ATOMIC_ACQ_REL);
+  __atomic_store_n(&(mod->generation), generation, __ATOMIC_RELEASE);
+  __atomic_store_n(&module_generation, generation, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&module_publish_lock);
+
+  if (old != NULL && epoch_retire(module_epoch, old, module_snapshot_free)) {
+    // Leaking one snapshot is better than freeing it under a reader.
+    log_error("Unable to retire snapshot %p, leaking it.", old);
+  }
+  return generation;
+}
+
+
+int
+module_snapshot_enter(void)
+{
+  if (module_epoch_reader == NULL) {
+    pthread_once(&module_epoch_once, module_epoch_init);
+    if (module_epoch == NULL) {
+      return ENOMEM;
+    }
+    module_epoch_reader = epoch_reader_register(module_epoch);
+    if (module_epoch_reader == NULL) {
+      return ENOMEM;
+    }
+  }
+
+  epoch_enter(module_epoch_reader);
+  return 0;
+}
+
+
+void
+module_snapshot_exit(void)
+{
+  epoch_exit(module_epoch_reader);
+}
+
+
+const module_data *
+module_snapshot(
+    module *mod)
+{
+  return __atomic_load_n(&(mod->snapshot), __ATOMIC_ACQUIRE);
+}
+
+
+uint64_t
+module_current_generation(void)
+{
+  return __atomic_load_n(&module_generation, __ATOMIC_ACQUIRE);
+}
@@ -25,35 +25,22 @@ DEALINGS IN THE SOFTWARE.
 
 #include <sys/stat.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 // Ensures that the api header does not overwrite this definition using
 // void types. We do not let modules know the contents of these structures
 // to keep modules from mucking with them.
 #define IRK_MODULE_DATA_DEFINED
-typedef struct module_data_node module_data_node;
 typedef struct module_data module_data;
 typedef struct module_file module_file;
 typedef struct module module;
+typedef struct irk_histogram irk_histogram;
+typedef struct irk_sketch irk_sketch;
 
 #include <irk/api.h>
 
-
-struct module_data_node {
-  char *key;
-  enum irk_value_type type;
-  union {
-    char *string;
-    int64_t i;
-    double d;
-  } value;;
-  module_data_node *next;
-};
-
-
-struct module_data {
-  module_data_node *head;
-};
-
+// struct module_data is defined in master/module_data.h, irk_histogram
+// and irk_sketch in master/distribution.h.
 
 struct module_file {
   /** The file name that this module was loaded from. */
@@ -121,6 +108,12 @@ struct module {
    */
   struct timeval timer_delay;
 
+  /**
+    The longest the timer callback may run before the module is treated
+    as stuck, see collector/scheduler.h. Zero means timer_delay.
+   */
+  struct timeval timer_deadline;
+
   /**
     Function to call in order to get data on refresh.
 
@@ -147,6 +140,8 @@ struct module {
     an expensive data collection cycle, irk allows a minimum time to be set
     between refreshes (globally). This can be used with any module that is
     expensive to collect, or which causes impact on the local machine.
+    Requests for a refresh within this time of the last one starting are
+    answered from the current snapshot, see collector/refresh.h.
 
     By default the time between refreshes is not limited.
    */
@@ -171,11 +166,216 @@ struct module {
   /** Set if register_refresh_callback was called. */
   bool register_refresh_callback_called;
 
+  /**
+    Set from when the initial callback is registered until what it
+    returned has been handed back, timer callbacks are not run until then.
+   */
+  bool initial_pending;
+
+  /**
+    The most recent data published for this module.
+
+    This is immutable once published and is replaced as a whole by
+    module_publish(). Readers must go through module_snapshot().
+   */
+  module_data *snapshot;
+
+  /** The generation of 'snapshot', 0 until something is published. */
+  uint64_t generation;
+
+  /**
+    The recent values of this module, see master/history.h. This is
+    created the first time a snapshot is published.
+   */
+  struct history *history;
+
+  /**
+    The metrics declared with declare_metric(), see master/schema.h, or
+    NULL if none were.
+   */
+  struct module_schema *schema;
+
+  /**
+    The scheduler's state for this module, or NULL if its timer is not
+    scheduled.
+   */
+  struct scheduler_entry *scheduler_entry;
+
+  /**
+    The state of refreshes of this module, see collector/refresh.h, or
+    NULL if it has never been refreshed.
+   */
+  struct refresh_entry *refresh_entry;
+
+  /**
+    What the callbacks of this module have cost, see
+    collector/accounting.h, or NULL if none have run.
+   */
+  struct accounting *accounting;
+
   /** Linked list used for module_file tracking. */
   module *next;
 };
 
 
+/**
+  Claims 'path' for 'mod' in the module index.
+
+  The module index is a path trie of every registered_path, used to find
+  which module owns a requested path and to list every module below a
+  prefix without scanning all of them. A module may only hold one path, so
+  any path previously claimed by 'mod' is released.
+
+  Arguments:
+    mod: The module claiming the path.
+    path: The normalized path being claimed.
+
+  Returns:
+    0 on success, including when 'mod' already holds 'path'.
+    EEXIST if another module already claimed exactly this path, or one
+    that gives the same Prometheus names (see encoder_prometheus_claim()).
+    ENOMEM on allocation failure.
+ */
+int
+module_index_add(
+    module *mod,
+    const char *path);
+
+
+/**
+  Removes the path claimed by 'mod' from the module index, if any.
+
+  Arguments:
+    mod: The module to remove.
+ */
+void
+module_index_remove(
+    module *mod);
+
+
+/**
+  Finds the module that owns 'path'.
+
+  This is the module with the longest registered_path that is a whole
+  component prefix of 'path', so "/net" owns "/net/dev" but not "/network".
+
+  Arguments:
+    path: The path being requested.
+
+  Returns:
+    The owning module or NULL if no module owns path.
+ */
+module *
+module_index_find(
+    const char *path);
+
+
+/**
+  Calls 'callback' for every module registered at or below 'path'.
+
+  Modules are visited in sorted order of their registered_path, and only
+  the modules that match are visited so this costs time proportional to the
+  size of the answer. A path of "/" visits every module.
+
+  Arguments:
+    path: The path to list.
+    callback: Called with each module and user_data. Returning non zero
+              stops the walk.
+    user_data: Passed through to callback.
+
+  Returns:
+    0 if the walk completed, otherwise the value returned by callback or
+    ENOMEM.
+ */
+int
+module_index_walk(
+    const char *path,
+    int (*callback)(module *mod, void *user_data),
+    void *user_data);
+
+
+/**
+  Makes 'md' the current snapshot of 'mod'.
+
+  Snapshots are published with a single atomic pointer swap so readers
+  always see either the old or the new snapshot in full, and never wait for
+  a collector. The snapshot being replaced is handed to the module epoch
+  and freed once no reader can still be holding it.
+
+  Arguments:
+    mod: The module the data belongs to.
+    md: The new data. This is owned by the module from now on and must not
+        be modified.
+
+  Generations come from a single counter shared by every module, so a
+  generation seen by a client orders changes across all modules. Every
+  key in 'md' is given its interned ID, see module_data_intern_keys(), the
+  changed generation of each value is set here too, see
+  module_data_set_changed(), and 'md' is encoded as JSON so that requests
+  can send it without formatting it again. Its numeric values are added
+  to the module's history, see master/history.h.
+
+  Returns:
+    The generation 'md' was published as, which is higher than that of any
+    snapshot published before it, or 0 with errno set to ENOMEM if the
+    module epoch could not be created.
+ */
+uint64_t
+module_publish(
+    module *mod,
+    module_data *md);
+
+
+/**
+  Returns the most recent generation published by any module.
+
+  A reader that takes this before looking at any snapshots knows that every
+  change up to and including it is visible to it. Anything published later
+  may or may not be.
+ */
+uint64_t
+module_current_generation(void);
+
+
+/**
+  Enters a read section in which snapshots may be used.
+
+  Any snapshot returned by module_snapshot() stays valid until the matching
+  module_snapshot_exit(). Read sections should be short, for example the
+  handling of a single request, since nothing replaced during one can be
+  freed until it ends. Sections may not be nested.
+
+  The first call on each thread registers the thread with the module epoch.
+
+  Returns:
+    0 on success, or ENOMEM if the thread could not be registered.
+ */
+int
+module_snapshot_enter(void);
+
+
+/** Leaves the read section started by module_snapshot_enter(). */
+void
+module_snapshot_exit(void);
+
+
+/**
+  Returns the current snapshot of 'mod'.
+
+  This must be called between module_snapshot_enter() and
+  module_snapshot_exit() and costs a single atomic load.
+
+  Arguments:
+    mod: The module to read.
+
+  Returns:
+    The snapshot, or NULL if nothing has been published yet.
+ */
+const module_data *
+module_snapshot(
+    module *mod);
+
+
 /**
   Loads all the library modules from the given path.
 
@@ -0,0 +1,695 @@
+/*
+Copyright (C) 2012 Brady Catherman
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <common/logging.h>
+#include <common/memory.h>
+#include <master/distribution.h>
+#include <master/module_data.h>
+#include <master/schema.h>
+
+// Sizes used when new_module_data() is given no hint.
+#define MODULE_DATA_DEFAULT_SLOTS 16
+#define MODULE_DATA_BYTES_PER_SLOT 32
+
+
+/**
+  Makes sure 'md' has room for one more slot and 'bytes' more bytes of
+  string area, moving everything into a bigger block if not.
+
+  Returns:
+    0 on success.
+    ENOMEM if the block could not be grown.
+ */
+static int
+module_data_reserve(
+    module_data *md,
+    size_t bytes)
+{
+  size_t slot_capacity = md->slot_capacity;
+  size_t strings_capacity = md->strings_capacity;
+
+  if (md->items == slot_capacity) {
+    slot_capacity *= 2;
+  }
+  while (strings_capacity - md->strings_used < bytes) {
+    strings_capacity *= 2;
+  }
+  if (slot_capacity == md->slot_capacity &&
+      strings_capacity == md->strings_capacity) {
+    return 0;
+  }
+  if (slot_capacity > UINT32_MAX || strings_capacity > UINT32_MAX) {
+    return ENOMEM;
+  }
+
+  char *block = (char *) irk_malloc(
+      slot_capacity * sizeof(module_data_slot) + strings_capacity);
+  if (block == NULL) {
+    return ENOMEM;
+  }
+
+  // String offsets are relative to the start of the string area so both
+  // halves can simply be copied across.
+  memcpy(block, md->block, md->items * sizeof(module_data_slot));
+  memcpy(
+      block + slot_capacity * sizeof(module_data_slot),
+      module_data_strings(md),
+      md->strings_used);
+  irk_free(md->block);
+
+  md->block = block;
+  md->slot_capacity = slot_capacity;
+  md->strings_capacity = strings_capacity;
+  return 0;
+}
+
+
+/**
+  Copies 'string' into the string area of 'md', which must have room.
+
+  Returns:
+    The offset the string was stored at.
+ */
+static uint32_t
+module_data_store_string(
+    module_data *md,
+    const char *string,
+    size_t len)
+{
+  uint32_t offset = md->strings_used;
+  char *strings = (char *) module_data_strings(md);
+  memcpy(strings + offset, string, len);
+  strings[offset + len] = '\0';
+  md->strings_used += len + 1;
+  return offset;
+}
+
+
+/**
+  Appends a slot to 'md' with room for 'extra' more bytes of string area,
+  filling in everything but the value.
+
+  The key is either the string 'key' or, if that is NULL, the interned
+  'key_id'.
+
+  Returns:
+    The new slot or NULL with errno set.
+ */
+static module_data_slot *
+module_data_append(
+    module_data *md,
+    const char *key,
+    uint32_t key_id,
+    size_t extra)
+{
+  if (md == NULL) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  size_t key_len;
+  if (key != NULL) {
+    key_len = strlen(key);
+    if (key_len > UINT16_MAX) {
+      log_error("module_data key is too long: %zu bytes", key_len);
+      errno = EINVAL;
+      return NULL;
+    }
+    extra += key_len + 1;
+  } else if (intern_key_string(key_id, &key_len) == NULL) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  int err = module_data_reserve(md, extra);
+  if (err != 0) {
+    errno = err;
+    return NULL;
+  }
+
+  module_data_slot *slot = (module_data_slot *) md->block + md->items;
+  if (key != NULL) {
+    slot->key_offset = module_data_store_string(md, key, key_len);
+    slot->flags = 0;
+  } else {
+    slot->key_offset = key_id;
+    slot->flags = MODULE_DATA_SLOT_KEY_ID;
+  }
+  slot->key_length = key_len;
+  slot->string_length = 0;
+  slot->changed = 0;
+  md->items++;
+  return slot;
+}
+
+
+module_data *
+new_module_data(
+    size_t size_hint)
+{
+  module_data *md = (module_data *) irk_malloc(sizeof(module_data));
+  if (md == NULL) {
+    return NULL;
+  }
+
+  if (size_hint == 0) {
+    size_hint = MODULE_DATA_DEFAULT_SLOTS;
+  } else if (size_hint > UINT32_MAX / MODULE_DATA_BYTES_PER_SLOT) {
+    size_hint = UINT32_MAX / MODULE_DATA_BYTES_PER_SLOT;
+  }
+  md->items = 0;
+  md->schema = NULL;
+  md->generation = 0;
+  md->published.tv_sec = 0;
+  md->published.tv_usec = 0;
+  for (int i = 0; i < ENCODER_COUNT; i++) {
+    md->encoded[i] = NULL;
+    for (int j = 0; j < COMPRESS_COUNT; j++) {
+      md->compressed[i][j] = NULL;
+    }
+  }
+  md->slot_capacity = size_hint;
+  md->strings_used = 0;
+  md->strings_capacity = size_hint * MODULE_DATA_BYTES_PER_SLOT;
+  md->block = (char *) irk_malloc(
+      md->slot_capacity * sizeof(module_data_slot) + md->strings_capacity);
+  if (md->block == NULL) {
+    irk_free(md);
+    return NULL;
+  }
+
+  return md;
+}
+
+
+/** Adds a string value for either 'key' or 'key_id'. */
+static int
+module_data_add_string(
+    module_data *md,
+    const char *key,
+    uint32_t key_id,
+    const char *value)
+{
+  if (value == NULL) {
+    return EINVAL;
+  }
+
+  size_t len = strlen(value);
+  if (len > UINT32_MAX - 1) {
+    return EINVAL;
+  }
+  bool fits_inline = len < MODULE_DATA_INLINE_STRING;
+
+  module_data_slot *slot =
+      module_data_append(md, key, key_id, fits_inline ? 0 : len + 1);
+  if (slot == NULL) {
+    return errno;
+  }
+
+  slot->type = IRK_STRING;
+  slot->string_length = len;
+  if (fits_inline) {
+    memcpy(slot->value.string_inline, value, len + 1);
+    slot->flags |= MODULE_DATA_SLOT_INLINE;
+  } else {
+    slot->value.string_offset = module_data_store_string(md, value, len);
+  }
+  return 0;
+}
+
+
+/** Adds an integer value for either 'key' or 'key_id'. */
+static int
+module_data_add_int(
+    module_data *md,
+    const char *key,
+    uint32_t key_id,
+    int64_t value)
+{
+  module_data_slot *slot = module_data_append(md, key, key_id, 0);
+  if (slot == NULL) {
+    return errno;
+  }
+
+  slot->type = IRK_INT;
+  slot->value.i = value;
+  return 0;
+}
+
+
+/** Adds a floating point value for either 'key' or 'key_id'. */
+static int
+module_data_add_double(
+    module_data *md,
+    const char *key,
+    uint32_t key_id,
+    double value)
+{
+  module_data_slot *slot = module_data_append(md, key, key_id, 0);
+  if (slot == NULL) {
+    return errno;
+  }
+
+  slot->type = IRK_DOUBLE;
+  slot->value.d = value;
+  return 0;
+}
+
+
+/**
+  Adds a histogram or sketch for either 'key' or 'key_id'.
+
+  Room is made for every bin, then only the ones that are not empty are
+  stored and the rest of that room is left for later values.
+ */
+static int
+module_data_add_distribution(
+    module_data *md,
+    const char *key,
+    uint32_t key_id,
+    const irk_histogram *h,
+    const irk_sketch *s)
+{
+  size_t size;
+  if (h != NULL) {
+    size = distribution_histogram_size(h);
+  } else if (s != NULL) {
+    size = distribution_sketch_size(s);
+  } else {
+    return EINVAL;
+  }
+
+  module_data_slot *slot = module_data_append(md, key, key_id, size);
+  if (slot == NULL) {
+    return errno;
+  }
+
+  char *out = (char *) module_data_strings(md) + md->strings_used;
+  if (h != NULL) {
+    slot->type = IRK_HISTOGRAM;
+    slot->string_length = distribution_histogram_store(h, out);
+  } else {
+    slot->type = IRK_SKETCH;
+    slot->string_length = distribution_sketch_store(s, out);
+  }
+  slot->value.string_offset = md->strings_used;
+  md->strings_used += slot->string_length;
+  return 0;
+}
+
+
+int
+add_string_value(
+    module_data *md,
+    const char *key,
+    const char *value)
+{
+  if (key == NULL) {
+    return EINVAL;
+  }
+  return module_data_add_string(md, key, 0, value);
+}
+
+
+int
+add_int_value(
+    module_data *md,
+    const char *key,
+    int64_t value)
+{
+  if (key == NULL) {
+    return EINVAL;
+  }
+  return module_data_add_int(md, key, 0, value);
+}
+
+
+int
+add_double_value(
+    module_data *md,
+    const char *key,
+    double value)
+{
+  if (key == NULL) {
+    return EINVAL;
+  }
+  return module_data_add_double(md, key, 0, value);
+}
+
+
+int
+add_string_value_by_id(
+    module_data *md,
+    uint32_t key_id,
+    const char *value)
+{
+  return module_data_add_string(md, NULL, key_id, value);
+}
+
+
+int
+add_int_value_by_id(
+    module_data *md,
+    uint32_t key_id,
+    int64_t value)
+{
+  return module_data_add_int(md, NULL, key_id, value);
+}
+
+
+int
+add_double_value_by_id(
+    module_data *md,
+    uint32_t key_id,
+    double value)
+{
+  return module_data_add_double(md, NULL, key_id, value);
+}
+
+
+int
+add_histogram_value(
+    module_data *md,
+    const char *key,
+    const irk_histogram *h)
+{
+  if (key == NULL) {
+    return EINVAL;
+  }
+  return module_data_add_distribution(md, key, 0, h, NULL);
+}
+
+
+int
+add_histogram_value_by_id(
+    module_data *md,
+    uint32_t key_id,
+    const irk_histogram *h)
+{
+  return module_data_add_distribution(md, NULL, key_id, h, NULL);
+}
+
+
+int
+add_sketch_value(
+    module_data *md,
+    const char *key,
+    const irk_sketch *s)
+{
+  if (key == NULL) {
+    return EINVAL;
+  }
+  return module_data_add_distribution(md, key, 0, NULL, s);
+}
+
+
+int
+add_sketch_value_by_id(
+    module_data *md,
+    uint32_t key_id,
+    const irk_sketch *s)
+{
+  return module_data_add_distribution(md, NULL, key_id, NULL, s);
+}
+
+
+/**
+  Returns slot 'index' of 'md' if it is a declared metric of type 'type',
+  otherwise NULL.
+ */
+static module_data_slot *
+module_data_schema_slot(
+    module_data *md,
+    uint32_t index,
+    enum irk_value_type type)
+{
+  if (md == NULL || md->schema == NULL || index >= md->schema->count) {
+    return NULL;
+  }
+  module_data_slot *slot = (module_data_slot *) md->block + index;
+  if (slot->type != type) {
+    return NULL;
+  }
+  return slot;
+}
+
+
+int
+set_string_slot(
+    module_data *md,
+    uint32_t slot,
+    const char *value)
+{
+  module_data_slot *s = module_data_schema_slot(md, slot, IRK_STRING);
+  if (s == NULL || value == NULL) {
+    return EINVAL;
+  }
+
+  size_t len = strlen(value);
+  if (len > UINT32_MAX - 1) {
+    return EINVAL;
+  }
+  if (len < MODULE_DATA_INLINE_STRING) {
+    memcpy(s->value.string_inline, value, len + 1);
+    s->flags |= MODULE_DATA_SLOT_INLINE;
+  } else {
+    int err = module_data_reserve(md, len + 1);
+    if (err != 0) {
+      return err;
+    }
+    // The block may have moved.
+    s = (module_data_slot *) md->block + slot;
+    s->value.string_offset = module_data_store_string(md, value, len);
+    s->flags &= ~MODULE_DATA_SLOT_INLINE;
+  }
+  s->string_length = len;
+  return 0;
+}
+
+
+int
+set_int_slot(
+    module_data *md,
+    uint32_t slot,
+    int64_t value)
+{
+  module_data_slot *s = module_data_schema_slot(md, slot, IRK_INT);
+  if (s == NULL) {
+    return EINVAL;
+  }
+  s->value.i = value;
+  return 0;
+}
+
+
+int
+set_double_slot(
+    module_data *md,
+    uint32_t slot,
+    double value)
+{
+  module_data_slot *s = module_data_schema_slot(md, slot, IRK_DOUBLE);
+  if (s == NULL) {
+    return EINVAL;
+  }
+  s->value.d = value;
+  return 0;
+}
+
+
+void
+free_module_data(
+    module_data *md)
+{
+  if (md == NULL) {
+    return;
+  }
+  for (int i = 0; i < ENCODER_COUNT; i++) {
+    fragment_release(md->encoded[i]);
+    md->encoded[i] = NULL;
+    for (int j = 0; j < COMPRESS_COUNT; j++) {
+      compress_segment_free(md->compressed[i][j]);
+      md->compressed[i][j] = NULL;
+    }
+  }
+  if (md->schema != NULL && schema_recycle(md)) {
+    return;
+  }
+  irk_free(md->block);
+  irk_free(md);
+}
+
+
+/** Returns true if slots 'a' in 'md_a' and 'b' in 'md_b' have one key. */
+static bool
+module_data_same_key(
+    const module_data *md_a,
+    const module_data_slot *a,
+    const module_data *md_b,
+    const module_data_slot *b)
+{
+  if (a->key_length != b->key_length) {
+    return false;
+  }
+  if ((a->flags & MODULE_DATA_SLOT_KEY_ID) &&
+      (b->flags & MODULE_DATA_SLOT_KEY_ID)) {
+    return a->key_offset == b->key_offset;
+  }
+  return memcmp(
+      module_data_key(md_a, a), module_data_key(md_b, b), a->key_length) == 0;
+}
+
+
+/** Returns true if slots 'a' and 'b' hold the same type and value. */
+static bool
+module_data_same_value(
+    const module_data *md_a,
+    const module_data_slot *a,
+    const module_data *md_b,
+    const module_data_slot *b)
+{
+  if (a->type != b->type) {
+    return false;
+  }
+  switch (a->type) {
+    case IRK_STRING:
+      return a->string_length == b->string_length &&
+          memcmp(
+              module_data_string(md_a, a),
+              module_data_string(md_b, b),
+              a->string_length) == 0;
+    case IRK_INT:
+      return a->value.i == b->value.i;
+    case IRK_DOUBLE:
+      // Compared bitwise so that a NaN that stays NaN is unchanged.
+      return memcmp(&(a->value.d), &(b->value.d), sizeof(double)) == 0;
+    case IRK_HISTOGRAM:
+    case IRK_SKETCH:
+      return a->string_length == b->string_length &&
+          memcmp(
+              module_data_distribution(md_a, a),
+              module_data_distribution(md_b, b),
+              a->string_length) == 0;
+  }
+  return false;
+}
+
+
+void
+module_data_set_changed(
+    module_data *md,
+    const module_data *previous,
+    uint64_t generation)
+{
+  module_data_slot *slots = (module_data_slot *) md->block;
+  const module_data_slot *previous_slots = NULL;
+  if (previous != NULL) {
+    previous_slots = module_data_slots(previous);
+  }
+
+  for (uint32_t i = 0; i < md->items; i++) {
+    const module_data_slot *match = NULL;
+    if (previous != NULL) {
+      if (i < previous->items &&
+          module_data_same_key(md, &slots[i], previous, &previous_slots[i])) {
+        match = &previous_slots[i];
+      } else {
+        match = module_data_find(
+            previous, module_data_key(md, &slots[i]), slots[i].key_length);
+      }
+    }
+
+    if (match != NULL &&
+        module_data_same_value(md, &slots[i], previous, match)) {
+      slots[i].changed = match->changed;
+    } else {
+      slots[i].changed = generation;
+    }
+  }
+}
+
+
+int
+module_data_intern_keys(
+    module_data *md,
+    module *mod,
+    const module_data *previous)
+{
+  module_data_slot *slots = (module_data_slot *) md->block;
+  const module_data_slot *previous_slots = NULL;
+  if (previous != NULL) {
+    previous_slots = module_data_slots(previous);
+  }
+
+  int err = 0;
+  for (uint32_t i = 0; i < md->items; i++) {
+    module_data_slot *slot = &slots[i];
+    if (slot->flags & MODULE_DATA_SLOT_KEY_ID) {
+      continue;
+    }
+
+    // Keys are normally in the same place as last cycle, in which case
+    // the ID is taken from there without hashing the key.
+    const char *key = module_data_strings(md) + slot->key_offset;
+    uint32_t id = 0;
+    if (previous != NULL && i < previous->items &&
+        (previous_slots[i].flags & MODULE_DATA_SLOT_KEY_ID) &&
+        module_data_same_key(md, slot, previous, &previous_slots[i])) {
+      id = previous_slots[i].key_offset;
+    } else {
+      id = intern_key(mod, key, slot->key_length);
+    }
+    if (id == 0) {
+      err = errno;
+      continue;
+    }
+
+    // The key is left in the string area, it just is not used any more.
+    slot->key_offset = id;
+    slot->flags |= MODULE_DATA_SLOT_KEY_ID;
+  }
+  return err;
+}
+
+
+const module_data_slot *
+module_data_find(
+    const module_data *md,
+    const char *key,
+    size_t key_len)
+{
+  const module_data_slot *slots = module_data_slots(md);
+
+  for (uint32_t i = 0; i < md->items; i++) {
+    if (slots[i].key_length == key_len &&
+        memcmp(module_data_key(md, &slots[i]), key, key_len) == 0) {
+      return &slots[i];
+    }
+  }
+  return NULL;
+}
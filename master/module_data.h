@@ -0,0 +1,286 @@
+/*
+Copyright (C) 2012 Brady Catherman
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef __MASTER_MODULE_DATA_H
+#define __MASTER_MODULE_DATA_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/time.h>
+
+#include <common/compress.h>
+#include <common/fragment.h>
+#include <master/encoder.h>
+#include <master/intern.h>
+#include <master/module.h>
+
+/**
+  The data a module returns from one collection cycle.
+
+  Rather than a node per metric everything lives in one contiguous block: a
+  dense array of fixed size slots, one per value, followed by a string area
+  holding the keys, any string values that are too long to fit in their
+  slot and the bins of histograms and sketches. Building a module_data
+  therefore costs two allocations however many metrics it has (plus the
+  occasional regrowth), and serializing it or looking a key up walks
+  memory in order.
+
+  Strings in the string area are NUL terminated and referred to by offset
+  from the start of the area, so they stay valid when the block is grown.
+
+  Modules build these with new_module_data() and the add_*_value() calls in
+  irk/api.h, or from the metrics they declared with new_schema_data() and
+  the set_*_slot() calls, everything here is for irk's own use.
+ */
+
+
+/** String values up to this long, including the NUL, are kept in the slot. */
+#define MODULE_DATA_INLINE_STRING 16
+
+/** Set in module_data_slot.flags if the string is in value.string_inline. */
+#define MODULE_DATA_SLOT_INLINE 0x01
+
+/** Set in module_data_slot.flags if key_offset holds an interned key ID. */
+#define MODULE_DATA_SLOT_KEY_ID 0x02
+
+
+/** A single value, 40 bytes. */
+typedef struct module_data_slot module_data_slot;
+struct module_data_slot {
+  union {
+    int64_t i;
+    double d;
+    uint32_t string_offset;
+    char string_inline[MODULE_DATA_INLINE_STRING];
+  } value;
+
+  /**
+    The generation in which this value last changed. This is filled in by
+    module_publish() by comparing against the snapshot being replaced.
+   */
+  uint64_t changed;
+
+  /**
+    Offset of the key in the string area, or the ID from intern_key() if
+    MODULE_DATA_SLOT_KEY_ID is set, in which case the key takes no space
+    in this module_data at all.
+   */
+  uint32_t key_offset;
+
+  /**
+    Length of the string value, not including the NUL, or of a stored
+    histogram or sketch.
+   */
+  uint32_t string_length;
+
+  /** Length of the key, not including the NUL. */
+  uint16_t key_length;
+
+  /** An enum irk_value_type. */
+  uint8_t type;
+
+  /** MODULE_DATA_SLOT_* flags. */
+  uint8_t flags;
+};
+
+
+struct module_data {
+  /**
+    The single allocation holding slot_capacity slots followed by
+    strings_capacity bytes of string area.
+   */
+  char *block;
+
+  /** Number of slots in use. */
+  uint32_t items;
+
+  /** Number of slots that fit in block. */
+  uint32_t slot_capacity;
+
+  /** Bytes of the string area in use. */
+  uint32_t strings_used;
+
+  /** Size of the string area. */
+  uint32_t strings_capacity;
+
+  /**
+    The generation this was published as by module_publish(), or 0 if it
+    has not been published.
+   */
+  uint64_t generation;
+
+  /** When this was published. */
+  struct timeval published;
+
+  /**
+    Every value encoded in each format, filled in the first time it is
+    needed by encoder_module_fragment(). This is the only part of a
+    snapshot that changes after it is published.
+   */
+  fragment *encoded[ENCODER_COUNT];
+
+  /**
+    The same, compressed with each content coding. These are filled in by
+    encoder_module_compressed(), COMPRESS_IDENTITY is never used.
+   */
+  compress_segment *compressed[ENCODER_COUNT][COMPRESS_COUNT];
+
+  /**
+    The schema this was made from by new_schema_data(), in which case its
+    first schema->count slots are the declared metrics in order. NULL for
+    anything made by new_module_data().
+   */
+  struct module_schema *schema;
+};
+
+
+/** Returns the array of md->items slots in 'md'. */
+static inline const module_data_slot *
+module_data_slots(
+    const module_data *md)
+{
+  return (const module_data_slot *) md->block;
+}
+
+
+/** Returns the start of the string area in 'md'. */
+static inline const char *
+module_data_strings(
+    const module_data *md)
+{
+  return md->block + md->slot_capacity * sizeof(module_data_slot);
+}
+
+
+/** Returns the NUL terminated key of 'slot', which must belong to 'md'. */
+static inline const char *
+module_data_key(
+    const module_data *md,
+    const module_data_slot *slot)
+{
+  if (slot->flags & MODULE_DATA_SLOT_KEY_ID) {
+    return intern_key_string(slot->key_offset, NULL);
+  }
+  return module_data_strings(md) + slot->key_offset;
+}
+
+
+/**
+  Returns the NUL terminated value of the IRK_STRING 'slot'.
+
+  The length is available in slot->string_length.
+ */
+static inline const char *
+module_data_string(
+    const module_data *md,
+    const module_data_slot *slot)
+{
+  if (slot->flags & MODULE_DATA_SLOT_INLINE) {
+    return slot->value.string_inline;
+  }
+  return module_data_strings(md) + slot->value.string_offset;
+}
+
+
+/**
+  Returns the stored copy of the IRK_HISTOGRAM or IRK_SKETCH 'slot'.
+
+  This is a distribution_header followed by its distribution_bins, see
+  master/distribution.h, and is slot->string_length bytes long. It is not
+  necessarily aligned so it must be read with memcpy().
+ */
+static inline const char *
+module_data_distribution(
+    const module_data *md,
+    const module_data_slot *slot)
+{
+  return module_data_strings(md) + slot->value.string_offset;
+}
+
+
+/**
+  Sets the changed generation of every slot in 'md'.
+
+  Values that are identical (same key, type and value) to one in 'previous'
+  keep its changed generation, everything else is marked as changed in
+  'generation'. Modules normally emit their keys in the same order every
+  cycle, so each key is first checked against the slot in the same
+  position which makes this a single linear pass in the common case.
+
+  Arguments:
+    md: The snapshot about to be published.
+    previous: The snapshot it replaces, or NULL.
+    generation: The generation md is being published as.
+ */
+void
+module_data_set_changed(
+    module_data *md,
+    const module_data *previous,
+    uint64_t generation);
+
+
+/**
+  Gives every slot of 'md' that has its key in the string area the
+  interned ID of that key, and sets MODULE_DATA_SLOT_KEY_ID on it, so that
+  nothing reading the snapshot later has to hash its keys.
+
+  A key in the same position as in 'previous' takes its ID from there, so
+  a module that adds the same keys every cycle is interned with one
+  comparison per key.
+
+  Arguments:
+    md: The snapshot about to be published.
+    mod: The module it belongs to.
+    previous: The snapshot it replaces, or NULL.
+
+  Returns:
+    0, or the error from intern_key() if any key could not be interned, in
+    which case that slot keeps its key in the string area.
+ */
+int
+module_data_intern_keys(
+    module_data *md,
+    module *mod,
+    const module_data *previous);
+
+
+/**
+  Finds the slot for 'key'.
+
+  This is a linear scan, which for the few hundred metrics a module exports
+  is a quick sequential walk comparing lengths before bytes.
+
+  Arguments:
+    md: The module_data to search.
+    key: The key to find, which need not be NUL terminated.
+    key_len: The length of key.
+
+  Returns:
+    The slot or NULL if key is not present.
+ */
+const module_data_slot *
+module_data_find(
+    const module_data *md,
+    const char *key,
+    size_t key_len);
+
+#endif
@@ -0,0 +1,139 @@
+/*
+Copyright (C) 2012 Brady Catherman
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <common/memory.h>
+#include <master/intern.h>
+#include <master/module_data.h>
+#include <master/schema.h>
+
+
+int
+schema_declare(
+    module *mod,
+    const char *key,
+    enum irk_value_type type,
+    uint32_t *slot)
+{
+  if (type != IRK_STRING && type != IRK_INT && type != IRK_DOUBLE) {
+    return EINVAL;
+  }
+  size_t key_len = strlen(key);
+  if (key_len > UINT16_MAX) {
+    return EINVAL;
+  }
+
+  module_schema *schema = mod->schema;
+  if (schema == NULL) {
+    schema = (module_schema *) irk_calloc(1, sizeof(module_schema));
+    if (schema == NULL) {
+      return ENOMEM;
+    }
+    mod->schema = schema;
+  }
+  if (__atomic_load_n(&(schema->frozen), __ATOMIC_ACQUIRE)) {
+    return EBUSY;
+  }
+
+  uint32_t id = intern_key(mod, key, key_len);
+  if (id == 0) {
+    return errno;
+  }
+  for (uint32_t i = 0; i < schema->count; i++) {
+    if (schema->template[i].key_offset == id) {
+      return EEXIST;
+    }
+  }
+
+  if (schema->count == schema->capacity) {
+    uint32_t capacity = schema->capacity ? schema->capacity * 2 : 16;
+    module_data_slot *template = (module_data_slot *) irk_realloc(
+        schema->template, capacity * sizeof(module_data_slot));
+    if (template == NULL) {
+      return ENOMEM;
+    }
+    schema->template = template;
+    schema->capacity = capacity;
+  }
+
+  module_data_slot *s = &(schema->template[schema->count]);
+  memset(s, 0, sizeof(*s));
+  s->key_offset = id;
+  s->key_length = key_len;
+  s->type = type;
+  s->flags = MODULE_DATA_SLOT_KEY_ID;
+  if (type == IRK_STRING) {
+    // An empty string until one is set.
+    s->flags |= MODULE_DATA_SLOT_INLINE;
+  }
+  *slot = schema->count++;
+  return 0;
+}
+
+
+module_data *
+new_schema_data(
+    module *mod)
+{
+  if (mod == NULL || mod->schema == NULL) {
+    errno = EINVAL;
+    return NULL;
+  }
+  module_schema *schema = mod->schema;
+  __atomic_store_n(&(schema->frozen), true, __ATOMIC_RELEASE);
+
+  module_data *md = __atomic_exchange_n(
+      &(schema->spare), NULL, __ATOMIC_ACQ_REL);
+  if (md == NULL) {
+    // Room for a few more values than declared, in case the module adds
+    // some with add_*_value().
+    md = new_module_data(schema->count + 4);
+    if (md == NULL) {
+      return NULL;
+    }
+    md->schema = schema;
+  } else {
+    md->strings_used = 0;
+    md->generation = 0;
+    md->published.tv_sec = 0;
+    md->published.tv_usec = 0;
+  }
+
+  memcpy(md->block, schema->template, schema->count * sizeof(module_data_slot));
+  md->items = schema->count;
+  return md;
+}
+
+
+bool
+schema_recycle(
+    module_data *md)
+{
+  module_data *expected = NULL;
+  return __atomic_compare_exchange_n(
+      &(md->schema->spare), &expected, md, false,
+      __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+}
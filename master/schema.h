@@ -0,0 +1,131 @@
+/*
+Copyright (C) 2012 Brady Catherman
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef __MASTER_SCHEMA_H
+#define __MASTER_SCHEMA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <common/fragment.h>
+#include <master/encoder.h>
+#include <master/module.h>
+#include <master/module_data.h>
+
+/**
+  Metrics declared up front by a module.
+
+  A module that exports the same values every cycle can declare them once
+  with declare_metric() and then fill in each cycle's module_data by slot
+  index with set_int_slot() and friends. The schema keeps a template of
+  every declared slot, with its interned key and type already filled in,
+  so new_schema_data() is one copy of the template and setting a value is
+  one store. The module never touches a key after declaring it.
+
+  Snapshots built from a schema are recycled: when one is freed it is kept
+  as the schema's spare, and the next new_schema_data() reuses its block.
+  A module collected on a timer normally ends up cycling between the same
+  two blocks, the published snapshot and the one being filled in.
+
+  Since the keys and their order never change, the name each encoder
+  writes for each key is also worked out once, see encoder_schema_name().
+
+  The schema is frozen by the first new_schema_data(), after which no more
+  metrics can be declared.
+ */
+
+
+typedef struct module_schema module_schema;
+struct module_schema {
+  /** One slot per declared metric, values zeroed. */
+  module_data_slot *template;
+
+  /** The number of declared metrics. */
+  uint32_t count;
+  uint32_t capacity;
+
+  /** Set by the first new_schema_data(). */
+  bool frozen;
+
+  /** A freed snapshot kept for reuse, or NULL. */
+  module_data *spare;
+
+  /**
+    The name of every slot in each format, filled in the first time it is
+    needed by encoder_schema_name().
+   */
+  struct module_schema_names *names[ENCODER_COUNT];
+};
+
+
+/** The names of every slot of a schema in one format. */
+struct module_schema_names {
+  /** Every name, back to back. */
+  fragment *data;
+
+  /**
+    Where the name of each slot starts in data, plus one more entry for
+    the end of the last one.
+   */
+  uint32_t offsets[];
+};
+
+
+/**
+  Adds a metric to the schema of 'mod', creating the schema if needed.
+
+  Arguments:
+    mod: The module.
+    key: The key of the metric.
+    type: IRK_STRING, IRK_INT or IRK_DOUBLE.
+    slot: Set to the index of the metric.
+
+  Returns:
+    0 on success.
+    EINVAL if the key is too long or the type can not be declared.
+    EEXIST if the key was already declared.
+    EBUSY if the schema has already been used.
+    ENOMEM on allocation failure.
+    ENOSPC if no more keys can be interned.
+ */
+int
+schema_declare(
+    module *mod,
+    const char *key,
+    enum irk_value_type type,
+    uint32_t *slot);
+
+
+/**
+  Offers a snapshot that is being freed for reuse.
+
+  Its caches must already have been released.
+
+  Returns:
+    true if the schema kept it, false if it should be freed.
+ */
+bool
+schema_recycle(
+    module_data *md);
+
+#endif
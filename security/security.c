@@ -29,6 +29,7 @@ DEALINGS IN THE SOFTWARE.
 #include <unistd.h>
 
 #include <common/logging.h>
+#include <common/memory.h>
 #include <common/strhash.h>
 #include <security/security.h>
 
@@ -104,9 +105,9 @@ security_check_path_stat(
   }
 
   // Get its current working directory.
-  char *new_wd = getwd(NULL);
+  char *new_wd = getcwd(NULL, 0);
   if (new_wd == NULL) {
-    log_debug("getwd(NULL) error: %s", strerror(errno));
+    log_debug("getcwd(NULL, 0) error: %s", strerror(errno));
     if (close(current_dir_fd)) {
       log_debug("close(%d) error: %d", current_dir_fd, strerror(errno));
     }
@@ -182,14 +183,14 @@ security_check_path(
 {
   // Make a copy of the filename structure so that we can modify it while
   // splitting out the components.
-  char *buffer = strdup(filename);
+  char *buffer = irk_strdup(filename);
   if (buffer == NULL) {
     log_debug("strdup() error: %s", strerror(errno));
     return S_ERROR;
   }
 
   int return_value = security_check_path_inner(buffer, cache);
-  free(buffer);
+  irk_free(buffer);
   return return_value;
 }
 